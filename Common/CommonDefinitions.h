@@ -18,10 +18,19 @@
 #define STATUS_OK 1
 #define STATUS_ERROR 0
 #define STATUS_OK_END 2
+#define STATUS_LIST 3
+#define STATUS_LIST_END 4
 
 #define STATUS_OK_CHAR '+'
 #define STATUS_ERROR_CHAR '-'
 #define STATUS_OK_END_CHAR '0'
+#define STATUS_LIST_CHAR '*' // a list of addresses separated by ADDRESS_DELIMITER, more lists follow
+#define STATUS_LIST_END_CHAR '=' // the last list of addresses
+
+#define REQUEST_PACKED_FLAG 'P' // after the '\0' of a request: the client reads lists of addresses (STATUS_LIST)
+#define QUERY_ID_FLAG '#' // after the '\0' of a request or a response: the query ID, 4 bytes big-endian
+#define QUERY_ID_SIZE 5 // flag + ID
+#define ADDRESS_DELIMITER ' '
 
 #pragma endregion
 
@@ -43,8 +52,18 @@
 #define _NOT_SPECIFY_PORT "Port number is not specified. Default port used!"
 #define _CONVERT_PORT_FAIL "Fail to convert port number from command-line. Default port used!"
 #define _CONVERT_ARGUMENTS_FAIL "Fail to extract port number and ip address from command-line arguments."
+#define _CONVERT_WORKERS_FAIL "Invalid number of workers. One worker used!"
+#define _CONVERT_SEGMENTATION_SIZE_FAIL "Invalid segmentation size. Default size used!"
+#define _CONVERT_BATCH_FAIL "Invalid batch size. Default size used!"
+#define _CONVERT_RESOLVERS_FAIL "Invalid number of resolvers. Default number used!"
+#define _CONVERT_CACHE_FAIL "Invalid cache options. Default values used!"
+#define _CONVERT_WINDOW_FAIL "Invalid window size. Default size used!"
+#define _CONVERT_LOAD_OPTIONS_FAIL "Invalid load options. Default values used!"
+#define _CONVERT_LIMITS_FAIL "Invalid connection limits. Default values used!"
 
 #define _ALLOCATE_MEMORY_FAIL "Fail to allocate memory."
+#define _LOG_RECORDS_DROPPED "Log records dropped, the log buffer is full."
+#define _OPEN_FILE_FAIL "Fail to open the file."
 
 #define _INITIALIZE_FAIL "Fail to initialize Winsock 2.2!"
 #define _BIND_SOCKET_FAIL "Fail to bind socket with the address."
@@ -52,6 +71,10 @@
 #define _SHUTDOWN_SOCKET_FAIL "Fail to shutdown the socket."
 #define _CLOSE_SOCKET_FAIL "Fail to close the socket."
 #define _SET_TIMEOUT_FAIL "Fail to set receive timeout for socket."
+#define _SET_NON_BLOCKING_FAIL "Fail to set non-blocking mode for socket."
+#define _POLL_FAIL "Fail to wait for events on sockets."
+#define _IO_URING_FAIL "Fail to set up io_uring. The poll event loop is used."
+#define _SET_REUSE_PORT_FAIL "Fail to allow the address to be shared with other sockets."
 #define _RECEIVE_FAIL "Fail to receive message from remote process."
 #define _SEND_FAIL "Fail to send message to the remote process."
 #define _LISTEN_SOCKET_FAIL "Fail to set socket to listen state."
@@ -66,6 +89,7 @@
 #define _MESSAGE_TOO_LARGE "Message Too Large. \"The buffer size is not large enough! Some data from remote process lost,\""
 #define _MESSAGE_EXTREME_LARGE "Message Too Large. \"The message size is larger than the maximum supported by the underlying transport.\""
 #define _SEND_NOT_ALL "Not all bytes was sent."
+#define _NO_ANSWER "No answer from the remote process. The request was sent again until the limit."
 
 #define _RECEIVE_UNEXPECTED_MESSAGE "Receive an invalid message."
 #define _CONNECTION_DROP "Connection to the remote process has been drop."
@@ -73,6 +97,9 @@
 #define _NOT_BOUND_SOCKET "Invalid Socket. \"The socket need to be bound to an address.\""
 #define _NOT_LISTEN_SOCKET "Invalid Socket. \"The socket need to be set to listen state.\""
 #define _REACH_SOCKETS_LIMIT "Too many open sockets"
+#define _REACH_MEMORY_LIMIT "The buffers of the connections reach their memory budget."
+#define _CONNECTION_TIMEOUT "A connection is closed: no bytes received or sent in the time limit."
+#define _REQUEST_TIMEOUT "A connection is closed: its request is not received completely in the time limit."
 
 #define _CONNECTION_REFUSED "Connection refused. \"Remote process refused to establish connection. Try again later.\""
 #define _ESTABLISH_CONNECTION_TIMEOUT "Establish connection to remote process timeout. No connection established."
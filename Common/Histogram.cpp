@@ -0,0 +1,75 @@
+#include "Histogram.h"
+
+#pragma region Histogram
+
+/// <summary>
+/// Add to a counter that has one writer: a plain load and store, no locked instruction
+/// </summary>
+static void AddToCounter(std::atomic<long long>* counter, long long value)
+{
+    counter->store(counter->load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+void RecordHistogram(HISTOGRAM* histogram, long long value)
+{
+    unsigned long long v = (unsigned long long)value;
+    int index;
+    if (v < 2 * HISTOGRAM_SUB_COUNT) {
+        index = (int)v; // exact
+    }
+    else {
+        // keep the HISTOGRAM_SUB_BITS + 1 highest bits: v >> shift is in [HISTOGRAM_SUB_COUNT, 2 * HISTOGRAM_SUB_COUNT)
+        int shift = 0;
+        while ((v >> shift) >= 2 * HISTOGRAM_SUB_COUNT)
+            shift++;
+        index = shift * HISTOGRAM_SUB_COUNT + (int)(v >> shift);
+    }
+    AddToCounter(&histogram->counts[index], 1);
+    AddToCounter(&histogram->total, 1);
+    if (value > histogram->max.load(std::memory_order_relaxed))
+        histogram->max.store(value, std::memory_order_relaxed);
+}
+
+void MergeHistogram(HISTOGRAM* destination, const HISTOGRAM* source)
+{
+    for (int i = 0; i < HISTOGRAM_SIZE; i++)
+        AddToCounter(&destination->counts[i], source->counts[i].load(std::memory_order_relaxed));
+    AddToCounter(&destination->total, source->total.load(std::memory_order_relaxed));
+    long long max = source->max.load(std::memory_order_relaxed);
+    if (max > destination->max.load(std::memory_order_relaxed))
+        destination->max.store(max, std::memory_order_relaxed);
+}
+
+long long GetHistogramPercentile(const HISTOGRAM* histogram, double percentile)
+{
+    long long total = 0;
+    for (int i = 0; i < HISTOGRAM_SIZE; i++) // the total may be ahead of the counts read
+        total += histogram->counts[i].load(std::memory_order_relaxed);
+    long long rank = (long long)(total * percentile / 100);
+    if (rank >= total)
+        rank = total - 1;
+    long long seen = 0;
+    for (int i = 0; i < HISTOGRAM_SIZE; i++) {
+        seen += histogram->counts[i].load(std::memory_order_relaxed);
+        if (seen > rank) {
+            if (i < 2 * HISTOGRAM_SUB_COUNT)
+                return i;
+            int shift = i / HISTOGRAM_SUB_COUNT - 1;
+            long long sub = i % HISTOGRAM_SUB_COUNT + HISTOGRAM_SUB_COUNT;
+            long long highest = ((sub + 1) << shift) - 1;
+            long long max = histogram->max.load(std::memory_order_relaxed);
+            return highest < max ? highest : max;
+        }
+    }
+    return 0;
+}
+
+long long GetHistogramBucketValue(int index)
+{
+    if (index < 2 * HISTOGRAM_SUB_COUNT)
+        return index;
+    int shift = index / HISTOGRAM_SUB_COUNT - 1;
+    return (long long)(index % HISTOGRAM_SUB_COUNT + HISTOGRAM_SUB_COUNT) << shift;
+}
+
+#pragma endregion
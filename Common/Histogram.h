@@ -0,0 +1,63 @@
+#pragma once
+
+#pragma region Header Declarations
+
+#include <atomic>
+
+#pragma endregion
+
+#pragma region Constants Definitions
+
+#define HISTOGRAM_SUB_BITS 5 // 2^5 sub-buckets for each power of 2, about 3% precision
+#define HISTOGRAM_SUB_COUNT (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_SIZE ((64 - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_COUNT)
+
+#pragma endregion
+
+#pragma region Type Definitions
+
+/// <summary>
+/// A log-linear histogram (HDR-style): exact below 2 * HISTOGRAM_SUB_COUNT, then HISTOGRAM_SUB_COUNT buckets for each power of 2.
+/// It has one writer, which updates it without locked instructions, and can be read by other threads.
+/// All zero is an empty histogram.
+/// </summary>
+typedef struct {
+    std::atomic<long long> counts[HISTOGRAM_SIZE];
+    std::atomic<long long> total; // number of values recorded
+    std::atomic<long long> max;
+} HISTOGRAM;
+
+#pragma endregion
+
+#pragma region Function Declarations
+
+/// <summary>
+/// Record a value in a histogram. Only the writer of the histogram can call it.
+/// </summary>
+/// <param name="histogram">The histogram</param>
+/// <param name="value">The value, not negative</param>
+void RecordHistogram(HISTOGRAM* histogram, long long value);
+
+/// <summary>
+/// Add the values recorded in a histogram to another. Only the writer of destination can call it.
+/// </summary>
+/// <param name="destination">The histogram is added to</param>
+/// <param name="source">The histogram is added</param>
+void MergeHistogram(HISTOGRAM* destination, const HISTOGRAM* source);
+
+/// <summary>
+/// Get a percentile of the values recorded in a histogram
+/// </summary>
+/// <param name="histogram">The histogram</param>
+/// <param name="percentile">The percentile, in [0, 100]</param>
+/// <returns>The highest value of the bucket holds the percentile. 0 if the histogram is empty</returns>
+long long GetHistogramPercentile(const HISTOGRAM* histogram, double percentile);
+
+/// <summary>
+/// Get the lowest value counted in a bucket of a histogram
+/// </summary>
+/// <param name="index">The index of the bucket</param>
+/// <returns>The lowest value</returns>
+long long GetHistogramBucketValue(int index);
+
+#pragma endregion
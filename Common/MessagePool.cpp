@@ -0,0 +1,147 @@
+#include <mutex>
+
+#include "Network.h"
+
+#pragma region Thread Pools
+
+/// <summary>
+/// The pool of a thread, abandoned when the thread exits so the blocks it still owns stay valid
+/// </summary>
+typedef struct POOL_OWNER {
+    MESSAGE_POOL* pool;
+    ~POOL_OWNER();
+} POOL_OWNER;
+
+static std::mutex registry_lock; // only taken when a thread gets its first pool or exits, and for the counters
+static MESSAGE_POOL* registry = NULL; // all pools, never freed
+static thread_local POOL_OWNER thread_pool = { NULL };
+
+POOL_OWNER::~POOL_OWNER()
+{
+    if (pool == NULL)
+        return;
+    std::lock_guard<std::mutex> guard(registry_lock);
+    pool->is_abandoned = 1;
+}
+
+MESSAGE_POOL* GetThreadPool()
+{
+    MESSAGE_POOL* pool = thread_pool.pool;
+    if (pool != NULL)
+        return pool;
+
+    std::lock_guard<std::mutex> guard(registry_lock);
+    for (pool = registry; pool != NULL && !pool->is_abandoned; pool = pool->next);
+    if (pool == NULL) {
+        pool = new MESSAGE_POOL;
+        for (int i = 0; i < POOL_SIZE_CLASSES; i++) {
+            pool->free_blocks[i] = NULL;
+            pool->remote_blocks[i].store(NULL, std::memory_order_relaxed);
+        }
+        pool->slab = NULL;
+        pool->slab_used = 0;
+        pool->allocations.store(0, std::memory_order_relaxed);
+        pool->slabs.store(0, std::memory_order_relaxed);
+        pool->large.store(0, std::memory_order_relaxed);
+        pool->remote_frees.store(0, std::memory_order_relaxed);
+        pool->next = registry;
+        registry = pool;
+    }
+    pool->is_abandoned = 0;
+    thread_pool.pool = pool;
+    return pool;
+}
+
+void GetPoolCounters(POOL_COUNTERS* ocounters)
+{
+    memset(ocounters, 0, sizeof(POOL_COUNTERS));
+    std::lock_guard<std::mutex> guard(registry_lock);
+    for (MESSAGE_POOL* pool = registry; pool != NULL; pool = pool->next) {
+        ocounters->pools++;
+        ocounters->allocations += pool->allocations.load(std::memory_order_relaxed);
+        ocounters->slabs += pool->slabs.load(std::memory_order_relaxed);
+        ocounters->large += pool->large.load(std::memory_order_relaxed);
+        ocounters->remote_frees += pool->remote_frees.load(std::memory_order_relaxed);
+    }
+}
+
+#pragma endregion
+
+#pragma region Blocks
+
+void* PoolAllocate(int size)
+{
+    MESSAGE_POOL* pool = GetThreadPool();
+    if (size > POOL_MAX_BLOCK_SIZE) {
+        POOL_BLOCK* block = (POOL_BLOCK*)malloc(sizeof(POOL_BLOCK) + size);
+        if (block == NULL) {
+            LogMessage(WARNING_FLAGS, 0, _ALLOCATE_MEMORY_FAIL);
+            return NULL;
+        }
+        block->owner = NULL;
+        block->size_class = POOL_LARGE_CLASS;
+        // the counters are only written by the owner thread, a plain store is enough
+        pool->large.store(pool->large.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return block + 1;
+    }
+
+    int size_class = 0;
+    while ((POOL_MIN_BLOCK_SIZE << size_class) < size)
+        size_class++;
+    pool->allocations.store(pool->allocations.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+    FREE_BLOCK* block = pool->free_blocks[size_class];
+    if (block == NULL) // take all blocks freed by other threads at once
+        block = pool->remote_blocks[size_class].exchange(NULL, std::memory_order_acquire);
+    if (block != NULL) {
+        pool->free_blocks[size_class] = block->next;
+        return block;
+    }
+
+    int block_size = (int)sizeof(POOL_BLOCK) + (POOL_MIN_BLOCK_SIZE << size_class);
+    if (pool->slab == NULL || pool->slab_used + block_size > POOL_SLAB_SIZE) {
+        // the rest of the previous slab is left unused, its blocks are still owned by the pool
+        char* slab = (char*)malloc(POOL_SLAB_SIZE);
+        if (slab == NULL) {
+            LogMessage(WARNING_FLAGS, 0, _ALLOCATE_MEMORY_FAIL);
+            return NULL;
+        }
+        pool->slab = slab;
+        pool->slab_used = 0;
+        pool->slabs.store(pool->slabs.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    POOL_BLOCK* header = (POOL_BLOCK*)(pool->slab + pool->slab_used);
+    pool->slab_used += block_size;
+    header->owner = pool;
+    header->size_class = size_class;
+    return header + 1;
+}
+
+void PoolFree(void* block)
+{
+    if (block == NULL)
+        return;
+    POOL_BLOCK* header = (POOL_BLOCK*)block - 1;
+    if (header->size_class == POOL_LARGE_CLASS) {
+        free(header);
+        return;
+    }
+
+    // the header stays in place while the block is free, it is reused as is
+    MESSAGE_POOL* owner = header->owner;
+    FREE_BLOCK* free_block = (FREE_BLOCK*)block;
+    if (owner == thread_pool.pool) {
+        free_block->next = owner->free_blocks[header->size_class];
+        owner->free_blocks[header->size_class] = free_block;
+        return;
+    }
+    // the owner only takes the whole list, so the push can't suffer from ABA
+    std::atomic<FREE_BLOCK*>* remote = &owner->remote_blocks[header->size_class];
+    FREE_BLOCK* head = remote->load(std::memory_order_relaxed);
+    do {
+        free_block->next = head;
+    } while (!remote->compare_exchange_weak(head, free_block, std::memory_order_release, std::memory_order_relaxed));
+    owner->remote_frees.fetch_add(1, std::memory_order_relaxed);
+}
+
+#pragma endregion
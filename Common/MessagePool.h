@@ -0,0 +1,138 @@
+#pragma once
+
+#pragma region Header Declarations
+
+#include <stdlib.h>
+#include <atomic>
+
+#include "CommonDefinitions.h"
+#pragma endregion
+
+#pragma region Constants Definitions
+
+#define POOL_SIZE_CLASSES 7 // blocks of 32, 64, ... 2048 bytes
+#define POOL_MIN_BLOCK_SIZE 32
+#define POOL_MAX_BLOCK_SIZE (POOL_MIN_BLOCK_SIZE << (POOL_SIZE_CLASSES - 1)) // larger blocks are allocated by malloc
+#define POOL_SLAB_SIZE 65536 // the pool takes memory from the system in slabs, and carves them into blocks
+#define POOL_LARGE_CLASS -1 // size class of a block allocated by malloc
+
+#pragma endregion
+
+#pragma region Type Definitions
+
+struct MESSAGE_POOL;
+
+/// <summary>
+/// The header before each block of a pool. The block is returned to its owner when freed, from any thread.
+/// </summary>
+typedef struct alignas(16) POOL_BLOCK {
+    struct MESSAGE_POOL* owner; // NULL for a large block
+    int size_class; // POOL_LARGE_CLASS for a large block
+} POOL_BLOCK;
+
+/// <summary>
+/// A free block, the link is stored in place of its data
+/// </summary>
+typedef struct FREE_BLOCK {
+    struct FREE_BLOCK* next;
+} FREE_BLOCK;
+
+/// <summary>
+/// The blocks of a thread. Only the owner thread allocates, so its free lists need no lock.
+/// Other threads free to the remote lists, which the owner takes all at once when its own list is empty.
+/// A pool is never freed: when its thread exits, the next new thread adopts it (See: GetThreadPool).
+/// </summary>
+typedef struct MESSAGE_POOL {
+    FREE_BLOCK* free_blocks[POOL_SIZE_CLASSES];
+    std::atomic<FREE_BLOCK*> remote_blocks[POOL_SIZE_CLASSES]; // freed by other threads, pushed lock-free
+    char* slab; // the slab being carved
+    int slab_used; // in bytes
+    int is_abandoned; // 1 if its thread exited. Protected by the registry lock
+    struct MESSAGE_POOL* next; // next pool in the registry
+    std::atomic<long long> allocations; // number of blocks allocated, reused or carved
+    std::atomic<long long> slabs; // number of slabs allocated by malloc
+    std::atomic<long long> large; // number of large blocks allocated by malloc
+    std::atomic<long long> remote_frees; // number of blocks freed by other threads
+} MESSAGE_POOL;
+
+/// <summary>
+/// The counters of all pools (See: GetPoolCounters)
+/// </summary>
+typedef struct {
+    int pools;
+    long long allocations;
+    long long slabs;
+    long long large;
+    long long remote_frees;
+} POOL_COUNTERS;
+
+#pragma endregion
+
+#pragma region Function Declarations
+
+/// <summary>
+/// Allocate a block from the pool of the calling thread. No lock is taken, and malloc is only called
+/// for a new slab or a block larger than POOL_MAX_BLOCK_SIZE.
+/// </summary>
+/// <param name="size">Number of bytes wanted</param>
+/// <returns>The block, aligned on 16 bytes. NULL if fail to allocate memory</returns>
+void* PoolAllocate(int size);
+
+/// <summary>
+/// Return a block to the pool it is allocated from. Any thread can free any block.
+/// </summary>
+/// <param name="block">The block (See: PoolAllocate). NULL is ignored</param>
+void PoolFree(void* block);
+
+/// <summary>
+/// Get the pool of the calling thread: its own, an abandoned one, or a new one
+/// </summary>
+/// <returns>The pool. NULL if fail to allocate memory</returns>
+MESSAGE_POOL* GetThreadPool();
+
+/// <summary>
+/// Sum the counters of all pools. The counters are read without stopping the threads.
+/// </summary>
+/// <param name="ocounters">[Output] The counters</param>
+void GetPoolCounters(POOL_COUNTERS* ocounters);
+
+#pragma endregion
+
+#pragma region Message Handle
+
+/// <summary>
+/// A message allocated from a pool, freed when the handle goes out of scope (See: PoolFree).
+/// It can be moved, not copied.
+/// </summary>
+typedef struct MESSAGE_HANDLE {
+    MESSAGE message;
+
+    MESSAGE_HANDLE() : message(NULL) {}
+    explicit MESSAGE_HANDLE(MESSAGE m) : message(m) {}
+    MESSAGE_HANDLE(MESSAGE_HANDLE&& other) noexcept : message(other.message) { other.message = NULL; }
+    MESSAGE_HANDLE& operator=(MESSAGE_HANDLE&& other) noexcept
+    {
+        if (this != &other) {
+            PoolFree(message);
+            message = other.message;
+            other.message = NULL;
+        }
+        return *this;
+    }
+    MESSAGE_HANDLE(const MESSAGE_HANDLE&) = delete;
+    MESSAGE_HANDLE& operator=(const MESSAGE_HANDLE&) = delete;
+    ~MESSAGE_HANDLE() { PoolFree(message); }
+
+    /// <summary>
+    /// Give up the message without freeing it, the caller frees it with PoolFree
+    /// </summary>
+    /// <returns>The message. NULL if the handle is empty</returns>
+    MESSAGE Release()
+    {
+        MESSAGE m = message;
+        message = NULL;
+        return m;
+    }
+} MESSAGE_HANDLE;
+
+#pragma endregion
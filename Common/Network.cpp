@@ -0,0 +1,552 @@
+#include <chrono>
+
+#include "Network.h"
+
+#pragma region Socket Common
+
+int WSInitialize()
+{
+    WORD version = MAKEWORD(2, 2);
+    WSADATA wsa_data;
+    if (WSAStartup(version, &wsa_data)) {
+        LogMessage(ERROR_FLAGS, 0, _INITIALIZE_FAIL);
+        WSACleanup();
+        return 0;
+    }
+    return 1;
+}
+
+int WSCleanup()
+{
+    return WSACleanup();
+}
+
+SOCKET CreateSocket(int protocol)
+{
+    SOCKET s = INVALID_SOCKET;
+    if (protocol == UDP) {
+        s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    }
+    else if (protocol == TCP) {
+        s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    }
+
+    if (s == INVALID_SOCKET) {
+        LogMessage(ERROR_FLAGS, 0, _CREATE_SOCKET_FAIL);
+    }
+    return s;
+}
+
+int CloseSocket(SOCKET socket, int mode, int flags)
+{
+    if (socket == INVALID_SOCKET)
+        return 1;
+    int is_ok = 1;
+    if (mode == CLOSE_SAFELY) {
+        if (shutdown(socket, flags) == SOCKET_ERROR) {
+            is_ok = 0;
+            LogMessage(WARNING_FLAGS, WSAGetLastError(), _SHUTDOWN_SOCKET_FAIL);
+        }
+    }
+    if (closesocket(socket) == SOCKET_ERROR) {
+        is_ok = 0;
+        LogMessage(WARNING_FLAGS, WSAGetLastError(), _CLOSE_SOCKET_FAIL);
+    }
+    return is_ok;
+}
+
+int BindSocket(SOCKET socket, ADDRESS addr)
+{
+    if (bind(socket, (SOCKADDR*)&addr, sizeof(addr)) == SOCKET_ERROR) {
+        int err = WSAGetLastError();
+        if (err == WSAEADDRINUSE) {
+            LogMessage(ERROR_FLAGS, err, _ADDRESS_IN_USE);
+        }
+        else if (err == WSAEINVAL) {
+            LogMessage(ERROR_FLAGS, err, _BOUNDED_SOCKET);
+        }
+        else {
+            LogMessage(ERROR_FLAGS, err, _BIND_SOCKET_FAIL);
+        }
+        return 0;
+    }
+    return 1;
+}
+
+ADDRESS CreateSocketAddress(IP ip, int port)
+{
+    ADDRESS addr;
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr = ip;
+    return addr;
+}
+
+int SetReusePort(SOCKET socket)
+{
+#ifdef SO_REUSEPORT
+    int enable = 1;
+    if (setsockopt(socket, SOL_SOCKET, SO_REUSEPORT, (const char*)&enable, sizeof(enable)) == SOCKET_ERROR) {
+        LogMessage(WARNING_FLAGS, WSAGetLastError(), _SET_REUSE_PORT_FAIL);
+        return 0;
+    }
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+int SetReceiveTimeout(SOCKET socket, int interval)
+{
+#ifdef _WIN32
+    DWORD _interval = interval;
+#else
+    struct timeval _interval;
+    _interval.tv_sec = interval / 1000;
+    _interval.tv_usec = (interval % 1000) * 1000;
+#endif
+    int ret = setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, (const char*)&_interval, sizeof(_interval));
+    if (ret == SOCKET_ERROR) {
+        LogMessage(WARNING_FLAGS, WSAGetLastError(), _SET_TIMEOUT_FAIL);
+        return 0;
+    }
+    return 1;
+}
+
+#pragma endregion
+
+#pragma region TCP Segmentation
+
+int EncodeSegmentationHeader(char* oheader, int current, long long remain)
+{
+    if (remain <= SEGMENTATION_LEGACY_REMAIN_MAX) {
+        // legacy: number of bytes current (2) | number of bytes remain (2)
+        unsigned short current_bigendian = htons((unsigned short)current); // uniform with many architectures.
+        unsigned short remain_bigendian = htons((unsigned short)remain);
+        memcpy_s(oheader, SEGMENTATION_HEADER_CURRENT_SIZE, &current_bigendian, SEGMENTATION_HEADER_CURRENT_SIZE);
+        memcpy_s(oheader + SEGMENTATION_HEADER_CURRENT_SIZE, SEGMENTATION_HEADER_REMAIN_SIZE, &remain_bigendian, SEGMENTATION_HEADER_REMAIN_SIZE);
+        return SEGMENTATION_HEADER_SIZE;
+    }
+    // extended: marker (2) | version (2) | number of bytes current (4) | number of bytes remain (8), all big-endian
+    unsigned long long value = SEGMENTATION_EXTENDED_MARKER;
+    value = (value << 16) | SEGMENTATION_EXTENDED_VERSION;
+    value = (value << 32) | (unsigned int)current;
+    for (int i = 0; i < 8; i++)
+        oheader[i] = (char)(value >> (56 - 8 * i));
+    for (int i = 0; i < 8; i++)
+        oheader[8 + i] = (char)((unsigned long long)remain >> (56 - 8 * i));
+    return SEGMENTATION_EXTENDED_HEADER_SIZE;
+}
+
+int DecodeSegmentationHeader(const char* header, int length, int* oheader_size, int* ocurrent, long long* oremain)
+{
+    const unsigned char* bytes = (const unsigned char*)header;
+    *oheader_size = SEGMENTATION_HEADER_SIZE;
+    if (length < SEGMENTATION_HEADER_SIZE)
+        return 0;
+    int current = (bytes[0] << 8) | bytes[1];
+    if (current != SEGMENTATION_EXTENDED_MARKER) {
+        // legacy: number of bytes current | number of bytes remain
+        *ocurrent = current;
+        *oremain = (bytes[2] << 8) | bytes[3];
+        return 1;
+    }
+    if (((bytes[2] << 8) | bytes[3]) != SEGMENTATION_EXTENDED_VERSION) {
+        LogMessage(WARNING_FLAGS, 0, _RECEIVE_UNEXPECTED_MESSAGE);
+        return -1;
+    }
+    *oheader_size = SEGMENTATION_EXTENDED_HEADER_SIZE;
+    if (length < SEGMENTATION_EXTENDED_HEADER_SIZE)
+        return 0;
+    unsigned long long value = 0;
+    for (int i = 4; i < 8; i++)
+        value = (value << 8) | bytes[i];
+    *ocurrent = (int)value;
+    value = 0;
+    for (int i = 8; i < 16; i++)
+        value = (value << 8) | bytes[i];
+    *oremain = (long long)value;
+    if (*ocurrent < 0 || *oremain < 0) {
+        LogMessage(WARNING_FLAGS, 0, _RECEIVE_UNEXPECTED_MESSAGE);
+        return -1;
+    }
+    return 1;
+}
+
+int WriteSocketBuffer(SOCKET sender, int bytes, const char* message)
+{
+    int sent = 0;
+    while (sent < bytes) { // send() may accept only a part of the bytes, continue with the rest
+        int ret = send(sender, message + sent, bytes - sent, 0);
+        if (ret == SOCKET_ERROR) {
+            int err = WSAGetLastError();
+            if (err == WSAEHOSTUNREACH) {
+                LogMessage(WARNING_FLAGS, err, _HOST_UNREACHABLE);
+            }
+            else if (err == WSAECONNABORTED || err == WSAECONNRESET) {
+                LogMessage(ERROR_FLAGS, err, _CONNECTION_DROP);
+            }
+            else {
+                LogMessage(WARNING_FLAGS, err, _SEND_FAIL);
+            }
+            return -1;
+        }
+        sent += ret;
+    }
+    return 1;
+}
+
+int WriteSocketBuffers(SOCKET sender, WSABUF* buffers, int count)
+{
+    while (count > 0) {
+        DWORD sent = 0;
+        if (WSASend(sender, buffers, count, &sent, 0, NULL, NULL) == SOCKET_ERROR) {
+            int err = WSAGetLastError();
+            if (err == WSAEHOSTUNREACH) {
+                LogMessage(WARNING_FLAGS, err, _HOST_UNREACHABLE);
+            }
+            else if (err == WSAECONNABORTED || err == WSAECONNRESET) {
+                LogMessage(ERROR_FLAGS, err, _CONNECTION_DROP);
+            }
+            else {
+                LogMessage(WARNING_FLAGS, err, _SEND_FAIL);
+            }
+            return -1;
+        }
+        // skip the buffers sent completely, continue from the first byte not sent
+        while (count > 0 && sent >= buffers->len) {
+            sent -= buffers->len;
+            buffers++;
+            count--;
+        }
+        if (count > 0) {
+            buffers->buf += sent;
+            buffers->len -= sent;
+        }
+    }
+    return 1;
+}
+
+int SegmentationSend(SOCKET sender, const char* message, int message_len, int* obyte_sent, const FRAMING* framing)
+{
+    int segment_size = framing != NULL ? framing->segment_size : APPLICATION_BUFF_MAX_SIZE;
+    int is_extended = framing != NULL && framing->is_extended;
+    if (!is_extended && message_len - (segment_size - SEGMENTATION_HEADER_SIZE) > SEGMENTATION_LEGACY_REMAIN_MAX) {
+        // the legacy header can not describe it, a wrapped "remain" would corrupt the stream
+        LogMessage(WARNING_FLAGS, 0, _MESSAGE_EXTREME_LARGE);
+        if (obyte_sent != NULL)
+            *obyte_sent = 0;
+        return 0;
+    }
+
+    int start_byte = 0; // start byte in message.
+    int bsend = 0; // number of bytes will send, not include header size.
+
+    char headers[SEGMENTATION_BATCH_SIZE][SEGMENTATION_EXTENDED_HEADER_SIZE];
+    WSABUF buffers[SEGMENTATION_BATCH_SIZE * 2];
+    while (start_byte < message_len) {
+        // Prepare a batch of pieces: header (number of bytes send | number of bytes remain) + body (a view on message, not copied)
+        int batch_start = start_byte;
+        int count = 0;
+        while (start_byte < message_len && count < SEGMENTATION_BATCH_SIZE * 2) {
+            bsend = message_len - start_byte;
+            if (bsend + SEGMENTATION_HEADER_SIZE > segment_size) {
+                bsend = segment_size - SEGMENTATION_HEADER_SIZE;
+            }
+            if (message_len - start_byte - bsend > SEGMENTATION_LEGACY_REMAIN_MAX) // the extended header is larger
+                bsend = segment_size - SEGMENTATION_EXTENDED_HEADER_SIZE;
+            long long bremain = message_len - start_byte - bsend;
+
+            char* header = headers[count / 2];
+            buffers[count].buf = header;
+            buffers[count].len = EncodeSegmentationHeader(header, bsend, bremain);
+            buffers[count + 1].buf = (char*)(message + start_byte);
+            buffers[count + 1].len = bsend;
+            count += 2;
+            start_byte += bsend;
+        }
+        // Send the whole batch with one call
+        int ret = WriteSocketBuffers(sender, buffers, count);
+        if (ret != 1) {
+            if (obyte_sent != NULL)
+                *obyte_sent = batch_start;
+            return ret;
+        }
+    }
+    if (obyte_sent != NULL)
+        *obyte_sent = start_byte;
+    return 1;
+}
+
+int ReadSocketBuffer(SOCKET receiver, int length, char* obuffer)
+{
+    int received = 0;
+    while (received < length) { // TCP may split the bytes, continue until all of them arrive
+        int ret = recv(receiver, obuffer + received, length - received, 0);
+        if (ret == SOCKET_ERROR) {
+            int err = WSAGetLastError();
+            if (err == WSAECONNABORTED || err == WSAECONNRESET) {
+                LogMessage(ERROR_FLAGS, err, _CONNECTION_DROP);
+            }
+            else {
+                LogMessage(WARNING_FLAGS, err, _RECEIVE_FAIL);
+            }
+            return -1;
+        }
+        else if (ret == 0) {
+            return -1;
+        }
+        received += ret;
+    }
+    return 1;
+}
+
+int ReadSegmentationHeader(SOCKET receiver, int segment_size, char* header, int* ocurrent, long long* oremain)
+{
+    *ocurrent = 0;
+    *oremain = 0;
+    // read the legacy header, then the rest if it is an extended header
+    int header_size, current;
+    long long remain;
+    int ret = ReadSocketBuffer(receiver, SEGMENTATION_HEADER_SIZE, header);
+    if (ret != 1)
+        return ret;
+    ret = DecodeSegmentationHeader(header, SEGMENTATION_HEADER_SIZE, &header_size, &current, &remain);
+    if (ret == 0) {
+        ret = ReadSocketBuffer(receiver, header_size - SEGMENTATION_HEADER_SIZE, header + SEGMENTATION_HEADER_SIZE);
+        if (ret != 1)
+            return ret;
+        ret = DecodeSegmentationHeader(header, header_size, &header_size, &current, &remain);
+    }
+    if (ret != 1)
+        return -1;
+    if (current + header_size > segment_size) {
+        LogMessage(WARNING_FLAGS, 0, _TOO_MUCH_BYTES);
+        return -1;
+    }
+    *ocurrent = current;
+    *oremain = remain;
+    return header_size;
+}
+
+int SegmentationReceive(SOCKET receiver, char* buffer, const char** omessage, int* omessage_len, long long* oremain)
+{
+    *omessage = NULL;
+    *omessage_len = 0;
+    *oremain = 0;
+    int current;
+    long long remain;
+    int header_size = ReadSegmentationHeader(receiver, APPLICATION_BUFF_MAX_SIZE, buffer, &current, &remain);
+    if (header_size <= 0)
+        return header_size;
+
+    // read message content, right after the header
+    if (current > 0) {
+        int ret = ReadSocketBuffer(receiver, current, buffer + header_size);
+        if (ret != 1)
+            return ret;
+    }
+    *omessage = buffer + header_size;
+    *omessage_len = current;
+    *oremain = remain;
+    return 1;
+}
+
+#pragma endregion
+
+#pragma region UDP Datagram
+
+int Receive(SOCKET receiver, char** omessage, ADDRESS* osender_addr)
+{
+    char buffer[APPLICATION_BUFF_MAX_SIZE];
+    ADDRESS _sender_addr;
+    socklen_t _sender_addr_len = sizeof(_sender_addr);
+
+    int ret = recvfrom(receiver, buffer, APPLICATION_BUFF_MAX_SIZE, 0, (SOCKADDR*)&_sender_addr, &_sender_addr_len);
+
+    int is_ok = 1;
+    if (ret == SOCKET_ERROR) {
+        int err = WSAGetLastError();
+        if (err == WSAEMSGSIZE) {
+            LogMessage(WARNING_FLAGS, err, _MESSAGE_TOO_LARGE);
+        }
+        else {
+            LogMessage(WARNING_FLAGS, err, _RECEIVE_FAIL);
+            is_ok = 0;
+        }
+    }
+    // Copy value to output variables
+    if (is_ok == 1) {
+        if (ret >= APPLICATION_BUFF_MAX_SIZE)
+            ret = APPLICATION_BUFF_MAX_SIZE - 1;
+        buffer[ret] = '\0'; // in case buffer dont have '\0' or lost byte.
+
+        *osender_addr = _sender_addr;
+        *omessage = (char*)malloc(strlen(buffer) + 1);
+
+        if (*omessage == NULL)
+        {
+            LogMessage(WARNING_FLAGS, 0, _ALLOCATE_MEMORY_FAIL);
+            is_ok = 0;
+        }
+        else
+            strcpy_s(*omessage, strlen(buffer) + 1, buffer);
+    }
+
+    return is_ok;
+}
+
+int EncodeQueryID(char* obuffer, unsigned int id)
+{
+    obuffer[0] = QUERY_ID_FLAG;
+    for (int i = 0; i < 4; i++)
+        obuffer[1 + i] = (char)(id >> (24 - 8 * i));
+    return QUERY_ID_SIZE;
+}
+
+int DecodeQueryID(const char* bytes, int length, unsigned int* oid)
+{
+    if (length < QUERY_ID_SIZE || bytes[0] != QUERY_ID_FLAG)
+        return 0;
+    const unsigned char* id = (const unsigned char*)bytes + 1;
+    *oid = ((unsigned int)id[0] << 24) | ((unsigned int)id[1] << 16) | ((unsigned int)id[2] << 8) | id[3];
+    return 1;
+}
+
+int Send(SOCKET sender, const char* message, ADDRESS receiver, int* obyte_sent)
+{
+    return SendBytes(sender, message, (int)strlen(message) + 1, receiver, obyte_sent);
+}
+
+int SendBytes(SOCKET sender, const char* bytes, int length, ADDRESS receiver, int* obyte_sent)
+{
+    int expect_send = length;
+
+    int ret = sendto(sender, bytes, expect_send, 0, (SOCKADDR*)&receiver, sizeof(receiver));
+
+    int is_ok = 1;
+    if (ret == SOCKET_ERROR) {
+        int err = WSAGetLastError();
+        if (err == WSAEMSGSIZE) {
+            LogMessage(WARNING_FLAGS, err, _MESSAGE_EXTREME_LARGE);
+            is_ok = 0;
+        }
+        else if (err == WSAEHOSTUNREACH) {
+            LogMessage(WARNING_FLAGS, err, _HOST_UNREACHABLE);
+            is_ok = 0;
+        }
+        else {
+            LogMessage(WARNING_FLAGS, err, _SEND_FAIL);
+            is_ok = 0;
+        }
+        if (obyte_sent != NULL)
+            *obyte_sent = 0;
+    }
+    else
+    {
+        if (obyte_sent != NULL)
+            *obyte_sent = ret;
+        if (ret < expect_send)
+        {
+            LogMessage(WARNING_FLAGS, 0, _SEND_NOT_ALL);
+        }
+    }
+    return is_ok;
+}
+
+#pragma endregion
+
+#pragma region Utilities
+
+int HasOption(int argc, char* argv[], const char* option)
+{
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], option) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+int GetIntOption(int argc, char* argv[], const char* option, int default_value)
+{
+    for (int i = 1; i < argc - 1; i++) {
+        if (strcmp(argv[i], option) == 0) {
+            int value = atoi(argv[i + 1]);
+            return value == 0 ? default_value : value;
+        }
+    }
+    return default_value;
+}
+
+const char* GetStringOption(int argc, char* argv[], const char* option)
+{
+    for (int i = 1; i < argc - 1; i++) {
+        if (strcmp(argv[i], option) == 0)
+            return argv[i + 1];
+    }
+    return NULL;
+}
+
+int TryParseIPString(const char* str, IP* oip)
+{
+    return inet_pton(AF_INET, str, oip) == 1;
+}
+
+IP CreateDefaultIP()
+{
+    IP addr;
+    addr.s_addr = htonl(INADDR_ANY);
+    return addr;
+}
+
+char* Clone(const char* source, int length, int start)
+{
+    char* _clone = (char*)malloc(length + start);
+
+    if (_clone == NULL)
+        LogMessage(WARNING_FLAGS, 0, _ALLOCATE_MEMORY_FAIL);
+    else
+        memcpy_s(_clone + start, length, source, length);
+    return _clone;
+}
+
+long long GetTimestamp()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+unsigned int NextRandom(unsigned int* state)
+{
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+#pragma endregion
+
+#pragma region Logging
+
+static LOG_HANDLER log_handler = PrintLogMessage;
+
+void SetLogHandler(LOG_HANDLER handler)
+{
+    log_handler = handler != NULL ? handler : PrintLogMessage;
+}
+
+void LogMessage(const char* flags, int error, const char* message)
+{
+    log_handler(flags, error, message);
+}
+
+void PrintLogMessage(const char* flags, int error, const char* message)
+{
+    if (error != 0)
+        printf("[%s:%d] %s\n", flags, error, message);
+    else
+        printf("[%s] %s\n", flags, message);
+}
+
+#pragma endregion
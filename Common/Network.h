@@ -0,0 +1,332 @@
+#pragma once
+
+#pragma region Header Declarations
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Platform.h"
+#include "CommonDefinitions.h"
+#include "MessagePool.h"
+#include "Histogram.h"
+#pragma endregion
+
+#pragma region Constants Definitions
+
+#define SEGMENTATION_HEADER_REMAIN_SIZE 2
+#define SEGMENTATION_HEADER_CURRENT_SIZE 2
+#define SEGMENTATION_HEADER_SIZE 4
+#define SEGMENTATION_LEGACY_REMAIN_MAX 0xFFFF // largest "remain" in a legacy header
+#define SEGMENTATION_EXTENDED_MARKER 0xFFFF // first 2 bytes of an extended header, never a valid legacy "current"
+#define SEGMENTATION_EXTENDED_VERSION 1
+#define SEGMENTATION_EXTENDED_HEADER_SIZE 16 // marker (2) | version (2) | current (4) | remain (8)
+#define SEGMENTATION_BATCH_SIZE 64 // number of pieces sent with one call
+#define SEGMENTATION_MAX_SIZE 65536 // largest segmentation can be agreed, include header
+
+#pragma endregion
+
+#pragma region Type Definitions
+
+/// <summary>
+/// The framing agreed by a client and a server (See: HELLO_MESSAGE)
+/// </summary>
+typedef struct {
+    int segment_size; // maximum size of a segmentation, include header
+    int is_extended; // 1 if the server decodes extended headers, messages can be larger than 64 KB
+} FRAMING;
+
+/// <summary>
+/// A function that outputs the messages logged by the library (See: SetLogHandler)
+/// </summary>
+typedef void (*LOG_HANDLER)(const char* flags, int error, const char* message);
+
+#pragma endregion
+
+#pragma region Function Declarations
+
+/// <summary>
+/// Initialize Winsock 2.2
+/// </summary>
+/// <returns>1 if initialize successfully, 0 otherwise</returns>
+int WSInitialize();
+
+/// <summary>
+/// Clean up Winsock 2.2
+/// </summary>
+/// <returns>1 if close successfully, 0 otherwise</returns>
+int WSCleanup();
+
+/// <summary>
+/// Create a TCP/UDP Socket.
+/// </summary>
+/// <param name="protocol">TCP or UDP</param>
+/// <returns>
+/// Created TCP/UDP Socket.
+/// INVALID_SOCKET if protocol is unexpected or have error on Winsock
+/// </returns>
+SOCKET CreateSocket(int protocol);
+
+/// <summary>
+/// Close a created Socket
+/// </summary>
+/// <param name="socket">The socket want to close</param>
+/// <param name="mode">CLOSE_NORMAL or CLOSE_SAFELY (Shutdown before close)</param>
+/// <param name="flags">Specify how to close socket safely. Some flags: SD_RECEIVE, SD_SEND, SD_BOTH (Manifest constants for shutdown()). This param is not used with CLOSE_NORMAL </param>
+/// <returns>1 if close successfully, 0 otherwise</returns>
+int CloseSocket(SOCKET socket, int mode, int flags = 0);
+
+/// <summary>
+/// Bind a socket to an address [IPv4, Port]
+/// </summary>
+/// <param name="socket">The socket want to bind</param>
+/// <param name="addr">A socket address [IPv4, Port]</param>
+/// <returns>1 is bind successfully. 0 otherwise</returns>
+int BindSocket(SOCKET socket, ADDRESS addr);
+
+/// <summary>
+/// Create a socket address that used IPv4 and Port Number
+/// </summary>
+/// <param name="ip">The IPv4 Address</param>
+/// <param name="port">The Port number</param>
+/// <returns>Created socket address</returns>
+ADDRESS CreateSocketAddress(IP ip, int port);
+
+/// <summary>
+/// Allow many sockets to bind to the same address (SO_REUSEPORT), so the system spreads incoming connections
+/// or datagrams across them. Must be called before BindSocket.
+/// </summary>
+/// <param name="socket">The socket want to set</param>
+/// <returns>1 if set successfully. 0 if not supported or have errors</returns>
+int SetReusePort(SOCKET socket);
+
+/// <summary>
+/// Set receive timeout interval for socket.
+/// </summary>
+/// <param name="socket">The socket want to set timeout</param>
+/// <param name="interval">The timeout interval, in milliseconds</param>
+/// <returns>1 if set successfully, 0 otherwise</returns>
+int SetReceiveTimeout(SOCKET socket, int interval);
+
+/// <summary>
+/// Write the header of a segmentation. The legacy header (2 bytes current | 2 bytes remain) is used
+/// if remain fits in it, otherwise the extended header (See: SEGMENTATION_EXTENDED_HEADER_SIZE)
+/// </summary>
+/// <param name="oheader">[Output] The header, at least SEGMENTATION_EXTENDED_HEADER_SIZE bytes</param>
+/// <param name="current">Number of bytes in the segmentation body</param>
+/// <param name="remain">Number of bytes in root message after this segmentation</param>
+/// <returns>Size of the header written</returns>
+int EncodeSegmentationHeader(char* oheader, int current, long long remain);
+
+/// <summary>
+/// Decode the header of a segmentation, legacy or extended
+/// </summary>
+/// <param name="header">The bytes of the header</param>
+/// <param name="length">Number of bytes available in header</param>
+/// <param name="oheader_size">[Output] Size of the header. If it is larger than length, the header is incomplete</param>
+/// <param name="ocurrent">[Output] Number of bytes in the segmentation body</param>
+/// <param name="oremain">[Output] Number of bytes in root message after this segmentation</param>
+/// <returns>1 if decode successfully. 0 if need more bytes. -1 if the header is invalid (unknown version)</returns>
+int DecodeSegmentationHeader(const char* header, int length, int* oheader_size, int* ocurrent, long long* oremain);
+
+/// <summary>
+/// Write a byte stream to the connected socket buffer, to send
+/// </summary>
+/// <param name="sender">The connected socket that is used for send message</param>
+/// <param name="bytes">Number of bytes expected to send</param>
+/// <param name="message">The bytes tream want to send</param>
+/// <returns>1 if success, all bytes are sent. -1 if have errors that the socket should be closed</returns>
+int WriteSocketBuffer(SOCKET sender, int bytes, const char* message);
+
+/// <summary>
+/// Write many buffers to the connected socket buffer with one call (scatter-gather), to send
+/// </summary>
+/// <param name="sender">The connected socket that is used for send message</param>
+/// <param name="buffers">The buffers want to send, in order. They are modified to track the bytes not sent</param>
+/// <param name="count">Number of buffers</param>
+/// <returns>1 if success, all bytes are sent. -1 if have errors that the socket should be closed</returns>
+int WriteSocketBuffers(SOCKET sender, WSABUF* buffers, int count);
+
+/// <summary>
+/// Segmentation a message into pieces and Send them with a connected socket.
+/// Each piece attached with the header consists of SEGMENTATION_HEADER_CURRENT_SIZE first bytes
+/// is the length of message in the piece (not include header size) and SEGMENTATION_HEADER_REMAIN_SIZE next bytes
+/// is the number of bytes on message that has not been sent. An extended header is used if remain does not fit (See: EncodeSegmentationHeader).
+/// The pieces are not copied: up to SEGMENTATION_BATCH_SIZE headers and views on message are sent with one call.
+/// </summary>
+/// <param name="sender">The connected socket used for sending</param>
+/// <param name="message">The message want to segmentation and send</param>
+/// <param name="message_len">The length of the message</param>
+/// <param name="obyte_sent">[Output] The bytes sent successfully</param>
+/// <param name="framing">The agreed framing (See: NegotiateSegmentation). NULL for legacy headers and APPLICATION_BUFF_MAX_SIZE</param>
+/// <returns>1 if success. 0 if number of bytes sent less than expected, or the message is too large for legacy headers. -1 if have errors that the socket should be closed</returns>
+int SegmentationSend(SOCKET sender, const char* message, int message_len, int* obyte_sent, const FRAMING* framing = NULL);
+
+/// <summary>
+/// Read a bytes stream from a connected socket into a buffer owned by caller
+/// </summary>
+/// <param name="receiver">The connected socket that is used for receiving bytes stream</param>
+/// <param name="bytes">Number of bytes want to read</param>
+/// <param name="obuffer">[Output] The buffer holds the byte streams read, at least <bytes> bytes</param>
+/// <returns>1 if read successfully, all bytes are read. -1 if have errors that the socket should be closed</returns>
+int ReadSocketBuffer(SOCKET receiver, int bytes, char* obuffer);
+
+/// <summary>
+/// Read and decode the header of a segmentation
+/// </summary>
+/// <param name="receiver">The connected socket that is used for receiving byte streams</param>
+/// <param name="segment_size">Maximum size of a segmentation, include header. A larger segmentation is invalid</param>
+/// <param name="header">The buffer holds the header, at least SEGMENTATION_EXTENDED_HEADER_SIZE bytes</param>
+/// <param name="ocurrent">[Output] Number of bytes in the segmentation body</param>
+/// <param name="oremain">[Output] Number of bytes in root message that have not been received</param>
+/// <returns>Size of the header if read successfully. -1 if have errors that the socket should be closed</returns>
+int ReadSegmentationHeader(SOCKET receiver, int segment_size, char* header, int* ocurrent, long long* oremain);
+
+/// <summary>
+/// Read a segmentation into a buffer owned by caller, and extract message from it.
+/// The header (legacy or extended) is placed at the start of buffer, the message is placed right after the header.
+/// No memory is allocated: the buffer can be reused for every segmentation.
+/// </summary>
+/// <param name="receiver">The connected socket that is used for receiving byte streams</param>
+/// <param name="buffer">The buffer holds the segmentation, at least APPLICATION_BUFF_MAX_SIZE bytes</param>
+/// <param name="omessage">[Output] The extracted message, a view on buffer after the header</param>
+/// <param name="omessage_len">[Output] The message size, in bytes</param>
+/// <param name="oremain">[Output] Number of bytes in root message that have not been received</param>
+/// <returns>1 if read successfully. 0 if cant read completely. -1 if have errors that the socket should be closed</returns>
+int SegmentationReceive(SOCKET receiver, char* buffer, const char** omessage, int* omessage_len, long long* oremain);
+
+/// <summary>
+/// Receive a message from an UDP socket buffer.
+/// </summary>
+/// <param name="receiver">The receiver socket</param>
+/// <param name="omessage">[Output] The message extracted from datagram</param>
+/// <param name="osender_addr">[Output] The sender's address in the datagram</param>
+/// <returns>1 if have no errors. 0 otherwise</returns>
+int Receive(SOCKET receiver, char** omessage, ADDRESS* osender_addr);
+
+/// <summary>
+/// Write the query ID of a datagram: QUERY_ID_FLAG, then the ID in 4 bytes big-endian
+/// </summary>
+/// <param name="obuffer">[Output] The buffer, at least QUERY_ID_SIZE bytes</param>
+/// <param name="id">The query ID</param>
+/// <returns>Number of bytes written: QUERY_ID_SIZE</returns>
+int EncodeQueryID(char* obuffer, unsigned int id);
+
+/// <summary>
+/// Read the query ID of a datagram (See: EncodeQueryID)
+/// </summary>
+/// <param name="bytes">The bytes that may hold the query ID</param>
+/// <param name="length">Number of bytes</param>
+/// <param name="oid">[Output] The query ID</param>
+/// <returns>1 if the bytes start with a query ID. 0 otherwise</returns>
+int DecodeQueryID(const char* bytes, int length, unsigned int* oid);
+
+/// <summary>
+/// Send bytes to an address, as one datagram
+/// </summary>
+/// <param name="sender">The sender socket</param>
+/// <param name="bytes">The bytes want to send</param>
+/// <param name="length">Number of bytes</param>
+/// <param name="receiver">The receiver's address</param>
+/// <param name="byte_sent">[Output] Number of bytes are sent successfully.</param>
+/// <returns>1 if have no errors. 0 otherwise</returns>
+int SendBytes(SOCKET sender, const char* bytes, int length, ADDRESS receiver, int* obyte_sent = NULL);
+
+/// <summary>
+/// Send a message to an address
+/// </summary>
+/// <param name="sender">The sender socket</param>
+/// <param name="message">The message want to send</param>
+/// <param name="receiver">The receiver's address</param>
+/// <param name="byte_sent">[Output] Number of bytes are sent successfully.</param>
+/// <returns>1 if have no errors. 0 otherwise</returns>
+int Send(SOCKET sender, const char* message, ADDRESS receiver, int* obyte_sent = NULL);
+
+/// <summary>
+/// Check whether an option is specified in command-line arguments
+/// </summary>
+/// <param name="argc">Number of Arguments [From main()]</param>
+/// <param name="argv">Arguments value [From main()]</param>
+/// <param name="option">The option want to check</param>
+/// <returns>1 if the option is specified. 0 otherwise</returns>
+int HasOption(int argc, char* argv[], const char* option);
+
+/// <summary>
+/// Get the integer value that follows an option in command-line arguments. Example: --segment-size 8192
+/// </summary>
+/// <param name="argc">Number of Arguments [From main()]</param>
+/// <param name="argv">Arguments value [From main()]</param>
+/// <param name="option">The option want to get value</param>
+/// <param name="default_value">The value used if the option is not specified or its value is invalid</param>
+/// <returns>The value of the option</returns>
+int GetIntOption(int argc, char* argv[], const char* option, int default_value);
+
+/// <summary>
+/// Get the string value that follows an option in command-line arguments. Example: --names names.txt
+/// </summary>
+/// <param name="argc">Number of Arguments [From main()]</param>
+/// <param name="argv">Arguments value [From main()]</param>
+/// <param name="option">The option want to get value</param>
+/// <returns>The value of the option. NULL if the option is not specified</returns>
+const char* GetStringOption(int argc, char* argv[], const char* option);
+
+/// <summary>
+/// Try parse a string to a IPv4 Address
+/// </summary>
+/// <param name="str">The string want to parse</param>
+/// <param name="oip">[Output] The result IPv4 Address</param>
+/// <returns>1 if parse successfully. 0 otherwise</returns>
+int TryParseIPString(const char* str, IP* oip);
+
+/// <summary>
+/// Create a INADDR_ANY IP Address
+/// </summary>
+/// <returns>The INADDR_ANY IP</returns>
+IP CreateDefaultIP();
+
+/// <summary>
+/// Create a new memory space and Copy <length> bytes from <root> to it.
+/// </summary>
+/// <param name="source">The source bytes</param>
+/// <param name="length">Number of bytes want to copy</param>
+/// <param name="start">The first byte in destination will hold the 0th byte of source</param>
+/// <returns>New memory space contains content of source. NULL if fail to allocate memory</returns>
+char* Clone(const char* source, int length, int start = 0);
+
+/// <summary>
+/// Get a monotonic timestamp
+/// </summary>
+/// <returns>The timestamp, in nanoseconds</returns>
+long long GetTimestamp();
+
+/// <summary>
+/// Generate a pseudo-random number (xorshift), each thread uses its own state
+/// </summary>
+/// <param name="state">The state, not 0</param>
+/// <returns>The number</returns>
+unsigned int NextRandom(unsigned int* state);
+
+/// <summary>
+/// Set the function that outputs the messages logged by the library. By default they are printed to console.
+/// Call it when no other thread is logging.
+/// </summary>
+/// <param name="handler">The function. NULL for printing to console</param>
+void SetLogHandler(LOG_HANDLER handler);
+
+/// <summary>
+/// Log a message with the current handler (See: SetLogHandler), in the format "[flags:error] message"
+/// </summary>
+/// <param name="flags">ERROR_FLAGS, WARNING_FLAGS or INFO_FLAGS</param>
+/// <param name="error">The error code. 0 if has no code</param>
+/// <param name="message">The message, a constant that lives as long as the program</param>
+void LogMessage(const char* flags, int error, const char* message);
+
+/// <summary>
+/// Print a message to console, in the format "[flags:error] message". The default log handler.
+/// </summary>
+/// <param name="flags">ERROR_FLAGS, WARNING_FLAGS or INFO_FLAGS</param>
+/// <param name="error">The error code. 0 if has no code</param>
+/// <param name="message">The message</param>
+void PrintLogMessage(const char* flags, int error, const char* message);
+
+#pragma endregion
@@ -0,0 +1,175 @@
+#pragma once
+
+#ifdef _WIN32
+#pragma region Winsock Backend
+
+#pragma comment(lib, "Ws2_32.lib")
+
+#include <WinSock2.h>
+#include <WS2tcpip.h>
+
+#pragma endregion
+#else
+#pragma region POSIX Backend
+
+// The POSIX sockets API with the Winsock names used by the projects,
+// so the same code builds on Windows and on Linux.
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <string.h>
+#include <stdio.h>
+
+typedef int SOCKET;
+typedef unsigned short WORD;
+typedef unsigned long DWORD;
+typedef unsigned long u_long;
+
+typedef struct sockaddr SOCKADDR;
+typedef struct sockaddr_in SOCKADDR_IN;
+typedef struct in_addr IN_ADDR;
+typedef struct addrinfo ADDRINFO;
+typedef struct pollfd WSAPOLLFD;
+
+/// <summary>
+/// Same layout as struct iovec, so an array of it is passed to sendmsg as is (See: WSASend)
+/// </summary>
+typedef struct {
+    char* buf;
+    size_t len;
+} WSABUF;
+
+typedef struct {
+    WORD wVersion;
+} WSADATA;
+
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+
+#define SD_RECEIVE SHUT_RD
+#define SD_SEND SHUT_WR
+#define SD_BOTH SHUT_RDWR
+
+#define MAKEWORD(low, high) ((WORD)(((low) & 0xFF) | (((high) & 0xFF) << 8)))
+
+#define WSAEINTR EINTR
+#define WSAEINVAL EINVAL
+#define WSAEMFILE EMFILE
+#define WSAEWOULDBLOCK EWOULDBLOCK
+#define WSAEMSGSIZE EMSGSIZE
+#define WSAEADDRINUSE EADDRINUSE
+#define WSAENOBUFS ENOBUFS
+#define WSAEISCONN EISCONN
+#define WSAECONNABORTED ECONNABORTED
+#define WSAECONNRESET ECONNRESET
+#define WSAECONNREFUSED ECONNREFUSED
+#define WSAETIMEDOUT ETIMEDOUT
+#define WSAEHOSTUNREACH EHOSTUNREACH
+#define WSAHOST_NOT_FOUND EAI_NONAME
+#define WSATRY_AGAIN EAI_AGAIN
+
+inline int WSAStartup(WORD version, WSADATA* odata)
+{
+    odata->wVersion = version;
+    // a send on a connection closed by the peer must fail with EPIPE, as on Winsock, not kill the process
+    signal(SIGPIPE, SIG_IGN);
+    return 0;
+}
+
+inline int WSACleanup()
+{
+    return 0;
+}
+
+inline int WSAGetLastError()
+{
+    return errno;
+}
+
+inline int closesocket(SOCKET socket)
+{
+    return close(socket);
+}
+
+inline int ioctlsocket(SOCKET socket, long command, u_long* argument)
+{
+    int value = (int)*argument;
+    return ioctl(socket, command, &value);
+}
+
+inline int WSAPoll(WSAPOLLFD* fds, unsigned long count, int timeout)
+{
+    return poll(fds, (nfds_t)count, timeout);
+}
+
+inline int WSASend(SOCKET socket, WSABUF* buffers, DWORD count, DWORD* obyte_sent, DWORD flags, void* overlapped, void* completion)
+{
+    (void)overlapped; // blocking sends only, no overlapped I/O
+    (void)completion;
+    struct msghdr header;
+    memset(&header, 0, sizeof(header));
+    header.msg_iov = (struct iovec*)buffers;
+    header.msg_iovlen = count;
+    ssize_t sent = sendmsg(socket, &header, (int)flags | MSG_NOSIGNAL);
+    if (sent < 0)
+        return SOCKET_ERROR;
+    *obyte_sent = (DWORD)sent;
+    return 0;
+}
+
+#pragma endregion
+
+#pragma region C Runtime
+// The bounds-checked functions of the Microsoft C runtime used by the projects
+
+#define sprintf_s snprintf
+#define scanf_s(format, value, size) scanf(format, value)
+
+inline int memcpy_s(void* destination, size_t destination_size, const void* source, size_t count)
+{
+    if (count > destination_size)
+        return ERANGE;
+    memcpy(destination, source, count);
+    return 0;
+}
+
+inline int strcpy_s(char* destination, size_t destination_size, const char* source)
+{
+    if (strlen(source) + 1 > destination_size)
+        return ERANGE;
+    strcpy(destination, source);
+    return 0;
+}
+
+inline int _itoa_s(int value, char* obuffer, size_t buffer_size, int radix)
+{
+    (void)radix; // the projects format decimal numbers only
+    return snprintf(obuffer, buffer_size, "%d", value) < (int)buffer_size ? 0 : ERANGE;
+}
+
+inline char* gets_s(char* obuffer, size_t buffer_size)
+{
+    if (fgets(obuffer, (int)buffer_size, stdin) == NULL)
+        return NULL;
+    obuffer[strcspn(obuffer, "\n")] = '\0';
+    return obuffer;
+}
+
+inline int fopen_s(FILE** ofile, const char* path, const char* mode)
+{
+    *ofile = fopen(path, mode);
+    return *ofile == NULL ? errno : 0;
+}
+
+#pragma endregion
+#endif
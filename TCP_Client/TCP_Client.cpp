@@ -1,5 +1,6 @@
 #include "TCP_Client.h"
 
+#ifndef TCP_CLIENT_LIBRARY // defined when the tests link the client functions
 int main(int argc, char* argv[])
 {
     int server_port;
@@ -19,8 +20,31 @@ int main(int argc, char* argv[])
             is_ok = 0;
         scanf_s("%c", &c, 1); // consume '\n'
     }
+    int proposed_segment_size = GetIntOption(argc, argv, SEGMENTATION_SIZE_OPTION, SEGMENTATION_MAX_SIZE);
+    if (proposed_segment_size < APPLICATION_BUFF_MAX_SIZE || proposed_segment_size > SEGMENTATION_MAX_SIZE) {
+        printf("[%s] %s\n", WARNING_FLAGS, _CONVERT_SEGMENTATION_SIZE_FAIL);
+        proposed_segment_size = SEGMENTATION_MAX_SIZE;
+    }
+    const char* batch_path = GetStringOption(argc, argv, BATCH_OPTION);
+    int window = GetIntOption(argc, argv, WINDOW_OPTION, DEFAULT_WINDOW);
+    if (window < 1 || window > MAX_WINDOW) {
+        printf("[%s] %s\n", WARNING_FLAGS, _CONVERT_WINDOW_FAIL);
+        window = DEFAULT_WINDOW;
+    }
 
-    if (is_ok && WSInitialize()) {
+    if (is_ok && HasOption(argc, argv, LOAD_OPTION)) {
+        LOAD_CONFIG load;
+        if (!ExtractLoadOptions(argc, argv, &load))
+            printf("[%s] %s\n", WARNING_FLAGS, _CONVERT_LOAD_OPTIONS_FAIL);
+        load.window = window;
+        load.segment_size = proposed_segment_size;
+        load.is_legacy = HasOption(argc, argv, LEGACY_OPTION);
+        if (WSInitialize()) {
+            RunLoad(CreateSocketAddress(server_ip, server_port), &load);
+            WSCleanup();
+        }
+    }
+    else if (is_ok && WSInitialize()) {
         SOCKET socket = CreateSocket(TCP);
         if (socket != INVALID_SOCKET) {
             SetReceiveTimeout(socket, RECEIVE_TIMEOUT_INTERVAL);
@@ -33,22 +57,34 @@ int main(int argc, char* argv[])
                     try_establish = 0;
                     printf("[%s] Ready to communicate...\n", INFO_FLAGS);
                     char request[USER_INPUT_MAX_SIZE];
+                    BUFFER response_buffer = { NULL, 0 }; // reused by every response
+                    FRAMING framing = { APPLICATION_BUFF_MAX_SIZE, 0 };
+                    if (!HasOption(argc, argv, LEGACY_OPTION))
+                        NegotiateSegmentation(socket, proposed_segment_size, &response_buffer, &framing);
+                    printf("[%s] Segmentation size: %d bytes%s\n", INFO_FLAGS, framing.segment_size, framing.is_extended ? "" : " (legacy headers)");
 
                     // Handle Request
-                    while (socket != INVALID_SOCKET) {
+                    if (batch_path != NULL) {
+                        if (RunBatch(socket, batch_path, window, &response_buffer, &framing) == -1) {
+                            CloseSocket(socket, CLOSE_SAFELY);
+                            socket = INVALID_SOCKET;
+                        }
+                    }
+                    while (batch_path == NULL && socket != INVALID_SOCKET) {
                         printf("[%s] Enter your request (number string): ", USER_INPUT_FLAGS);
                         gets_s(request, USER_INPUT_MAX_SIZE);
                         if (strlen(request) == 0)
                             break;
-                        int status = SegmentationSend(socket, request, strlen(request) + 1, NULL);
+                        int status = SegmentationSend(socket, request, strlen(request) + 1, NULL, &framing);
                         if (status == 1) {
-                            HandleResponse(socket);
+                            HandleResponse(socket, &response_buffer, &framing);
                         }
                         else if (status == -1) {
                             CloseSocket(socket, CLOSE_SAFELY);
                             socket = INVALID_SOCKET;
                         }
                     }
+                    DestroyBuffer(&response_buffer);
                 }
                 // Handle establish fail
                 else {
@@ -69,69 +105,10 @@ int main(int argc, char* argv[])
     printf("[%s] Stopping...\n", INFO_FLAGS);
     return 0;
 }
+#endif
 
 #pragma region Socket Common
 
-int WSInitialize()
-{
-    WORD version = MAKEWORD(2, 2);
-    WSADATA wsa_data;
-    if (WSAStartup(version, &wsa_data)) {
-        printf("[%s] %s\n", ERROR_FLAGS, _INITIALIZE_FAIL);
-        WSACleanup();
-        return 0;
-    }
-    return 1;
-}
-
-int WSCleanup()
-{
-    return WSACleanup();
-}
-
-ADDRESS CreateSocketAddress(IP ip, int port)
-{
-    ADDRESS addr;
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port);
-    addr.sin_addr = ip;
-    return addr;
-}
-
-SOCKET CreateSocket(int protocol)
-{
-    SOCKET s = INVALID_SOCKET;
-    if (protocol == UDP) {
-        s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    }
-    else if (protocol == TCP) {
-        s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    }
-
-    if (s == INVALID_SOCKET) {
-        printf("[%s] %s\n", ERROR_FLAGS, _CREATE_SOCKET_FAIL);
-    }
-    return s;
-}
-
-int CloseSocket(SOCKET socket, int mode, int flags)
-{
-    if (socket == INVALID_SOCKET)
-        return 1;
-    int is_ok = 1;
-    if (mode == CLOSE_SAFELY) {
-        if (shutdown(socket, flags) == SOCKET_ERROR) {
-            is_ok = 0;
-            printf("[%s:%d] %s\n", WARNING_FLAGS, WSAGetLastError(), _SHUTDOWN_SOCKET_FAIL);
-        }
-    }
-    if (closesocket(socket) == SOCKET_ERROR) {
-        is_ok = 0;
-        printf("[%s:%d] %s\n", WARNING_FLAGS, WSAGetLastError(), _CLOSE_SOCKET_FAIL);
-    }
-    return is_ok;
-}
-
 int EstablishConnection(SOCKET socket, ADDRESS address)
 {
     int ret = connect(socket, (SOCKADDR*)&address, sizeof(address));
@@ -158,198 +135,477 @@ int EstablishConnection(SOCKET socket, ADDRESS address)
 }
 #pragma endregion
 
-#pragma region Send and Receive
+#pragma region Handle Response
 
-int WriteSocketBuffer(SOCKET sender, int bytes, const char* message)
+int HandleResponse(SOCKET socket, BUFFER* buffer, const FRAMING* framing)
 {
-    int ret = send(sender, message, bytes, 0);
-    if (ret == SOCKET_ERROR) {
-        int err = WSAGetLastError();
-        if (err == WSAEHOSTUNREACH) {
-            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _HOST_UNREACHABLE);
-        }
-        else if (err == WSAECONNABORTED || err == WSAECONNRESET) {
-            printf("[%s:%d] %s\n", ERROR_FLAGS, err, _CONNECTION_DROP);
-        }
-        else {
-            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _SEND_FAIL);
-        }
-        return -1;
-    }
-    else if (ret < bytes) {
-        printf("[%s] %s\n", WARNING_FLAGS, _SEND_NOT_ALL);
-        return 0;
+    MESSAGE response = NULL;
+
+    if (MergeSegmentationMessage(socket, buffer, &response, framing) == 1) {
+        PrintResponse(response, NULL);
+        return 1;
     }
-    return 1;
+    return 0;
 }
 
-int SegmentationSend(SOCKET sender, const char* message, int message_len, int* obyte_sent)
+int PrintResponse(const MESSAGE message, const char* title)
 {
-    int start_byte = 0; // start byte in message.
-    unsigned short bsend = 0; // number of bytes will send, not include header size.
-    unsigned short bremain = 0; // number of bytes remain.
-
-    char content[APPLICATION_BUFF_MAX_SIZE];
-    while (start_byte < message_len) {
-        // Prepare content for sending: header (number of bytes send | number of bytes remain) + body (a part of message)
-        bsend = message_len - start_byte;
-        if (bsend + SEGMENTATION_HEADER_SIZE > APPLICATION_BUFF_MAX_SIZE) {
-            bsend = APPLICATION_BUFF_MAX_SIZE - SEGMENTATION_HEADER_SIZE;
+    int has_next = 0;
+    if (strlen(message) == 0) {
+    }
+    if (message[0] == STATUS_ERROR_CHAR) {
+        printf("\t%s\n", message + 1);
+    }
+    else if (message[0] == STATUS_OK_CHAR || message[0] == STATUS_OK_END_CHAR) {
+        if (title != NULL) {
+            printf("%s\n", title);
         }
-        bremain = message_len - start_byte - bsend;
-
-        int bsend_bigendian = htons(bsend); // uniform with many architectures.
-        int bremain_bigendian = htons(bremain);
+        printf("\t%s\n", message + 1);
+        has_next = (message[0] == STATUS_OK_CHAR);
+    }
+    return has_next;
+}
 
-        memcpy_s(content, SEGMENTATION_HEADER_CURRENT_SIZE, &bsend_bigendian, SEGMENTATION_HEADER_CURRENT_SIZE);
-        memcpy_s(content + SEGMENTATION_HEADER_CURRENT_SIZE, SEGMENTATION_HEADER_REMAIN_SIZE, &bremain_bigendian, SEGMENTATION_HEADER_REMAIN_SIZE);
-        memcpy_s(content + SEGMENTATION_HEADER_SIZE, bsend, message + start_byte, bsend);
-        int ret = WriteSocketBuffer(sender, bsend + SEGMENTATION_HEADER_SIZE, content);
-        if (ret == 1) {
-            start_byte += bsend;
+int MergeSegmentationMessage(SOCKET socket, BUFFER* buffer, MESSAGE* omessage, const FRAMING* framing)
+{
+    int segment_size = framing != NULL ? framing->segment_size : APPLICATION_BUFF_MAX_SIZE;
+    char header[SEGMENTATION_EXTENDED_HEADER_SIZE];
+    int mlen, start_byte = 0;
+    long long remain;
+    int status = 1;
+    *omessage = NULL;
+    while (1) {
+        status = ReadSegmentationHeader(socket, segment_size, header, &mlen, &remain);
+        if (status <= 0)
+            return status;
+        if (remain > INT_MAX - start_byte - mlen) {
+            printf("[%s] %s\n", WARNING_FLAGS, _MESSAGE_EXTREME_LARGE);
+            return -1;
         }
-        else {
-            if (obyte_sent != NULL)
-                *obyte_sent = start_byte;
-            return ret;
+        // grow with the bytes really received, "remain" is not trusted for allocation
+        if (!ReserveBuffer(buffer, start_byte + mlen))
+            return 0;
+        // read the body straight to its place in the merged message
+        if (mlen > 0) {
+            status = ReadSocketBuffer(socket, mlen, buffer->data + start_byte);
+            if (status != 1)
+                return status;
         }
+        start_byte += mlen;
+        if (remain <= 0)
+            break;
     }
-    if (obyte_sent != NULL)
-        *obyte_sent = start_byte;
+    *omessage = buffer->data;
     return 1;
 }
 
-int ReadSocketBuffer(SOCKET receiver, int length, char** ostream_byte)
+int RunBatch(SOCKET socket, const char* path, int window, BUFFER* buffer, const FRAMING* framing)
 {
-    if (length > APPLICATION_BUFF_MAX_SIZE)
-    {
-        printf("[%s] %s\n", WARNING_FLAGS, _TOO_MUCH_BYTES);
-        length = APPLICATION_BUFF_MAX_SIZE;
+    FILE* file = NULL;
+    if (fopen_s(&file, path, "r") != 0 || file == NULL) {
+        printf("[%s] %s\n", WARNING_FLAGS, _OPEN_FILE_FAIL);
+        return 0;
     }
-    char buffer[APPLICATION_BUFF_MAX_SIZE];
-
-    int ret = recv(receiver, buffer, length, 0);
-    if (ret == SOCKET_ERROR) {
-        int err = WSAGetLastError();
-        if (err == WSAECONNABORTED || err == WSAECONNRESET) {
-            printf("[%s:%d] %s\n", ERROR_FLAGS, err, _CONNECTION_DROP);
+    BUFFER line = { NULL, 0 }; // reused by every line
+    int length, in_flight = 0, sent = 0;
+    int status = 1;
+    auto start = std::chrono::steady_clock::now();
+    while (status == 1) {
+        int ret = ReadLine(file, &line, &length);
+        if (ret != 1) {
+            status = ret == 0 ? 1 : 0;
+            break;
         }
-        else {
-            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _RECEIVE_FAIL);
+        if (length == 0)
+            continue;
+        // the line is sent with its '\0', as an interactive request
+        ret = SegmentationSend(socket, line.data, length + 1, NULL, framing);
+        if (ret == -1)
+            status = -1;
+        else if (ret == 1) {
+            sent++;
+            in_flight++;
+        }
+        // keep at most <window> requests in flight
+        if (status == 1 && in_flight == window) {
+            if (HandleResponse(socket, buffer, framing) != 1)
+                status = -1;
+            in_flight--;
         }
-        return -1;
     }
-    else if (ret == 0) {
-        return -1;
+    while (status != -1 && in_flight > 0) {
+        if (HandleResponse(socket, buffer, framing) != 1)
+            status = -1;
+        in_flight--;
     }
-    else if (ret < length) {
-        printf("[%s] %s\n", WARNING_FLAGS, _RECEIVE_UNEXPECTED_MESSAGE);
-        *ostream_byte = NULL;
-        return 0;
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    printf("[%s] %d requests in %.3f seconds (%.0f requests/s)\n", INFO_FLAGS, sent, seconds, seconds > 0 ? sent / seconds : 0);
+    DestroyBuffer(&line);
+    fclose(file);
+    return status;
+}
+
+int ReadLine(FILE* file, BUFFER* buffer, int* olength)
+{
+    int length = 0;
+    *olength = 0;
+    while (1) {
+        if (!ReserveBuffer(buffer, length + APPLICATION_BUFF_MAX_SIZE))
+            return -1;
+        if (fgets(buffer->data + length, buffer->capacity - length, file) == NULL)
+            break;
+        length += (int)strlen(buffer->data + length);
+        if (length > 0 && buffer->data[length - 1] == '\n')
+            break;
     }
-    else {
-        *ostream_byte = Clone(buffer, length);
+    if (length == 0)
+        return 0;
+    while (length > 0 && (buffer->data[length - 1] == '\n' || buffer->data[length - 1] == '\r'))
+        length--;
+    buffer->data[length] = '\0';
+    *olength = length;
+    return 1;
+}
+
+int NegotiateSegmentation(SOCKET socket, int size, BUFFER* buffer, FRAMING* oframing)
+{
+    oframing->segment_size = APPLICATION_BUFF_MAX_SIZE;
+    oframing->is_extended = 0;
+    char hello[USER_INPUT_MAX_SIZE];
+    sprintf_s(hello, USER_INPUT_MAX_SIZE, "%s%d", HELLO_MESSAGE, size);
+    if (SegmentationSend(socket, hello, (int)strlen(hello) + 1, NULL) != 1)
+        return 0;
+
+    // a server that does not support the hello rejects it as an invalid request
+    MESSAGE response;
+    if (MergeSegmentationMessage(socket, buffer, &response) != 1 || response[0] != STATUS_OK_END_CHAR)
+        return 0;
+    int agreed = atoi(response + 1);
+    if (agreed < APPLICATION_BUFF_MAX_SIZE || agreed > size)
+        return 0;
+    oframing->segment_size = agreed;
+    oframing->is_extended = 1;
+    return 1;
+}
+
+int ReserveBuffer(BUFFER* buffer, int size)
+{
+    if (size <= buffer->capacity)
+        return 1;
+    int capacity = buffer->capacity > 0 ? buffer->capacity : APPLICATION_BUFF_MAX_SIZE;
+    while (capacity < size)
+        capacity *= 2;
+    char* data = (char*)realloc(buffer->data, capacity);
+    if (data == NULL) {
+        printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+        return 0;
     }
+    buffer->data = data;
+    buffer->capacity = capacity;
     return 1;
 }
 
-int SegmentationReceive(SOCKET receiver, char** ostream_byte, int* ostream_len, int* oremain)
+void DestroyBuffer(BUFFER* buffer)
+{
+    free(buffer->data);
+    buffer->data = NULL;
+    buffer->capacity = 0;
+}
+
+#pragma endregion
+
+#pragma region Load Generator
+
+int RunLoad(ADDRESS server, const LOAD_CONFIG* config)
 {
-    *ostream_byte = NULL;
-    char* read;
-    int remain;
-    int current;
-    // read number of bytes remain | number of bytes current
-    int ret = ReadSocketBuffer(receiver, SEGMENTATION_HEADER_SIZE, &read);
-    if (ret == 1) {
-        current = ntohs(*(unsigned short*)read);
-        remain = ntohs(*(unsigned short*)(read + SEGMENTATION_HEADER_CURRENT_SIZE));
-
-        *ostream_len = current;
-        *oremain = remain;
-        free(read);
+    // prepare the requests, shared by every thread
+    CORPUS corpus = { NULL, NULL, 0 };
+    char* digits = NULL;
+    int* digit_sums = NULL;
+    if (config->corpus_path != NULL) {
+        if (!LoadCorpus(config->corpus_path, &corpus))
+            return 0;
     }
     else {
-        *ostream_len = 0;
-        *oremain = 0;
-        return ret;
+        digits = (char*)malloc(config->max_size);
+        digit_sums = (int*)malloc((config->max_size + 1) * sizeof(int));
+        if (digits == NULL || digit_sums == NULL) {
+            printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+            free(digits);
+            free(digit_sums);
+            return 0;
+        }
+        unsigned int seed = 2463534242u;
+        digit_sums[0] = 0;
+        for (int i = 0; i < config->max_size; i++) {
+            digits[i] = '0' + NextRandom(&seed) % 10;
+            digit_sums[i + 1] = digit_sums[i] + digits[i] - '0';
+        }
     }
 
-    // read message content
-    ret = ReadSocketBuffer(receiver, current, &read);
-    if (ret == 1) {
-        *ostream_byte = Clone(read, current);
-        free(read);
+    LOAD_WORKER* workers = (LOAD_WORKER*)calloc(config->threads, sizeof(LOAD_WORKER));
+    if (workers == NULL) {
+        printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+        DestroyCorpus(&corpus);
+        free(digits);
+        free(digit_sums);
+        return 0;
     }
-    else {
-        *ostream_len = 0;
-        *oremain = 0;
-        return ret;
+    printf("[%s] Load: %d connections, %d threads, %d requests per connection, window %d\n", INFO_FLAGS,
+        config->connections, config->threads, config->requests, config->window);
+    std::thread* threads = new std::thread[config->threads];
+    long long start = GetTimestamp();
+    for (int i = 0; i < config->threads; i++) {
+        LOAD_WORKER* worker = &workers[i];
+        worker->config = config;
+        worker->server = server;
+        // spread the connections, the first threads take the rest
+        worker->connections = config->connections / config->threads + (i < config->connections % config->threads);
+        worker->corpus = corpus.count > 0 ? &corpus : NULL;
+        worker->digits = digits;
+        worker->digit_sums = digit_sums;
+        worker->seed = 2654435761u * (i + 1);
+        worker->next_line = i;
+        threads[i] = std::thread(RunLoadWorker, worker);
+    }
+
+    // merge the results
+    HISTOGRAM* latency = (HISTOGRAM*)calloc(1, sizeof(HISTOGRAM));
+    long long requests = 0, bytes = 0, rejected = 0, mismatches = 0, errors = 0;
+    for (int i = 0; i < config->threads; i++) {
+        threads[i].join();
+        if (latency != NULL)
+            MergeHistogram(latency, &workers[i].latency);
+        requests += workers[i].requests;
+        bytes += workers[i].bytes;
+        rejected += workers[i].rejected;
+        mismatches += workers[i].mismatches;
+        errors += workers[i].errors;
     }
+    double seconds = (GetTimestamp() - start) / 1e9;
+    printf("[%s] %lld requests in %.3f seconds: %.0f requests/s, %.2f MB/s\n", INFO_FLAGS,
+        requests, seconds, requests / seconds, bytes / seconds / (1024 * 1024));
+    if (latency != NULL) {
+        printf("[%s] Latency (us): p50 %.1f, p99 %.1f, p999 %.1f, max %.1f\n", INFO_FLAGS,
+            GetHistogramPercentile(latency, 50) / 1e3, GetHistogramPercentile(latency, 99) / 1e3,
+            GetHistogramPercentile(latency, 99.9) / 1e3, latency->max.load() / 1e3);
+    }
+    printf("[%s] Rejected: %lld, Mismatched: %lld, Lost: %lld\n", INFO_FLAGS, rejected, mismatches, errors);
+
+    free(latency);
+    delete[] threads;
+    free(workers);
+    DestroyCorpus(&corpus);
+    free(digits);
+    free(digit_sums);
     return 1;
 }
 
-#pragma endregion
-
-#pragma region Handle Response
-
-int HandleResponse(SOCKET socket)
+void RunLoadWorker(LOAD_WORKER* worker)
 {
-    MESSAGE response = NULL;
+    const LOAD_CONFIG* config = worker->config;
+    LOAD_CONNECTION* connections = (LOAD_CONNECTION*)calloc(worker->connections, sizeof(LOAD_CONNECTION));
+    if (connections == NULL) {
+        printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+        worker->errors += (long long)worker->connections * config->requests;
+        return;
+    }
+    for (int i = 0; i < worker->connections; i++) {
+        LOAD_CONNECTION* connection = &connections[i];
+        connection->framing.segment_size = APPLICATION_BUFF_MAX_SIZE;
+        connection->socket = CreateSocket(TCP);
+        if (connection->socket == INVALID_SOCKET) {
+            worker->errors += config->requests;
+            continue;
+        }
+        SetReceiveTimeout(connection->socket, RECEIVE_TIMEOUT_INTERVAL);
+        if (!EstablishConnection(connection->socket, worker->server)) {
+            CloseLoadConnection(worker, connection);
+            continue;
+        }
+        if (!config->is_legacy)
+            NegotiateSegmentation(connection->socket, config->segment_size, &connection->response, &connection->framing);
+    }
 
-    if (MergeSegmentationMessage(socket, &response)) {
-        PrintResponse(response, NULL);
-        DestroyMessage(response);
-        return 1;
+    int active = 1;
+    while (active) {
+        // fill the window of every connection, then receive one response from each
+        for (int i = 0; i < worker->connections; i++) {
+            LOAD_CONNECTION* connection = &connections[i];
+            while (connection->socket != INVALID_SOCKET && connection->in_flight < config->window && connection->sent < config->requests) {
+                if (SendLoadRequest(worker, connection) != 1)
+                    CloseLoadConnection(worker, connection);
+            }
+        }
+        active = 0;
+        for (int i = 0; i < worker->connections; i++) {
+            LOAD_CONNECTION* connection = &connections[i];
+            if (connection->socket == INVALID_SOCKET)
+                continue;
+            if (connection->in_flight > 0 && ReceiveLoadResponse(worker, connection) != 1)
+                CloseLoadConnection(worker, connection);
+            else if (connection->received + connection->skipped == config->requests)
+                CloseLoadConnection(worker, connection);
+            else
+                active = 1;
+        }
     }
-    return 0;
+    free(connections);
 }
 
-int PrintResponse(const MESSAGE message, const char* title)
+int SendLoadRequest(LOAD_WORKER* worker, LOAD_CONNECTION* connection)
 {
-    int has_next = 0;
-    if (strlen(message) == 0) {
+    const LOAD_CONFIG* config = worker->config;
+    const char* request;
+    int request_len;
+    int expected = -1;
+    if (worker->corpus != NULL) {
+        int line = worker->next_line++ % worker->corpus->count;
+        request = worker->corpus->lines[line];
+        request_len = worker->corpus->lengths[line] + 1; // with its '\0', as an interactive request
     }
-    if (message[0] == STATUS_ERROR_CHAR) {
-        printf("\t%s\n", message + 1);
+    else {
+        // a random view on the digits, its sum is known
+        int size = config->min_size + NextRandom(&worker->seed) % (config->max_size - config->min_size + 1);
+        int offset = NextRandom(&worker->seed) % (config->max_size - size + 1);
+        request = worker->digits + offset;
+        request_len = size;
+        expected = worker->digit_sums[offset + size] - worker->digit_sums[offset];
     }
-    else if (message[0] == STATUS_OK_CHAR || message[0] == STATUS_OK_END_CHAR) {
-        if (title != NULL) {
-            printf("%s\n", title);
-        }
-        printf("\t%s\n", message + 1);
-        has_next = (message[0] == STATUS_OK_CHAR);
+    int slot = (connection->first + connection->in_flight) % config->window;
+    connection->sent_at[slot] = GetTimestamp();
+    connection->expected[slot] = expected;
+    int ret = SegmentationSend(connection->socket, request, request_len, NULL, &connection->framing);
+    if (ret == -1)
+        return -1;
+    if (ret == 0) { // not sent, too large for legacy headers
+        connection->sent++;
+        connection->skipped++;
+        worker->errors++;
+        return 1;
     }
-    return has_next;
+    connection->in_flight++;
+    connection->sent++;
+    worker->bytes += request_len;
+    return 1;
 }
 
-int MergeSegmentationMessage(SOCKET socket, MESSAGE* omessage)
+int ReceiveLoadResponse(LOAD_WORKER* worker, LOAD_CONNECTION* connection)
 {
-    char* _message;
-    int mlen, remain, start_byte = 0;
-    int status = 1;
-    *omessage = NULL;
-    while (1) {
-        status = SegmentationReceive(socket, &_message, &mlen, &remain);
-        if (status != 1)
-            return status;
-        if (*omessage == NULL) {
-            *omessage = (MESSAGE)malloc((size_t)mlen + remain);
+    MESSAGE response;
+    if (MergeSegmentationMessage(connection->socket, &connection->response, &response, &connection->framing) != 1)
+        return -1;
+    int slot = connection->first;
+    RecordHistogram(&worker->latency, GetTimestamp() - connection->sent_at[slot]);
+    connection->first = (slot + 1) % worker->config->window;
+    connection->in_flight--;
+    connection->received++;
+    worker->requests++;
+    if (response[0] == STATUS_ERROR_CHAR)
+        worker->rejected++;
+    else if (connection->expected[slot] != -1 && (response[0] != STATUS_OK_END_CHAR || atoi(response + 1) != connection->expected[slot]))
+        worker->mismatches++;
+    return 1;
+}
+
+void CloseLoadConnection(LOAD_WORKER* worker, LOAD_CONNECTION* connection)
+{
+    worker->errors += worker->config->requests - connection->received - connection->skipped;
+    CloseSocket(connection->socket, CLOSE_SAFELY, SD_BOTH);
+    connection->socket = INVALID_SOCKET;
+    connection->in_flight = 0;
+    DestroyBuffer(&connection->response);
+}
+
+int LoadCorpus(const char* path, CORPUS* ocorpus)
+{
+    FILE* file = NULL;
+    if (fopen_s(&file, path, "r") != 0 || file == NULL) {
+        printf("[%s] %s\n", WARNING_FLAGS, _OPEN_FILE_FAIL);
+        return 0;
+    }
+    BUFFER line = { NULL, 0 };
+    int length, capacity = 0, ret;
+    ocorpus->lines = NULL;
+    ocorpus->lengths = NULL;
+    ocorpus->count = 0;
+    while ((ret = ReadLine(file, &line, &length)) == 1) {
+        if (length == 0)
+            continue;
+        if (ocorpus->count == capacity) {
+            capacity = capacity > 0 ? capacity * 2 : APPLICATION_BUFF_MAX_SIZE;
+            char** lines = (char**)realloc(ocorpus->lines, capacity * sizeof(char*));
+            if (lines != NULL)
+                ocorpus->lines = lines;
+            int* lengths = (int*)realloc(ocorpus->lengths, capacity * sizeof(int));
+            if (lengths != NULL)
+                ocorpus->lengths = lengths;
+            if (lines == NULL || lengths == NULL) {
+                printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+                ret = -1;
+                break;
+            }
         }
-        memcpy_s(*omessage + start_byte, mlen, _message, mlen);
-        start_byte += mlen;
-        free(_message);
-        if (remain <= 0)
+        char* clone = Clone(line.data, length + 1);
+        if (clone == NULL) {
+            ret = -1;
             break;
+        }
+        ocorpus->lines[ocorpus->count] = clone;
+        ocorpus->lengths[ocorpus->count] = length;
+        ocorpus->count++;
+    }
+    DestroyBuffer(&line);
+    fclose(file);
+    if (ret == -1 || ocorpus->count == 0) {
+        DestroyCorpus(ocorpus);
+        return 0;
     }
     return 1;
 }
 
-void DestroyMessage(MESSAGE m)
+void DestroyCorpus(CORPUS* corpus)
 {
-    free(m);
-    m = NULL;
+    for (int i = 0; i < corpus->count; i++)
+        free(corpus->lines[i]);
+    free(corpus->lines);
+    free(corpus->lengths);
+    corpus->lines = NULL;
+    corpus->lengths = NULL;
+    corpus->count = 0;
 }
+
+int ExtractLoadOptions(int argc, char* argv[], LOAD_CONFIG* oconfig)
+{
+    int is_ok = 1;
+    oconfig->connections = GetIntOption(argc, argv, CONNECTIONS_OPTION, 1);
+    if (oconfig->connections < 1 || oconfig->connections > MAX_LOAD_CONNECTIONS) {
+        oconfig->connections = 1;
+        is_ok = 0;
+    }
+    oconfig->threads = GetIntOption(argc, argv, THREADS_OPTION, 1);
+    if (oconfig->threads < 1 || oconfig->threads > MAX_LOAD_THREADS) {
+        oconfig->threads = 1;
+        is_ok = 0;
+    }
+    if (oconfig->threads > oconfig->connections)
+        oconfig->threads = oconfig->connections; // a thread has at least one connection
+    oconfig->requests = GetIntOption(argc, argv, REQUESTS_OPTION, DEFAULT_LOAD_REQUESTS);
+    if (oconfig->requests < 1) {
+        oconfig->requests = DEFAULT_LOAD_REQUESTS;
+        is_ok = 0;
+    }
+    oconfig->min_size = GetIntOption(argc, argv, MIN_SIZE_OPTION, DEFAULT_REQUEST_SIZE);
+    oconfig->max_size = GetIntOption(argc, argv, MAX_SIZE_OPTION, oconfig->min_size);
+    if (oconfig->min_size < 1 || oconfig->max_size > MAX_REQUEST_SIZE || oconfig->min_size > oconfig->max_size) {
+        oconfig->min_size = DEFAULT_REQUEST_SIZE;
+        oconfig->max_size = DEFAULT_REQUEST_SIZE;
+        is_ok = 0;
+    }
+    oconfig->corpus_path = GetStringOption(argc, argv, CORPUS_OPTION);
+    return is_ok;
+}
+
 #pragma endregion
 
 #pragma region Utilities
@@ -370,32 +626,5 @@ int ExtractCommand(int argc, char* argv[], int* oport, IP* oip)
     return is_ok;
 }
 
-int SetReceiveTimeout(SOCKET socket, int interval)
-{
-    int _interval = interval;
-    int ret = setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, (const char*)&_interval, sizeof(_interval));
-    if (ret == SOCKET_ERROR) {
-        printf("[%s:%d] %s\n", WARNING_FLAGS, WSAGetLastError(), _SET_TIMEOUT_FAIL);
-        return 0;
-    }
-    return 1;
-}
-
-int TryParseIPString(const char* str, IP* oip)
-{
-    return inet_pton(AF_INET, str, oip) == 1;
-}
-
-char* Clone(const char* source, int length, int start)
-{
-    char* _clone = (char*)malloc(length + start);
-
-    if (_clone == NULL)
-        printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
-    else
-        memcpy_s(_clone + start, length, source, length);
-    return _clone;
-}
-
 #pragma endregion
 
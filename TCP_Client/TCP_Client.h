@@ -1,65 +1,119 @@
 #pragma once
-#pragma comment(lib, "Ws2_32.lib")
 
 #pragma region Header Declarations
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 
-#include <WinSock2.h>
-#include <WS2tcpip.h>
+#include <chrono>
+#include <thread>
 
-#include "CommonDefinitions.h"
+#include "Network.h"
 #pragma endregion
 
 #pragma region Constants Definitions
 
-#define SEGMENTATION_HEADER_REMAIN_SIZE 2
-#define SEGMENTATION_HEADER_CURRENT_SIZE 2
-#define SEGMENTATION_HEADER_SIZE 4
+
+#define HELLO_MESSAGE "#HELLO " // first request to ask for larger segmentations: "#HELLO <size>"
+
+#define SEGMENTATION_SIZE_OPTION "--segment-size"
+#define LEGACY_OPTION "--legacy" // do not say hello, use legacy headers only
+#define BATCH_OPTION "--batch" // send every line of a file as a request: --batch <path>
+#define WINDOW_OPTION "--window" // number of requests in flight in batch mode
+
+#define DEFAULT_WINDOW 16
+#define MAX_WINDOW 1024 // the responses in flight must fit the socket buffers, the client does not read while sending
+
+#define LOAD_OPTION "--load" // non-interactive load generator (See: RunLoad)
+#define CONNECTIONS_OPTION "--connections"
+#define THREADS_OPTION "--threads"
+#define REQUESTS_OPTION "--requests" // number of requests per connection
+#define CORPUS_OPTION "--corpus" // replay the lines of a file instead of synthetic requests: --corpus <path>
+#define MIN_SIZE_OPTION "--min-size" // size of synthetic requests, uniform in [min, max]
+#define MAX_SIZE_OPTION "--max-size"
+
+#define DEFAULT_LOAD_REQUESTS 10000
+#define DEFAULT_REQUEST_SIZE 100
+#define MAX_LOAD_THREADS 64
+#define MAX_LOAD_CONNECTIONS 4096
+#define MAX_REQUEST_SIZE (16 * 1024 * 1024)
 
 #pragma endregion
 
-#pragma region Function Declarations
+#pragma region Type Definitions
 
 /// <summary>
-/// Initialize Winsock 2.2
+/// A growable buffer owned by caller, reused between calls to avoid allocations
 /// </summary>
-/// <returns>1 if initialize successfully, 0 otherwise</returns>
-int WSInitialize();
+typedef struct {
+    char* data;
+    int capacity;
+} BUFFER;
 
 /// <summary>
-/// Clean up Winsock 2.2
+/// The lines of a file replayed by the load generator
 /// </summary>
-/// <returns>1 if close successfully, 0 otherwise</returns>
-int WSCleanup();
+typedef struct {
+    char** lines; // each line is terminated by '\0'
+    int* lengths;
+    int count;
+} CORPUS;
 
 /// <summary>
-/// Create a TCP/UDP Socket.
+/// Options of the load generator, extracted from command-line arguments
 /// </summary>
-/// <param name="protocol">TCP or UDP</param>
-/// <returns>
-/// Created TCP/UDP Socket.
-/// INVALID_SOCKET if protocol is unexpected or have error on Winsock
-/// </returns>
-SOCKET CreateSocket(int protocol);
+typedef struct {
+    int connections;
+    int threads;
+    int requests; // number of requests per connection
+    int window; // number of requests in flight on each connection
+    int segment_size; // proposed segmentation size
+    int is_legacy; // 1 for not saying hello
+    int min_size; // size of synthetic requests
+    int max_size;
+    const char* corpus_path; // NULL for synthetic requests
+} LOAD_CONFIG;
 
 /// <summary>
-/// Close a created Socket
+/// A connection of the load generator, with the requests in flight
 /// </summary>
-/// <param name="socket">The socket want to close</param>
-/// <param name="mode">CLOSE_NORMAL or CLOSE_SAFELY (Shutdown before close)</param>
-/// <param name="flags">Specify how to close socket safely. Some flags: SD_RECEIVE, SD_SEND, SD_BOTH (Manifest constants for shutdown()). This param is not used with CLOSE_NORMAL </param>
-/// <returns>1 if close successfully, 0 otherwise</returns>
-int CloseSocket(SOCKET socket, int mode, int flags = 0);
+typedef struct {
+    SOCKET socket;
+    FRAMING framing;
+    BUFFER response;
+    long long sent_at[MAX_WINDOW]; // send times of the requests in flight, in nanoseconds (circular, from first)
+    int expected[MAX_WINDOW]; // expected sums of the requests in flight, -1 if unknown
+    int first; // position of the oldest request in flight
+    int in_flight;
+    int sent;
+    int received;
+    int skipped; // number of requests not sent (See: SegmentationSend)
+} LOAD_CONNECTION;
 
 /// <summary>
-/// Create a socket address that used IPv4 and Port Number
+/// A thread of the load generator. The results are merged by the main thread after it finishes.
 /// </summary>
-/// <param name="ip">The IPv4 Address</param>
-/// <param name="port">The Port number</param>
-/// <returns>Created socket address</returns>
-ADDRESS CreateSocketAddress(IP ip, int port);
+typedef struct {
+    const LOAD_CONFIG* config;
+    ADDRESS server;
+    int connections; // number of connections opened by this thread
+    const CORPUS* corpus; // NULL for synthetic requests
+    const char* digits; // synthetic requests are views on it
+    const int* digit_sums; // digit_sums[i] is the sum of the first i digits
+    unsigned int seed;
+    int next_line; // next line of corpus
+    HISTOGRAM latency; // in nanoseconds
+    long long requests; // number of responses received
+    long long bytes; // number of request bytes sent
+    long long rejected; // number of error responses
+    long long mismatches; // number of responses differ from the expected sums
+    long long errors; // number of requests not sent, or lost by connection errors
+} LOAD_WORKER;
+
+#pragma endregion
+
+#pragma region Function Declarations
 
 /// <summary>
 /// Establish a connection to a specified socket address
@@ -70,109 +124,154 @@ ADDRESS CreateSocketAddress(IP ip, int port);
 int EstablishConnection(SOCKET socket, ADDRESS address);
 
 /// <summary>
-/// Write a byte stream to the connected socket buffer, to send
+/// Handle the response from remote process: Collect message segmentations, Merge them and Print to console
 /// </summary>
-/// <param name="sender">The connected socket that is used for send message</param>
-/// <param name="bytes">Number of bytes expected to send</param>
-/// <param name="message">The bytes tream want to send</param>
-/// <returns>1 if success. 0 if number of bytes sent less than expected. -1 if have errors that the socket should be closed</returns>
-int WriteSocketBuffer(SOCKET sender, int bytes, const char* message);
+/// <param name="socket">The connected socket used to communicate with remote process</param>
+/// <param name="buffer">The buffer reused to hold the merged responses</param>
+/// <param name="framing">The agreed framing. NULL for APPLICATION_BUFF_MAX_SIZE</param>
+/// <returns>1 if success. 0 if has error when receive responses and merge messages inside them.</returns>
+int HandleResponse(SOCKET socket, BUFFER* buffer, const FRAMING* framing = NULL);
 
 /// <summary>
-/// Segmentation a message into pieces and Send them with a connected socket.
-/// Each piece attached with the header consists of SEGMENTATION_HEADER_CURRENT_SIZE first bytes
-/// is the length of message in the piece (not include header size) and SEGMENTATION_HEADER_REMAIN_SIZE next bytes
-/// is the number of bytes on message that has not been sent.
+/// Extract infomation in Message object and Print the message to console.
 /// </summary>
-/// <param name="sender">The connected socket used for sending</param>
-/// <param name="message">The message want to segmentation and send</param>
-/// <param name="message_len">The length of the message</param>
-/// <param name="obyte_sent">[Output] The bytes sent successfully</param>
-/// <returns>1 if success. 0 if number of bytes sent less than expected. -1 if have errors that the socket should be closed</returns>
-int SegmentationSend(SOCKET sender, const char* message, int message_len, int* obyte_sent);
+/// <param name="message">The response Message object</param>
+/// <param name="title">The title for message, which is shown previous. NULL for not use</param>
+/// <returns>1 if has another response after this message, 0 otherwise</returns>
+int PrintResponse(const MESSAGE message, const char* title = NULL);
 
 /// <summary>
-/// Read a bytes stream from a connected socket 
+/// Merge many segmentation responses in a connected socket into a buffer owned by caller.
+/// Each body is read straight to its place in the buffer.
+/// The buffer grows geometrically with the bytes received (the "remain" in headers is not trusted for allocation),
+/// and only when the message is larger than all previous ones, so no memory is allocated in steady state.
 /// </summary>
-/// <param name="receiver">The connected socket that is used for receiving bytes stream</param>
-/// <param name="bytes">Number of bytes want to read</param>
-/// <param name="omessage">[Output] The byte streams read</param>
-/// <returns>1 if read successfully. 0 if cant read completely. -1 if have errors that the socket should be closed</returns>
-int ReadSocketBuffer(SOCKET receiver, int bytes, char** omessage);
+/// <param name="socket">The connected socket used to receive segmentation</param>
+/// <param name="buffer">The buffer holds the merged message</param>
+/// <param name="omessage">[Output] The merged message, a view on buffer</param>
+/// <param name="framing">The agreed framing. NULL for APPLICATION_BUFF_MAX_SIZE</param>
+/// <returns>1 if read successfully. 0 if cant read message completely. -1 if have errors that the socket should be closed</returns>
+int MergeSegmentationMessage(SOCKET socket, BUFFER* buffer, MESSAGE* omessage, const FRAMING* framing = NULL);
 
 /// <summary>
-/// Read and extract message from a byte stream.
+/// Send every non-empty line of a file as a request, with up to <window> requests in flight (pipelining).
+/// The server responds in the order of the requests, so the responses are printed in the order of the lines.
 /// </summary>
-/// <param name="receiver">The connected socket that is used for receiving byte streams</param>
-/// <param name="omessage">[Output] The extracted message, after removing SEGMENTATION_HEADER_SIZE first bytes from byte stream</param>
-/// <param name="omessage_len">[Output] The message size, in bytes</param>
-/// <param name="oremain">[Output] Number of bytes in root message that have not been received</param>
-/// <returns>1 if read successfully. 0 if cant read completely. -1 if have errors that the socket should be closed</returns>
-int SegmentationReceive(SOCKET receiver, char** omessage, int* omessage_len, int* oremain);
+/// <param name="socket">The connected socket used to communicate with remote process</param>
+/// <param name="path">The path of the file</param>
+/// <param name="window">Maximum number of requests sent but not responded</param>
+/// <param name="buffer">The buffer reused to hold the merged responses</param>
+/// <param name="framing">The agreed framing. NULL for APPLICATION_BUFF_MAX_SIZE</param>
+/// <returns>1 if every line is processed. 0 if fail to open or read the file. -1 if have errors that the socket should be closed</returns>
+int RunBatch(SOCKET socket, const char* path, int window, BUFFER* buffer, const FRAMING* framing = NULL);
 
 /// <summary>
-/// Handle the response from remote process: Collect message segmentations, Merge them and Print to console
+/// Run the load generator: open C connections from T threads, keep <window> requests in flight on each connection,
+/// then report requests/s, MB/s and latency percentiles. The requests are the lines of a corpus,
+/// or synthetic digit strings of size uniform in [min_size, max_size] and checked against their expected sums.
 /// </summary>
-/// <param name="socket">The connected socket used to communicate with remote process</param>
-/// <returns>1 if success. 0 if has error when receive responses and merge messages inside them.</returns>
-int HandleResponse(SOCKET socket);
+/// <param name="server">The address of the server</param>
+/// <param name="config">The options (See: ExtractLoadOptions)</param>
+/// <returns>1 if the load runs. 0 if fail to prepare the requests or the threads</returns>
+int RunLoad(ADDRESS server, const LOAD_CONFIG* config);
 
 /// <summary>
-/// Extract infomation in Message object and Print the message to console.
+/// Body of a load generator thread: connect, send and receive until every connection has its requests responded
 /// </summary>
-/// <param name="message">The response Message object</param>
-/// <param name="title">The title for message, which is shown previous. NULL for not use</param>
-/// <returns>1 if has another response after this message, 0 otherwise</returns>
-int PrintResponse(const MESSAGE message, const char* title = NULL);
+/// <param name="worker">The thread state, holds the results</param>
+void RunLoadWorker(LOAD_WORKER* worker);
 
 /// <summary>
-/// Merge many segmentation responses in a connected socket.
+/// Send the next request on a connection of the load generator, and remember its send time
 /// </summary>
-/// <param name="socket">The connected socket used to receive segmentation</param>
-/// <param name="omessage">[Output] The merged message</param>
-/// <returns>1 if read successfully. 0 if cant read message completely. -1 if have errors that the socket should be closed</returns>
-int MergeSegmentationMessage(SOCKET socket, MESSAGE* omessage);
+/// <param name="worker">The thread owns the connection</param>
+/// <param name="connection">The connection, with less than <window> requests in flight</param>
+/// <returns>1 if send successfully. -1 if have errors that the connection should be closed</returns>
+int SendLoadRequest(LOAD_WORKER* worker, LOAD_CONNECTION* connection);
 
 /// <summary>
-/// Extract port number and ipv4 string from command-line arguments.
-/// If has error, set oport = 0 and oip = NULL.
+/// Receive the response of the oldest request in flight on a connection of the load generator, and record its latency
+/// </summary>
+/// <param name="worker">The thread owns the connection</param>
+/// <param name="connection">The connection, with requests in flight</param>
+/// <returns>1 if receive successfully. -1 if have errors that the connection should be closed</returns>
+int ReceiveLoadResponse(LOAD_WORKER* worker, LOAD_CONNECTION* connection);
+
+/// <summary>
+/// Close a connection of the load generator. Its requests not responded are counted as errors.
+/// </summary>
+/// <param name="worker">The thread owns the connection</param>
+/// <param name="connection">The connection</param>
+void CloseLoadConnection(LOAD_WORKER* worker, LOAD_CONNECTION* connection);
+
+/// <summary>
+/// Read the non-empty lines of a file into a corpus
+/// </summary>
+/// <param name="path">The path of the file</param>
+/// <param name="ocorpus">[Output] The corpus</param>
+/// <returns>1 if the file has at least one line. 0 if fail to open or read the file</returns>
+int LoadCorpus(const char* path, CORPUS* ocorpus);
+
+/// <summary>
+/// Free memory of a corpus
+/// </summary>
+/// <param name="corpus">The corpus</param>
+void DestroyCorpus(CORPUS* corpus);
+
+/// <summary>
+/// Extract the options of the load generator from command-line arguments.
+/// The window, segmentation size and legacy options are not extracted, they are shared with other modes.
 /// </summary>
 /// <param name="argc">Number of Arguments [From main()]</param>
 /// <param name="argv">Arguments value [From main()]</param>
-/// <param name="oport">[Output] The extracted port number</param>
-/// <param name="oip">[Output] The extracted ip address</param>
-/// <returns>1 if extract successfully. 0 otherwise, has error</returns>
-int ExtractCommand(int argc, char* argv[], int* oport, IP* oip);
+/// <param name="oconfig">[Output] The options. Invalid values are replaced by default values</param>
+/// <returns>1 if every option is valid. 0 otherwise</returns>
+int ExtractLoadOptions(int argc, char* argv[], LOAD_CONFIG* oconfig);
 
 /// <summary>
-/// Try parse a string to a IPv4 Address
+/// Read a line of a file into a buffer owned by caller, without the line terminator ("\n" or "\r\n").
+/// The buffer grows to hold lines of any length.
 /// </summary>
-/// <param name="str">The string want to parse</param>
-/// <param name="oip">[Output] The result IPv4 Address</param>
-/// <returns>1 if parse successfully. 0 otherwise</returns>
-int TryParseIPString(const char* str, IP* oip);
+/// <param name="file">The file</param>
+/// <param name="buffer">The buffer holds the line, terminated by '\0'</param>
+/// <param name="olength">[Output] Length of the line</param>
+/// <returns>1 if a line is read. 0 if the end of file is reached. -1 if fail to allocate memory</returns>
+int ReadLine(FILE* file, BUFFER* buffer, int* olength);
 
 /// <summary>
-/// Set receive timeout interval for socket.
+/// Say hello to the server ("#HELLO <size>", See: HELLO_MESSAGE) to ask for a larger segmentation size and extended headers.
+/// A server that does not support it rejects the hello as an invalid request, then legacy headers and APPLICATION_BUFF_MAX_SIZE are used.
 /// </summary>
-/// <param name="socket">The socket want to set timeout</param>
-/// <param name="interval">The timeout interval</param>
-/// <returns>1 if set successfully, 0 otherwise</returns>
-int SetReceiveTimeout(SOCKET socket, int interval);
+/// <param name="socket">The connected socket, before any other request</param>
+/// <param name="size">The requested segmentation size</param>
+/// <param name="buffer">The buffer used to receive the response</param>
+/// <param name="oframing">[Output] The agreed framing</param>
+/// <returns>1 if the server accepts the hello. 0 otherwise, legacy framing is used</returns>
+int NegotiateSegmentation(SOCKET socket, int size, BUFFER* buffer, FRAMING* oframing);
 
 /// <summary>
-/// Create a new memory space and Copy <length> bytes from <root> to it.
+/// Make sure a buffer can hold at least <size> bytes. The capacity is doubled until it is large enough.
 /// </summary>
-/// <param name="source">The source bytes</param>
-/// <param name="length">Number of bytes want to copy</param>
-/// <param name="start">The first byte in destination will hold the 0th byte of source</param>
-/// <returns>New memory space contains content of source. NULL if fail to allocate memory</returns>
-char* Clone(const char* source, int length, int start = 0);
+/// <param name="buffer">The buffer want to reserve</param>
+/// <param name="size">The required size, in bytes</param>
+/// <returns>1 if the buffer is large enough. 0 if fail to allocate memory</returns>
+int ReserveBuffer(BUFFER* buffer, int size);
 
 /// <summary>
-/// Free memory for Message object
+/// Free memory of a buffer
 /// </summary>
-/// <param name="m">The message want to free</param>
-void DestroyMessage(MESSAGE m);
+/// <param name="buffer">The buffer want to free</param>
+void DestroyBuffer(BUFFER* buffer);
+
+/// <summary>
+/// Extract port number and ipv4 string from command-line arguments.
+/// If has error, set oport = 0 and oip = NULL.
+/// </summary>
+/// <param name="argc">Number of Arguments [From main()]</param>
+/// <param name="argv">Arguments value [From main()]</param>
+/// <param name="oport">[Output] The extracted port number</param>
+/// <param name="oip">[Output] The extracted ip address</param>
+/// <returns>1 if extract successfully. 0 otherwise, has error</returns>
+int ExtractCommand(int argc, char* argv[], int* oport, IP* oip);
 
 #pragma endregion
\ No newline at end of file
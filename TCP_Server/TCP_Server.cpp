@@ -1,292 +1,1586 @@
 #include "TCP_Server.h"
 
+#ifndef TCP_SERVER_LIBRARY // defined when the tests link the server functions
 int main(int argc, char* argv[])
 {
 	int running_port;
+	SERVER_CONFIG config;
 	ExtractCommand(argc, argv, &running_port);
+	ExtractOptions(argc, argv, &config);
 
+	StartLogging();
 	if (WSInitialize()) {
-		SOCKET listener = CreateSocket(TCP);
-		ADDRESS socket_address = CreateSocketAddress(CreateDefaultIP(), running_port);
+		if (config.stats_port > 0) {
+			EnableStats();
+			std::thread(RunStatsServer, config.stats_port).detach();
+		}
+		SOCKET listener = CreateListener(running_port, config.workers > 1);
 		if (listener != INVALID_SOCKET) {
-			if (BindSocket(listener, socket_address)) {
-				if (ListenConnections(listener)) {
-					printf("[%s] Listenning at port %d...\n", INFO_FLAGS, running_port);
-					while (1) {
-						SOCKET connector = GetConnectionSocket(listener);
-						while (connector != INVALID_SOCKET) {
-							// communicate
-							int status = HandleRequest(connector);
-							if (status == -1) {
-								CloseSocket(connector, CLOSE_SAFELY);
-								connector = INVALID_SOCKET;
-							}
+			printf("[%s] Listenning at port %d...\n", INFO_FLAGS, running_port);
+			if (HasOption(argc, argv, BLOCKING_OPTION)) {
+				while (1) {
+					SOCKET connector = GetConnectionSocket(listener);
+					// one client at a time: a silent client is dropped after the idle timeout
+					if (connector != INVALID_SOCKET && config.idle_timeout > 0)
+						SetReceiveTimeout(connector, config.idle_timeout);
+					int can_negotiate = 1; // only the first request of the connection can be a hello
+					while (connector != INVALID_SOCKET) {
+						// communicate
+						int status = HandleRequest(connector, &can_negotiate, &config);
+						if (status == -1) {
+							CloseSocket(connector, CLOSE_SAFELY);
+							connector = INVALID_SOCKET;
 						}
 					}
 				}
 			}
+			else if (config.workers > 1) {
+				RunWorkers(listener, running_port, &config);
+			}
+			else {
+				RunServerLoop(listener, &config);
+			}
 		}
 		CloseSocket(listener, CLOSE_SAFELY);
 		WSCleanup();
 	}
+	StopLogging();
 	printf("[%s] Stopping...\n", INFO_FLAGS);
 	return 0;
 }
+#endif
+
+#pragma region Socket Common
+
+int ListenConnections(SOCKET socket, int connection_numbers)
+{
+	int ret = listen(socket, connection_numbers);
+	if (ret == SOCKET_ERROR) {
+		int err = WSAGetLastError();
+		if (err == WSAEINVAL) {
+			LogMessage(ERROR_FLAGS, err, _NOT_BOUND_SOCKET);
+		}
+		else if (err == WSAEMFILE) {
+			LogMessage(ERROR_FLAGS, err, _REACH_SOCKETS_LIMIT);
+		}
+		else {
+			LogMessage(ERROR_FLAGS, err, _LISTEN_SOCKET_FAIL);
+		}
+		return 0;
+	}
+	return 1;
+}
+
+SOCKET CreateListener(int port, int reuse_port)
+{
+	SOCKET listener = CreateSocket(TCP);
+	if (listener == INVALID_SOCKET)
+		return INVALID_SOCKET;
+	if (reuse_port)
+		SetReusePort(listener);
+	ADDRESS socket_address = CreateSocketAddress(CreateDefaultIP(), port);
+	if (!BindSocket(listener, socket_address) || !ListenConnections(listener)) {
+		CloseSocket(listener, CLOSE_NORMAL);
+		return INVALID_SOCKET;
+	}
+	return listener;
+}
+
+SOCKET GetConnectionSocket(SOCKET listener, ADDRESS* osender_address)
+{
+	socklen_t sender_addr_len = sizeof(SOCKADDR_IN);
+	socklen_t* addr_len = osender_address == NULL ? NULL : &sender_addr_len;
+	long long start = StartTimer();
+	IncreaseCounter(&GetThreadStats()->system_calls);
+	SOCKET result = accept(listener, (SOCKADDR*)osender_address, addr_len);
+	if (result != INVALID_SOCKET)
+		StopTimer(STATS_ACCEPT, start);
+	if (result == INVALID_SOCKET) {
+		int err = WSAGetLastError();
+		if (err == WSAEWOULDBLOCK) {
+			// non-blocking listener has no pending connection
+		}
+		else if (err == WSAEINVAL) {
+			LogMessage(WARNING_FLAGS, err, _NOT_LISTEN_SOCKET);
+		}
+		else {
+			LogMessage(WARNING_FLAGS, err, _ACCEPT_SOCKET_FAIL);
+		}
+	}
+	return result;
+}
+
+int SetNonBlocking(SOCKET socket)
+{
+	u_long mode = 1;
+	if (ioctlsocket(socket, FIONBIO, &mode) == SOCKET_ERROR) {
+		LogMessage(WARNING_FLAGS, WSAGetLastError(), _SET_NON_BLOCKING_FAIL);
+		return 0;
+	}
+	return 1;
+}
+
+#pragma endregion
+
+#pragma region Send and Receive
+
+int ReadAvailable(SOCKET receiver, char* buffer, int length)
+{
+	IncreaseCounter(&GetThreadStats()->system_calls);
+	int ret = recv(receiver, buffer, length, 0);
+	if (ret == SOCKET_ERROR) {
+		int err = WSAGetLastError();
+		if (err == WSAEWOULDBLOCK) {
+			return 0;
+		}
+		else if (err == WSAECONNABORTED || err == WSAECONNRESET) {
+			LogMessage(ERROR_FLAGS, err, _CONNECTION_DROP);
+		}
+		else {
+			LogMessage(WARNING_FLAGS, err, _RECEIVE_FAIL);
+		}
+		return -1;
+	}
+	else if (ret == 0) { // remote process closed the connection
+		return -1;
+	}
+	return ret;
+}
+
+int WriteAvailable(SOCKET sender, const char* buffer, int length)
+{
+	IncreaseCounter(&GetThreadStats()->system_calls);
+	int ret = send(sender, buffer, length, 0);
+	if (ret == SOCKET_ERROR) {
+		int err = WSAGetLastError();
+		if (err == WSAEWOULDBLOCK) {
+			return 0;
+		}
+		else if (err == WSAEHOSTUNREACH) {
+			LogMessage(WARNING_FLAGS, err, _HOST_UNREACHABLE);
+		}
+		else if (err == WSAECONNABORTED || err == WSAECONNRESET) {
+			LogMessage(ERROR_FLAGS, err, _CONNECTION_DROP);
+		}
+		else {
+			LogMessage(WARNING_FLAGS, err, _SEND_FAIL);
+		}
+		return -1;
+	}
+	return ret;
+}
+
+int EncodeSegmentation(char* obuffer, int buffer_size, const char* message, int message_len, int segment_size)
+{
+	int start_byte = 0; // start byte in message.
+	int written = 0; // number of bytes written to buffer.
+	do {
+		int bsend = message_len - start_byte;
+		if (bsend + SEGMENTATION_HEADER_SIZE > segment_size) {
+			bsend = segment_size - SEGMENTATION_HEADER_SIZE;
+		}
+		if (message_len - start_byte - bsend > SEGMENTATION_LEGACY_REMAIN_MAX) // the extended header is larger
+			bsend = segment_size - SEGMENTATION_EXTENDED_HEADER_SIZE;
+		long long bremain = message_len - start_byte - bsend;
+		int header_size = bremain > SEGMENTATION_LEGACY_REMAIN_MAX ? SEGMENTATION_EXTENDED_HEADER_SIZE : SEGMENTATION_HEADER_SIZE;
+		if (written + header_size + bsend > buffer_size)
+			return -1;
+
+		written += EncodeSegmentationHeader(obuffer + written, bsend, bremain);
+		memcpy_s(obuffer + written, bsend, message + start_byte, bsend);
+		written += bsend;
+		start_byte += bsend;
+	} while (start_byte < message_len);
+	return written;
+}
+
+#pragma endregion
+
+#pragma region Ring Buffer
+
+int InitializeRing(RING_BUFFER* ring, int size)
+{
+	ring->data = (char*)malloc(size);
+	ring->size = ring->data == NULL ? 0 : size;
+	ring->head = 0;
+	ring->tail = 0;
+	if (ring->data == NULL) {
+		LogMessage(WARNING_FLAGS, 0, _ALLOCATE_MEMORY_FAIL);
+		return 0;
+	}
+	return 1;
+}
+
+int ResizeRing(RING_BUFFER* ring, int size)
+{
+	char* data = (char*)malloc(size);
+	if (data == NULL) {
+		LogMessage(WARNING_FLAGS, 0, _ALLOCATE_MEMORY_FAIL);
+		return 0;
+	}
+	int length = RingLength(ring);
+	RingPeek(ring, data, length);
+	free(ring->data);
+	ring->data = data;
+	ring->size = size;
+	ring->head = 0;
+	ring->tail = length;
+	return 1;
+}
+
+void DestroyRing(RING_BUFFER* ring)
+{
+	free(ring->data);
+	ring->data = NULL;
+	ring->size = 0;
+}
+
+int RingLength(const RING_BUFFER* ring)
+{
+	return (int)(ring->tail - ring->head);
+}
+
+int RingFree(const RING_BUFFER* ring)
+{
+	return ring->size - RingLength(ring);
+}
+
+char* RingWriteSpan(RING_BUFFER* ring, int* olength)
+{
+	unsigned int start = ring->tail & (ring->size - 1);
+	int contiguous = ring->size - start;
+	int free_bytes = RingFree(ring);
+	*olength = contiguous < free_bytes ? contiguous : free_bytes;
+	return ring->data + start;
+}
+
+const char* RingReadSpan(const RING_BUFFER* ring, int* olength)
+{
+	unsigned int start = ring->head & (ring->size - 1);
+	int contiguous = ring->size - start;
+	int length = RingLength(ring);
+	*olength = contiguous < length ? contiguous : length;
+	return ring->data + start;
+}
+
+void RingCommit(RING_BUFFER* ring, int length)
+{
+	ring->tail += length;
+}
+
+void RingConsume(RING_BUFFER* ring, int length)
+{
+	ring->head += length;
+}
+
+void RingPeek(const RING_BUFFER* ring, char* obuffer, int length)
+{
+	unsigned int start = ring->head & (ring->size - 1);
+	int first = ring->size - start;
+	if (first > length)
+		first = length;
+	memcpy_s(obuffer, length, ring->data + start, first);
+	memcpy_s(obuffer + first, length - first, ring->data, length - first);
+}
+
+int RingWrite(RING_BUFFER* ring, const char* source, int length)
+{
+	if (length > RingFree(ring))
+		return 0;
+	int written = 0;
+	while (written < length) {
+		int span;
+		char* destination = RingWriteSpan(ring, &span);
+		if (span > length - written)
+			span = length - written;
+		memcpy_s(destination, span, source + written, span);
+		RingCommit(ring, span);
+		written += span;
+	}
+	return 1;
+}
+
+#pragma endregion
+
+#pragma region Connection Limits
+
+static SERVER_LIMITS server_limits;
+
+int AdmitConnection(const SERVER_CONFIG* config)
+{
+	// counted first, so the workers accepting at the same time can't exceed the limit together
+	if (server_limits.connections.fetch_add(1, std::memory_order_relaxed) >= config->max_connections) {
+		server_limits.connections.fetch_sub(1, std::memory_order_relaxed);
+		server_limits.refused.fetch_add(1, std::memory_order_relaxed);
+		LogMessage(WARNING_FLAGS, 0, _REACH_SOCKETS_LIMIT);
+		return 0;
+	}
+	if (server_limits.memory.load(std::memory_order_relaxed) + 2 * RING_BUFFER_SIZE > config->server_memory) {
+		server_limits.connections.fetch_sub(1, std::memory_order_relaxed);
+		server_limits.over_memory.fetch_add(1, std::memory_order_relaxed);
+		LogMessage(WARNING_FLAGS, 0, _REACH_MEMORY_LIMIT);
+		return 0;
+	}
+	return 1;
+}
+
+int ReserveMemory(CONNECTION* connection, int bytes)
+{
+	const SERVER_CONFIG* config = connection->config;
+	if (connection->memory + bytes > config->connection_memory) {
+		server_limits.over_budget.fetch_add(1, std::memory_order_relaxed);
+		LogMessage(WARNING_FLAGS, 0, _REACH_MEMORY_LIMIT);
+		return 0;
+	}
+	if (server_limits.memory.fetch_add(bytes, std::memory_order_relaxed) + bytes > config->server_memory) {
+		server_limits.memory.fetch_sub(bytes, std::memory_order_relaxed);
+		server_limits.over_memory.fetch_add(1, std::memory_order_relaxed);
+		LogMessage(WARNING_FLAGS, 0, _REACH_MEMORY_LIMIT);
+		return 0;
+	}
+	connection->memory += bytes;
+	return 1;
+}
+
+void ReleaseMemory(CONNECTION* connection, int bytes)
+{
+	connection->memory -= bytes;
+	server_limits.memory.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+int GrowInput(CONNECTION* connection, int size)
+{
+	int growth = size - connection->input.size;
+	if (!ReserveMemory(connection, growth))
+		return 0;
+	if (!ResizeRing(&connection->input, size)) {
+		ReleaseMemory(connection, growth);
+		return 0;
+	}
+	return 1;
+}
+
+void UpdateDeadlines(CONNECTION* connection)
+{
+	long long now = GetTimestamp();
+	connection->last_active = now;
+	// a request is waiting for bytes: its body is partly received, or a header is partly received
+	// while the output buffer has space. A full output buffer is the client not reading, left to the idle deadline.
+	const REQUEST_STATE* request = &connection->request;
+	int is_waiting = request->body_left > 0 || request->remain > 0
+		|| (RingLength(&connection->input) > 0 && RingFree(&connection->output) >= RESPONSE_MAX_SIZE);
+	if (!is_waiting)
+		connection->request_started = 0;
+	else if (connection->request_started == 0)
+		connection->request_started = now;
+}
+
+int IsConnectionExpired(const CONNECTION* connection, long long now)
+{
+	const SERVER_CONFIG* config = connection->config;
+	if (config->read_timeout > 0 && connection->request_started != 0
+		&& now - connection->request_started > config->read_timeout * 1000000LL) {
+		server_limits.read_timeouts.fetch_add(1, std::memory_order_relaxed);
+		LogMessage(WARNING_FLAGS, 0, _REQUEST_TIMEOUT);
+		return 1;
+	}
+	if (config->idle_timeout > 0 && now - connection->last_active > config->idle_timeout * 1000000LL) {
+		server_limits.idle_timeouts.fetch_add(1, std::memory_order_relaxed);
+		LogMessage(WARNING_FLAGS, 0, _CONNECTION_TIMEOUT);
+		return 1;
+	}
+	return 0;
+}
+
+void PrintLimitCounters()
+{
+	printf("[%s] Limits: %d open, %lld KB of buffers, %lld refused, %lld over connection budget, %lld over server memory, %lld read timeouts, %lld idle timeouts\n",
+		INFO_FLAGS, server_limits.connections.load(std::memory_order_relaxed), server_limits.memory.load(std::memory_order_relaxed) / 1024,
+		server_limits.refused.load(std::memory_order_relaxed), server_limits.over_budget.load(std::memory_order_relaxed),
+		server_limits.over_memory.load(std::memory_order_relaxed), server_limits.read_timeouts.load(std::memory_order_relaxed),
+		server_limits.idle_timeouts.load(std::memory_order_relaxed));
+}
+
+#pragma endregion
+
+#pragma region Event Loop
+
+int RunServerLoop(SOCKET listener, const SERVER_CONFIG* config, WORKER* worker)
+{
+#ifdef SERVER_IO_URING
+	if (!config->is_poll) {
+		int ret = RunUringLoop(listener, config, worker);
+		if (ret != -1)
+			return ret;
+		LogMessage(WARNING_FLAGS, 0, _IO_URING_FAIL);
+	}
+#endif
+	return RunEventLoop(listener, config, worker);
+}
+
+#ifdef SERVER_EPOLL
+int RunEventLoop(SOCKET listener, const SERVER_CONFIG* config, WORKER* worker)
+{
+	if (!SetNonBlocking(listener))
+		return 0;
+	int epoll = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll == -1) {
+		LogMessage(ERROR_FLAGS, errno, _POLL_FAIL);
+		return 0;
+	}
+	struct epoll_event event;
+	event.events = EPOLLIN;
+	event.data.ptr = NULL; // the listener
+	int capacity = CONNECTIONS_INIT_CAPACITY;
+	int count = 0;
+	EPOLL_CONNECTION** connections = (EPOLL_CONNECTION**)malloc(sizeof(EPOLL_CONNECTION*) * capacity);
+	if (connections == NULL || epoll_ctl(epoll, EPOLL_CTL_ADD, listener, &event) == -1) {
+		LogMessage(ERROR_FLAGS, errno, connections == NULL ? _ALLOCATE_MEMORY_FAIL : _POLL_FAIL);
+		free(connections);
+		close(epoll);
+		return 0;
+	}
+	struct epoll_event events[EPOLL_MAX_EVENTS];
+	int has_deadlines = config->read_timeout > 0 || config->idle_timeout > 0;
+	long long next_check = 0;
+
+	while (1) {
+		int ready = epoll_wait(epoll, events, EPOLL_MAX_EVENTS, has_deadlines ? DEADLINE_CHECK_INTERVAL : -1);
+		IncreaseCounter(&GetThreadStats()->system_calls);
+		if (ready == -1) {
+			if (errno == EINTR)
+				continue;
+			LogMessage(ERROR_FLAGS, errno, _POLL_FAIL);
+			break;
+		}
+
+		// a connection is reported once by a call, so it is only destroyed while its own events are handled
+		int is_accepting = 0;
+		int is_listening = 1;
+		for (int i = 0; i < ready; i++) {
+			EPOLL_CONNECTION* connection = (EPOLL_CONNECTION*)events[i].data.ptr;
+			if (connection == NULL) {
+				is_accepting = (events[i].events & EPOLLIN) != 0;
+				is_listening = (events[i].events & EPOLLERR) == 0;
+				continue;
+			}
+			int status = 1;
+			if (events[i].events & EPOLLERR) {
+				status = -1;
+			}
+			else {
+				if (events[i].events & EPOLLOUT)
+					status = OnConnectionWritable(connection->state);
+				if (status != -1 && (events[i].events & (EPOLLIN | EPOLLHUP)))
+					status = OnConnectionReadable(connection->state);
+			}
+			if (status == -1 || !UpdateEpollEvents(epoll, connection))
+				DestroyEpollConnection(connections, &count, connection);
+		}
+		if (!is_listening) {
+			LogMessage(ERROR_FLAGS, 0, _NOT_LISTEN_SOCKET);
+			break;
+		}
+
+		// the connections without events are only visited to check their deadlines, a few times per second.
+		// Iterate backward: a destroyed connection is replaced by the last one, which has been checked.
+		long long now = has_deadlines ? GetTimestamp() : 0;
+		if (has_deadlines && now >= next_check) {
+			next_check = now + DEADLINE_CHECK_INTERVAL * 1000000LL;
+			for (int i = count - 1; i >= 0; i--) {
+				if (IsConnectionExpired(connections[i]->state, now))
+					DestroyEpollConnection(connections, &count, connections[i]);
+			}
+		}
+
+		// Accept all pending connections
+		SOCKET connector;
+		while (is_accepting && (connector = GetConnectionSocket(listener)) != INVALID_SOCKET) {
+			if (count == capacity) {
+				EPOLL_CONNECTION** _connections = (EPOLL_CONNECTION**)realloc(connections, sizeof(EPOLL_CONNECTION*) * capacity * 2);
+				if (_connections == NULL) {
+					LogMessage(WARNING_FLAGS, 0, _ALLOCATE_MEMORY_FAIL);
+					CloseSocket(connector, CLOSE_NORMAL);
+					break;
+				}
+				connections = _connections;
+				capacity *= 2;
+			}
+			CONNECTION* state = CreateConnection(connector, config, worker);
+			if (state == NULL) {
+				CloseSocket(connector, CLOSE_NORMAL);
+				continue;
+			}
+			EPOLL_CONNECTION* connection = (EPOLL_CONNECTION*)malloc(sizeof(EPOLL_CONNECTION));
+			event.events = EPOLLIN;
+			event.data.ptr = connection;
+			if (connection == NULL || epoll_ctl(epoll, EPOLL_CTL_ADD, connector, &event) == -1) {
+				LogMessage(WARNING_FLAGS, errno, connection == NULL ? _ALLOCATE_MEMORY_FAIL : _POLL_FAIL);
+				DestroyConnection(state);
+				free(connection);
+				continue;
+			}
+			if (worker != NULL)
+				worker->accepted.fetch_add(1, std::memory_order_relaxed);
+			connection->state = state;
+			connection->index = count;
+			connection->events = EPOLLIN;
+			connections[count++] = connection;
+		}
+	}
+
+	for (int i = 0; i < count; i++) {
+		DestroyConnection(connections[i]->state);
+		free(connections[i]);
+	}
+	free(connections);
+	close(epoll);
+	return 0;
+}
+
+int UpdateEpollEvents(int epoll, EPOLL_CONNECTION* connection)
+{
+	short wanted = GetConnectionEvents(connection->state);
+	struct epoll_event event;
+	event.events = 0;
+	if (wanted & POLLRDNORM)
+		event.events |= EPOLLIN;
+	if (wanted & POLLWRNORM)
+		event.events |= EPOLLOUT;
+	if (event.events == connection->events)
+		return 1; // most requests are answered at once, nothing to change
+	event.data.ptr = connection;
+	IncreaseCounter(&GetThreadStats()->system_calls);
+	if (epoll_ctl(epoll, EPOLL_CTL_MOD, connection->state->socket, &event) == -1) {
+		LogMessage(WARNING_FLAGS, errno, _POLL_FAIL);
+		return 0;
+	}
+	connection->events = event.events;
+	return 1;
+}
+
+void DestroyEpollConnection(EPOLL_CONNECTION** connections, int* count, EPOLL_CONNECTION* connection)
+{
+	WORKER* worker = connection->state->worker;
+	DestroyConnection(connection->state);
+	if (worker != NULL)
+		worker->closed.fetch_add(1, std::memory_order_relaxed);
+	(*count)--;
+	connections[connection->index] = connections[*count];
+	connections[connection->index]->index = connection->index;
+	free(connection);
+}
+#else
+int RunEventLoop(SOCKET listener, const SERVER_CONFIG* config, WORKER* worker)
+{
+	if (!SetNonBlocking(listener))
+		return 0;
+
+	int capacity = CONNECTIONS_INIT_CAPACITY;
+	int count = 1; // the listener is always at index 0
+	WSAPOLLFD* fds = (WSAPOLLFD*)malloc(sizeof(WSAPOLLFD) * capacity);
+	CONNECTION** connections = (CONNECTION**)malloc(sizeof(CONNECTION*) * capacity);
+	if (fds == NULL || connections == NULL) {
+		LogMessage(ERROR_FLAGS, 0, _ALLOCATE_MEMORY_FAIL);
+		free(fds);
+		free(connections);
+		return 0;
+	}
+	fds[0].fd = listener;
+	fds[0].events = POLLRDNORM;
+	connections[0] = NULL;
+	int has_deadlines = config->read_timeout > 0 || config->idle_timeout > 0;
+	long long next_check = 0;
+
+	while (1) {
+		int ready = WSAPoll(fds, count, has_deadlines ? DEADLINE_CHECK_INTERVAL : -1);
+		IncreaseCounter(&GetThreadStats()->system_calls);
+		if (ready == SOCKET_ERROR) {
+			LogMessage(ERROR_FLAGS, WSAGetLastError(), _POLL_FAIL);
+			break;
+		}
+		// the connections without events are only visited to check their deadlines, a few times per second
+		long long now = has_deadlines ? GetTimestamp() : 0;
+		int is_checking = has_deadlines && now >= next_check;
+		if (is_checking)
+			next_check = now + DEADLINE_CHECK_INTERVAL * 1000000LL;
+
+		// Iterate backward: a closed connection is replaced by the last one, which has been handled.
+		for (int i = count - 1; i >= 1; i--) {
+			if (fds[i].revents == 0 && !is_checking)
+				continue;
+			CONNECTION* connection = connections[i];
+			int status = 1;
+			if (fds[i].revents & (POLLERR | POLLNVAL)) {
+				status = -1;
+			}
+			else if (fds[i].revents != 0) {
+				if (fds[i].revents & POLLWRNORM)
+					status = OnConnectionWritable(connection);
+				if (status != -1 && (fds[i].revents & (POLLRDNORM | POLLHUP)))
+					status = OnConnectionReadable(connection);
+			}
+			// checked after the events too: a client trickling bytes is active, but its request is not received in time
+			if (status != -1 && is_checking && IsConnectionExpired(connection, now))
+				status = -1;
+
+			if (status == -1) {
+				DestroyConnection(connection);
+				if (worker != NULL)
+					worker->closed.fetch_add(1, std::memory_order_relaxed);
+				count--;
+				fds[i] = fds[count];
+				connections[i] = connections[count];
+			}
+			else {
+				fds[i].events = GetConnectionEvents(connection);
+			}
+		}
+
+		// Accept all pending connections
+		if (fds[0].revents & POLLRDNORM) {
+			SOCKET connector;
+			while ((connector = GetConnectionSocket(listener)) != INVALID_SOCKET) {
+				if (count == capacity) {
+					WSAPOLLFD* _fds = (WSAPOLLFD*)realloc(fds, sizeof(WSAPOLLFD) * capacity * 2);
+					if (_fds != NULL)
+						fds = _fds;
+					CONNECTION** _connections = (CONNECTION**)realloc(connections, sizeof(CONNECTION*) * capacity * 2);
+					if (_connections != NULL)
+						connections = _connections;
+					if (_fds == NULL || _connections == NULL) {
+						LogMessage(WARNING_FLAGS, 0, _ALLOCATE_MEMORY_FAIL);
+						CloseSocket(connector, CLOSE_NORMAL);
+						break;
+					}
+					capacity *= 2;
+				}
+				CONNECTION* connection = CreateConnection(connector, config, worker);
+				if (connection == NULL) {
+					CloseSocket(connector, CLOSE_NORMAL);
+					continue;
+				}
+				if (worker != NULL)
+					worker->accepted.fetch_add(1, std::memory_order_relaxed);
+				fds[count].fd = connector;
+				fds[count].events = POLLRDNORM;
+				fds[count].revents = 0;
+				connections[count] = connection;
+				count++;
+			}
+		}
+		else if (fds[0].revents & (POLLERR | POLLNVAL)) {
+			LogMessage(ERROR_FLAGS, 0, _NOT_LISTEN_SOCKET);
+			break;
+		}
+	}
+
+	for (int i = 1; i < count; i++)
+		DestroyConnection(connections[i]);
+	free(fds);
+	free(connections);
+	return 0;
+}
+#endif
+
+int RunWorkers(SOCKET listener, int port, const SERVER_CONFIG* config)
+{
+	int worker_numbers = config->workers;
+	WORKER* workers = new WORKER[worker_numbers];
+	std::thread* threads = new std::thread[worker_numbers];
+	int has_own_listeners = SetReusePort(listener); // already set before bind, only check the support here
+
+	int started = 0;
+	for (int i = 0; i < worker_numbers; i++) {
+		workers[i].id = i;
+		workers[i].accepted = 0;
+		workers[i].closed = 0;
+		workers[i].requests = 0;
+		// Without SO_REUSEPORT, workers compete for connections on the shared listener
+		workers[i].listener = (i == 0 || !has_own_listeners) ? listener : CreateListener(port, 1);
+		if (workers[i].listener == INVALID_SOCKET)
+			continue;
+		threads[i] = std::thread(RunServerLoop, workers[i].listener, config, &workers[i]);
+		started++;
+	}
+	printf("[%s] Started %d workers (%s)\n", INFO_FLAGS, started, has_own_listeners ? "SO_REUSEPORT listeners" : "shared listener");
+
+	long long last_accepted = -1;
+	while (started > 0) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(WORKER_STATS_INTERVAL));
+		long long accepted = 0;
+		for (int i = 0; i < worker_numbers; i++)
+			accepted += workers[i].accepted.load(std::memory_order_relaxed);
+		if (accepted != last_accepted) {
+			PrintWorkerCounters(workers, worker_numbers);
+			last_accepted = accepted;
+		}
+	}
+
+	delete[] threads;
+	delete[] workers;
+	return 0;
+}
+
+void PrintWorkerCounters(WORKER* workers, int worker_numbers)
+{
+	for (int i = 0; i < worker_numbers; i++) {
+		long long accepted = workers[i].accepted.load(std::memory_order_relaxed);
+		long long closed = workers[i].closed.load(std::memory_order_relaxed);
+		printf("[%s] Worker %d: %lld accepted, %lld open, %lld requests\n", INFO_FLAGS, workers[i].id,
+			accepted, accepted - closed, workers[i].requests.load(std::memory_order_relaxed));
+	}
+	PrintLimitCounters();
+}
+
+CONNECTION* CreateConnection(SOCKET socket, const SERVER_CONFIG* config, WORKER* worker)
+{
+	if (!AdmitConnection(config))
+		return NULL;
+	CONNECTION* connection = SetNonBlocking(socket) ? (CONNECTION*)malloc(sizeof(CONNECTION)) : NULL;
+	if (connection == NULL) {
+		server_limits.connections.fetch_sub(1, std::memory_order_relaxed);
+		return NULL; // the failure of SetNonBlocking is logged
+	}
+	if (!InitializeRing(&connection->input, RING_BUFFER_SIZE)) {
+		free(connection);
+		server_limits.connections.fetch_sub(1, std::memory_order_relaxed);
+		return NULL;
+	}
+	if (!InitializeRing(&connection->output, RING_BUFFER_SIZE)) {
+		DestroyRing(&connection->input);
+		free(connection);
+		server_limits.connections.fetch_sub(1, std::memory_order_relaxed);
+		return NULL;
+	}
+	// checked against server_memory by AdmitConnection, a small excess is possible while connections are accepted
+	connection->memory = connection->input.size + connection->output.size;
+	server_limits.memory.fetch_add(connection->memory, std::memory_order_relaxed);
+	connection->last_active = GetTimestamp();
+	connection->request_started = 0;
+	connection->socket = socket;
+	connection->config = config;
+	connection->worker = worker;
+	connection->segment_size = APPLICATION_BUFF_MAX_SIZE;
+	connection->can_negotiate = 1;
+	ResetRequest(&connection->request, config->is_bigint);
+	return connection;
+}
+
+void DestroyConnection(CONNECTION* connection)
+{
+	CloseSocket(connection->socket, CLOSE_SAFELY);
+	DestroyRing(&connection->input);
+	DestroyRing(&connection->output);
+	server_limits.memory.fetch_sub(connection->memory, std::memory_order_relaxed);
+	server_limits.connections.fetch_sub(1, std::memory_order_relaxed);
+	free(connection);
+}
+
+short GetConnectionEvents(const CONNECTION* connection)
+{
+	short events = 0;
+	if (RingFree(&connection->input) > 0)
+		events |= POLLRDNORM;
+	if (RingLength(&connection->output) > 0)
+		events |= POLLWRNORM;
+	return events;
+}
+
+int IsInputBlocked(const CONNECTION* connection)
+{
+	return RingFree(&connection->output) < RESPONSE_MAX_SIZE && RingLength(&connection->input) > 0;
+}
+
+int OnConnectionReadable(CONNECTION* connection)
+{
+	// read as many bytes as the input buffer can hold
+	while (RingFree(&connection->input) > 0) {
+		int span;
+		char* destination = RingWriteSpan(&connection->input, &span);
+		long long start = StartTimer();
+		int ret = ReadAvailable(connection->socket, destination, span);
+		if (ret == -1)
+			return -1;
+		StopTimer(STATS_RECEIVE, start);
+		RingCommit(&connection->input, ret);
+		STATS* stats = GetThreadStats();
+		IncreaseCounter(&stats->bytes_in, ret);
+		if (ret < span) {
+			IncreaseCounter(&stats->short_reads);
+			break;
+		}
+	}
+	if (ProcessInput(connection) == -1)
+		return -1;
+	return FlushOutput(connection);
+}
+
+int OnConnectionWritable(CONNECTION* connection)
+{
+	if (FlushOutput(connection) == -1)
+		return -1;
+	// the output queue has more space: continue with the requests waiting in input buffer
+	if (ProcessInput(connection) == -1)
+		return -1;
+	return FlushOutput(connection);
+}
+
+int ProcessInput(CONNECTION* connection)
+{
+	REQUEST_STATE* request = &connection->request;
+	char header[SEGMENTATION_EXTENDED_HEADER_SIZE];
+	while (1) {
+		if (request->body_left == 0) {
+			// header: legacy or extended (See: DecodeSegmentationHeader)
+			int header_size, current;
+			long long remain;
+			int length = RingLength(&connection->input);
+			int peek = length < SEGMENTATION_EXTENDED_HEADER_SIZE ? length : SEGMENTATION_EXTENDED_HEADER_SIZE;
+			RingPeek(&connection->input, header, peek);
+			int ret = DecodeSegmentationHeader(header, peek, &header_size, &current, &remain);
+			if (ret == -1)
+				return -1;
+			if (ret == 0)
+				break; // wait for the rest of the header
+			if (current + header_size > connection->segment_size) {
+				LogMessage(WARNING_FLAGS, 0, _TOO_MUCH_BYTES);
+				return -1;
+			}
+			if (remain == 0 && RingFree(&connection->output) < RESPONSE_MAX_SIZE)
+				break; // wait until the previous responses are sent
+			int is_hello = connection->can_negotiate && remain == 0;
+			if (is_hello && length < header_size + current)
+				break; // the first request may be a hello, it is handled as a whole
+			RingConsume(&connection->input, header_size);
+
+			int hello_len = (int)strlen(HELLO_MESSAGE);
+			int first_len;
+			const char* first = RingReadSpan(&connection->input, &first_len);
+			if (is_hello && first_len >= current && current > hello_len && memcmp(first, HELLO_MESSAGE, hello_len) == 0) {
+				// "#HELLO <size>": the client asks for larger segmentations
+				char size_str[INT_MAX_LEN + 1];
+				int size_len = current - hello_len < INT_MAX_LEN ? current - hello_len : INT_MAX_LEN;
+				memcpy_s(size_str, INT_MAX_LEN + 1, first + hello_len, size_len);
+				size_str[size_len] = '\0';
+				RingConsume(&connection->input, current);
+				connection->can_negotiate = 0;
+				if (!NegotiateSegmentation(connection, atoi(size_str)))
+					return -1;
+				continue;
+			}
+			BeginSegmentation(request, current, remain);
+		}
+
+		// body: fold the bytes received, they may wrap around the buffer end
+		while (request->body_left > 0) {
+			int span;
+			const char* data = RingReadSpan(&connection->input, &span);
+			if (span == 0)
+				break;
+			if (span > request->body_left)
+				span = request->body_left;
+			FoldSegmentation(request, data, span);
+			RingConsume(&connection->input, span);
+		}
+		if (request->body_left > 0)
+			break; // wait for the rest of the body
+
+		if (request->remain == 0) {
+			connection->can_negotiate = 0;
+			if (!QueueResponse(connection))
+				return -1;
+			ResetRequest(request, request->is_bigint);
+		}
+	}
+	UpdateDeadlines(connection);
+	return 1;
+}
+
+int FlushOutput(CONNECTION* connection)
+{
+	while (RingLength(&connection->output) > 0) {
+		int span;
+		const char* source = RingReadSpan(&connection->output, &span);
+		long long start = StartTimer();
+		int ret = WriteAvailable(connection->socket, source, span);
+		if (ret == -1)
+			return -1;
+		StopTimer(STATS_SEND, start);
+		IncreaseCounter(&GetThreadStats()->bytes_out, ret);
+		RingConsume(&connection->output, ret);
+		if (ret < span)
+			break; // socket buffer is full, continue when it is writable
+	}
+	return 1;
+}
+
+int NegotiateSegmentation(CONNECTION* connection, int size)
+{
+	if (size > connection->config->max_segment_size)
+		size = connection->config->max_segment_size;
+	if (size < APPLICATION_BUFF_MAX_SIZE)
+		size = APPLICATION_BUFF_MAX_SIZE;
+
+	// a full segmentation fits the input buffer, so it is read with few calls
+	int ring_size = connection->input.size;
+	while (ring_size < size)
+		ring_size *= 2;
+	if (ring_size != connection->input.size && !GrowInput(connection, ring_size))
+		size = APPLICATION_BUFF_MAX_SIZE;
+
+	// the response is smaller than the old size, the client switches after receiving it
+	char frame[RESPONSE_MAX_SIZE];
+	int ret = EncodeNumberFrame(frame, RESPONSE_MAX_SIZE, size);
+	if (ret == -1 || !RingWrite(&connection->output, frame, ret))
+		return 0;
+	connection->segment_size = size;
+	return 1;
+}
+
+int QueueResponse(CONNECTION* connection)
+{
+	int span;
+	char* destination = RingWriteSpan(&connection->output, &span);
+	int ret = EncodeResponse(&connection->request, destination, span);
+	if (ret != -1) {
+		RingCommit(&connection->output, ret);
+	}
+	else {
+		// the frame would wrap around the buffer end, it is encoded aside and copied in two parts
+		char frame[RESPONSE_MAX_SIZE];
+		ret = EncodeResponse(&connection->request, frame, RESPONSE_MAX_SIZE);
+		if (ret == -1 || !RingWrite(&connection->output, frame, ret)) {
+			LogMessage(WARNING_FLAGS, 0, _TOO_MUCH_BYTES);
+			return 0;
+		}
+	}
+	connection->request_started = 0; // the read deadline restarts with the next request
+	if (connection->worker != NULL)
+		connection->worker->requests.fetch_add(1, std::memory_order_relaxed);
+	STATS* stats = GetThreadStats();
+	IncreaseCounter(&stats->requests);
+	if (connection->request.is_error || connection->request.is_overflow)
+		IncreaseCounter(&stats->rejected);
+	return 1;
+}
+
+#pragma endregion
+
+#ifdef SERVER_IO_URING
+#pragma region io_uring Event Loop
+
+int RunUringLoop(SOCKET listener, const SERVER_CONFIG* config, WORKER* worker)
+{
+	URING ring;
+	if (!SetupUring(&ring))
+		return -1;
+	if (!PrepareUringAccept(&ring, listener)) {
+		DestroyUring(&ring);
+		return -1;
+	}
+
+	STATS* stats = GetThreadStats();
+	int has_deadlines = config->read_timeout > 0 || config->idle_timeout > 0;
+	long long next_check = 0;
+	while (1) {
+		// submit the operations prepared by the last completions, and wait for the next ones
+		int ret = SubmitUring(&ring, 1, has_deadlines ? DEADLINE_CHECK_INTERVAL : -1);
+		IncreaseCounter(&stats->system_calls);
+		if (ret == -1) {
+			LogMessage(ERROR_FLAGS, errno, _POLL_FAIL);
+			break;
+		}
+		long long now = has_deadlines ? GetTimestamp() : 0;
+		if (has_deadlines && now >= next_check) {
+			next_check = now + DEADLINE_CHECK_INTERVAL * 1000000LL;
+			URING_CONNECTION* connection = ring.connections;
+			while (connection != NULL) {
+				URING_CONNECTION* next = connection->next; // the connection may be freed
+				if (!connection->is_closing && IsConnectionExpired(connection->state, now))
+					CloseUringConnection(&ring, connection);
+				connection = next;
+			}
+		}
+
+		int status = 1;
+		unsigned int head = *ring.cq_head;
+		unsigned int tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail && status == 1; head++)
+			status = OnUringCompletion(&ring, &ring.cqes[head & ring.cq_mask], listener, config, worker);
+		__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+		if (status == -1) {
+			LogMessage(ERROR_FLAGS, 0, _NOT_LISTEN_SOCKET);
+			break;
+		}
+	}
+
+	// closing the io_uring cancels the operations in flight, so the connections can be destroyed
+	URING_CONNECTION* connection = ring.connections;
+	DestroyUring(&ring);
+	while (connection != NULL) {
+		URING_CONNECTION* next = connection->next;
+		DestroyConnection(connection->state);
+		free(connection);
+		connection = next;
+	}
+	return 0;
+}
+
+int SetupUring(URING* oring)
+{
+	memset(oring, 0, sizeof(URING));
+	oring->fd = -1;
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	// only the thread of the event loop submits, and completions are processed when it waits for them (Linux 6.1)
+	params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+	int fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+	if (fd < 0) {
+		memset(&params, 0, sizeof(params));
+		fd = (int)syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+	}
+	if (fd < 0)
+		return 0;
+	oring->fd = fd;
+	// the wait for completions has a timeout for the deadlines of connections (Linux 5.11)
+	if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_EXT_ARG)) {
+		DestroyUring(oring);
+		return 0;
+	}
+
+	// the submission and completion queues share one mapping
+	size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+	oring->sq_ring_size = sq_size > cq_size ? sq_size : cq_size;
+	void* sq_ring = mmap(NULL, oring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	oring->sq_ring = sq_ring == MAP_FAILED ? NULL : sq_ring;
+	oring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	void* sqes = mmap(NULL, oring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	oring->sqes = sqes == MAP_FAILED ? NULL : (struct io_uring_sqe*)sqes;
+	size_t buffers_size = URING_BUFFER_COUNT * sizeof(struct io_uring_buf);
+	void* buffers = mmap(NULL, buffers_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	oring->buffers = buffers == MAP_FAILED ? NULL : (struct io_uring_buf_ring*)buffers;
+	oring->buffer_data = (char*)malloc((size_t)URING_BUFFER_COUNT * URING_BUFFER_SIZE);
+	if (oring->sq_ring == NULL || oring->sqes == NULL || oring->buffers == NULL || oring->buffer_data == NULL) {
+		LogMessage(WARNING_FLAGS, 0, _ALLOCATE_MEMORY_FAIL);
+		DestroyUring(oring);
+		return 0;
+	}
+
+	char* ring = (char*)oring->sq_ring;
+	oring->sq_head = (unsigned int*)(ring + params.sq_off.head);
+	oring->sq_tail = (unsigned int*)(ring + params.sq_off.tail);
+	oring->sq_mask = *(unsigned int*)(ring + params.sq_off.ring_mask);
+	oring->sq_entries = params.sq_entries;
+	unsigned int* sq_array = (unsigned int*)(ring + params.sq_off.array);
+	for (unsigned int i = 0; i < params.sq_entries; i++)
+		sq_array[i] = i; // the entries are submitted in order
+	oring->cq_head = (unsigned int*)(ring + params.cq_off.head);
+	oring->cq_tail = (unsigned int*)(ring + params.cq_off.tail);
+	oring->cq_mask = *(unsigned int*)(ring + params.cq_off.ring_mask);
+	oring->cqes = (struct io_uring_cqe*)(ring + params.cq_off.cqes);
+
+	// provided buffers: the kernel picks one for each recv completion (Linux 6.0)
+	struct io_uring_buf_reg registration;
+	memset(&registration, 0, sizeof(registration));
+	registration.ring_addr = (unsigned long long)(uintptr_t)oring->buffers;
+	registration.ring_entries = URING_BUFFER_COUNT;
+	registration.bgid = URING_BUFFER_GROUP;
+	if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_PBUF_RING, &registration, 1) < 0) {
+		DestroyUring(oring);
+		return 0;
+	}
+	for (int i = 0; i < URING_BUFFER_COUNT; i++)
+		RecycleUringBuffer(oring, i);
+	return 1;
+}
 
-#pragma region Socket Common
-
-int WSInitialize()
+void DestroyUring(URING* ring)
 {
-    WORD version = MAKEWORD(2, 2);
-    WSADATA wsa_data;
-    if (WSAStartup(version, &wsa_data)) {
-        printf("[%s] %s\n", ERROR_FLAGS, _INITIALIZE_FAIL);
-        WSACleanup();
-        return 0;
-    }
-    return 1;
+	if (ring->fd >= 0)
+		close(ring->fd);
+	if (ring->sq_ring != NULL)
+		munmap(ring->sq_ring, ring->sq_ring_size);
+	if (ring->sqes != NULL)
+		munmap(ring->sqes, ring->sqes_size);
+	if (ring->buffers != NULL)
+		munmap(ring->buffers, URING_BUFFER_COUNT * sizeof(struct io_uring_buf));
+	free(ring->buffer_data);
+	memset(ring, 0, sizeof(URING));
+	ring->fd = -1;
 }
 
-int WSCleanup()
+struct io_uring_sqe* GetUringEntry(URING* ring)
 {
-    return WSACleanup();
+	unsigned int tail = *ring->sq_tail;
+	if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries) {
+		IncreaseCounter(&GetThreadStats()->system_calls);
+		if (SubmitUring(ring, 0) != 1 || tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >= ring->sq_entries)
+			return NULL;
+	}
+	struct io_uring_sqe* sqe = &ring->sqes[tail & ring->sq_mask];
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	// the kernel reads the entry when it is submitted, after the caller fills it
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring->sq_pending++;
+	return sqe;
 }
 
-ADDRESS CreateSocketAddress(IP ip, int port)
+int SubmitUring(URING* ring, int wait_numbers, int timeout)
 {
-    ADDRESS addr;
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port);
-    addr.sin_addr = ip;
-    return addr;
+	unsigned int flags = wait_numbers > 0 ? IORING_ENTER_GETEVENTS : 0;
+	struct __kernel_timespec interval;
+	struct io_uring_getevents_arg argument;
+	memset(&argument, 0, sizeof(argument));
+	if (wait_numbers > 0 && timeout >= 0) {
+		interval.tv_sec = timeout / 1000;
+		interval.tv_nsec = (timeout % 1000) * 1000000LL;
+		argument.ts = (unsigned long long)(uintptr_t)&interval;
+		flags |= IORING_ENTER_EXT_ARG;
+	}
+	int ret = (flags & IORING_ENTER_EXT_ARG)
+		? (int)syscall(__NR_io_uring_enter, ring->fd, ring->sq_pending, wait_numbers, flags, &argument, sizeof(argument))
+		: (int)syscall(__NR_io_uring_enter, ring->fd, ring->sq_pending, wait_numbers, flags, NULL, 0);
+	if (ret < 0)
+		return errno == EINTR || errno == EAGAIN || errno == EBUSY || errno == ETIME ? 0 : -1;
+	ring->sq_pending -= ret;
+	return 1;
 }
 
-SOCKET CreateSocket(int protocol)
+void RecycleUringBuffer(URING* ring, int id)
 {
-    SOCKET s = INVALID_SOCKET;
-    if (protocol == UDP) {
-        s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    }
-    else if (protocol == TCP) {
-        s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
-    }
+	// the ring is an array of io_uring_buf, whose first entry holds the tail (bufs has another offset in C++)
+	struct io_uring_buf* buffer = (struct io_uring_buf*)ring->buffers + (ring->buffer_tail & (URING_BUFFER_COUNT - 1));
+	buffer->addr = (unsigned long long)(uintptr_t)(ring->buffer_data + (size_t)id * URING_BUFFER_SIZE);
+	buffer->len = URING_BUFFER_SIZE;
+	buffer->bid = (unsigned short)id;
+	ring->buffer_tail++;
+	__atomic_store_n(&ring->buffers->tail, ring->buffer_tail, __ATOMIC_RELEASE);
+}
 
-    if (s == INVALID_SOCKET) {
-        printf("[%s] %s\n", ERROR_FLAGS, _CREATE_SOCKET_FAIL);
-    }
-    return s;
+int PrepareUringAccept(URING* ring, SOCKET listener)
+{
+	struct io_uring_sqe* sqe = GetUringEntry(ring);
+	if (sqe == NULL)
+		return 0;
+	sqe->opcode = IORING_OP_ACCEPT;
+	sqe->fd = listener;
+	sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+	sqe->user_data = URING_OP_ACCEPT;
+	return 1;
 }
 
-int CloseSocket(SOCKET socket, int mode, int flags)
+int PrepareUringReceive(URING* ring, URING_CONNECTION* connection)
 {
-    if (socket == INVALID_SOCKET)
-        return 1;
-    int is_ok = 1;
-    if (mode == CLOSE_SAFELY) {
-        if (shutdown(socket, flags) == SOCKET_ERROR) {
-            is_ok = 0;
-            printf("[%s:%d] %s\n", WARNING_FLAGS, WSAGetLastError(), _SHUTDOWN_SOCKET_FAIL);
-        }
-    }
-    if (closesocket(socket) == SOCKET_ERROR) {
-        is_ok = 0;
-        printf("[%s:%d] %s\n", WARNING_FLAGS, WSAGetLastError(), _CLOSE_SOCKET_FAIL);
-    }
-    return is_ok;
+	struct io_uring_sqe* sqe = GetUringEntry(ring);
+	if (sqe == NULL)
+		return 0;
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = connection->state->socket;
+	// a multishot recv takes the bytes as they come: it is armed while the responses are sent as fast,
+	// otherwise a buffer is received at a time, so the requests stop at the output space (See: UpdateUringReceive)
+	sqe->ioprio = RingLength(&connection->state->output) == 0 ? IORING_RECV_MULTISHOT : 0;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = URING_BUFFER_GROUP;
+	sqe->user_data = (unsigned long long)(uintptr_t)connection | URING_OP_RECEIVE;
+	connection->is_receiving = 1;
+	connection->is_paused = 0;
+	return 1;
 }
 
-int BindSocket(SOCKET socket, ADDRESS addr)
+int PrepareUringSend(URING* ring, URING_CONNECTION* connection)
 {
-	if (bind(socket, (SOCKADDR*)&addr, sizeof(addr)) == SOCKET_ERROR) {
-		int err = WSAGetLastError();
-		if (err == WSAEADDRINUSE) {
-			printf("[%s:%d] %s\"\n", ERROR_FLAGS, err, _ADDRESS_IN_USE);
-		}
-		else if (err == WSAEINVAL) {
-			printf("[%s:%d] %s\n", ERROR_FLAGS, err, _BOUNDED_SOCKET);
-		}
-		else {
-			printf("[%s:%d] %s\n", ERROR_FLAGS, err, _BIND_SOCKET_FAIL);
-		}
+	RING_BUFFER* output = &connection->state->output;
+	int length = RingLength(output);
+	if (connection->is_sending || length == 0)
+		return 1;
+	struct io_uring_sqe* sqe = GetUringEntry(ring);
+	if (sqe == NULL)
 		return 0;
-	}
+
+	// the responses are not copied, and new ones are only appended after them until the send completes
+	int span;
+	connection->spans[0].iov_base = (void*)RingReadSpan(output, &span);
+	connection->spans[0].iov_len = span;
+	connection->spans[1].iov_base = output->data;
+	connection->spans[1].iov_len = length - span;
+	memset(&connection->message, 0, sizeof(connection->message));
+	connection->message.msg_iov = connection->spans;
+	connection->message.msg_iovlen = span < length ? 2 : 1;
+
+	sqe->opcode = IORING_OP_SENDMSG;
+	sqe->fd = connection->state->socket;
+	sqe->addr = (unsigned long long)(uintptr_t)&connection->message;
+	sqe->len = 1;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = (unsigned long long)(uintptr_t)connection | URING_OP_SEND;
+	connection->is_sending = 1;
 	return 1;
 }
 
-int ListenConnections(SOCKET socket, int connection_numbers)
+int UpdateUringReceive(URING* ring, URING_CONNECTION* connection)
 {
-	int ret = listen(socket, connection_numbers);
-	if (ret == SOCKET_ERROR) {
-		int err = WSAGetLastError();
-		if (err == WSAEINVAL) {
-			printf("[%s:%d] %s\n", ERROR_FLAGS, err, _NOT_BOUND_SOCKET);
-		}
-		else if (err == WSAEMFILE) {
-			printf("[%s:%d] %s\n", ERROR_FLAGS, err, _REACH_SOCKETS_LIMIT);
-		}
-		else {
-			printf("[%s:%d] %s\n", ERROR_FLAGS, err, _LISTEN_SOCKET_FAIL);
-		}
+	if (!IsInputBlocked(connection->state) && connection->held_count == 0)
+		return connection->is_receiving ? 1 : PrepareUringReceive(ring, connection);
+	if (!connection->is_receiving || connection->is_paused)
+		return 1;
+	// the bytes received until the cancel completes are still appended
+	struct io_uring_sqe* sqe = GetUringEntry(ring);
+	if (sqe == NULL)
 		return 0;
-	}
+	sqe->opcode = IORING_OP_ASYNC_CANCEL;
+	sqe->addr = (unsigned long long)(uintptr_t)connection | URING_OP_RECEIVE;
+	sqe->user_data = URING_OP_CANCEL;
+	connection->is_paused = 1;
 	return 1;
 }
 
-SOCKET GetConnectionSocket(SOCKET listener, ADDRESS* osender_address)
+int AppendHeldBuffers(URING* ring, URING_CONNECTION* connection, int is_all)
 {
-	int sender_addr_len = sizeof(SOCKADDR_IN);
-	int* addr_len = osender_address == NULL ? NULL : &sender_addr_len;
-	SOCKET result = accept(listener, (SOCKADDR*)osender_address, addr_len);
-	if (result == INVALID_SOCKET) {
-		int err = WSAGetLastError();
-		if (err == WSAEINVAL) {
-			printf("[%s:%d] %s\n", WARNING_FLAGS, err, _NOT_LISTEN_SOCKET);
-		}
-		else {
-			printf("[%s:%d] %s\n", WARNING_FLAGS, err, _ACCEPT_SOCKET_FAIL);
-		}
+	int count = 0;
+	int status = 1;
+	while (count < connection->held_count && status == 1 && (is_all || !IsInputBlocked(connection->state))) {
+		int id = connection->held[count];
+		status = AppendInput(connection->state, ring->buffer_data + (size_t)id * URING_BUFFER_SIZE, connection->held_lengths[count]);
+		RecycleUringBuffer(ring, id);
+		count++;
 	}
-	return result;
+	connection->held_count -= count;
+	memmove(connection->held, connection->held + count, connection->held_count * sizeof(connection->held[0]));
+	memmove(connection->held_lengths, connection->held_lengths + count, connection->held_count * sizeof(connection->held_lengths[0]));
+	return status;
 }
 
-#pragma endregion
+int OnUringCompletion(URING* ring, const struct io_uring_cqe* cqe, SOCKET listener, const SERVER_CONFIG* config, WORKER* worker)
+{
+	int operation = (int)(cqe->user_data & URING_OP_MASK);
+	URING_CONNECTION* connection = (URING_CONNECTION*)(uintptr_t)(cqe->user_data & ~(unsigned long long)URING_OP_MASK);
+	int has_more = (cqe->flags & IORING_CQE_F_MORE) != 0;
+	STATS* stats = GetThreadStats();
 
-#pragma region Send and Receive
+	if (operation == URING_OP_CANCEL)
+		return 1;
 
-int WriteSocketBuffer(SOCKET sender, int bytes, const char* message)
-{
-	int ret = send(sender, message, bytes, 0);
-	if (ret == SOCKET_ERROR) {
-		int err = WSAGetLastError();
-		if (err == WSAEHOSTUNREACH) {
-			printf("[%s:%d] %s\n", WARNING_FLAGS, err, _HOST_UNREACHABLE);
-		}
-		else if (err == WSAECONNABORTED || err == WSAECONNRESET) {
-			printf("[%s:%d] %s\n", ERROR_FLAGS, err, _CONNECTION_DROP);
+	if (operation == URING_OP_ACCEPT) {
+		if (cqe->res >= 0) {
+			CONNECTION* state = CreateConnection(cqe->res, config, worker);
+			connection = state == NULL ? NULL : (URING_CONNECTION*)calloc(1, sizeof(URING_CONNECTION));
+			if (connection == NULL) {
+				if (state == NULL)
+					CloseSocket(cqe->res, CLOSE_NORMAL);
+				else {
+					LogMessage(WARNING_FLAGS, 0, _ALLOCATE_MEMORY_FAIL);
+					DestroyConnection(state);
+				}
+			}
+			else {
+				connection->state = state;
+				connection->next = ring->connections;
+				if (ring->connections != NULL)
+					ring->connections->previous = connection;
+				ring->connections = connection;
+				if (worker != NULL)
+					worker->accepted.fetch_add(1, std::memory_order_relaxed);
+				if (!PrepareUringReceive(ring, connection))
+					CloseUringConnection(ring, connection);
+			}
 		}
 		else {
-			printf("[%s:%d] %s\n", WARNING_FLAGS, err, _SEND_FAIL);
+			LogMessage(WARNING_FLAGS, -cqe->res, _ACCEPT_SOCKET_FAIL);
+			if (cqe->res == -EBADF || cqe->res == -ENOTSOCK || cqe->res == -EINVAL)
+				return -1;
 		}
-		return -1;
-	}
-	else if (ret < bytes) {
-		printf("[%s] %s\n", WARNING_FLAGS, _SEND_NOT_ALL);
-		return 0;
+		if (!has_more && !PrepareUringAccept(ring, listener))
+			return -1;
+		return 1;
 	}
-	return 1;
-}
 
-int SegmentationSend(SOCKET sender, const char* message, int message_len, int* obyte_sent)
-{
-	int start_byte = 0; // start byte in message.
-	unsigned short bsend = 0; // number of bytes will send, not include header size.
-	unsigned short bremain = 0; // number of bytes remain.
-
-	char content[APPLICATION_BUFF_MAX_SIZE];
-	while (start_byte < message_len) {
-		// Prepare content for sending: header (number of bytes send | number of bytes remain) + body (a part of message)
-		bsend = message_len - start_byte;
-		if (bsend + SEGMENTATION_HEADER_SIZE > APPLICATION_BUFF_MAX_SIZE) {
-			bsend = APPLICATION_BUFF_MAX_SIZE - SEGMENTATION_HEADER_SIZE;
+	if (operation == URING_OP_RECEIVE) {
+		if (!has_more)
+			connection->is_receiving = 0;
+		if (connection->is_closing) {
+			// the bytes received after the close are dropped, the last completion destroys the connection
+			if (cqe->res > 0)
+				RecycleUringBuffer(ring, cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+			CloseUringConnection(ring, connection);
 		}
-		bremain = message_len - start_byte - bsend;
-
-		int bsend_bigendian = htons(bsend); // uniform with many architectures.
-		int bremain_bigendian = htons(bremain);
-
-		memcpy_s(content, SEGMENTATION_HEADER_CURRENT_SIZE, &bsend_bigendian, SEGMENTATION_HEADER_CURRENT_SIZE);
-		memcpy_s(content + SEGMENTATION_HEADER_CURRENT_SIZE, SEGMENTATION_HEADER_REMAIN_SIZE, &bremain_bigendian, SEGMENTATION_HEADER_REMAIN_SIZE);
-		memcpy_s(content + SEGMENTATION_HEADER_SIZE, bsend, message + start_byte, bsend);
-		int ret = WriteSocketBuffer(sender, bsend + SEGMENTATION_HEADER_SIZE, content);
-		if (ret == 1) {
-			start_byte += bsend;
+		else if (cqe->res > 0) {
+			int id = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+			IncreaseCounter(&stats->bytes_in, cqe->res);
+			int status = 1;
+			if ((connection->is_paused || connection->held_count > 0) && connection->held_count < URING_HELD_BUFFERS) {
+				// received before the cancel completes: the bytes stay in the provided buffer until the responses are sent
+				connection->held[connection->held_count] = (unsigned short)id;
+				connection->held_lengths[connection->held_count] = cqe->res;
+				connection->held_count++;
+			}
+			else {
+				status = AppendHeldBuffers(ring, connection, 1);
+				if (status == 1)
+					status = AppendInput(connection->state, ring->buffer_data + (size_t)id * URING_BUFFER_SIZE, cqe->res);
+				RecycleUringBuffer(ring, id);
+			}
+			if (status == -1 || !PrepareUringSend(ring, connection) || !UpdateUringReceive(ring, connection))
+				CloseUringConnection(ring, connection);
+		}
+		else if (cqe->res == -ENOBUFS || cqe->res == -ECANCELED) {
+			// every provided buffer is in use, receive again when they are recycled.
+			// Or cancelled by UpdateUringReceive, receive again when the responses are sent
+			if (!UpdateUringReceive(ring, connection))
+				CloseUringConnection(ring, connection);
 		}
 		else {
-			if (obyte_sent != NULL)
-				*obyte_sent = start_byte;
-			return ret;
+			// remote process closed the connection
+			int err = -cqe->res;
+			if (err == ECONNRESET || err == ECONNABORTED)
+				LogMessage(ERROR_FLAGS, err, _CONNECTION_DROP);
+			else if (err > 0)
+				LogMessage(WARNING_FLAGS, err, _RECEIVE_FAIL);
+			CloseUringConnection(ring, connection);
 		}
+		return 1;
+	}
+
+	// URING_OP_SEND
+	connection->is_sending = 0;
+	if (connection->is_closing) {
+		CloseUringConnection(ring, connection);
+		return 1;
+	}
+	if (cqe->res < 0) {
+		int err = -cqe->res;
+		if (err == ECONNRESET || err == ECONNABORTED || err == EPIPE)
+			LogMessage(ERROR_FLAGS, err, _CONNECTION_DROP);
+		else
+			LogMessage(WARNING_FLAGS, err, _SEND_FAIL);
+		CloseUringConnection(ring, connection);
+		return 1;
 	}
-	if (obyte_sent != NULL)
-		*obyte_sent = start_byte;
+	IncreaseCounter(&stats->bytes_out, cqe->res);
+	RingConsume(&connection->state->output, cqe->res);
+	// the output buffer has more space: continue with the requests waiting in input buffer
+	if (ProcessInput(connection->state) == -1 || AppendHeldBuffers(ring, connection, 0) == -1
+		|| !PrepareUringSend(ring, connection) || !UpdateUringReceive(ring, connection))
+		CloseUringConnection(ring, connection);
 	return 1;
 }
 
-int ReadSocketBuffer(SOCKET receiver, int length, char** ostream_byte)
+int AppendInput(CONNECTION* connection, const char* data, int length)
 {
-	if (length > APPLICATION_BUFF_MAX_SIZE)
-	{
-		printf("[%s] %s\n", WARNING_FLAGS, _TOO_MUCH_BYTES);
-		length = APPLICATION_BUFF_MAX_SIZE;
+	if (RingFree(&connection->input) < length) {
+		// process the requests received, then grow the buffer if they wait for output space
+		if (ProcessInput(connection) == -1)
+			return -1;
+		int size = connection->input.size;
+		while (size - RingLength(&connection->input) < length)
+			size *= 2;
+		if (size != connection->input.size && !GrowInput(connection, size))
+			return -1;
 	}
-	char buffer[APPLICATION_BUFF_MAX_SIZE];
+	RingWrite(&connection->input, data, length);
+	return ProcessInput(connection);
+}
 
-	int ret = recv(receiver, buffer, length, 0);
-	if (ret == SOCKET_ERROR) {
-		int err = WSAGetLastError();
-		if (err == WSAECONNABORTED || err == WSAECONNRESET) {
-			printf("[%s:%d] %s\n", ERROR_FLAGS, err, _CONNECTION_DROP);
-		}
-		else {
-			printf("[%s:%d] %s\n", WARNING_FLAGS, err, _RECEIVE_FAIL);
+void CloseUringConnection(URING* ring, URING_CONNECTION* connection)
+{
+	if (!connection->is_closing) {
+		connection->is_closing = 1;
+		// cancel the operations in flight, their last completions destroy the connection
+		int operations[2] = { connection->is_receiving ? URING_OP_RECEIVE : -1, connection->is_sending ? URING_OP_SEND : -1 };
+		for (int i = 0; i < 2; i++) {
+			if (operations[i] == -1)
+				continue;
+			struct io_uring_sqe* sqe = GetUringEntry(ring);
+			if (sqe == NULL) {
+				shutdown(connection->state->socket, SD_BOTH); // the operations complete anyway
+				break;
+			}
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->addr = (unsigned long long)(uintptr_t)connection | operations[i];
+			sqe->user_data = URING_OP_CANCEL;
 		}
-		return -1;
-	}
-	else if (ret == 0) {
-		return -1;
-	}
-	else if (ret < length) {
-		printf("[%s] %s\n", WARNING_FLAGS, _RECEIVE_UNEXPECTED_MESSAGE);
-		*ostream_byte = NULL;
-		return 0;
 	}
-	else {
-		*ostream_byte = Clone(buffer, length);
-	}
-	return 1;
+	if (connection->is_receiving || connection->is_sending)
+		return;
+	for (int i = 0; i < connection->held_count; i++)
+		RecycleUringBuffer(ring, connection->held[i]);
+
+	if (connection->previous != NULL)
+		connection->previous->next = connection->next;
+	else
+		ring->connections = connection->next;
+	if (connection->next != NULL)
+		connection->next->previous = connection->previous;
+	WORKER* worker = connection->state->worker;
+	DestroyConnection(connection->state);
+	if (worker != NULL)
+		worker->closed.fetch_add(1, std::memory_order_relaxed);
+	free(connection);
+}
+
+#pragma endregion
+#endif
+
+#pragma region Handle Request
+
+int GetSumDigitOnString(const char* str, int strlen)
+{
+	static const SUM_DIGIT_KERNEL kernel = SelectSumDigitKernel();
+	return kernel(str, strlen);
+}
+
+void ResetRequest(REQUEST_STATE* state, int is_bigint)
+{
+	state->total = 0;
+	memset(state->big_total, 0, sizeof(state->big_total));
+	state->is_bigint = is_bigint;
+	state->is_error = 0;
+	state->is_overflow = 0;
+	state->is_stopped = 0;
+	state->body_left = 0;
+	state->remain = 0;
 }
 
-int SegmentationReceive(SOCKET receiver, char** ostream_byte, int* ostream_len, int* oremain)
+void BeginSegmentation(REQUEST_STATE* state, int current, long long remain)
 {
-	*ostream_byte = NULL;
-	char* read;
-	int remain;
-	int current;
-	// read number of bytes remain | number of bytes current
-	int ret = ReadSocketBuffer(receiver, SEGMENTATION_HEADER_SIZE, &read);
-	if (ret == 1) {
-		current = ntohs(*(unsigned short*)read);
-		remain = ntohs(*(unsigned short*)(read + SEGMENTATION_HEADER_CURRENT_SIZE));
+	state->is_stopped = 0;
+	state->body_left = current;
+	state->remain = remain;
+	IncreaseCounter(&GetThreadStats()->segments);
+}
 
-		*ostream_len = current;
-		*oremain = remain;
-		free(read);
+void FoldSegmentation(REQUEST_STATE* state, const char* data, int length)
+{
+	state->body_left -= length;
+	if (state->is_error || state->is_overflow || state->is_stopped)
+		return; // skipped without parsing
+	const char* end = (const char*)memchr(data, '\0', length);
+	if (end != NULL) {
+		length = (int)(end - data);
+		state->is_stopped = 1;
 	}
-	else {
-		*ostream_len = 0;
-		*oremain = 0;
-		return ret;
+	long long start = StartTimer();
+	int sum = GetSumDigitOnString(data, length); // a segmentation is small, the partial sum fits an int
+	StopTimer(STATS_SUM_DIGIT, start);
+	if (sum == -1) {
+		state->is_error = 1;
+	}
+	else if (state->total > LLONG_MAX - sum) {
+		if (state->is_bigint) { // carry, once every LLONG_MAX of sum
+			AddBigTotal(state->big_total, state->total);
+			state->total = sum;
+		}
+		else
+			state->is_overflow = 1;
 	}
+	else
+		state->total += sum;
+}
 
-	// read message content
-	ret = ReadSocketBuffer(receiver, current, &read);
-	if (ret == 1) {
-		*ostream_byte = Clone(read, current);
-		free(read);
+void AddBigTotal(unsigned int* limbs, unsigned long long value)
+{
+	unsigned long long carry = value;
+	for (int i = 0; i < BIG_TOTAL_LIMBS && carry > 0; i++) {
+		carry += limbs[i];
+		limbs[i] = (unsigned int)(carry % BIG_TOTAL_BASE);
+		carry /= BIG_TOTAL_BASE;
 	}
-	else {
-		*ostream_len = 0;
-		*oremain = 0;
-		return ret;
+}
+
+int EncodeResponse(const REQUEST_STATE* state, char* obuffer, int buffer_size)
+{
+	static const RESPONSE_FRAME error_frame = EncodeConstantFrame(STATUS_ERROR, ERROR_MESSAGE);
+	static const RESPONSE_FRAME overflow_frame = EncodeConstantFrame(STATUS_ERROR, OVERFLOW_MESSAGE);
+	if (state->is_error || state->is_overflow) {
+		const RESPONSE_FRAME* frame = state->is_error ? &error_frame : &overflow_frame;
+		if (frame->length > buffer_size)
+			return -1;
+		memcpy_s(obuffer, buffer_size, frame->data, frame->length);
+		return frame->length;
 	}
-	return 1;
+
+	int top = BIG_TOTAL_LIMBS - 1;
+	while (top >= 0 && state->big_total[top] == 0)
+		top--;
+	if (top < 0) // nothing carried: the total is a 64-bit integer
+		return EncodeNumberFrame(obuffer, buffer_size, (unsigned long long)state->total);
+
+	unsigned int limbs[BIG_TOTAL_LIMBS];
+	memcpy_s(limbs, sizeof(limbs), state->big_total, sizeof(limbs));
+	AddBigTotal(limbs, state->total);
+	top = BIG_TOTAL_LIMBS - 1;
+	while (top > 0 && limbs[top] == 0)
+		top--;
+	// the most significant limb without leading zeros, then 9 digits for each limb
+	int top_digits = CountDigits(limbs[top]);
+	int digits = top_digits + 9 * top;
+	int length = SEGMENTATION_HEADER_SIZE + digits + 2;
+	if (length > buffer_size)
+		return -1;
+	char* body = obuffer + EncodeSegmentationHeader(obuffer, digits + 2, 0);
+	body[0] = STATUS_OK_END_CHAR;
+	char* digit = body + 1;
+	WriteDigits(digit, limbs[top], top_digits);
+	digit += top_digits;
+	for (int i = top - 1; i >= 0; i--, digit += 9)
+		WriteDigits(digit, limbs[i], 9);
+	*digit = '\0';
+	return length;
 }
 
-#pragma endregion
+int EncodeNumberFrame(char* obuffer, int buffer_size, unsigned long long value)
+{
+	int digits = CountDigits(value);
+	int length = SEGMENTATION_HEADER_SIZE + digits + 2; // header | status | digits | '\0'
+	if (length > buffer_size)
+		return -1;
+	char* body = obuffer + EncodeSegmentationHeader(obuffer, digits + 2, 0);
+	body[0] = STATUS_OK_END_CHAR;
+	WriteDigits(body + 1, value, digits);
+	body[digits + 1] = '\0';
+	return length;
+}
 
-#pragma region Handle Request
+RESPONSE_FRAME EncodeConstantFrame(int status, const char* message)
+{
+	RESPONSE_FRAME frame;
+	char response[RESPONSE_MAX_SIZE];
+	int response_len = BuildMessage(status, message, response, RESPONSE_MAX_SIZE - SEGMENTATION_HEADER_SIZE);
+	// a response is smaller than any segmentation size, its frame is the same for every connection
+	frame.length = EncodeSegmentation(frame.data, RESPONSE_MAX_SIZE, response, response_len);
+	return frame;
+}
 
-int GetSumDigitOnString(const char* str, int strlen)
+int CountDigits(unsigned long long value)
+{
+	int digits = 1;
+	for (unsigned long long bound = 10; digits < UINT64_MAX_LEN && value >= bound; bound *= 10)
+		digits++;
+	return digits;
+}
+
+void WriteDigits(char* obuffer, unsigned long long value, int digits)
+{
+	static const char digit_pairs[201] =
+		"0001020304050607080910111213141516171819"
+		"2021222324252627282930313233343536373839"
+		"4041424344454647484950515253545556575859"
+		"6061626364656667686970717273747576777879"
+		"8081828384858687888990919293949596979899";
+	char* digit = obuffer + digits;
+	for (; digits >= 2; digits -= 2) {
+		int pair = (int)(value % 100);
+		value /= 100;
+		digit -= 2;
+		digit[0] = digit_pairs[pair * 2];
+		digit[1] = digit_pairs[pair * 2 + 1];
+	}
+	if (digits == 1)
+		digit[-1] = (char)('0' + value % 10);
+}
+
+int GetSumDigitOnStringScalar(const char* str, int strlen)
 {
 	int result = 0;
 	int i = 0;
@@ -295,63 +1589,402 @@ int GetSumDigitOnString(const char* str, int strlen)
 			result += str[i] - '0';
 		else if (str[i] == '\0')
 			break;
-		else // '\0'
+		else // not-digit
 			return -1;
 		i++;
 	}
 	return result;
 }
 
-int HandleRequest(SOCKET socket)
+#ifdef SUM_DIGIT_SIMD
+int GetSumDigitOnStringSSE2(const char* str, int strlen)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i digit_zero = _mm_set1_epi8('0');
+	const __m128i digit_max = _mm_set1_epi8(9);
+	__m128i sums = _mm_setzero_si128(); // two 64-bit sums
+	int i = 0;
+	for (; i + 16 <= strlen; i += 16) {
+		__m128i digits = _mm_sub_epi8(_mm_loadu_si128((const __m128i*)(str + i)), digit_zero);
+		// digit if (byte - '0') <= 9 as unsigned, '\0' and others fail
+		__m128i is_digit = _mm_cmpeq_epi8(_mm_max_epu8(digits, digit_max), digit_max);
+		if (_mm_movemask_epi8(is_digit) != 0xFFFF)
+			break; // the block needs the exact order of '\0' and not-digit characters
+		sums = _mm_add_epi64(sums, _mm_sad_epu8(digits, zero));
+	}
+	long long result = _mm_cvtsi128_si32(sums) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(sums, sums));
+	if (i < strlen) {
+		int tail = GetSumDigitOnStringScalar(str + i, strlen - i);
+		if (tail == -1)
+			return -1;
+		result += tail;
+	}
+	return (int)result;
+}
+
+TARGET_AVX2 int GetSumDigitOnStringAVX2(const char* str, int strlen)
 {
-	char* request;
-	int request_len;
-	int remain;
-	int total = 0;
-	int status = 1, is_continue = 1;
-	while (is_continue) {
-		status = SegmentationReceive(socket, &request, &request_len, &remain);
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i digit_zero = _mm256_set1_epi8('0');
+	const __m256i digit_max = _mm256_set1_epi8(9);
+	__m256i sums = _mm256_setzero_si256(); // four 64-bit sums
+	int i = 0;
+	for (; i + 32 <= strlen; i += 32) {
+		__m256i digits = _mm256_sub_epi8(_mm256_loadu_si256((const __m256i*)(str + i)), digit_zero);
+		// digit if (byte - '0') <= 9 as unsigned, '\0' and others fail
+		__m256i is_digit = _mm256_cmpeq_epi8(_mm256_max_epu8(digits, digit_max), digit_max);
+		if (_mm256_movemask_epi8(is_digit) != -1)
+			break; // the block needs the exact order of '\0' and not-digit characters
+		sums = _mm256_add_epi64(sums, _mm256_sad_epu8(digits, zero));
+	}
+	__m128i half = _mm_add_epi64(_mm256_castsi256_si128(sums), _mm256_extracti128_si256(sums, 1));
+	long long result = _mm_cvtsi128_si32(half) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(half, half));
+	if (i < strlen) {
+		_mm256_zeroupper(); // the compiler does not clear the upper halves before the call: legacy SSE code would pay a transition on each instruction
+		int tail = GetSumDigitOnStringSSE2(str + i, strlen - i);
+		if (tail == -1)
+			return -1;
+		result += tail;
+	}
+	return (int)result;
+}
+#endif
+
+SUM_DIGIT_KERNEL SelectSumDigitKernel()
+{
+#ifdef SUM_DIGIT_SIMD
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	int max_leaf = info[0];
+	__cpuid(info, 1);
+	int has_sse2 = (info[3] >> 26) & 1;
+	int has_avx = ((info[2] >> 28) & 1) && ((info[2] >> 27) & 1) // AVX and OSXSAVE
+		&& (_xgetbv(0) & 6) == 6; // the OS saves XMM and YMM registers
+	int has_avx2 = 0;
+	if (max_leaf >= 7 && has_avx) {
+		__cpuidex(info, 7, 0);
+		has_avx2 = (info[1] >> 5) & 1;
+	}
+#else
+	__builtin_cpu_init();
+	int has_sse2 = __builtin_cpu_supports("sse2");
+	int has_avx2 = __builtin_cpu_supports("avx2"); // checks the OS support too
+#endif
+	if (has_avx2)
+		return GetSumDigitOnStringAVX2;
+	if (has_sse2)
+		return GetSumDigitOnStringSSE2;
+#endif
+	return GetSumDigitOnStringScalar;
+}
+
+int HandleRequest(SOCKET socket, int* can_negotiate, const SERVER_CONFIG* config)
+{
+	char buffer[APPLICATION_BUFF_MAX_SIZE]; // reused by every segment of the request
+	char frame[RESPONSE_MAX_SIZE];
+	const char* body;
+	int body_len;
+	long long remain;
+	REQUEST_STATE request;
+	ResetRequest(&request, config != NULL && config->is_bigint);
+	int status = 1;
+	STATS* stats = GetThreadStats();
+	do {
+		long long start = StartTimer();
+		status = SegmentationReceive(socket, buffer, &body, &body_len, &remain);
 		if (status != 1)
 			return status;
-		int sum = GetSumDigitOnString(request, request_len);
-		free(request);
-		if (sum == -1) { // contains alpha characters
-			// send response
-			MESSAGE response = CreateMessage(STATUS_ERROR, ERROR_MESSAGE);
-			status = SegmentationSend(socket, response, strlen(response) + 1, NULL);
-
-			if (status != 1)
-				return status;
-			DestroyMessage(response);
-			// clean buffer
-			while (remain > 0) {
-				status = SegmentationReceive(socket, &request, &request_len, &remain);
-				if (status != 1)
-					return status;
-				free(request);
-			}
-			return 0;
+		StopTimer(STATS_RECEIVE, start);
+		IncreaseCounter(&stats->bytes_in, body_len);
+		int hello_len = (int)strlen(HELLO_MESSAGE);
+		int is_hello = *can_negotiate && remain == 0 && body_len > hello_len && memcmp(body, HELLO_MESSAGE, hello_len) == 0;
+		*can_negotiate = 0;
+		if (is_hello) {
+			// hello: extended headers are supported, but segmentations are not larger than APPLICATION_BUFF_MAX_SIZE
+			int frame_len = EncodeNumberFrame(frame, RESPONSE_MAX_SIZE, APPLICATION_BUFF_MAX_SIZE);
+			return WriteSocketBuffer(socket, frame_len, frame);
 		}
-		else
-		{
-			total += sum;
-			is_continue = remain != 0;
+		// a rejected request is still received to the end, but not parsed
+		BeginSegmentation(&request, body_len, remain);
+		FoldSegmentation(&request, body, body_len);
+	} while (remain > 0);
+
+	// the frame is sent as is: a response is smaller than any segmentation
+	int frame_len = EncodeResponse(&request, frame, RESPONSE_MAX_SIZE);
+	IncreaseCounter(&stats->requests);
+	if (request.is_error || request.is_overflow)
+		IncreaseCounter(&stats->rejected);
+	long long start = StartTimer();
+	status = WriteSocketBuffer(socket, frame_len, frame);
+	StopTimer(STATS_SEND, start);
+	IncreaseCounter(&stats->bytes_out, frame_len);
+	return status;
+}
+
+#pragma endregion
+
+#pragma region Statistics
+
+static std::atomic<int> stats_enabled(0);
+static STATS stats_table[STATS_MAX_THREADS];
+static std::atomic<int> stats_count(0);
+static STATS stats_discarded; // written by the threads beyond the table, never dumped
+static thread_local STATS* thread_stats = NULL;
+static thread_local int timer_countdown = 0; // StartTimer calls until the next sampled one
+static thread_local unsigned int timer_seed = 1;
+
+void EnableStats()
+{
+	stats_enabled.store(1, std::memory_order_relaxed);
+}
+
+int IsStatsEnabled()
+{
+	return stats_enabled.load(std::memory_order_relaxed);
+}
+
+STATS* GetThreadStats()
+{
+	if (thread_stats == NULL) {
+		int slot = stats_count.fetch_add(1, std::memory_order_relaxed);
+		// should not happen: workers are limited by MAX_WORKERS. A slot has one writer, so it is not shared.
+		thread_stats = slot < STATS_MAX_THREADS ? &stats_table[slot] : &stats_discarded;
+	}
+	return thread_stats;
+}
+
+long long StartTimer()
+{
+	if (!IsStatsEnabled() || --timer_countdown > 0)
+		return 0;
+	// random intervals: a loop that times several steps in turn does not sample the same one
+	timer_countdown = 1 + NextRandom(&timer_seed) % (2 * STATS_TIMER_SAMPLING - 1);
+	return GetTimestamp();
+}
+
+void StopTimer(int histogram, long long start)
+{
+	if (start != 0)
+		RecordHistogram(&GetThreadStats()->latency[histogram], GetTimestamp() - start);
+}
+
+void IncreaseCounter(std::atomic<long long>* counter, long long value)
+{
+	counter->store(counter->load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+int DumpStats(char* obuffer, int buffer_size)
+{
+	static const char* names[STATS_HISTOGRAMS] = { "accept", "receive", "sum_digit", "send" };
+	STATS* merged = new STATS(); // zero-initialized, too large for the stack
+	int threads = stats_count.load(std::memory_order_relaxed);
+	if (threads > STATS_MAX_THREADS)
+		threads = STATS_MAX_THREADS;
+	for (int t = 0; t < threads; t++) {
+		STATS* stats = &stats_table[t];
+		for (int h = 0; h < STATS_HISTOGRAMS; h++)
+			MergeHistogram(&merged->latency[h], &stats->latency[h]);
+		IncreaseCounter(&merged->bytes_in, stats->bytes_in.load(std::memory_order_relaxed));
+		IncreaseCounter(&merged->bytes_out, stats->bytes_out.load(std::memory_order_relaxed));
+		IncreaseCounter(&merged->segments, stats->segments.load(std::memory_order_relaxed));
+		IncreaseCounter(&merged->requests, stats->requests.load(std::memory_order_relaxed));
+		IncreaseCounter(&merged->rejected, stats->rejected.load(std::memory_order_relaxed));
+		IncreaseCounter(&merged->short_reads, stats->short_reads.load(std::memory_order_relaxed));
+		IncreaseCounter(&merged->system_calls, stats->system_calls.load(std::memory_order_relaxed));
+	}
+
+	int written = sprintf_s(obuffer, buffer_size, "threads %d\nlatency_sampling %d\nbytes_in %lld\nbytes_out %lld\nsegments %lld\nrequests %lld\nrejected %lld\nshort_reads %lld\nsystem_calls %lld\n",
+		threads, STATS_TIMER_SAMPLING, merged->bytes_in.load(), merged->bytes_out.load(), merged->segments.load(),
+		merged->requests.load(), merged->rejected.load(), merged->short_reads.load(), merged->system_calls.load());
+	for (int h = 0; h < STATS_HISTOGRAMS && written > 0 && written < buffer_size; h++) {
+		const HISTOGRAM* histogram = &merged->latency[h];
+		written += sprintf_s(obuffer + written, buffer_size - written, "%s_ns count %lld p50 %lld p99 %lld p999 %lld max %lld\n",
+			names[h], histogram->total.load(), GetHistogramPercentile(histogram, 50), GetHistogramPercentile(histogram, 99),
+			GetHistogramPercentile(histogram, 99.9), histogram->max.load());
+	}
+	if (written > 0 && written < buffer_size)
+		written += sprintf_s(obuffer + written, buffer_size - written, "connections %d\nconnection_memory %lld\nrefused %lld\nover_budget %lld\nover_memory %lld\nread_timeouts %lld\nidle_timeouts %lld\n",
+			server_limits.connections.load(), server_limits.memory.load(), server_limits.refused.load(), server_limits.over_budget.load(),
+			server_limits.over_memory.load(), server_limits.read_timeouts.load(), server_limits.idle_timeouts.load());
+	delete merged;
+	return written;
+}
+
+void RunStatsServer(int port)
+{
+	SOCKET listener = CreateSocket(TCP);
+	if (listener == INVALID_SOCKET)
+		return;
+	IP loopback;
+	loopback.s_addr = htonl(INADDR_LOOPBACK);
+	if (!BindSocket(listener, CreateSocketAddress(loopback, port)) || !ListenConnections(listener)) {
+		CloseSocket(listener, CLOSE_NORMAL);
+		return;
+	}
+	printf("[%s] Statistics at 127.0.0.1:%d\n", INFO_FLAGS, port);
+	char dump[STATS_DUMP_MAX_SIZE];
+	while (1) {
+		SOCKET connector = accept(listener, NULL, NULL); // not measured
+		if (connector == INVALID_SOCKET)
+			continue;
+		int length = DumpStats(dump, STATS_DUMP_MAX_SIZE);
+		WriteSocketBuffer(connector, length, dump);
+		CloseSocket(connector, CLOSE_SAFELY);
+	}
+}
+
+#pragma endregion
+
+#pragma region Logging
+
+static std::atomic<int> log_running(0);
+static std::thread log_flusher;
+static LOG_RING log_table[LOG_MAX_THREADS];
+static std::atomic<int> log_count(0);
+static thread_local LOG_RING* thread_log = NULL;
+static long long log_reported[LOG_MAX_THREADS]; // dropped records reported, only used by the flusher
+
+void StartLogging()
+{
+	log_running.store(1, std::memory_order_release);
+	log_flusher = std::thread(RunLogFlusher);
+	SetLogHandler(QueueLogMessage);
+}
+
+void StopLogging()
+{
+	if (log_running.exchange(0, std::memory_order_acq_rel) == 0)
+		return;
+	log_flusher.join();
+	FlushLogs();
+	SetLogHandler(NULL);
+}
+
+void QueueLogMessage(const char* flags, int error, const char* message)
+{
+	LOG_RECORD record = { flags, error, message, 0, 0 };
+	LOG_RING* ring = GetThreadLog();
+	if (ring == NULL) {
+		PrintLogRecord(&record);
+		return;
+	}
+
+	// rate limit, by the address of the message constant
+	long long now = GetTimestamp() / 1000000;
+	LOG_RATE* rate = GetLogRate(ring, message);
+	if (rate->message != message) {
+		// the slot is free or evicted: the records suppressed of the evicted message are reported first
+		if (rate->suppressed > 0) {
+			LOG_RECORD summary = { rate->flags, 0, rate->message, rate->suppressed, 1 };
+			EnqueueLogRecord(ring, &summary);
 		}
+		rate->flags = flags;
+		rate->message = message;
+		rate->window_start = now;
+		rate->count = 0;
+		rate->suppressed = 0;
 	}
-	// handle success result
-	char* total_str = (char*)malloc(INT_MAX_LEN + 1);
-	if (total_str == NULL) {
-		printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
-		status = 0;
+	else if (now - rate->window_start >= LOG_RATE_INTERVAL) {
+		record.suppressed = rate->suppressed;
+		rate->window_start = now;
+		rate->count = 0;
+		rate->suppressed = 0;
 	}
-	else {
-		_itoa_s(total, total_str, INT_MAX_LEN + 1, 10);
-		MESSAGE response = CreateMessage(STATUS_OK_END, total_str);
-		status = SegmentationSend(socket, response, strlen(response) + 1, NULL);
-		free(total_str);
-		DestroyMessage(response);
+	if (++rate->count > LOG_RATE_BURST) {
+		rate->suppressed++;
+		return;
+	}
+	EnqueueLogRecord(ring, &record);
+}
+
+void EnqueueLogRecord(LOG_RING* ring, const LOG_RECORD* record)
+{
+	if (!log_running.load(std::memory_order_acquire)) {
+		PrintLogRecord(record);
+		return;
+	}
+	unsigned int tail = ring->tail.load(std::memory_order_relaxed);
+	if (tail - ring->head.load(std::memory_order_acquire) >= LOG_RING_SIZE) {
+		IncreaseCounter(&ring->dropped);
+		return;
+	}
+	ring->records[tail & (LOG_RING_SIZE - 1)] = *record;
+	ring->tail.store(tail + 1, std::memory_order_release);
+}
+
+LOG_RATE* GetLogRate(LOG_RING* ring, const char* message)
+{
+	// slots are never freed, so a message is always found before the first free slot
+	int start = (int)(((size_t)message >> 3) % LOG_RATE_SLOTS);
+	LOG_RATE* oldest = NULL;
+	for (int i = 0; i < LOG_RATE_SLOTS; i++) {
+		LOG_RATE* rate = &ring->rates[(start + i) % LOG_RATE_SLOTS];
+		if (rate->message == message || rate->message == NULL)
+			return rate;
+		if (oldest == NULL || rate->window_start < oldest->window_start)
+			oldest = rate;
+	}
+	return oldest;
+}
+
+LOG_RING* GetThreadLog()
+{
+	if (thread_log == NULL) {
+		int slot = log_count.fetch_add(1, std::memory_order_relaxed);
+		if (slot >= LOG_MAX_THREADS) {
+			log_count.store(LOG_MAX_THREADS, std::memory_order_relaxed);
+			return NULL;
+		}
+		thread_log = &log_table[slot];
+	}
+	return thread_log;
+}
+
+void PrintLogRecord(const LOG_RECORD* record)
+{
+	if (record->is_summary) {
+		printf("[%s] %s (%d suppressed)\n", record->flags, record->message, record->suppressed);
+		return;
+	}
+	char suppressed[32] = "";
+	if (record->suppressed > 0)
+		snprintf(suppressed, sizeof(suppressed), " (%d more suppressed)", record->suppressed);
+	// one call for each record, so it is not mixed with the lines printed by other threads
+	if (record->error != 0)
+		printf("[%s:%d] %s%s\n", record->flags, record->error, record->message, suppressed);
+	else
+		printf("[%s] %s%s\n", record->flags, record->message, suppressed);
+}
+
+void FlushLogs()
+{
+	int count = log_count.load(std::memory_order_acquire);
+	if (count > LOG_MAX_THREADS)
+		count = LOG_MAX_THREADS;
+	for (int i = 0; i < count; i++) {
+		LOG_RING* ring = &log_table[i];
+		unsigned int head = ring->head.load(std::memory_order_relaxed);
+		unsigned int tail = ring->tail.load(std::memory_order_acquire);
+		for (; head != tail; head++)
+			PrintLogRecord(&ring->records[head & (LOG_RING_SIZE - 1)]);
+		ring->head.store(head, std::memory_order_release);
+
+		long long dropped = ring->dropped.load(std::memory_order_relaxed);
+		if (dropped != log_reported[i]) {
+			printf("[%s] %s (%lld dropped)\n", WARNING_FLAGS, _LOG_RECORDS_DROPPED, dropped - log_reported[i]);
+			log_reported[i] = dropped;
+		}
+	}
+	fflush(stdout);
+}
+
+void RunLogFlusher()
+{
+	while (log_running.load(std::memory_order_acquire)) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(LOG_FLUSH_INTERVAL));
+		FlushLogs();
 	}
-	return status;
 }
 
 #pragma endregion
@@ -362,13 +1995,13 @@ int ExtractCommand(int argc, char* argv[], int* oport)
 {
 	int is_ok = 1;
 	if (argc < 2) {
-		printf("[%s] %s\n", WARNING_FLAGS, _NOT_SPECIFY_PORT);
+		LogMessage(WARNING_FLAGS, 0, _NOT_SPECIFY_PORT);
 		is_ok = 0;
 	}
 	else {
 		*oport = atoi(argv[1]);
 		if (*oport == 0) {
-			printf("[%s] %s\n", WARNING_FLAGS, _CONVERT_PORT_FAIL);
+			LogMessage(WARNING_FLAGS, 0, _CONVERT_PORT_FAIL);
 			is_ok = 0;
 		}
 	}
@@ -379,46 +2012,72 @@ int ExtractCommand(int argc, char* argv[], int* oport)
 	return is_ok;
 }
 
-IP CreateDefaultIP()
-{
-	IP addr;
-	addr.s_addr = htonl(INADDR_ANY);
-	return addr;
-}
-
-char* Clone(const char* source, int length, int start)
+int ExtractOptions(int argc, char* argv[], SERVER_CONFIG* oconfig)
 {
-	char* _clone = (char*)malloc(length + start);
+	int is_ok = 1;
+	oconfig->workers = GetIntOption(argc, argv, WORKERS_OPTION, 1);
+	if (oconfig->workers < 1 || oconfig->workers > MAX_WORKERS) {
+		LogMessage(WARNING_FLAGS, 0, _CONVERT_WORKERS_FAIL);
+		oconfig->workers = 1;
+		is_ok = 0;
+	}
+	oconfig->is_bigint = HasOption(argc, argv, BIGINT_OPTION);
+	oconfig->stats_port = GetIntOption(argc, argv, STATS_PORT_OPTION, 0);
+	oconfig->is_poll = HasOption(argc, argv, POLL_OPTION);
+	oconfig->max_segment_size = GetIntOption(argc, argv, SEGMENTATION_SIZE_OPTION, SEGMENTATION_MAX_SIZE);
+	if (oconfig->max_segment_size < APPLICATION_BUFF_MAX_SIZE || oconfig->max_segment_size > SEGMENTATION_MAX_SIZE) {
+		LogMessage(WARNING_FLAGS, 0, _CONVERT_SEGMENTATION_SIZE_FAIL);
+		oconfig->max_segment_size = SEGMENTATION_MAX_SIZE;
+		is_ok = 0;
+	}
 
-	if (_clone == NULL)
-		printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
-	else
-		memcpy_s(_clone + start, length, source, length);
-	return _clone;
+	// an explicit 0 disables a timeout, so the default is only used when the option is absent
+	int max_connections = GetIntOption(argc, argv, MAX_CONNECTIONS_OPTION, DEFAULT_MAX_CONNECTIONS);
+	int connection_memory = GetIntOption(argc, argv, CONNECTION_MEMORY_OPTION, DEFAULT_CONNECTION_MEMORY);
+	int server_memory = GetIntOption(argc, argv, SERVER_MEMORY_OPTION, DEFAULT_SERVER_MEMORY);
+	int read_timeout = GetIntOption(argc, argv, READ_TIMEOUT_OPTION, -1);
+	int idle_timeout = GetIntOption(argc, argv, IDLE_TIMEOUT_OPTION, -1);
+	if (read_timeout == -1)
+		read_timeout = HasOption(argc, argv, READ_TIMEOUT_OPTION) ? 0 : DEFAULT_READ_TIMEOUT;
+	if (idle_timeout == -1)
+		idle_timeout = HasOption(argc, argv, IDLE_TIMEOUT_OPTION) ? 0 : DEFAULT_IDLE_TIMEOUT;
+	if (max_connections < 1 || connection_memory < MIN_CONNECTION_MEMORY || server_memory < 1 || read_timeout < 0 || idle_timeout < 0) {
+		LogMessage(WARNING_FLAGS, 0, _CONVERT_LIMITS_FAIL);
+		max_connections = DEFAULT_MAX_CONNECTIONS;
+		connection_memory = DEFAULT_CONNECTION_MEMORY;
+		server_memory = DEFAULT_SERVER_MEMORY;
+		read_timeout = DEFAULT_READ_TIMEOUT;
+		idle_timeout = DEFAULT_IDLE_TIMEOUT;
+		is_ok = 0;
+	}
+	oconfig->max_connections = max_connections;
+	oconfig->connection_memory = connection_memory * 1024;
+	oconfig->server_memory = server_memory * 1024LL * 1024;
+	oconfig->read_timeout = read_timeout;
+	oconfig->idle_timeout = idle_timeout;
+	return is_ok;
 }
 
-MESSAGE CreateMessage(int status, const char* message)
+int BuildMessage(int status, const char* message, char* obuffer, int buffer_size)
 {
-	MESSAGE m = Clone(message, strlen(message) + 1, 1);
+	int message_len = (int)strlen(message) + 1;
+	if (message_len + 1 > buffer_size)
+		message_len = buffer_size - 1; // truncate, the last byte is '\0'
 	if (status == STATUS_OK) {
-		m[0] = STATUS_OK_CHAR;
+		obuffer[0] = STATUS_OK_CHAR;
 	}
 	else if (status == STATUS_OK_END) {
-		m[0] = STATUS_OK_END_CHAR;
+		obuffer[0] = STATUS_OK_END_CHAR;
 	}
 	else if (status == STATUS_ERROR) {
-		m[0] = STATUS_ERROR_CHAR;
+		obuffer[0] = STATUS_ERROR_CHAR;
 	}
 	else {
-		m[0] = '\0';
+		obuffer[0] = '\0';
 	}
-	return m;
-}
-
-void DestroyMessage(MESSAGE m)
-{
-	free(m);
-	m = NULL;
+	memcpy_s(obuffer + 1, buffer_size - 1, message, message_len);
+	obuffer[message_len] = '\0';
+	return message_len + 1;
 }
 
 #pragma endregion
@@ -1,86 +1,335 @@
 #pragma once
-#pragma comment(lib, "Ws2_32.lib")
 
 #pragma region Header Declarations
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 
-#include <WinSock2.h>
-#include <WS2tcpip.h>
+#include <atomic>
+#include <thread>
+#include <chrono>
 
-#include "CommonDefinitions.h"
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define SUM_DIGIT_SIMD // SSE2/AVX2 kernels for GetSumDigitOnString, chosen at runtime
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#ifdef IORING_RECV_MULTISHOT
+#define SERVER_IO_URING // io_uring event loop (See: RunUringLoop), the poll event loop is the fallback
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+#endif
+#endif
+
+#ifdef __linux__
+#define SERVER_EPOLL // the event loop waits with epoll (See: RunEventLoop), WSAPoll is used on Windows
+#include <sys/epoll.h>
+#endif
+
+#include "Network.h"
 #pragma endregion
 
 #pragma region Constants Definitions
 
 #define MAX_CONNECTIONS SOMAXCONN
 
-#define SEGMENTATION_HEADER_REMAIN_SIZE 2
-#define SEGMENTATION_HEADER_CURRENT_SIZE 2
-#define SEGMENTATION_HEADER_SIZE 4
+
+#define HELLO_MESSAGE "#HELLO " // first request of a client that wants larger segmentations: "#HELLO <size>"
 
 #define INT_MAX_LEN 10
+#define UINT64_MAX_LEN 20 // digits of the largest unsigned 64-bit integer
+
+#define BIG_TOTAL_LIMBS 3 // a request has less than 2^64 bytes, so its total is less than 10^27
+#define BIG_TOTAL_BASE 1000000000 // each limb holds 9 decimal digits
+#define BIG_TOTAL_MAX_LEN (BIG_TOTAL_LIMBS * 9)
 
 #define ERROR_MESSAGE "Failed: String contains non-number character."
+#define OVERFLOW_MESSAGE "Failed: Sum of digits is too large."
+
+#define BLOCKING_OPTION "--blocking"
+#define WORKERS_OPTION "--workers"
+#define SEGMENTATION_SIZE_OPTION "--segment-size"
+#define BIGINT_OPTION "--bigint"
+#define POLL_OPTION "--poll" // use the readiness event loop (epoll, or WSAPoll on Windows) even if io_uring is available
+#define STATS_PORT_OPTION "--stats-port" // enable instrumentation, and dump the statistics to each connection on 127.0.0.1:<port>
+#define MAX_CONNECTIONS_OPTION "--max-connections" // connections open at the same time in all workers, the next ones are closed when accepted
+#define CONNECTION_MEMORY_OPTION "--connection-memory" // in KB, budget of the buffers of a connection
+#define SERVER_MEMORY_OPTION "--memory" // in MB, budget of the buffers of all connections
+#define READ_TIMEOUT_OPTION "--read-timeout" // in milliseconds, a request started is received completely in this time. 0 for no limit
+#define IDLE_TIMEOUT_OPTION "--idle-timeout" // in milliseconds, a connection without bytes received or sent is closed after this time. 0 for no limit
+
+#define MAX_WORKERS 64
+
+#define DEFAULT_MAX_CONNECTIONS 10000
+#define DEFAULT_CONNECTION_MEMORY 1024 // in KB, the input buffer of an io_uring connection grows while its responses wait (See: AppendInput)
+#define MIN_CONNECTION_MEMORY (2 * RING_BUFFER_SIZE / 1024) // in KB, the buffers of a new connection
+#define DEFAULT_SERVER_MEMORY 512 // in MB
+#define DEFAULT_READ_TIMEOUT RECEIVE_TIMEOUT_INTERVAL
+#define DEFAULT_IDLE_TIMEOUT 60000
+#define DEADLINE_CHECK_INTERVAL 100 // in milliseconds, period of the check of the connection deadlines
+#define WORKER_STATS_INTERVAL 5000
+
+#define CONNECTIONS_INIT_CAPACITY 64
+#define EPOLL_MAX_EVENTS 256 // events taken by an epoll_wait, the next ones are taken by the next call
+
+#define STATS_MAX_THREADS (MAX_WORKERS + 1) // workers, or the main thread
+#define STATS_DUMP_MAX_SIZE 4096
+#define STATS_ACCEPT 0 // histograms of STATS
+#define STATS_RECEIVE 1
+#define STATS_SUM_DIGIT 2
+#define STATS_SEND 3
+#define STATS_HISTOGRAMS 4
+#define STATS_TIMER_SAMPLING 16 // one latency of 16 is measured on average, a timestamp costs about as much as a short request
+
+#define LOG_MAX_THREADS (MAX_WORKERS + 2) // workers, the main thread and the statistics thread
+#define LOG_RING_SIZE 1024 // records of a thread not flushed yet, power of 2
+#define LOG_RATE_SLOTS 16 // messages rate-limited at the same time by a thread, the least recent one is evicted for a new one
+#define LOG_RATE_BURST 10 // records of the same message printed in LOG_RATE_INTERVAL, the others are counted
+#define LOG_RATE_INTERVAL 1000 // in milliseconds
+#define LOG_FLUSH_INTERVAL 50 // in milliseconds
+
+#define URING_ENTRIES 512 // submission queue size of an io_uring, the completion queue is twice
+#define URING_BUFFER_COUNT 512 // buffers provided for multishot recv, power of 2
+#define URING_BUFFER_SIZE 4096
+#define URING_BUFFER_GROUP 1
+#define URING_HELD_BUFFERS 64 // provided buffers kept by a paused connection, a multishot recv fills about 32 before its cancel
+#define URING_OP_CANCEL 0 // kind of an operation, in the low bits of its user_data. The other bits are the URING_CONNECTION
+#define URING_OP_ACCEPT 1
+#define URING_OP_RECEIVE 2
+#define URING_OP_SEND 3
+#define URING_OP_MASK 3
+
+#define RING_BUFFER_SIZE 2048 // default size of ring buffers, power of 2, holds at least one APPLICATION_BUFF_MAX_SIZE segmentation
+#define RESPONSE_MAX_SIZE 64 // a framed response: header + status + sum of digits or ERROR_MESSAGE
 #pragma endregion
 
 #pragma region Type Definitions
 
+/// <summary>
+/// A kernel of GetSumDigitOnString (See: SelectSumDigitKernel)
+/// </summary>
+typedef int (*SUM_DIGIT_KERNEL)(const char* str, int strlen);
+
 #define ADDRESS SOCKADDR_IN
 #define IP IN_ADDR
 #define MESSAGE char*
 
-#pragma endregion
+/// <summary>
+/// Runtime options of the server, extracted from command-line arguments
+/// </summary>
+typedef struct {
+	int workers; // number of worker threads
+	int max_segment_size; // largest segmentation size agreed with a client (See: HELLO_MESSAGE)
+	int is_bigint; // 1 if totals larger than a 64-bit integer are responded, instead of OVERFLOW_MESSAGE
+	int stats_port; // port of the statistics dump. 0 for no instrumentation
+	int is_poll; // 1 if the poll event loop is used even if io_uring is available
+	int max_connections;
+	int connection_memory; // in bytes, budget of the buffers of a connection
+	long long server_memory; // in bytes, budget of the buffers of all connections
+	int read_timeout; // in milliseconds. 0 for no limit
+	int idle_timeout; // in milliseconds. 0 for no limit
+} SERVER_CONFIG;
 
-#pragma region Function Declarations
+/// <summary>
+/// The connections and buffer bytes of all workers, checked against the limits of SERVER_CONFIG,
+/// and the number of times each limit is reached. Shared by the workers (See: AdmitConnection, ReserveMemory).
+/// </summary>
+typedef struct {
+	std::atomic<int> connections; // open connections
+	std::atomic<long long> memory; // in bytes, buffers of the open connections
+	std::atomic<long long> refused; // connections closed when accepted, max_connections reached
+	std::atomic<long long> over_budget; // buffers not grown, connection_memory reached
+	std::atomic<long long> over_memory; // connections refused or buffers not grown, server_memory reached
+	std::atomic<long long> read_timeouts; // connections closed, a request not received in read_timeout
+	std::atomic<long long> idle_timeouts; // connections closed, no bytes received or sent in idle_timeout
+} SERVER_LIMITS;
+
+/// <summary>
+/// A worker thread that runs its own event loop.
+/// The counters are only written by the worker, and read by the main thread to report connection skew.
+/// </summary>
+typedef struct alignas(64) {
+	int id;
+	SOCKET listener;
+	std::atomic<long long> accepted; // number of connections accepted
+	std::atomic<long long> closed; // number of connections closed
+	std::atomic<long long> requests; // number of requests responded
+} WORKER;
+
+/// <summary>
+/// Statistics of a thread: latency histograms (in nanoseconds) and counters.
+/// Each thread writes its own statistics, they are merged when dumped (See: DumpStats).
+/// </summary>
+typedef struct alignas(64) {
+	HISTOGRAM latency[STATS_HISTOGRAMS]; // indexed by STATS_ACCEPT, STATS_RECEIVE, STATS_SUM_DIGIT, STATS_SEND
+	std::atomic<long long> bytes_in;
+	std::atomic<long long> bytes_out;
+	std::atomic<long long> segments;
+	std::atomic<long long> requests;
+	std::atomic<long long> rejected; // requests responded with an error
+	std::atomic<long long> short_reads; // reads returned less bytes than the buffer can hold
+	std::atomic<long long> system_calls; // calls of poll, accept, recv, send or io_uring_enter by the server
+} STATS;
+
+/// <summary>
+/// A log record: the arguments of a LogMessage call. message is a constant (See: CommonDefinitions.h), so it is not copied.
+/// </summary>
+typedef struct {
+	const char* flags;
+	int error; // error code. 0 if has no code
+	const char* message;
+	int suppressed; // number of records of the same message suppressed by the rate limit before this one
+	int is_summary; // 1 if the record only reports the suppressed records of its message, it is not logged again
+} LOG_RECORD;
+
+/// <summary>
+/// The rate limit of a message on a thread. The slots of a thread are an open-addressing table keyed by message (See: GetLogRate).
+/// </summary>
+typedef struct {
+	const char* flags; // flags of the records, to report the suppressed records when the slot is evicted
+	const char* message; // NULL if the slot is free
+	long long window_start; // in milliseconds
+	int count; // number of records in the current window
+	int suppressed; // number of records suppressed, not reported yet
+} LOG_RATE;
+
+/// <summary>
+/// Log records of a thread, not printed yet. A single-producer single-consumer queue:
+/// tail is only written by the owner thread, head is only written by the flusher thread.
+/// </summary>
+typedef struct alignas(64) {
+	LOG_RECORD records[LOG_RING_SIZE];
+	alignas(64) std::atomic<unsigned int> head;
+	alignas(64) std::atomic<unsigned int> tail;
+	std::atomic<long long> dropped; // records dropped because the queue is full
+	LOG_RATE rates[LOG_RATE_SLOTS]; // only used by the owner thread
+} LOG_RING;
+
+/// <summary>
+/// A circular byte queue. head and tail count bytes consumed and produced,
+/// they are masked with size - 1 to get positions in data.
+/// </summary>
+typedef struct {
+	char* data;
+	int size; // power of 2
+	unsigned int head;
+	unsigned int tail;
+} RING_BUFFER;
 
 /// <summary>
-/// Initialize Winsock 2.2
+/// Incremental state of a request. The segmentation bodies are folded into it as they arrive (See: FoldSegmentation),
+/// so a request of any size is processed with constant memory.
 /// </summary>
-/// <returns>1 if initialize successfully, 0 otherwise</returns>
-int WSInitialize();
+typedef struct {
+	long long total; // sum of digits of the bytes folded, since the last carry to big_total
+	unsigned int big_total[BIG_TOTAL_LIMBS]; // the carried part of the sum, in BIG_TOTAL_BASE limbs (little-endian)
+	int is_bigint; // 1 if total is carried to big_total when it overflows. 0 for responding OVERFLOW_MESSAGE
+	int is_error; // 1 if the request contains non-number characters, the rest is skipped without parsing
+	int is_overflow; // 1 if the sum does not fit total and is_bigint is 0, the rest is skipped without parsing
+	int is_stopped; // 1 if '\0' is found in the current segmentation, the rest of it is ignored
+	int body_left; // number of bytes of the current segmentation body not folded yet
+	long long remain; // number of bytes of the request after the current segmentation
+} REQUEST_STATE;
 
 /// <summary>
-/// Clean up Winsock 2.2
+/// A complete framed response, encoded once and copied as is (See: EncodeConstantFrame)
 /// </summary>
-/// <returns>1 if close successfully, 0 otherwise</returns>
-int WSCleanup();
+typedef struct {
+	char data[RESPONSE_MAX_SIZE];
+	int length;
+} RESPONSE_FRAME;
 
 /// <summary>
-/// Create a TCP/UDP Socket.
+/// State of a non-blocking connection served by the event loop.
+/// Received bytes are folded into the request state as soon as they are in the input buffer,
+/// only a segmentation header has to be complete. Responses are queued in the output buffer
+/// and sent as the socket accepts them.
 /// </summary>
-/// <param name="protocol">TCP or UDP</param>
-/// <returns>
-/// Created TCP/UDP Socket.
-/// INVALID_SOCKET if protocol is unexpected or have error on Winsock
-/// </returns>
-SOCKET CreateSocket(int protocol);
+typedef struct {
+	SOCKET socket;
+	const SERVER_CONFIG* config;
+	WORKER* worker; // the worker owns the connection. NULL if not counted
+	RING_BUFFER input;
+	RING_BUFFER output;
+	int segment_size; // agreed segmentation size, APPLICATION_BUFF_MAX_SIZE until the client says hello
+	int can_negotiate; // 1 until the first request is processed
+	REQUEST_STATE request; // the request being received
+	int memory; // in bytes, size of the buffers, counted in the budgets (See: ReserveMemory)
+	long long last_active; // timestamp of the last bytes received or sent, in nanoseconds
+	long long request_started; // timestamp when the request being received started to wait for bytes. 0 if not waiting
+} CONNECTION;
 
+#ifdef SERVER_EPOLL
 /// <summary>
-/// Close a created Socket
+/// A connection served by the epoll event loop
 /// </summary>
-/// <param name="socket">The socket want to close</param>
-/// <param name="mode">CLOSE_NORMAL or CLOSE_SAFELY (Shutdown before close)</param>
-/// <param name="flags">Specify how to close socket safely. Some flags: SD_RECEIVE, SD_SEND, SD_BOTH (Manifest constants for shutdown()). This param is not used with CLOSE_NORMAL </param>
-/// <returns>1 if close successfully, 0 otherwise</returns>
-int CloseSocket(SOCKET socket, int mode, int flags = 0);
+typedef struct {
+	CONNECTION* state;
+	int index; // in the connections of the event loop, which are visited to check their deadlines
+	unsigned int events; // the events registered with epoll_ctl, changed only when GetConnectionEvents differs
+} EPOLL_CONNECTION;
+#endif
 
+#ifdef SERVER_IO_URING
 /// <summary>
-/// Bind a socket to an address [IPv4, Port]
+/// An io_uring set up with raw system calls: the submission and completion queues shared with the kernel,
+/// and the ring of buffers provided for multishot recv.
 /// </summary>
-/// <param name="socket">The socket want to bind</param>
-/// <param name="addr">A socket address [IPv4, Port]</param>
-/// <returns>1 is bind successfully. 0 otherwise</returns>
-int BindSocket(SOCKET socket, ADDRESS addr);
+typedef struct {
+	int fd;
+	unsigned int* sq_head;
+	unsigned int* sq_tail;
+	unsigned int sq_mask;
+	unsigned int sq_entries;
+	unsigned int sq_pending; // number of entries queued since the last submit
+	struct io_uring_sqe* sqes;
+	unsigned int* cq_head;
+	unsigned int* cq_tail;
+	unsigned int cq_mask;
+	struct io_uring_cqe* cqes;
+	void* sq_ring; // mapped memory, the completion queue shares it (IORING_FEAT_SINGLE_MMAP)
+	size_t sq_ring_size;
+	size_t sqes_size;
+	struct io_uring_buf_ring* buffers; // ring of the provided buffers, URING_BUFFER_COUNT entries
+	char* buffer_data; // URING_BUFFER_COUNT buffers of URING_BUFFER_SIZE bytes
+	unsigned short buffer_tail;
+	struct URING_CONNECTION* connections; // the connections served, linked
+} URING;
 
 /// <summary>
-/// Create a socket address that used IPv4 and Port Number
+/// A connection served by the io_uring event loop. It is freed only when none of its operations is in flight,
+/// so a completion never refers to a freed connection.
 /// </summary>
-/// <param name="ip">The IPv4 Address</param>
-/// <param name="port">The Port number</param>
-/// <returns>Created socket address</returns>
-ADDRESS CreateSocketAddress(IP ip, int port);
+typedef struct URING_CONNECTION {
+	CONNECTION* state;
+	struct URING_CONNECTION* previous; // the connections served by an io_uring are linked, to destroy them when it stops
+	struct URING_CONNECTION* next;
+	int is_receiving; // 1 if the multishot recv is armed
+	int is_sending; // 1 if a sendmsg is in flight
+	int is_closing; // 1 if the connection is destroyed when its operations complete
+	int is_paused; // 1 if the recv is cancelled, the requests received wait for output space (See: UpdateUringReceive)
+	int held_count; // provided buffers received while paused, appended when the responses are sent (See: AppendHeldBuffers)
+	unsigned short held[URING_HELD_BUFFERS];
+	int held_lengths[URING_HELD_BUFFERS];
+	struct msghdr message; // of the sendmsg in flight
+	struct iovec spans[2]; // the queued responses, they may wrap around the output buffer end
+} URING_CONNECTION;
+#endif
+
+#pragma endregion
+
+#pragma region Function Declarations
 
 /// <summary>
 /// Set listen state for a socket.
@@ -90,6 +339,14 @@ ADDRESS CreateSocketAddress(IP ip, int port);
 /// <returns>1 if has no errors. 0 otherwise</returns>
 int ListenConnections(SOCKET socket, int connection_numbers = MAX_CONNECTIONS);
 
+/// <summary>
+/// Create a TCP socket, bind it to INADDR_ANY:port and set it to listen state.
+/// </summary>
+/// <param name="port">The port number</param>
+/// <param name="reuse_port">1 if the address can be shared with other listeners (See: SetReusePort)</param>
+/// <returns>The listener socket. INVALID_SOCKET if have errors</returns>
+SOCKET CreateListener(int port, int reuse_port);
+
 /// <summary>
 /// Extract and Accept the first connection from listener socket pending queue.
 /// This function blocks the program if the pending queue is empty
@@ -100,61 +357,678 @@ int ListenConnections(SOCKET socket, int connection_numbers = MAX_CONNECTIONS);
 SOCKET GetConnectionSocket(SOCKET listener, ADDRESS* osender_address = NULL);
 
 /// <summary>
-/// Write a byte stream to the connected socket buffer, to send
+/// Set a socket to non-blocking mode
 /// </summary>
-/// <param name="sender">The connected socket that is used for send message</param>
-/// <param name="bytes">Number of bytes expected to send</param>
-/// <param name="message">The bytes tream want to send</param>
-/// <returns>1 if success. 0 if number of bytes sent less than expected. -1 if have errors that the socket should be closed</returns>
-int WriteSocketBuffer(SOCKET sender, int bytes, const char* message);
+/// <param name="socket">The socket want to set</param>
+/// <returns>1 if set successfully, 0 otherwise</returns>
+int SetNonBlocking(SOCKET socket);
 
 /// <summary>
-/// Segmentation a message into pieces and Send them with a connected socket.
-/// Each piece attached with the header consists of SEGMENTATION_HEADER_CURRENT_SIZE first bytes
-/// is the length of message in the piece (not include header size) and SEGMENTATION_HEADER_REMAIN_SIZE next bytes
-/// is the number of bytes on message that has not been sent.
+/// Calculate sum of digits in the string
 /// </summary>
-/// <param name="sender">The connected socket used for sending</param>
-/// <param name="message">The message want to segmentation and send</param>
-/// <param name="message_len">The length of the message</param>
-/// <param name="obyte_sent">[Output] The bytes sent successfully</param>
-/// <returns>1 if success. 0 if number of bytes sent less than expected. -1 if have errors that the socket should be closed</returns>
-int SegmentationSend(SOCKET sender, const char* message, int message_len, int* obyte_sent);
+/// <param name="str">The string input</param>
+/// <param name="strlen">Number of bytes will be processed. Up to INT_MAX / 9 bytes, so the sum fits an int</param>
+/// <returns>-1 if string contains not-digit characters. Otherwise, return an integer is the sum of digits</returns>
+int GetSumDigitOnString(const char* str, int strlen);
 
 /// <summary>
-/// Read a bytes stream from a connected socket 
+/// Reset the state to receive a new request
 /// </summary>
-/// <param name="receiver">The connected socket that is used for receiving bytes stream</param>
-/// <param name="bytes">Number of bytes want to read</param>
-/// <param name="omessage">[Output] The byte streams read</param>
-/// <returns>1 if read successfully. 0 if cant read completely. -1 if have errors that the socket should be closed</returns>
-int ReadSocketBuffer(SOCKET receiver, int bytes, char** omessage);
+/// <param name="state">The request state</param>
+/// <param name="is_bigint">1 for big-integer totals. 0 for 64-bit totals with overflow detection</param>
+void ResetRequest(REQUEST_STATE* state, int is_bigint = 0);
 
 /// <summary>
-/// Read and extract message from a byte stream.
+/// Start a new segmentation of the request, after its header is decoded
 /// </summary>
-/// <param name="receiver">The connected socket that is used for receiving byte streams</param>
-/// <param name="omessage">[Output] The extracted message, after removing SEGMENTATION_HEADER_SIZE first bytes from byte stream</param>
-/// <param name="omessage_len">[Output] The message size, in bytes</param>
-/// <param name="oremain">[Output] Number of bytes in root message that have not been received</param>
-/// <returns>1 if read successfully. 0 if cant read completely. -1 if have errors that the socket should be closed</returns>
-int SegmentationReceive(SOCKET receiver, char** omessage, int* omessage_len, int* oremain);
+/// <param name="state">The request state</param>
+/// <param name="current">Number of bytes in the segmentation body</param>
+/// <param name="remain">Number of bytes of the request after this segmentation</param>
+void BeginSegmentation(REQUEST_STATE* state, int current, long long remain);
 
 /// <summary>
-/// Calculate sum of digits in the string
+/// Fold a part of the current segmentation body into the request state.
+/// Same semantics as GetSumDigitOnString on the whole body: stop at '\0', error on not-digit characters.
+/// The part is summed into an int, then widened once to the 64-bit total. The bytes of a rejected request are skipped without parsing.
+/// </summary>
+/// <param name="state">The request state</param>
+/// <param name="data">The next bytes of the body</param>
+/// <param name="length">Number of bytes, not more than body_left</param>
+void FoldSegmentation(REQUEST_STATE* state, const char* data, int length);
+
+/// <summary>
+/// Add a value to a big integer
+/// </summary>
+/// <param name="limbs">The big integer, BIG_TOTAL_LIMBS limbs in BIG_TOTAL_BASE (little-endian)</param>
+/// <param name="value">The value want to add</param>
+void AddBigTotal(unsigned int* limbs, unsigned long long value);
+
+/// <summary>
+/// Encode the framed response of a complete request in place: header, then ERROR_MESSAGE, OVERFLOW_MESSAGE
+/// or the sum of digits with STATUS_OK_END. The error responses are copied from frames encoded once.
+/// Nothing is written if the frame does not fit the buffer.
+/// </summary>
+/// <param name="state">The state of the complete request</param>
+/// <param name="obuffer">[Output] The buffer holds the frame</param>
+/// <param name="buffer_size">Size of obuffer</param>
+/// <returns>Length of the frame. -1 if the buffer is not large enough</returns>
+int EncodeResponse(const REQUEST_STATE* state, char* obuffer, int buffer_size);
+
+/// <summary>
+/// Encode a framed STATUS_OK_END response that holds a number in decimal, in place
+/// </summary>
+/// <param name="obuffer">[Output] The buffer holds the frame</param>
+/// <param name="buffer_size">Size of obuffer</param>
+/// <param name="value">The number</param>
+/// <returns>Length of the frame. -1 if the buffer is not large enough</returns>
+int EncodeNumberFrame(char* obuffer, int buffer_size, unsigned long long value);
+
+/// <summary>
+/// Encode a constant response as a complete frame, to copy it without formatting
+/// </summary>
+/// <param name="status">The status (flag) for the message</param>
+/// <param name="message">The response message</param>
+/// <returns>The frame</returns>
+RESPONSE_FRAME EncodeConstantFrame(int status, const char* message);
+
+/// <summary>
+/// Count the decimal digits of a number
+/// </summary>
+/// <param name="value">The number</param>
+/// <returns>Number of digits, 1 for 0</returns>
+int CountDigits(unsigned long long value);
+
+/// <summary>
+/// Write the decimal digits of a number, two at a time from a table. Without '\0'.
+/// </summary>
+/// <param name="obuffer">[Output] The buffer holds the digits</param>
+/// <param name="value">The number</param>
+/// <param name="digits">Number of digits written, the number is padded with leading zeros (See: CountDigits)</param>
+void WriteDigits(char* obuffer, unsigned long long value, int digits);
+
+/// <summary>
+/// Calculate sum of digits in the string, one byte per step. Same semantics as GetSumDigitOnString: stop at '\0'.
 /// </summary>
 /// <param name="str">The string input</param>
 /// <param name="strlen">Number of bytes will be processed</param>
 /// <returns>-1 if string contains not-digit characters. Otherwise, return an integer is the sum of digits</returns>
-int GetSumDigitOnString(const char* str, int strlen);
+int GetSumDigitOnStringScalar(const char* str, int strlen);
 
+#ifdef SUM_DIGIT_SIMD
 /// <summary>
-/// Handle requests: Read requests from buffer, Processing requests and Send response back.
+/// Calculate sum of digits in the string, 16 bytes per step with SSE2.
+/// A block contains '\0' or a not-digit character is finished by GetSumDigitOnStringScalar.
+/// </summary>
+/// <param name="str">The string input</param>
+/// <param name="strlen">Number of bytes will be processed</param>
+/// <returns>-1 if string contains not-digit characters. Otherwise, return an integer is the sum of digits</returns>
+int GetSumDigitOnStringSSE2(const char* str, int strlen);
+
+/// <summary>
+/// Calculate sum of digits in the string, 32 bytes per step with AVX2.
+/// A block contains '\0' or a not-digit character is finished by GetSumDigitOnStringSSE2.
+/// </summary>
+/// <param name="str">The string input</param>
+/// <param name="strlen">Number of bytes will be processed</param>
+/// <returns>-1 if string contains not-digit characters. Otherwise, return an integer is the sum of digits</returns>
+int GetSumDigitOnStringAVX2(const char* str, int strlen);
+#endif
+
+/// <summary>
+/// Choose the fastest kernel of GetSumDigitOnString supported by the CPU (CPUID) and the OS
+/// </summary>
+/// <returns>The kernel</returns>
+SUM_DIGIT_KERNEL SelectSumDigitKernel();
+
+/// <summary>
+/// Handle requests: Read requests from buffer, fold each segmentation into the request state and Send response back.
+/// A hello request is answered with APPLICATION_BUFF_MAX_SIZE: extended headers are supported, larger segmentations are not.
+/// Only the first request of a connection can be a hello, a later one is an invalid request.
 /// </summary>
 /// <param name="socket">The connected socket to the remote process</param>
+/// <param name="can_negotiate">1 if no request is received on the connection yet, kept by the caller for each connection. It is set to 0 when a request is received</param>
+/// <param name="config">Runtime options (See: SERVER_CONFIG). NULL for 64-bit totals</param>
 /// <returns>1 if have no errors. 0 if request cant be processed completely. 
 /// -1 if have errors and the socket cant be used anymore (lost connection to remote process)</returns>
-int HandleRequest(SOCKET socket);
+int HandleRequest(SOCKET socket, int* can_negotiate, const SERVER_CONFIG* config = NULL);
+
+/// <summary>
+/// Allocate an empty ring buffer
+/// </summary>
+/// <param name="ring">The ring buffer</param>
+/// <param name="size">Capacity of the ring buffer, power of 2</param>
+/// <returns>1 if allocate successfully. 0 otherwise</returns>
+int InitializeRing(RING_BUFFER* ring, int size);
+
+/// <summary>
+/// Change the capacity of a ring buffer, keep its content
+/// </summary>
+/// <param name="ring">The ring buffer</param>
+/// <param name="size">New capacity, power of 2 and not less than RingLength</param>
+/// <returns>1 if resize successfully. 0 if fail to allocate memory, the ring buffer is not changed</returns>
+int ResizeRing(RING_BUFFER* ring, int size);
+
+/// <summary>
+/// Free memory of a ring buffer
+/// </summary>
+/// <param name="ring">The ring buffer</param>
+void DestroyRing(RING_BUFFER* ring);
+
+/// <summary>
+/// Get number of bytes in a ring buffer
+/// </summary>
+/// <param name="ring">The ring buffer</param>
+/// <returns>Number of bytes can be read</returns>
+int RingLength(const RING_BUFFER* ring);
+
+/// <summary>
+/// Get number of free bytes in a ring buffer
+/// </summary>
+/// <param name="ring">The ring buffer</param>
+/// <returns>Number of bytes can be written</returns>
+int RingFree(const RING_BUFFER* ring);
+
+/// <summary>
+/// Get the contiguous free space at the tail of a ring buffer. Call RingCommit after writing to it.
+/// </summary>
+/// <param name="ring">The ring buffer</param>
+/// <param name="olength">[Output] Number of contiguous bytes can be written</param>
+/// <returns>The first free byte</returns>
+char* RingWriteSpan(RING_BUFFER* ring, int* olength);
+
+/// <summary>
+/// Get the contiguous bytes at the head of a ring buffer. Call RingConsume after reading them.
+/// </summary>
+/// <param name="ring">The ring buffer</param>
+/// <param name="olength">[Output] Number of contiguous bytes can be read</param>
+/// <returns>The first byte</returns>
+const char* RingReadSpan(const RING_BUFFER* ring, int* olength);
+
+/// <summary>
+/// Mark bytes written to the span from RingWriteSpan as produced
+/// </summary>
+/// <param name="ring">The ring buffer</param>
+/// <param name="length">Number of bytes written</param>
+void RingCommit(RING_BUFFER* ring, int length);
+
+/// <summary>
+/// Remove bytes from the head of a ring buffer
+/// </summary>
+/// <param name="ring">The ring buffer</param>
+/// <param name="length">Number of bytes want to remove</param>
+void RingConsume(RING_BUFFER* ring, int length);
+
+/// <summary>
+/// Copy bytes from the head of a ring buffer without removing them
+/// </summary>
+/// <param name="ring">The ring buffer</param>
+/// <param name="obuffer">[Output] The destination, at least <length> bytes</param>
+/// <param name="length">Number of bytes want to copy, not larger than RingLength</param>
+void RingPeek(const RING_BUFFER* ring, char* obuffer, int length);
+
+/// <summary>
+/// Append bytes to the tail of a ring buffer
+/// </summary>
+/// <param name="ring">The ring buffer</param>
+/// <param name="source">The bytes want to append</param>
+/// <param name="length">Number of bytes want to append</param>
+/// <returns>1 if append successfully. 0 if the free space is not enough, nothing is appended</returns>
+int RingWrite(RING_BUFFER* ring, const char* source, int length);
+
+/// <summary>
+/// Serve all connections of the listener in one thread: wait for readiness of the sockets (epoll on Linux, WSAPoll otherwise),
+/// accept new connections and advance the state of each ready connection without blocking.
+/// epoll returns the ready sockets only, so idle connections cost nothing but the deadline checks.
+/// This function only returns if the listener can't be polled anymore.
+/// </summary>
+/// <param name="listener">The listener socket, in listen state</param>
+/// <param name="config">The server options</param>
+/// <param name="worker">The worker runs the event loop, its counters are updated. NULL if not counted</param>
+/// <returns>0 if the event loop stops because of errors</returns>
+int RunEventLoop(SOCKET listener, const SERVER_CONFIG* config, WORKER* worker = NULL);
+
+#ifdef SERVER_EPOLL
+/// <summary>
+/// Register the events that a connection of the epoll event loop is waiting for (See: GetConnectionEvents), if they changed
+/// </summary>
+/// <param name="epoll">The epoll instance</param>
+/// <param name="connection">The connection</param>
+/// <returns>1 if have no errors. 0 otherwise</returns>
+int UpdateEpollEvents(int epoll, EPOLL_CONNECTION* connection);
+
+/// <summary>
+/// Destroy a connection of the epoll event loop, the last connection is moved to its index.
+/// Closing its socket removes it from the epoll instance.
+/// </summary>
+/// <param name="connections">The connections of the event loop</param>
+/// <param name="count">Number of connections, decreased by one</param>
+/// <param name="connection">The connection</param>
+void DestroyEpollConnection(EPOLL_CONNECTION** connections, int* count, EPOLL_CONNECTION* connection);
+#endif
+
+/// <summary>
+/// Run the io_uring event loop (See: RunUringLoop) if the system supports it and the poll option is not specified,
+/// otherwise the poll event loop (See: RunEventLoop)
+/// </summary>
+/// <param name="listener">The listener socket, in listen state</param>
+/// <param name="config">The server options</param>
+/// <param name="worker">The worker runs the event loop, its counters are updated. NULL if not counted</param>
+/// <returns>0 if the event loop stops because of errors</returns>
+int RunServerLoop(SOCKET listener, const SERVER_CONFIG* config, WORKER* worker = NULL);
+
+#ifdef SERVER_IO_URING
+/// <summary>
+/// Serve all connections of the listener in one thread with io_uring: a multishot accept on the listener,
+/// a multishot recv on each connection with buffers picked by the kernel from a provided ring,
+/// and a sendmsg of the queued responses. The operations prepared while handling completions are submitted
+/// with the wait for the next completions, so one system call serves many requests under load.
+/// This function only returns if the io_uring can't be used anymore.
+/// </summary>
+/// <param name="listener">The listener socket, in listen state</param>
+/// <param name="config">The server options</param>
+/// <param name="worker">The worker runs the event loop, its counters are updated. NULL if not counted</param>
+/// <returns>0 if the event loop stops because of errors. -1 if the io_uring can't be set up, nothing is done</returns>
+int RunUringLoop(SOCKET listener, const SERVER_CONFIG* config, WORKER* worker = NULL);
+
+/// <summary>
+/// Set up an io_uring and register its provided buffers. It needs Linux 6.0 (multishot recv with provided buffer rings).
+/// </summary>
+/// <param name="oring">[Output] The io_uring</param>
+/// <returns>1 if set up successfully. 0 otherwise, nothing is allocated</returns>
+int SetupUring(URING* oring);
+
+/// <summary>
+/// Unmap the queues and the provided buffers of an io_uring, and close it
+/// </summary>
+/// <param name="ring">The io_uring</param>
+void DestroyUring(URING* ring);
+
+/// <summary>
+/// Get a free submission queue entry, zeroed. The queued entries are submitted first if the queue is full.
+/// </summary>
+/// <param name="ring">The io_uring</param>
+/// <returns>The entry. NULL if the queue is still full</returns>
+struct io_uring_sqe* GetUringEntry(URING* ring);
+
+/// <summary>
+/// Submit the queued entries, and wait for completions
+/// </summary>
+/// <param name="ring">The io_uring</param>
+/// <param name="wait_numbers">Number of completions want to wait for. 0 for not waiting</param>
+/// <param name="timeout">In milliseconds, the longest wait. -1 for no limit</param>
+/// <returns>1 if have no errors. 0 if interrupted or timed out. -1 if the io_uring can't be used anymore</returns>
+int SubmitUring(URING* ring, int wait_numbers, int timeout = -1);
+
+/// <summary>
+/// Give a provided buffer back to the kernel, after its bytes are consumed
+/// </summary>
+/// <param name="ring">The io_uring</param>
+/// <param name="id">The buffer id, from the flags of the recv completion</param>
+void RecycleUringBuffer(URING* ring, int id);
+
+/// <summary>
+/// Queue a multishot accept on the listener
+/// </summary>
+/// <param name="ring">The io_uring</param>
+/// <param name="listener">The listener socket</param>
+/// <returns>1 if queue successfully. 0 otherwise</returns>
+int PrepareUringAccept(URING* ring, SOCKET listener);
+
+/// <summary>
+/// Queue a recv on a connection, with the provided buffers: multishot if it has no responses queued, single-shot otherwise
+/// </summary>
+/// <param name="ring">The io_uring</param>
+/// <param name="connection">The connection, no recv armed</param>
+/// <returns>1 if queue successfully. 0 otherwise</returns>
+int PrepareUringReceive(URING* ring, URING_CONNECTION* connection);
+
+/// <summary>
+/// Queue a sendmsg of the responses in the output buffer of a connection, if it has some and no sendmsg is in flight
+/// </summary>
+/// <param name="ring">The io_uring</param>
+/// <param name="connection">The connection</param>
+/// <returns>1 if have no errors. 0 if fail to queue</returns>
+int PrepareUringSend(URING* ring, URING_CONNECTION* connection);
+
+/// <summary>
+/// Arm or cancel the multishot recv of a connection, as the poll event loop stops reading when the input buffer is full:
+/// it is cancelled while the requests received wait for output space (See: IsInputBlocked), armed again after.
+/// </summary>
+/// <param name="ring">The io_uring</param>
+/// <param name="connection">The connection, not closing</param>
+/// <returns>1 if have no errors. 0 if fail to queue</returns>
+int UpdateUringReceive(URING* ring, URING_CONNECTION* connection);
+
+/// <summary>
+/// Append the provided buffers held by a connection to its input buffer, in the order received, and recycle them.
+/// The input buffer does not grow for the bytes received while the recv is cancelled.
+/// </summary>
+/// <param name="ring">The io_uring</param>
+/// <param name="connection">The connection</param>
+/// <param name="is_all">1 to append all of them. 0 to stop when the requests wait for output space (See: IsInputBlocked)</param>
+/// <returns>1 if have no errors. -1 if have errors and the connection should be closed</returns>
+int AppendHeldBuffers(URING* ring, URING_CONNECTION* connection, int is_all);
+
+/// <summary>
+/// Handle a completion of the io_uring event loop: accept a connection, process the bytes received or the bytes sent
+/// </summary>
+/// <param name="ring">The io_uring</param>
+/// <param name="cqe">The completion</param>
+/// <param name="listener">The listener socket</param>
+/// <param name="config">The server options</param>
+/// <param name="worker">The worker runs the event loop. NULL if not counted</param>
+/// <returns>1 if have no errors. -1 if the listener can't accept anymore</returns>
+int OnUringCompletion(URING* ring, const struct io_uring_cqe* cqe, SOCKET listener, const SERVER_CONFIG* config, WORKER* worker);
+
+/// <summary>
+/// Append the bytes received by a connection to its input buffer, and process them.
+/// The input buffer grows if the requests can't be processed while the responses wait for output space,
+/// the connection is closed if it would exceed the memory budgets.
+/// </summary>
+/// <param name="connection">The connection</param>
+/// <param name="data">The bytes received</param>
+/// <param name="length">Number of bytes received</param>
+/// <returns>1 if have no errors. -1 if have errors and the connection should be closed</returns>
+int AppendInput(CONNECTION* connection, const char* data, int length);
+
+/// <summary>
+/// Close a connection of the io_uring event loop: cancel its operations in flight,
+/// and destroy it when none is in flight anymore
+/// </summary>
+/// <param name="ring">The io_uring</param>
+/// <param name="connection">The connection</param>
+void CloseUringConnection(URING* ring, URING_CONNECTION* connection);
+#endif
+
+/// <summary>
+/// Start worker threads, each runs its own event loop. If the system supports SO_REUSEPORT, each worker
+/// has its own listener bound to the same port, otherwise all workers share the listener.
+/// Print the counters of workers periodically. This function does not return unless no worker can be started.
+/// </summary>
+/// <param name="listener">The first listener socket, in listen state (created with reuse_port if possible)</param>
+/// <param name="port">The port number of the listener</param>
+/// <param name="config">The server options, contains number of worker threads</param>
+/// <returns>0 if no worker can be started</returns>
+int RunWorkers(SOCKET listener, int port, const SERVER_CONFIG* config);
+
+/// <summary>
+/// Print the counters of workers, and of the limits, to console
+/// </summary>
+/// <param name="workers">The workers</param>
+/// <param name="worker_numbers">Number of workers</param>
+void PrintWorkerCounters(WORKER* workers, int worker_numbers);
+
+/// <summary>
+/// Count a new connection against max_connections, before anything is allocated for it.
+/// It is refused if too many connections are open, or if the buffers of a new connection exceed server_memory.
+/// </summary>
+/// <param name="config">The server options</param>
+/// <returns>1 if the connection is admitted, it is released by DestroyConnection. 0 if it should be closed</returns>
+int AdmitConnection(const SERVER_CONFIG* config);
+
+/// <summary>
+/// Count more buffer bytes of a connection against connection_memory and server_memory
+/// </summary>
+/// <param name="connection">The connection</param>
+/// <param name="bytes">Number of bytes its buffers grow</param>
+/// <returns>1 if the bytes fit both budgets. 0 if a budget is reached, nothing is counted</returns>
+int ReserveMemory(CONNECTION* connection, int bytes);
+
+/// <summary>
+/// Give back buffer bytes of a connection to the budgets
+/// </summary>
+/// <param name="connection">The connection</param>
+/// <param name="bytes">Number of bytes its buffers shrink</param>
+void ReleaseMemory(CONNECTION* connection, int bytes);
+
+/// <summary>
+/// Grow the input buffer of a connection, within the memory budgets
+/// </summary>
+/// <param name="connection">The connection</param>
+/// <param name="size">The new size, power of 2</param>
+/// <returns>1 if the buffer grows. 0 if a budget is reached or fail to allocate memory, the buffer is kept</returns>
+int GrowInput(CONNECTION* connection, int size);
+
+/// <summary>
+/// Restart the deadlines of a connection after its bytes are processed: it is active now,
+/// and its read deadline runs while a request is partly received
+/// </summary>
+/// <param name="connection">The connection</param>
+void UpdateDeadlines(CONNECTION* connection);
+
+/// <summary>
+/// Check the read and idle deadlines of a connection, and count the one passed
+/// </summary>
+/// <param name="connection">The connection</param>
+/// <param name="now">The current timestamp, in nanoseconds (See: GetTimestamp)</param>
+/// <returns>1 if a deadline is passed and the connection should be closed. 0 otherwise</returns>
+int IsConnectionExpired(const CONNECTION* connection, long long now);
+
+/// <summary>
+/// Print the counters of the limits to console
+/// </summary>
+void PrintLimitCounters();
+
+/// <summary>
+/// Enable the instrumentation. Latencies are not measured until it is enabled, counters are always updated.
+/// </summary>
+void EnableStats();
+
+/// <summary>
+/// Check whether the instrumentation is enabled
+/// </summary>
+/// <returns>1 if enabled. 0 otherwise</returns>
+int IsStatsEnabled();
+
+/// <summary>
+/// Get the statistics of the calling thread. A slot is taken from a fixed table on the first call.
+/// When the table is full, the statistics of the thread are discarded.
+/// </summary>
+/// <returns>The statistics, written only by the calling thread</returns>
+STATS* GetThreadStats();
+
+/// <summary>
+/// Start measuring a latency. The latencies are sampled, at random intervals of STATS_TIMER_SAMPLING on average.
+/// </summary>
+/// <returns>The start timestamp. 0 if the instrumentation is disabled or the latency is not sampled</returns>
+long long StartTimer();
+
+/// <summary>
+/// Record the latency since StartTimer in a histogram of the calling thread
+/// </summary>
+/// <param name="histogram">The histogram: STATS_ACCEPT, STATS_RECEIVE, STATS_SUM_DIGIT or STATS_SEND</param>
+/// <param name="start">The timestamp returned by StartTimer</param>
+void StopTimer(int histogram, long long start);
+
+/// <summary>
+/// Increase a counter that has one writer, without locked instructions
+/// </summary>
+/// <param name="counter">The counter</param>
+/// <param name="value">The value to add</param>
+void IncreaseCounter(std::atomic<long long>* counter, long long value = 1);
+
+/// <summary>
+/// Merge the statistics of every thread and Write them as text
+/// </summary>
+/// <param name="obuffer">[Output] The text, terminated by '\0'</param>
+/// <param name="buffer_size">Size of obuffer</param>
+/// <returns>Length of the text</returns>
+int DumpStats(char* obuffer, int buffer_size);
+
+/// <summary>
+/// Serve the statistics dump on 127.0.0.1:<port>: each connection receives a dump, then it is closed.
+/// Runs on its own thread.
+/// </summary>
+/// <param name="port">The port</param>
+void RunStatsServer(int port);
+
+/// <summary>
+/// Start the thread prints the log records, and route LogMessage to QueueLogMessage.
+/// Records logged before it are printed directly.
+/// </summary>
+void StartLogging();
+
+/// <summary>
+/// Stop the logging thread and print the remaining records. LogMessage prints directly again.
+/// Call it after the other threads stop logging.
+/// </summary>
+void StopLogging();
+
+/// <summary>
+/// The log handler of the server (See: SetLogHandler).
+/// Log a message without blocking: the record is queued for the logging thread, or counted as dropped if the queue is full.
+/// Repeated records of the same message are limited to LOG_RATE_BURST each LOG_RATE_INTERVAL.
+/// The number of records suppressed is reported with the next record of the message, or when its slot is evicted.
+/// </summary>
+/// <param name="flags">ERROR_FLAGS, WARNING_FLAGS or INFO_FLAGS</param>
+/// <param name="error">The error code. 0 if has no code</param>
+/// <param name="message">The message, a constant that lives as long as the program</param>
+void QueueLogMessage(const char* flags, int error, const char* message);
+
+/// <summary>
+/// Queue a record for the logging thread, or print it directly if the logging thread is not running.
+/// The record is counted as dropped if the queue is full.
+/// </summary>
+/// <param name="ring">The log queue of the calling thread</param>
+/// <param name="record">The record</param>
+void EnqueueLogRecord(LOG_RING* ring, const LOG_RECORD* record);
+
+/// <summary>
+/// Find the rate limit slot of a message, by linear probing from the slot of its address.
+/// </summary>
+/// <param name="ring">The log queue of the calling thread, it owns the slots</param>
+/// <param name="message">The message</param>
+/// <returns>The slot of the message, or a free slot. If every slot holds another message, the one with the oldest window, to evict</returns>
+LOG_RATE* GetLogRate(LOG_RING* ring, const char* message);
+
+/// <summary>
+/// Get the log queue of the calling thread. A slot is taken from a fixed table on the first call.
+/// </summary>
+/// <returns>The queue. NULL if the table is full</returns>
+LOG_RING* GetThreadLog();
+
+/// <summary>
+/// Print a log record in the format "[flags:error] message", with the number of records suppressed before it
+/// </summary>
+/// <param name="record">The record</param>
+void PrintLogRecord(const LOG_RECORD* record);
+
+/// <summary>
+/// Print the queued records of every thread
+/// </summary>
+void FlushLogs();
+
+/// <summary>
+/// Flush the logs each LOG_FLUSH_INTERVAL until StopLogging. Runs on its own thread.
+/// </summary>
+void RunLogFlusher();
+
+/// <summary>
+/// Create the state for a new accepted connection, if the limits admit it (See: AdmitConnection).
+/// The socket is set to non-blocking mode.
+/// </summary>
+/// <param name="socket">The connected socket</param>
+/// <param name="config">The server options</param>
+/// <param name="worker">The worker owns the connection. NULL if not counted</param>
+/// <returns>The connection state. NULL if refused, fail to allocate memory or set non-blocking mode</returns>
+CONNECTION* CreateConnection(SOCKET socket, const SERVER_CONFIG* config, WORKER* worker = NULL);
+
+/// <summary>
+/// Close the connection socket and free the connection state, its buffers and itself are released from the limits
+/// </summary>
+/// <param name="connection">The connection want to destroy</param>
+void DestroyConnection(CONNECTION* connection);
+
+/// <summary>
+/// Read the available bytes of a non-blocking socket, at most <length> bytes.
+/// </summary>
+/// <param name="receiver">The non-blocking connected socket</param>
+/// <param name="buffer">The destination buffer</param>
+/// <param name="length">Maximum number of bytes want to read</param>
+/// <returns>Number of bytes read. 0 if no bytes available now. -1 if have errors that the socket should be closed</returns>
+int ReadAvailable(SOCKET receiver, char* buffer, int length);
+
+/// <summary>
+/// Write as many bytes as a non-blocking socket accepts now.
+/// </summary>
+/// <param name="sender">The non-blocking connected socket</param>
+/// <param name="buffer">The bytes want to send</param>
+/// <param name="length">Number of bytes want to send</param>
+/// <returns>Number of bytes sent. 0 if the socket buffer is full. -1 if have errors that the socket should be closed</returns>
+int WriteAvailable(SOCKET sender, const char* buffer, int length);
+
+/// <summary>
+/// Segmentation a message into a buffer, in the same format as SegmentationSend.
+/// </summary>
+/// <param name="obuffer">[Output] The buffer holds the segmentations</param>
+/// <param name="buffer_size">Size of the buffer</param>
+/// <param name="message">The message want to segmentation</param>
+/// <param name="message_len">The length of the message</param>
+/// <param name="segment_size">Maximum size of a segmentation, include header</param>
+/// <returns>Number of bytes written to buffer. -1 if the buffer is not large enough</returns>
+int EncodeSegmentation(char* obuffer, int buffer_size, const char* message, int message_len, int segment_size = APPLICATION_BUFF_MAX_SIZE);
+
+/// <summary>
+/// Get the events that a connection is waiting for: readable if its input buffer has space,
+/// writable if it has queued responses.
+/// </summary>
+/// <param name="connection">The connection</param>
+/// <returns>The events for WSAPoll</returns>
+short GetConnectionEvents(const CONNECTION* connection);
+
+/// <summary>
+/// Check whether the requests received by a connection wait for output space: its output buffer has no space for a response,
+/// and its input buffer is not empty after ProcessInput
+/// </summary>
+/// <param name="connection">The connection</param>
+/// <returns>1 if blocked, the connection should not receive more. 0 otherwise</returns>
+int IsInputBlocked(const CONNECTION* connection);
+
+/// <summary>
+/// Read the available bytes of a connection into its input buffer, process the complete segmentations and send the responses.
+/// </summary>
+/// <param name="connection">The readable connection</param>
+/// <returns>1 if have no errors. -1 if have errors and the connection should be closed</returns>
+int OnConnectionReadable(CONNECTION* connection);
+
+/// <summary>
+/// Continue sending the queued responses of a connection, then process the requests waiting for output space.
+/// </summary>
+/// <param name="connection">The writable connection</param>
+/// <returns>1 if have no errors. -1 if have errors and the connection should be closed</returns>
+int OnConnectionWritable(CONNECTION* connection);
+
+/// <summary>
+/// Fold the bytes in the input buffer of a connection into its request state, segmentation by segmentation.
+/// A response is queued when the last byte of a request is folded. Pipelined requests are processed and responded in order.
+/// </summary>
+/// <param name="connection">The connection</param>
+/// <returns>1 if have no errors. -1 if the input is invalid and the connection should be closed</returns>
+int ProcessInput(CONNECTION* connection);
+
+/// <summary>
+/// Send the queued responses of a connection, until the queue is empty or the socket buffer is full.
+/// </summary>
+/// <param name="connection">The connection</param>
+/// <returns>1 if have no errors. -1 if have errors and the connection should be closed</returns>
+int FlushOutput(CONNECTION* connection);
+
+/// <summary>
+/// Agree the segmentation size requested by the first request of a connection ("#HELLO <size>", See: HELLO_MESSAGE),
+/// and queue the agreed size as response. The size is limited by the max_segment_size option.
+/// </summary>
+/// <param name="connection">The connection</param>
+/// <param name="size">The segmentation size requested by the client</param>
+/// <returns>1 if have no errors. 0 if fail to allocate memory or queue the response</returns>
+int NegotiateSegmentation(CONNECTION* connection, int size);
+
+/// <summary>
+/// Queue the response for the request read on a connection (error message or sum of digits) in its output buffer.
+/// The frame is encoded right in the buffer, unless it would wrap around the buffer end.
+/// </summary>
+/// <param name="connection">The connection has received a complete request</param>
+/// <returns>1 if queue successfully. 0 otherwise</returns>
+int QueueResponse(CONNECTION* connection);
 
 /// <summary>
 /// Extract port number from command-line arguments.
@@ -167,33 +1041,25 @@ int HandleRequest(SOCKET socket);
 int ExtractCommand(int argc, char* argv[], int* oport);
 
 /// <summary>
-/// Create a INADDR_ANY IP Address
+/// Extract server options from command-line arguments.
+/// If an option has error, use its default value
 /// </summary>
-/// <returns>The INADDR_ANY IP</returns>
-IP CreateDefaultIP();
-
-/// <summary>
-/// Create a new memory space and Copy <length> bytes from <root> to it.
-/// </summary>
-/// <param name="source">The source bytes</param>
-/// <param name="length">Number of bytes want to copy</param>
-/// <param name="start">The first byte in destination will hold the 0th byte of source</param>
-/// <returns>New memory space contains content of source. NULL if fail to allocate memory</returns>
-char* Clone(const char* source, int length, int start = 0);
+/// <param name="argc">Number of Arguments [From main()]</param>
+/// <param name="argv">Arguments value [From main()]</param>
+/// <param name="oconfig">[Output] The extracted options</param>
+/// <returns>1 if extract successfully. 0 if some options have errors</returns>
+int ExtractOptions(int argc, char* argv[], SERVER_CONFIG* oconfig);
 
 /// <summary>
-/// Create a Message object that used to send back to client.
-/// The first bit of Message is the message's status: See STATUS_ definitions
+/// Write a Message to a buffer owned by caller: the status character (See: STATUS_ definitions),
+/// then the message with its '\0'. The message is truncated if the buffer is not large enough.
+/// The responses of requests are written by EncodeResponse, which frames them in the same format.
 /// </summary>
 /// <param name="status">The status (flag) for the message</param>
-/// <param name="message">The response message want to send</param>
-/// <returns>A message with status</returns>
-MESSAGE CreateMessage(int status, const char* message);
-
-/// <summary>
-/// Free memory for Message object
-/// </summary>
-/// <param name="m">The message want to free</param>
-void DestroyMessage(MESSAGE m);
+/// <param name="message">The response message want to write</param>
+/// <param name="obuffer">[Output] The buffer holds the message</param>
+/// <param name="buffer_size">Size of the buffer</param>
+/// <returns>Number of bytes written, include the status and the last '\0'</returns>
+int BuildMessage(int status, const char* message, char* obuffer, int buffer_size);
 
 #pragma endregion
\ No newline at end of file
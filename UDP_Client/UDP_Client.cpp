@@ -1,5 +1,6 @@
 #include "UDP_Client.h"
 
+#ifndef UDP_CLIENT_LIBRARY // defined when the tests link the client functions
 int main(int argc, char* argv[]) 
 {
     int server_port;
@@ -19,23 +20,57 @@ int main(int argc, char* argv[])
         scanf_s("%c", &c, 1); // consume '\n'
     }
     
+    if (is_ok && HasOption(argc, argv, LOAD_OPTION)) {
+        LOAD_CONFIG load;
+        if (!ExtractLoadOptions(argc, argv, &load))
+            printf("[%s] %s\n", WARNING_FLAGS, _CONVERT_LOAD_OPTIONS_FAIL);
+        if (WSInitialize()) {
+            RunLoad(CreateSocketAddress(server_ip, server_port), &load);
+            WSCleanup();
+        }
+        is_ok = 0;
+    }
+
+    if (is_ok && HasOption(argc, argv, FLOOD_OPTION)) {
+        if (WSInitialize()) {
+            int queries = GetIntOption(argc, argv, FLOOD_OPTION, 0);
+            int sockets = GetIntOption(argc, argv, SOCKETS_OPTION, 1);
+            if (queries < 1 || sockets < 1 || sockets > MAX_FLOOD_SOCKETS) {
+                printf("[%s] %s\n", WARNING_FLAGS, _CONVERT_LOAD_OPTIONS_FAIL);
+                queries = queries < 1 ? 1 : queries;
+                sockets = 1;
+            }
+            const char* name = GetStringOption(argc, argv, NAME_OPTION);
+            if (name == NULL)
+                name = DEFAULT_FLOOD_NAME;
+            RunFlood(CreateSocketAddress(server_ip, server_port), queries, sockets, name, !HasOption(argc, argv, LEGACY_OPTION));
+            WSCleanup();
+        }
+        is_ok = 0;
+    }
+
     if (is_ok && WSInitialize()) {
         SOCKET socket = CreateSocket(UDP);
         if (socket != INVALID_SOCKET) {
-            SetReceiveTimeout(socket, RECEIVE_TIMEOUT_INTERVAL);
             printf("[%s] Ready to communicate...\n", INFO_FLAGS);
 
             ADDRESS server = CreateSocketAddress(server_ip, server_port);
             char request[USER_INPUT_MAX_SIZE];
+            int is_packed = !HasOption(argc, argv, LEGACY_OPTION);
+            int retries;
+            if (!ExtractRetries(argc, argv, &retries))
+                printf("[%s] %s\n", WARNING_FLAGS, _CONVERT_LOAD_OPTIONS_FAIL);
+            // the timeouts follow the round-trip time of the server, learned by the answers
+            RTT_ESTIMATOR rtt;
+            InitializeRTT(&rtt);
+            unsigned int seed = (unsigned int)GetTimestamp() | 1;
 
             while (1) {
                 printf("[%s] Enter your request (domain name): ", USER_INPUT_FLAGS);
                 gets_s(request, USER_INPUT_MAX_SIZE);
                 if (strlen(request) == 0)
                     break;
-                if (Send(socket, request, server)) {
-                    HandleResponse(socket, server);
-                }
+                HandleResponse(socket, server, request, is_packed, retries, &rtt, &seed);
             }
         }
         CloseSocket(socket, CLOSE_NORMAL);
@@ -45,189 +80,637 @@ int main(int argc, char* argv[])
     printf("[%s] Stopping...\n", INFO_FLAGS);
     return 0;
 }
+#endif
 
-#pragma region Socket Common
+#pragma region Handle Response
 
-int WSInitialize()
+int PrintResponse(const MESSAGE message, const char* title)
 {
-    WORD version = MAKEWORD(2, 2);
-    WSADATA wsa_data;
-    if (WSAStartup(version, &wsa_data)) {
-        printf("[%s] %s\n", ERROR_FLAGS, _INITIALIZE_FAIL);
-        WSACleanup();
-        return 0;
+    int has_next = 0;
+    if (strlen(message) == 0) {
     }
-    return 1;
+    if (message[0] == STATUS_ERROR_CHAR) {
+        printf("\t%s\n", message + 1);
+    }
+    else if (message[0] == STATUS_OK_CHAR || message[0] == STATUS_OK_END_CHAR) {
+        if (title != NULL) {
+            printf("%s", title);
+        }
+        printf("\t%s\n", message + 1);
+        has_next = (message[0] == STATUS_OK_CHAR);
+    }
+    else if (message[0] == STATUS_LIST_CHAR || message[0] == STATUS_LIST_END_CHAR) {
+        if (title != NULL) {
+            printf("%s", title);
+        }
+        // one address per line, as the responses of the old format
+        const char* address = message + 1;
+        while (*address != '\0') {
+            const char* delimiter = strchr(address, ADDRESS_DELIMITER);
+            int length = delimiter != NULL ? (int)(delimiter - address) : (int)strlen(address);
+            printf("\t%.*s\n", length, address);
+            address += length;
+            if (*address == ADDRESS_DELIMITER)
+                address++;
+        }
+        has_next = (message[0] == STATUS_LIST_CHAR);
+    }
+    return has_next;
+}
+
+int SendRequest(SOCKET sender, const char* name, ADDRESS receiver, int is_packed, const unsigned int* id)
+{
+    if (!is_packed && id == NULL)
+        return Send(sender, name, receiver);
+    char request[APPLICATION_BUFF_MAX_SIZE];
+    int length = (int)strlen(name) + 1;
+    if (length + 1 + QUERY_ID_SIZE > APPLICATION_BUFF_MAX_SIZE)
+        return Send(sender, name, receiver); // no room for the flags, the server answers in the old format
+    memcpy(request, name, length);
+    if (is_packed)
+        request[length++] = REQUEST_PACKED_FLAG;
+    if (id != NULL)
+        length += EncodeQueryID(request + length, *id);
+    return SendBytes(sender, request, length, receiver);
+}
+
+int GetResponseID(const char* response, int length, unsigned int* oid)
+{
+    int message_length = (int)strlen(response) + 1;
+    return DecodeQueryID(response + message_length, length - message_length, oid);
 }
 
-int WSCleanup()
+unsigned int CreateQueryID(unsigned int* seed)
 {
-    return WSACleanup();
+    return NextRandom(seed) & ~QUERY_ATTEMPT_MASK;
 }
 
-ADDRESS CreateSocketAddress(IP ip, int port)
+void InitializeRTT(RTT_ESTIMATOR* ortt)
 {
-    ADDRESS addr;
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port);
-    addr.sin_addr = ip;
-    return addr;
+    ortt->srtt = 0;
+    ortt->rttvar = 0;
+    ortt->rto = INITIAL_RTO * 1000000LL;
 }
 
-SOCKET CreateSocket(int protocol)
+void UpdateRTT(RTT_ESTIMATOR* rtt, long long sample)
 {
-    SOCKET s = INVALID_SOCKET;
-    if (protocol == UDP) {
-        s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (rtt->srtt == 0) {
+        rtt->srtt = sample;
+        rtt->rttvar = sample / 2;
     }
-    else if (protocol == TCP) {
-        s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    else {
+        // RTTVAR = 3/4 RTTVAR + 1/4 |SRTT - R|, then SRTT = 7/8 SRTT + 1/8 R
+        long long error = rtt->srtt > sample ? rtt->srtt - sample : sample - rtt->srtt;
+        rtt->rttvar = (3 * rtt->rttvar + error) / 4;
+        rtt->srtt = (7 * rtt->srtt + sample) / 8;
     }
+    rtt->rto = rtt->srtt + 4 * rtt->rttvar;
+    if (rtt->rto < MIN_RTO * 1000000LL)
+        rtt->rto = MIN_RTO * 1000000LL;
+    if (rtt->rto > MAX_RTO * 1000000LL)
+        rtt->rto = MAX_RTO * 1000000LL;
+}
 
-    if (s == INVALID_SOCKET) {
-        printf("[%s] %s\n", ERROR_FLAGS, _CREATE_SOCKET_FAIL);
+long long GetRetransmissionTimeout(const RTT_ESTIMATOR* rtt, int attempt)
+{
+    long long timeout = rtt->rto;
+    for (int i = 0; i < attempt && timeout < MAX_RTO * 1000000LL; i++)
+        timeout *= 2;
+    return timeout < MAX_RTO * 1000000LL ? timeout : MAX_RTO * 1000000LL;
+}
+
+int HandleResponse(SOCKET socket, ADDRESS server, const char* name, int is_packed, int retries, RTT_ESTIMATOR* rtt, unsigned int* seed)
+{
+    char response[APPLICATION_BUFF_MAX_SIZE];
+    const char* title = RESPONSE_TITLE;
+    unsigned int query_id = CreateQueryID(seed);
+    long long sent_at[MAX_RETRIES + 1];
+    int transmissions = 0;
+    int answering = -1; // the transmission whose answer is printed. -1 before its first datagram
+    long long deadline = 0;
+    while (1) {
+        long long now = GetTimestamp();
+        if (now >= deadline) {
+            if (transmissions > retries) {
+                printf("[%s] %s\n", WARNING_FLAGS, _NO_ANSWER);
+                return 0;
+            }
+            // each transmission has its own ID, so the answer tells which one it is for
+            unsigned int id = query_id | transmissions;
+            sent_at[transmissions] = now;
+            if (!SendRequest(socket, name, server, is_packed, &id))
+                return 0;
+            deadline = now + GetRetransmissionTimeout(rtt, transmissions);
+            transmissions++;
+            if (answering != -1) {
+                // a part of an answer is lost, the next answer is printed whole
+                answering = -1;
+                title = RESPONSE_TITLE;
+            }
+            continue;
+        }
+
+        WSAPOLLFD fd = { socket, POLLRDNORM, 0 };
+        int ret = WSAPoll(&fd, 1, (int)((deadline - now + 999999) / 1000000));
+        if (ret == SOCKET_ERROR) {
+            int err = WSAGetLastError();
+            if (err != WSAEINTR) {
+                printf("[%s:%d] %s\n", WARNING_FLAGS, err, _POLL_FAIL);
+                return 0;
+            }
+            continue;
+        }
+        if (ret == 0)
+            continue;
+        ADDRESS sender;
+        socklen_t sender_len = sizeof(sender);
+        int length = recvfrom(socket, response, sizeof(response) - 1, 0, (SOCKADDR*)&sender, &sender_len);
+        if (length == SOCKET_ERROR)
+            continue; // a datagram too large, or an error reported by an ICMP message: wait for the answer
+        response[length] = '\0';
+        if (sender.sin_addr.s_addr != server.sin_addr.s_addr || sender.sin_port != server.sin_port)
+            continue;
+
+        unsigned int id;
+        int attempt = transmissions - 1; // an old server does not echo the ID
+        int has_id = GetResponseID(response, length, &id);
+        if (has_id) {
+            attempt = (int)(id & QUERY_ATTEMPT_MASK);
+            if ((id & ~QUERY_ATTEMPT_MASK) != query_id || attempt >= transmissions)
+                continue; // late answer of a previous query
+        }
+        if (answering == -1) {
+            answering = attempt;
+            // without ID, the transmission answered is unknown after a retransmission (Karn's algorithm)
+            if (has_id || transmissions == 1)
+                UpdateRTT(rtt, GetTimestamp() - sent_at[attempt]);
+        }
+        else if (attempt != answering)
+            continue; // the same answer, for another transmission
+        if (!PrintResponse(response, title))
+            return 1;
+        title = NULL; // Only use title for the first response.
     }
-    return s;
 }
+#pragma endregion
 
-int CloseSocket(SOCKET socket, int mode, int flags)
+#pragma region Flood Benchmark
+
+int RunFlood(ADDRESS server, int queries, int sockets, const char* name, int is_packed)
 {
-    if (socket == INVALID_SOCKET)
-        return 1;
-    int is_ok = 1;
-    if (mode == CLOSE_SAFELY) {
-        if (shutdown(socket, flags) == SOCKET_ERROR) {
-            is_ok = 0;
-            printf("[%s:%d] %s\n", WARNING_FLAGS, WSAGetLastError(), _SHUTDOWN_SOCKET_FAIL);
+    FLOOD_WORKER* workers = new FLOOD_WORKER[sockets];
+    std::thread* threads = new std::thread[sockets * 2];
+    int started = 0;
+    printf("[%s] Flood: %d queries of \"%s\", %d sockets, %s responses\n", INFO_FLAGS, queries, name, sockets, is_packed ? "packed" : "legacy");
+
+    long long start = GetTimestamp();
+    for (int i = 0; i < sockets; i++) {
+        FLOOD_WORKER* worker = &workers[i];
+        worker->socket = CreateSocket(UDP);
+        worker->server = server;
+        worker->name = name;
+        worker->is_packed = is_packed;
+        // spread the queries, the first sockets take the rest
+        worker->queries = queries / sockets + (i < queries % sockets);
+        worker->is_sent = 0;
+        worker->answered = 0;
+        worker->replies = 0;
+        worker->last_reply = start;
+        if (worker->socket == INVALID_SOCKET) {
+            worker->queries = 0;
+            continue;
         }
+        SetReceiveTimeout(worker->socket, FLOOD_QUIET_INTERVAL);
+        threads[started++] = std::thread(ReceiveFlood, worker);
+        threads[started++] = std::thread(SendFlood, worker);
     }
-    if (closesocket(socket) == SOCKET_ERROR) {
-        is_ok = 0;
-        printf("[%s:%d] %s\n", WARNING_FLAGS, WSAGetLastError(), _CLOSE_SOCKET_FAIL);
+    for (int i = 0; i < started; i++)
+        threads[i].join();
+
+    long long sent = 0, answered = 0, replies = 0, end = start;
+    for (int i = 0; i < sockets; i++) {
+        sent += workers[i].queries;
+        answered += workers[i].answered;
+        replies += workers[i].replies;
+        if (workers[i].last_reply > end)
+            end = workers[i].last_reply;
+        CloseSocket(workers[i].socket, CLOSE_NORMAL);
+    }
+    double seconds = (end - start) / 1e9;
+    printf("[%s] %lld queries answered in %.3f seconds: %.0f queries/s, %lld response datagrams\n", INFO_FLAGS,
+        answered, seconds, seconds > 0 ? answered / seconds : 0, replies);
+    printf("[%s] Dropped: %lld of %lld queries (%.2f%%)\n", INFO_FLAGS, sent - answered, sent,
+        sent > 0 ? 100.0 * (sent - answered) / sent : 0);
+
+    delete[] threads;
+    delete[] workers;
+    return started > 0;
+}
+
+void SendFlood(FLOOD_WORKER* worker)
+{
+    for (int i = 0; i < worker->queries; i++)
+        SendRequest(worker->socket, worker->name, worker->server, worker->is_packed);
+    worker->is_sent.store(1, std::memory_order_release);
+}
+
+void ReceiveFlood(FLOOD_WORKER* worker)
+{
+    char buffer[APPLICATION_BUFF_MAX_SIZE];
+    while (worker->answered < worker->queries) {
+        int ret = recv(worker->socket, buffer, sizeof(buffer), 0);
+        if (ret == SOCKET_ERROR) {
+            // nothing for FLOOD_QUIET_INTERVAL: the rest is dropped if all queries are sent
+            if (worker->is_sent.load(std::memory_order_acquire))
+                break;
+            continue;
+        }
+        worker->replies++;
+        if (ret > 0 && (buffer[0] == STATUS_OK_END_CHAR || buffer[0] == STATUS_LIST_END_CHAR || buffer[0] == STATUS_ERROR_CHAR))
+            worker->answered++;
+        worker->last_reply = GetTimestamp();
     }
-    return is_ok;
 }
 
 #pragma endregion
 
-#pragma region Send and Receive
+#pragma region Load Generator
 
-int Receive(SOCKET receiver, char** omessage, ADDRESS* osender_addr)
+int RunLoad(ADDRESS server, const LOAD_CONFIG* config)
 {
-    char buffer[APPLICATION_BUFF_MAX_SIZE];
-    ADDRESS _sender_addr;
-    int _sender_addr_len = sizeof(_sender_addr);
+    NAME_LIST names = { NULL, 0, NULL };
+    int is_ok = config->names_path != NULL ? LoadNames(config->names_path, &names) : GenerateZipfNames(config->zipf_names, &names);
+    if (!is_ok)
+        return 0;
+    LOAD_WORKER* workers = (LOAD_WORKER*)calloc(config->threads, sizeof(LOAD_WORKER));
+    HISTOGRAM* latency = (HISTOGRAM*)calloc(1, sizeof(HISTOGRAM));
+    if (workers == NULL || latency == NULL) {
+        printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+        free(workers);
+        free(latency);
+        DestroyNames(&names);
+        return 0;
+    }
+    if (config->names_path != NULL)
+        printf("[%s] Load: %d queries, window %d, %d threads, %d names of %s, %s responses\n", INFO_FLAGS, config->queries,
+            config->window, config->threads, names.count, config->names_path, config->is_packed ? "packed" : "legacy");
+    else
+        printf("[%s] Load: %d queries, window %d, %d threads, %d Zipf names, %s responses\n", INFO_FLAGS, config->queries,
+            config->window, config->threads, names.count, config->is_packed ? "packed" : "legacy");
 
-    int ret = recvfrom(receiver, buffer, APPLICATION_BUFF_MAX_SIZE, 0, (SOCKADDR*)&_sender_addr, &_sender_addr_len);
+    std::thread* threads = new std::thread[config->threads];
+    long long start = GetTimestamp();
+    for (int i = 0; i < config->threads; i++) {
+        LOAD_WORKER* worker = &workers[i];
+        worker->config = config;
+        worker->server = server;
+        worker->names = &names;
+        // spread the window and the queries, the first threads take the rest
+        worker->slots = config->window / config->threads + (i < config->window % config->threads);
+        worker->queries = config->queries / config->threads + (i < config->queries % config->threads);
+        worker->seed = 2654435761u * (i + 1);
+        worker->next_name = i;
+        InitializeRTT(&worker->rtt);
+        threads[i] = std::thread(RunLoadWorker, worker);
+    }
 
-    int is_ok = 1;
-    if (ret == SOCKET_ERROR) {
-        int err = WSAGetLastError();
-        if (err == WSAEMSGSIZE) {
-            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _MESSAGE_TOO_LARGE);
-        }
-        else {
-            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _RECEIVE_FAIL);
-            is_ok = 0;
-        }
+    // merge the results
+    long long answered = 0, not_found = 0, lost = 0, replies = 0, retransmissions = 0, late = 0, dropped = 0;
+    for (int i = 0; i < config->threads; i++) {
+        threads[i].join();
+        MergeHistogram(latency, &workers[i].latency);
+        answered += workers[i].answered;
+        not_found += workers[i].not_found;
+        lost += workers[i].lost;
+        replies += workers[i].replies;
+        retransmissions += workers[i].retransmissions;
+        late += workers[i].late;
+        dropped += workers[i].dropped;
+    }
+    double seconds = (GetTimestamp() - start) / 1e9;
+    printf("[%s] %lld queries answered in %.3f seconds: %.0f queries/s, %lld response datagrams (%.2f per answer)\n", INFO_FLAGS,
+        answered, seconds, answered / seconds, replies, answered > 0 ? (double)replies / answered : 0);
+    printf("[%s] Lost: %lld of %d queries (%.2f%%), Not found: %lld, Retransmissions: %lld, Late datagrams: %lld\n", INFO_FLAGS,
+        lost, config->queries, 100.0 * lost / config->queries, not_found, retransmissions, late);
+    if (config->drop_rate > 0)
+        printf("[%s] Dropped on receipt: %lld datagrams (%d%%)\n", INFO_FLAGS, dropped, config->drop_rate);
+    if (config->timeout == 0 && workers[0].rtt.srtt > 0)
+        printf("[%s] RTT estimate of thread 0 (us): srtt %.1f, rttvar %.1f, rto %.1f\n", INFO_FLAGS,
+            workers[0].rtt.srtt / 1e3, workers[0].rtt.rttvar / 1e3, workers[0].rtt.rto / 1e3);
+    if (latency->total.load() > 0) {
+        printf("[%s] Latency (us): p50 %.1f, p90 %.1f, p99 %.1f, p999 %.1f, max %.1f\n", INFO_FLAGS,
+            GetHistogramPercentile(latency, 50) / 1e3, GetHistogramPercentile(latency, 90) / 1e3,
+            GetHistogramPercentile(latency, 99) / 1e3, GetHistogramPercentile(latency, 99.9) / 1e3, latency->max.load() / 1e3);
+        PrintLatencyHistogram(latency);
     }
-    // Copy value to output variables
-    if (is_ok == 1) {
-        if (ret >= APPLICATION_BUFF_MAX_SIZE)
-            ret = APPLICATION_BUFF_MAX_SIZE - 1;
-        buffer[ret] = '\0'; // in case buffer dont have '\0' or lost byte.
 
-        *osender_addr = _sender_addr;
-        *omessage = (char*)malloc(strlen(buffer) + 1);
+    delete[] threads;
+    free(latency);
+    free(workers);
+    DestroyNames(&names);
+    return 1;
+}
 
-        if (*omessage == NULL)
-        {
-            printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
-            is_ok = 0;
+void RunLoadWorker(LOAD_WORKER* worker)
+{
+    LOAD_SLOT* slots = (LOAD_SLOT*)calloc(worker->slots, sizeof(LOAD_SLOT));
+    WSAPOLLFD* fds = (WSAPOLLFD*)calloc(worker->slots, sizeof(WSAPOLLFD));
+    if (slots == NULL || fds == NULL) {
+        printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+        worker->lost += worker->queries;
+        free(slots);
+        free(fds);
+        return;
+    }
+    for (int i = 0; i < worker->slots; i++)
+        slots[i].socket = CreateSocket(UDP);
+
+    int sent = 0, outstanding = 0;
+    while (sent < worker->queries || outstanding > 0) {
+        long long now = GetTimestamp();
+        long long next_deadline = LLONG_MAX;
+        for (int i = 0; i < worker->slots; i++) {
+            LOAD_SLOT* slot = &slots[i];
+            if (slot->is_outstanding && slot->deadline <= now) {
+                if (slot->transmissions > worker->config->retries) {
+                    worker->lost++;
+                    slot->is_outstanding = 0;
+                    outstanding--;
+                }
+                else {
+                    // a part of an answer may be received, the next answer is taken whole
+                    slot->answering = -1;
+                    worker->retransmissions++;
+                    SendLoadQuery(worker, slot);
+                }
+            }
+            if (!slot->is_outstanding && sent < worker->queries && slot->socket != INVALID_SOCKET) {
+                slot->name = NextLoadName(worker);
+                slot->id = CreateQueryID(&worker->seed);
+                slot->transmissions = 0;
+                slot->answering = -1;
+                slot->is_outstanding = 1;
+                sent++;
+                outstanding++;
+                SendLoadQuery(worker, slot); // not sent: retransmitted at the deadline
+            }
+            if (slot->is_outstanding && slot->deadline < next_deadline)
+                next_deadline = slot->deadline;
+            fds[i].fd = slot->socket;
+            fds[i].events = POLLRDNORM;
+            fds[i].revents = 0;
+        }
+        if (outstanding == 0) {
+            if (sent < worker->queries) { // no socket left
+                worker->lost += worker->queries - sent;
+                break;
+            }
+            continue;
+        }
+
+        int timeout = (int)((next_deadline - now + 999999) / 1000000); // in milliseconds, rounded up
+        int ret = WSAPoll(fds, worker->slots, timeout);
+        if (ret == SOCKET_ERROR) {
+            int err = WSAGetLastError();
+            if (err != WSAEINTR) {
+                printf("[%s:%d] %s\n", WARNING_FLAGS, err, _POLL_FAIL);
+                worker->lost += worker->queries - sent + outstanding;
+                break;
+            }
+            continue;
+        }
+        for (int i = 0; i < worker->slots && ret > 0; i++) {
+            if (fds[i].revents == 0)
+                continue;
+            ret--;
+            if (fds[i].revents & POLLRDNORM)
+                outstanding -= ReceiveLoadResponse(worker, &slots[i]);
         }
-        else
-            strcpy_s(*omessage, strlen(buffer) + 1, buffer);
     }
 
-    return is_ok;
+    for (int i = 0; i < worker->slots; i++)
+        CloseSocket(slots[i].socket, CLOSE_NORMAL);
+    free(slots);
+    free(fds);
 }
 
-int Send(SOCKET sender, const char* message, ADDRESS receiver, int* obyte_sent)
+int SendLoadQuery(LOAD_WORKER* worker, LOAD_SLOT* slot)
 {
-    int expect_send = (int)strlen(message) + 1;
+    const LOAD_CONFIG* config = worker->config;
+    unsigned int id = slot->id | slot->transmissions;
+    long long now = GetTimestamp();
+    slot->sent_at[slot->transmissions] = now;
+    if (config->timeout > 0)
+        slot->deadline = now + config->timeout * 1000000LL;
+    else
+        slot->deadline = now + GetRetransmissionTimeout(&worker->rtt, slot->transmissions);
+    slot->transmissions++;
+    return SendRequest(slot->socket, slot->name, worker->server, config->is_packed, &id);
+}
 
-    int ret = sendto(sender, message, expect_send, 0, (SOCKADDR*)&receiver, sizeof(receiver));
+int ReceiveLoadResponse(LOAD_WORKER* worker, LOAD_SLOT* slot)
+{
+    char buffer[APPLICATION_BUFF_MAX_SIZE];
+    int length = recv(slot->socket, buffer, sizeof(buffer) - 1, 0);
+    if (length == SOCKET_ERROR || length == 0)
+        return 0;
+    buffer[length] = '\0';
+    if (worker->config->drop_rate > 0 && (int)(NextRandom(&worker->seed) % 100) < worker->config->drop_rate) {
+        worker->dropped++;
+        return 0;
+    }
+    worker->replies++;
 
-    int is_ok = 1;
-    if (ret == SOCKET_ERROR) {
-        int err = WSAGetLastError();
-        if (err == WSAEMSGSIZE) {
-            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _MESSAGE_EXTREME_LARGE);
-            is_ok = 0;
-        }
-        else if (err == WSAEHOSTUNREACH) {
-            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _HOST_UNREACHABLE);
-            is_ok = 0;
+    unsigned int id;
+    int attempt = slot->transmissions - 1; // an old server does not echo the ID
+    int has_id = GetResponseID(buffer, length, &id);
+    if (has_id)
+        attempt = (int)(id & QUERY_ATTEMPT_MASK);
+    if (!slot->is_outstanding || (has_id && ((id & ~QUERY_ATTEMPT_MASK) != slot->id || attempt >= slot->transmissions))
+        || (slot->answering != -1 && attempt != slot->answering)) {
+        worker->late++;
+        return 0;
+    }
+    if (slot->answering == -1) {
+        slot->answering = attempt;
+        if (has_id || slot->transmissions == 1)
+            UpdateRTT(&worker->rtt, GetTimestamp() - slot->sent_at[attempt]);
+    }
+    // the answer is complete with its last datagram, the others only count
+    char status = buffer[0];
+    if (status != STATUS_OK_END_CHAR && status != STATUS_LIST_END_CHAR && status != STATUS_ERROR_CHAR)
+        return 0;
+    RecordHistogram(&worker->latency, GetTimestamp() - slot->sent_at[0]);
+    slot->is_outstanding = 0;
+    worker->answered++;
+    worker->not_found += (status == STATUS_ERROR_CHAR);
+    return 1;
+}
+
+int LoadNames(const char* path, NAME_LIST* onames)
+{
+    FILE* file = NULL;
+    if (fopen_s(&file, path, "r") != 0 || file == NULL) {
+        printf("[%s] %s\n", WARNING_FLAGS, _OPEN_FILE_FAIL);
+        return 0;
+    }
+    char line[APPLICATION_BUFF_MAX_SIZE];
+    int capacity = 0, is_ok = 1;
+    onames->names = NULL;
+    onames->count = 0;
+    onames->popularity = NULL;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        int length = (int)strlen(line);
+        if (length == 0)
+            continue;
+        if (onames->count == capacity) {
+            capacity = capacity > 0 ? capacity * 2 : APPLICATION_BUFF_MAX_SIZE;
+            char** names = (char**)realloc(onames->names, capacity * sizeof(char*));
+            if (names == NULL) {
+                printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+                is_ok = 0;
+                break;
+            }
+            onames->names = names;
         }
-        else {
-            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _SEND_FAIL);
+        char* name = Clone(line, length + 1);
+        if (name == NULL) {
             is_ok = 0;
+            break;
         }
-        if (obyte_sent != NULL)
-            *obyte_sent = 0;
+        onames->names[onames->count++] = name;
     }
-    else
-    {
-        if (obyte_sent != NULL)
-            *obyte_sent = ret;
-        if (ret < expect_send)
-        {
-            printf("[%s] %s\n", WARNING_FLAGS, _SEND_NOT_ALL);
-        }
+    fclose(file);
+    if (!is_ok || onames->count == 0) {
+        DestroyNames(onames);
+        return 0;
     }
-    return is_ok;
+    return 1;
 }
 
-#pragma endregion
-
-#pragma region Handle Response
-
-int PrintResponse(const MESSAGE message, const char* title)
+int GenerateZipfNames(int count, NAME_LIST* onames)
 {
-    int has_next = 0;
-    if (strlen(message) == 0) {
+    onames->names = (char**)calloc(count, sizeof(char*));
+    onames->popularity = (double*)malloc(count * sizeof(double));
+    onames->count = 0;
+    if (onames->names == NULL || onames->popularity == NULL) {
+        printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+        DestroyNames(onames);
+        return 0;
     }
-    if (message[0] == STATUS_ERROR_CHAR) {
-        printf("\t%s\n", message + 1);
+    double sum = 0;
+    for (int i = 0; i < count; i++) {
+        sum += 1.0 / pow(i + 1, ZIPF_EXPONENT);
+        onames->popularity[i] = sum;
     }
-    else if (message[0] == STATUS_OK_CHAR || message[0] == STATUS_OK_END_CHAR) {
-        if (title != NULL) {
-            printf("%s", title);
+    for (int i = 0; i < count; i++) {
+        onames->popularity[i] /= sum;
+        char name[APPLICATION_BUFF_MAX_SIZE];
+        sprintf_s(name, sizeof(name), ZIPF_NAME_FORMAT, i + 1);
+        onames->names[i] = Clone(name, (int)strlen(name) + 1);
+        if (onames->names[i] == NULL) {
+            DestroyNames(onames);
+            return 0;
         }
-        printf("\t%s\n", message + 1);
-        has_next = (message[0] == STATUS_OK_CHAR);
+        onames->count++;
     }
-    return has_next;
+    onames->popularity[count - 1] = 1.0; // the rounding errors must not leave a random number without name
+    return 1;
 }
 
-void HandleResponse(SOCKET socket, ADDRESS sender)
+const char* NextLoadName(LOAD_WORKER* worker)
 {
-    char* response;
-    char default_title[] = RESPONSE_TITLE;
-    char* title = default_title;
-    int is_continue = 1;
-    while (is_continue) {
-        if (Receive(socket, &response, &sender))
-        {
-            is_continue = PrintResponse(response, title);
-            if (is_continue)
-                title = NULL; // Only use title for the first response.
-            free(response);
-        }
+    const NAME_LIST* names = worker->names;
+    if (names->popularity == NULL)
+        return names->names[worker->next_name++ % names->count];
+    // the first name whose cumulative probability is above a uniform random number
+    double x = NextRandom(&worker->seed) / 4294967296.0;
+    int low = 0, high = names->count - 1;
+    while (low < high) {
+        int middle = (low + high) / 2;
+        if (names->popularity[middle] > x)
+            high = middle;
         else
+            low = middle + 1;
+    }
+    return names->names[low];
+}
+
+void DestroyNames(NAME_LIST* names)
+{
+    if (names->names != NULL) {
+        for (int i = 0; i < names->count; i++)
+            free(names->names[i]);
+    }
+    free(names->names);
+    free(names->popularity);
+    names->names = NULL;
+    names->popularity = NULL;
+    names->count = 0;
+}
+
+void PrintLatencyHistogram(const HISTOGRAM* latency)
+{
+    const char bar[] = "########################################";
+    int bar_width = (int)sizeof(bar) - 1;
+    printf("[%s] Latency histogram:\n", INFO_FLAGS);
+    // rows of powers of 2 microseconds. A bucket of the histogram is in the row of its lowest value
+    int index = 0;
+    for (long long upper = 1000; index < HISTOGRAM_SIZE; upper *= 2) {
+        long long count = 0;
+        while (index < HISTOGRAM_SIZE && GetHistogramBucketValue(index) < upper)
+            count += latency->counts[index++].load();
+        if (count > 0) {
+            double share = (double)count / latency->total.load();
+            printf("\t< %7lld us %10lld %6.2f%% %.*s\n", upper / 1000, count, 100 * share, (int)(share * bar_width + 0.5), bar);
+        }
+        if (upper > latency->max.load())
             break;
     }
 }
+
+int ExtractLoadOptions(int argc, char* argv[], LOAD_CONFIG* oconfig)
+{
+    int is_ok = 1;
+    oconfig->queries = GetIntOption(argc, argv, LOAD_OPTION, DEFAULT_LOAD_QUERIES);
+    if (oconfig->queries < 1) {
+        oconfig->queries = DEFAULT_LOAD_QUERIES;
+        is_ok = 0;
+    }
+    oconfig->window = GetIntOption(argc, argv, WINDOW_OPTION, DEFAULT_LOAD_WINDOW);
+    if (oconfig->window < 1 || oconfig->window > MAX_LOAD_WINDOW) {
+        oconfig->window = DEFAULT_LOAD_WINDOW;
+        is_ok = 0;
+    }
+    oconfig->threads = GetIntOption(argc, argv, THREADS_OPTION, 1);
+    if (oconfig->threads < 1 || oconfig->threads > MAX_LOAD_THREADS) {
+        oconfig->threads = 1;
+        is_ok = 0;
+    }
+    if (oconfig->threads > oconfig->window)
+        oconfig->threads = oconfig->window; // a thread has at least one socket
+    oconfig->timeout = GetIntOption(argc, argv, TIMEOUT_OPTION, 0);
+    if (oconfig->timeout < 0) {
+        oconfig->timeout = 0;
+        is_ok = 0;
+    }
+    is_ok &= ExtractRetries(argc, argv, &oconfig->retries);
+    oconfig->drop_rate = GetIntOption(argc, argv, DROP_OPTION, 0);
+    if (oconfig->drop_rate < 0 || oconfig->drop_rate > 100) {
+        oconfig->drop_rate = 0;
+        is_ok = 0;
+    }
+    oconfig->zipf_names = GetIntOption(argc, argv, ZIPF_OPTION, DEFAULT_ZIPF_NAMES);
+    if (oconfig->zipf_names < 1) {
+        oconfig->zipf_names = DEFAULT_ZIPF_NAMES;
+        is_ok = 0;
+    }
+    oconfig->names_path = GetStringOption(argc, argv, NAMES_OPTION);
+    oconfig->is_packed = !HasOption(argc, argv, LEGACY_OPTION);
+    return is_ok;
+}
+
 #pragma endregion
 
 #pragma region Utilities
@@ -248,21 +731,16 @@ int ExtractCommand(int argc, char* argv[], int* oport, IP* oip)
     return is_ok;
 }
 
-int SetReceiveTimeout(SOCKET socket, int interval)
+int ExtractRetries(int argc, char* argv[], int* oretries)
 {
-    int _interval = interval;
-    int ret = setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, (const char*)&_interval, sizeof(_interval));
-    if (ret == SOCKET_ERROR) {
-        printf("[%s:%d] %s\n", WARNING_FLAGS, WSAGetLastError(), _SET_TIMEOUT_FAIL);
+    *oretries = GetIntOption(argc, argv, RETRIES_OPTION, -1);
+    if (*oretries == -1) // GetIntOption does not tell 0 from a missing option
+        *oretries = HasOption(argc, argv, RETRIES_OPTION) ? 0 : DEFAULT_RETRIES;
+    if (*oretries < 0 || *oretries > MAX_RETRIES) {
+        *oretries = DEFAULT_RETRIES;
         return 0;
     }
     return 1;
 }
 
-int TryParseIPString(const char* str, IP* oip)
-{
-    return inet_pton(AF_INET, str, oip) == 1;
-}
-
 #pragma endregion
-
@@ -1,60 +1,146 @@
 #pragma once
-#pragma comment(lib, "Ws2_32.lib")
 
 #pragma region Header Declarations
 #include <stdio.h>
+#include <stdlib.h>
+#include <limits.h>
+#include <math.h>
+#include <thread>
+#include <atomic>
+#include <chrono>
 
-#include <WinSock2.h>
-#include <WS2tcpip.h>
-
-#include "CommonDefinitions.h"
+#include "Network.h"
 #pragma endregion
 
 #pragma region Constant Definitions
 #define RESPONSE_TITLE "IP Addresses:\n"
+
+#define FLOOD_OPTION "--flood" // non-interactive benchmark: send <number> queries as fast as possible (See: RunFlood)
+#define SOCKETS_OPTION "--sockets" // number of sockets of the flood, each has a sender and a receiver thread
+#define NAME_OPTION "--name" // the domain name queried by the flood
+#define LEGACY_OPTION "--legacy" // ask for one response datagram per address, as the old clients (See: SendRequest)
+#define RETRIES_OPTION "--retries" // number of retransmissions of a query before it is given up
+
+#define DEFAULT_RETRIES 4
+#define INITIAL_RTO 1000 // in milliseconds, the retransmission timeout before the first RTT sample (RFC 6298)
+#define MIN_RTO 10 // in milliseconds
+#define MAX_RTO RECEIVE_TIMEOUT_INTERVAL
+#define QUERY_ATTEMPT_BITS 3 // the low bits of a query ID number the transmissions of the query
+#define QUERY_ATTEMPT_MASK ((1u << QUERY_ATTEMPT_BITS) - 1)
+#define MAX_RETRIES ((int)QUERY_ATTEMPT_MASK)
+
+#define DEFAULT_FLOOD_NAME "localhost"
+#define MAX_FLOOD_SOCKETS 64
+#define FLOOD_QUIET_INTERVAL 1000 // in milliseconds, the flood stops when no response comes in this interval after all queries are sent
+
+#define LOAD_OPTION "--load" // non-interactive load generator: send <number> queries with a window outstanding (See: RunLoad)
+#define WINDOW_OPTION "--window" // number of queries outstanding, each on its own socket
+#define THREADS_OPTION "--threads" // the sockets of the window are spread across threads
+#define TIMEOUT_OPTION "--timeout" // in milliseconds, a fixed retransmission timeout instead of the RTT estimate
+#define DROP_OPTION "--drop" // in percent, response datagrams dropped on receipt to emulate a lossy path
+#define NAMES_OPTION "--names" // query the lines of a file in order: --names <path>
+#define ZIPF_OPTION "--zipf" // query <number> generated names with Zipf-distributed popularity (the default)
+
+#define DEFAULT_LOAD_QUERIES 10000
+#define DEFAULT_LOAD_WINDOW 64
+#define MAX_LOAD_WINDOW 512 // a socket per query outstanding
+#define MAX_LOAD_THREADS 64
+#define DEFAULT_ZIPF_NAMES 1000
+#define ZIPF_EXPONENT 1.0 // the k-th most popular name is queried with a probability proportional to 1 / k^ZIPF_EXPONENT
+#define ZIPF_NAME_FORMAT "name%d.example" // the generated names, name1.example is the most popular
 #pragma endregion
 
+#pragma region Type Definitions
 
-#pragma region Function Declarations
+/// <summary>
+/// A socket of the flood benchmark. The sender thread writes is_sent, the receiver thread writes the counters.
+/// </summary>
+typedef struct {
+    SOCKET socket;
+    ADDRESS server;
+    const char* name;
+    int is_packed; // 1 if the queries ask for lists of addresses
+    int queries; // number of queries to send
+    std::atomic<int> is_sent; // 1 when all queries are sent
+    long long answered; // number of queries answered: responses with STATUS_OK_END, STATUS_LIST_END or STATUS_ERROR
+    long long replies; // number of response datagrams
+    long long last_reply; // timestamp of the last response, in nanoseconds
+} FLOOD_WORKER;
 
 /// <summary>
-/// Initialize Winsock 2.2
+/// The round-trip time of a server, estimated as RFC 6298: the retransmission timeout follows
+/// the smoothed RTT and its variation. Each query backs off exponentially from it.
 /// </summary>
-/// <returns>1 if initialize successfully, 0 otherwise</returns>
-int WSInitialize();
+typedef struct {
+    long long srtt; // smoothed RTT, in nanoseconds. 0 before the first sample
+    long long rttvar; // RTT variation, in nanoseconds
+    long long rto; // retransmission timeout of a first transmission, in nanoseconds
+} RTT_ESTIMATOR;
 
 /// <summary>
-/// Clean up Winsock 2.2
+/// Options of the load generator, extracted from command-line arguments
 /// </summary>
-/// <returns>1 if close successfully, 0 otherwise</returns>
-int WSCleanup();
+typedef struct {
+    int queries; // number of queries to send
+    int window; // number of queries outstanding
+    int threads;
+    int timeout; // in milliseconds, fixed retransmission timeout. 0 for the RTT estimate
+    int retries; // number of retransmissions of a query before it is lost
+    int drop_rate; // in percent, response datagrams dropped on receipt
+    int is_packed; // 1 if the queries ask for lists of addresses (See: SendRequest)
+    const char* names_path; // NULL for generated names
+    int zipf_names; // number of generated names
+} LOAD_CONFIG;
 
 /// <summary>
-/// Create a TCP/UDP Socket.
+/// The names queried by the load generator
 /// </summary>
-/// <param name="protocol">TCP or UDP</param>
-/// <returns>
-/// Created TCP/UDP Socket. 
-/// INVALID_SOCKET if Protocol is unexpected or have error on Winsock
-/// </returns>
-SOCKET CreateSocket(int protocol);
+typedef struct {
+    char** names; // each name is terminated by '\0'
+    int count;
+    double* popularity; // cumulative Zipf probabilities, popularity[count - 1] is 1. NULL for querying the names in order
+} NAME_LIST;
 
 /// <summary>
-/// Close a created Socket
+/// A socket of the load generator, with at most one query outstanding.
+/// The responses are matched to the query by its ID: the late responses of previous queries are dropped.
 /// </summary>
-/// <param name="socket">The socket want to close</param>
-/// <param name="mode">CLOSE_NORMAL or CLOSE_SAFELY (Shutdown before close)</param>
-/// <param name="flags">Specify how to close socket safely. Some flags: SD_RECEIVE, SD_SEND, SD_BOTH (Manifest constants for shutdown()). This param is not used with CLOSE_NORMAL </param>
-/// <returns>1 if close successfully, 0 otherwise</returns>
-int CloseSocket(SOCKET socket, int mode, int flags = 0);
+typedef struct {
+    SOCKET socket;
+    int is_outstanding; // 1 if a query is sent and not answered
+    const char* name; // the name of the query, sent again by retransmissions
+    unsigned int id; // the ID of the query, its low bits are 0 (See: CreateQueryID)
+    int transmissions; // number of times the query is sent
+    int answering; // the transmission whose answer is received. -1 before its first datagram
+    long long sent_at[MAX_RETRIES + 1]; // send time of each transmission, in nanoseconds
+    long long deadline; // the query is sent again, or lost, if not answered at this time, in nanoseconds
+} LOAD_SLOT;
 
 /// <summary>
-/// Create a socket address that used IPv4 and Port Number
+/// A thread of the load generator. The results are merged by the main thread after it finishes.
 /// </summary>
-/// <param name="ip">The IPv4 Address</param>
-/// <param name="port">The Port number</param>
-/// <returns>Created socket address</returns>
-ADDRESS CreateSocketAddress(IP ip, int port);
+typedef struct {
+    const LOAD_CONFIG* config;
+    ADDRESS server;
+    const NAME_LIST* names;
+    int slots; // number of sockets of this thread
+    int queries; // number of queries to send
+    unsigned int seed;
+    int next_name; // next name of the list, if queried in order
+    RTT_ESTIMATOR rtt; // shared by the sockets of the thread
+    HISTOGRAM latency; // in nanoseconds, from the first transmission of a query
+    long long answered; // number of queries answered, include not_found
+    long long not_found; // number of STATUS_ERROR answers
+    long long lost; // number of queries not answered after all retransmissions, or not sent
+    long long replies; // number of response datagrams
+    long long retransmissions;
+    long long late; // number of datagrams not for the query outstanding: previous queries, or other transmissions
+    long long dropped; // number of datagrams dropped to emulate loss
+} LOAD_WORKER;
+#pragma endregion
+
+
+#pragma region Function Declarations
 
 /// <summary>
 /// Extract infomation in Message object and Print the message to console.
@@ -65,30 +151,179 @@ ADDRESS CreateSocketAddress(IP ip, int port);
 int PrintResponse(const MESSAGE message, const char* title = NULL);
 
 /// <summary>
-/// Extract message from server and show it to console.
+/// Send a request for a domain name. A packed request is the name, '\0' and REQUEST_PACKED_FLAG:
+/// the server answers with lists of addresses, usually one datagram. The old servers ignore the flag.
 /// </summary>
-/// <param name="socket">The socket to receive message</param>
-/// <param name="sender">The expected sender</param>
-void HandleResponse(SOCKET socket, ADDRESS sender);
+/// <param name="sender">The sender socket</param>
+/// <param name="name">The domain name</param>
+/// <param name="receiver">The server's address</param>
+/// <param name="is_packed">1 for a packed request. 0 for one response datagram per address</param>
+/// <param name="id">The query ID, echoed in every response. NULL for no ID</param>
+/// <returns>1 if have no errors. 0 otherwise</returns>
+int SendRequest(SOCKET sender, const char* name, ADDRESS receiver, int is_packed, const unsigned int* id = NULL);
 
 /// <summary>
-/// Receive a message from a UDP socket buffer.
+/// Get the query ID a response echoes after its '\0'
 /// </summary>
-/// <param name="receiver">The receiver socket</param>
-/// <param name="omessage">[Output] The message extracted from datagram</param>
-/// <param name="osender_addr">[Output] The sender's address extracted from datagram</param>
-/// <returns>1 if have no errors. 0 otherwise</returns>
-int Receive(SOCKET receiver, char** omessage, ADDRESS* osender_addr);
+/// <param name="response">The response datagram, followed by '\0'</param>
+/// <param name="length">Number of bytes of the datagram</param>
+/// <param name="oid">[Output] The query ID</param>
+/// <returns>1 if the response has an ID. 0 otherwise, the server does not echo IDs</returns>
+int GetResponseID(const char* response, int length, unsigned int* oid);
 
 /// <summary>
-/// Send a Message to a Address
+/// Create the ID of a new query: a random number, with QUERY_ATTEMPT_BITS low bits at 0 for numbering its transmissions
 /// </summary>
-/// <param name="sender">The sender socket</param>
-/// <param name="message">The message want to send</param>
-/// <param name="receiver">The receiver's address</param>
-/// <param name="byte_sent">[Output] Number of bytes are sent successfully.</param>
-/// <returns>1 if have no errors. 0 otherwise</returns>
-int Send(SOCKET sender, const char* message, ADDRESS receiver, int* obyte_sent = NULL);
+/// <param name="seed">The state of the random numbers</param>
+/// <returns>The ID of the first transmission</returns>
+unsigned int CreateQueryID(unsigned int* seed);
+
+/// <summary>
+/// Initialize a round-trip time estimator, without sample: the timeout is INITIAL_RTO
+/// </summary>
+/// <param name="ortt">[Output] The estimator</param>
+void InitializeRTT(RTT_ESTIMATOR* ortt);
+
+/// <summary>
+/// Add a round-trip time sample to an estimator. The sample must be taken from the transmission
+/// the response answers, which the query ID tells, so retransmissions give samples too.
+/// </summary>
+/// <param name="rtt">The estimator</param>
+/// <param name="sample">The round-trip time, in nanoseconds</param>
+void UpdateRTT(RTT_ESTIMATOR* rtt, long long sample);
+
+/// <summary>
+/// Get the time to wait for an answer before sending a query again: the timeout doubles for each transmission
+/// </summary>
+/// <param name="rtt">The estimator</param>
+/// <param name="attempt">The transmission, 0 for the first</param>
+/// <returns>The timeout, in nanoseconds, at most MAX_RTO</returns>
+long long GetRetransmissionTimeout(const RTT_ESTIMATOR* rtt, int attempt);
+
+/// <summary>
+/// Send a query for a domain name, then show the answer of the server to console.
+/// The query is sent again with the same name and a new ID if not answered in the retransmission timeout.
+/// The datagrams of other senders, and of other queries, are dropped.
+/// </summary>
+/// <param name="socket">The socket to send the query and receive the answer</param>
+/// <param name="server">The server's address</param>
+/// <param name="name">The domain name</param>
+/// <param name="is_packed">1 if the query asks for lists of addresses (See: SendRequest)</param>
+/// <param name="retries">Number of retransmissions before giving up</param>
+/// <param name="rtt">The round-trip time estimator of the server, updated by the answer</param>
+/// <param name="seed">The state of the random query IDs</param>
+/// <returns>1 if the query is answered. 0 otherwise</returns>
+int HandleResponse(SOCKET socket, ADDRESS server, const char* name, int is_packed, int retries, RTT_ESTIMATOR* rtt, unsigned int* seed);
+
+/// <summary>
+/// Send queries for one name to the server from many sockets as fast as possible,
+/// and report the queries answered per second and the queries dropped (never answered)
+/// </summary>
+/// <param name="server">The server's address</param>
+/// <param name="queries">Number of queries</param>
+/// <param name="sockets">Number of sockets, the queries are spread across them</param>
+/// <param name="name">The domain name queried</param>
+/// <param name="is_packed">1 if the queries ask for lists of addresses (See: SendRequest)</param>
+/// <returns>1 if the flood is done. 0 if fail to start</returns>
+int RunFlood(ADDRESS server, int queries, int sockets, const char* name, int is_packed);
+
+/// <summary>
+/// Send the queries of a flood socket
+/// </summary>
+/// <param name="worker">The flood socket</param>
+void SendFlood(FLOOD_WORKER* worker);
+
+/// <summary>
+/// Receive the responses of a flood socket, until all queries are answered,
+/// or no response comes in FLOOD_QUIET_INTERVAL after all queries are sent
+/// </summary>
+/// <param name="worker">The flood socket</param>
+void ReceiveFlood(FLOOD_WORKER* worker);
+
+/// <summary>
+/// Run the load generator: T threads keep a window of queries outstanding, each on its own socket,
+/// until all queries are answered or lost. Then report queries/s, the loss rate and a latency histogram.
+/// </summary>
+/// <param name="server">The server's address</param>
+/// <param name="config">The options (See: ExtractLoadOptions)</param>
+/// <returns>1 if the load runs. 0 if fail to prepare the names or the threads</returns>
+int RunLoad(ADDRESS server, const LOAD_CONFIG* config);
+
+/// <summary>
+/// Body of a load generator thread: send a query on every idle socket, wait for responses and deadlines,
+/// send again the queries not answered in their retransmission timeout, repeat.
+/// </summary>
+/// <param name="worker">The thread state, holds the results</param>
+void RunLoadWorker(LOAD_WORKER* worker);
+
+/// <summary>
+/// Send the query of a socket of the load generator, a new one or a retransmission, and set its deadline
+/// </summary>
+/// <param name="worker">The thread owns the socket</param>
+/// <param name="slot">The socket, with its query</param>
+/// <returns>1 if send successfully. 0 otherwise</returns>
+int SendLoadQuery(LOAD_WORKER* worker, LOAD_SLOT* slot);
+
+/// <summary>
+/// Receive a response datagram on a socket of the load generator. The last datagram of an answer records its latency.
+/// </summary>
+/// <param name="worker">The thread owns the socket</param>
+/// <param name="slot">The socket, readable</param>
+/// <returns>1 if the query of the socket is answered. 0 otherwise</returns>
+int ReceiveLoadResponse(LOAD_WORKER* worker, LOAD_SLOT* slot);
+
+/// <summary>
+/// Read the non-empty lines of a file as the names to query in order
+/// </summary>
+/// <param name="path">The path of the file</param>
+/// <param name="onames">[Output] The names</param>
+/// <returns>1 if the file has at least one name. 0 if fail to open or read the file</returns>
+int LoadNames(const char* path, NAME_LIST* onames);
+
+/// <summary>
+/// Generate names with Zipf-distributed popularity (See: ZIPF_NAME_FORMAT, ZIPF_EXPONENT)
+/// </summary>
+/// <param name="count">Number of names</param>
+/// <param name="onames">[Output] The names</param>
+/// <returns>1 if generate successfully. 0 if fail to allocate memory</returns>
+int GenerateZipfNames(int count, NAME_LIST* onames);
+
+/// <summary>
+/// Pick the name of the next query: the next line of a file, or a random name by popularity
+/// </summary>
+/// <param name="worker">The thread sends the query</param>
+/// <returns>The name</returns>
+const char* NextLoadName(LOAD_WORKER* worker);
+
+/// <summary>
+/// Free memory of a name list
+/// </summary>
+/// <param name="names">The names</param>
+void DestroyNames(NAME_LIST* names);
+
+/// <summary>
+/// Print the values of a histogram in buckets of powers of 2 microseconds, with the share of each
+/// </summary>
+/// <param name="latency">The histogram, in nanoseconds</param>
+void PrintLatencyHistogram(const HISTOGRAM* latency);
+
+/// <summary>
+/// Extract the options of the load generator from command-line arguments
+/// </summary>
+/// <param name="argc">Number of Arguments [From main()]</param>
+/// <param name="argv">Arguments value [From main()]</param>
+/// <param name="oconfig">[Output] The options. Invalid values are replaced by default values</param>
+/// <returns>1 if every option is valid. 0 otherwise</returns>
+int ExtractLoadOptions(int argc, char* argv[], LOAD_CONFIG* oconfig);
+
+/// <summary>
+/// Extract the number of retransmissions of a query from command-line arguments
+/// </summary>
+/// <param name="argc">Number of Arguments [From main()]</param>
+/// <param name="argv">Arguments value [From main()]</param>
+/// <param name="oretries">[Output] The number of retransmissions. DEFAULT_RETRIES if not specified or invalid</param>
+/// <returns>1 if extract successfully. 0 if the value is invalid</returns>
+int ExtractRetries(int argc, char* argv[], int* oretries);
 
 /// <summary>
 /// Extract port number and ipv4 string from command-line arguments.
@@ -101,19 +336,5 @@ int Send(SOCKET sender, const char* message, ADDRESS receiver, int* obyte_sent =
 /// <returns>1 if extract successfully. 0 otherwise, has error</returns>
 int ExtractCommand(int argc, char* argv[], int* oport, IP* oip);
 
-/// <summary>
-/// Try parse a string to a IPv4 Address
-/// </summary>
-/// <param name="str">The string want to parse</param>
-/// <param name="oip">[Output] The result IPv4 Address</param>
-/// <returns>1 if parse successfully. 0 otherwise</returns>
-int TryParseIPString(const char* str, IP* oip);
 
-/// <summary>
-/// Set receive timeout interval for socket.
-/// </summary>
-/// <param name="socket">The socket want to set timeout</param>
-/// <param name="interval">The timeout interval</param>
-/// <returns>1 if set successfully, 0 otherwise</returns>
-int SetReceiveTimeout(SOCKET socket, int interval);
-#pragma endregion
+#pragma endregion
\ No newline at end of file
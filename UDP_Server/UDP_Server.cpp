@@ -1,24 +1,20 @@
 #include "UDP_Server.h"
 
+#ifndef UDP_SERVER_LIBRARY // defined when the tests link the server functions
 int main(int argc, char* argv[])
 {
     int running_port;
+    SERVER_CONFIG config;
     ExtractCommand(argc, argv, &running_port);
+    ExtractOptions(argc, argv, &config);
 
     if (WSInitialize()) {
-        SOCKET socket = CreateSocket(UDP);
-        ADDRESS socket_address = CreateSocketAddress(CreateDefaultIP(), running_port);
+        SOCKET socket = CreateDatagramSocket(running_port, config.workers > 1);
         if (socket != INVALID_SOCKET) {
-            if (BindSocket(socket, socket_address)) {
-                printf("[%s] Ready to communicate at port %d...\n", INFO_FLAGS, running_port);
-                char* request;
-                ADDRESS client;
-                while (1) {
-                    if (Receive(socket, &request, &client)) {
-                        HandleDomainNameRequest(request, socket, client);
-                    }
-                }
-            }
+            printf("[%s] Ready to communicate at port %d...\n", INFO_FLAGS, running_port);
+            CACHE* cache = CreateCache(&config);
+            RESOLVER_POOL* pool = CreateResolverPool(&config, cache);
+            RunWorkers(socket, running_port, &config, pool, cache);
         }
         CloseSocket(socket, CLOSE_NORMAL);
         WSCleanup();
@@ -26,165 +22,663 @@ int main(int argc, char* argv[])
     printf("[%s] Stopping...\n", INFO_FLAGS);
     return 0;
 }
+#endif
 
-#pragma region Socket Common
+#pragma region Datagram Loop
 
-int WSInitialize()
+SOCKET CreateDatagramSocket(int port, int reuse_port)
 {
-    WORD version = MAKEWORD(2, 2);
-    WSADATA wsa_data;
-    if (WSAStartup(version, &wsa_data)) {
-        printf("[%s] %s\n", ERROR_FLAGS, _INITIALIZE_FAIL);
-        WSACleanup();
-        return 0;
+    SOCKET socket = CreateSocket(UDP);
+    if (socket == INVALID_SOCKET)
+        return INVALID_SOCKET;
+    if (reuse_port)
+        SetReusePort(socket);
+#ifdef SO_RXQ_OVFL
+    int enable = 1; // the number of datagrams dropped is received with each datagram
+    setsockopt(socket, SOL_SOCKET, SO_RXQ_OVFL, (const char*)&enable, sizeof(enable));
+#endif
+    if (!BindSocket(socket, CreateSocketAddress(CreateDefaultIP(), port))) {
+        CloseSocket(socket, CLOSE_NORMAL);
+        return INVALID_SOCKET;
     }
-    return 1;
+    return socket;
 }
 
-int WSCleanup()
+int RunDatagramLoop(SOCKET socket, const SERVER_CONFIG* config, RESOLVER_POOL* pool, CACHE* cache, WORKER* worker)
 {
-    return WSACleanup();
+    DATAGRAM_BATCH requests, replies;
+    RESPONSES* responses = (RESPONSES*)malloc(sizeof(RESPONSES));
+    if (responses == NULL) {
+        printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+        return 0;
+    }
+    if (!CreateBatch(&requests, config->batch_size)) {
+        free(responses);
+        return 0;
+    }
+    if (!CreateBatch(&replies, config->batch_size)) {
+        DestroyBatch(&requests);
+        free(responses);
+        return 0;
+    }
+
+    while (1) {
+        int count = ReceiveBatch(socket, &requests, worker);
+        int queued = 0, coalesced = 0, overloaded = 0;
+        for (int i = 0; i < count; i++) {
+            DATAGRAM* request = &requests.datagrams[i];
+            REQUEST_FLAGS flags;
+            ExtractRequestFlags(request, &flags);
+            NormalizeName(request->data);
+            if (cache != NULL && CacheGet(cache, request->data, responses)) {
+                queued += AppendResponses(socket, &replies, responses, request->address, &flags);
+                continue;
+            }
+            if (pool == NULL) {
+                queued += HandleDomainNameRequest(request->data, socket, request->address, &flags, &replies, config, cache);
+                continue;
+            }
+            // the resolver threads send the responses, the loop receives the next requests at once
+            WAITER waiter = { request->address, socket, worker, flags };
+            int ret = SubmitLookup(pool, request->data, waiter);
+            coalesced += (ret == 2);
+            overloaded += (ret == 0);
+        }
+        // all responses of the batch leave with one call
+        SendBatch(socket, &replies);
+        if (worker != NULL) {
+            worker->queries.fetch_add(count, std::memory_order_relaxed);
+            worker->replies.fetch_add(queued, std::memory_order_relaxed);
+            worker->coalesced.fetch_add(coalesced, std::memory_order_relaxed);
+            worker->overloaded.fetch_add(overloaded, std::memory_order_relaxed);
+        }
+    }
+
+    DestroyBatch(&requests);
+    DestroyBatch(&replies);
+    free(responses);
+    return 0;
 }
 
-ADDRESS CreateSocketAddress(IP ip, int port)
+int RunWorkers(SOCKET socket, int port, const SERVER_CONFIG* config, RESOLVER_POOL* pool, CACHE* cache)
 {
-    ADDRESS addr;
-    addr.sin_family = AF_INET;
-    addr.sin_port = htons(port);
-    addr.sin_addr = ip;
-    return addr;
+    int worker_numbers = config->workers;
+    WORKER* workers = new WORKER[worker_numbers];
+    std::thread* threads = new std::thread[worker_numbers];
+    int has_own_sockets = SetReusePort(socket); // already set before bind, only check the support here
+
+    int started = 0;
+    for (int i = 0; i < worker_numbers; i++) {
+        workers[i].id = i;
+        workers[i].queries = 0;
+        workers[i].replies = 0;
+        workers[i].coalesced = 0;
+        workers[i].overloaded = 0;
+        workers[i].dropped = 0;
+        // Without SO_REUSEPORT, workers compete for datagrams on the shared socket
+        workers[i].socket = (i == 0 || !has_own_sockets) ? socket : CreateDatagramSocket(port, 1);
+        if (workers[i].socket == INVALID_SOCKET)
+            continue;
+        threads[i] = std::thread(RunDatagramLoop, workers[i].socket, config, pool, cache, &workers[i]);
+        started++;
+    }
+    printf("[%s] Started %d workers (%s)\n", INFO_FLAGS, started, has_own_sockets ? "SO_REUSEPORT sockets" : "shared socket");
+
+    long long last_queries = -1;
+    while (started > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(WORKER_STATS_INTERVAL));
+        long long queries = 0;
+        for (int i = 0; i < worker_numbers; i++)
+            queries += workers[i].queries.load(std::memory_order_relaxed);
+        if (queries != last_queries) {
+            PrintWorkerCounters(workers, worker_numbers, cache);
+            last_queries = queries;
+        }
+    }
+
+    delete[] threads;
+    delete[] workers;
+    return 0;
 }
 
-SOCKET CreateSocket(int protocol)
+void PrintWorkerCounters(WORKER* workers, int worker_numbers, CACHE* cache)
 {
-    SOCKET s = INVALID_SOCKET;
-    if (protocol == UDP) {
-        s = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    for (int i = 0; i < worker_numbers; i++) {
+        printf("[%s] Worker %d: %lld queries, %lld replies, %lld coalesced, %lld overloaded, %lld dropped\n", INFO_FLAGS, workers[i].id,
+            workers[i].queries.load(std::memory_order_relaxed), workers[i].replies.load(std::memory_order_relaxed),
+            workers[i].coalesced.load(std::memory_order_relaxed), workers[i].overloaded.load(std::memory_order_relaxed),
+            workers[i].dropped.load(std::memory_order_relaxed));
     }
-    else if (protocol == TCP) {
-        s = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (cache != NULL) {
+        long long hits = cache->hits.load(std::memory_order_relaxed);
+        long long lookups = hits + cache->misses.load(std::memory_order_relaxed);
+        printf("[%s] Cache: %.1f%% hit ratio (%lld of %lld), %lld entries, %lld bytes of %lld, %lld evicted\n", INFO_FLAGS,
+            lookups > 0 ? 100.0 * hits / lookups : 0, hits, lookups, cache->entries.load(std::memory_order_relaxed),
+            cache->memory.load(std::memory_order_relaxed), cache->shard_memory * CACHE_SHARDS,
+            cache->evicted.load(std::memory_order_relaxed));
     }
+    POOL_COUNTERS pool;
+    GetPoolCounters(&pool);
+    printf("[%s] Message pools: %d threads, %lld blocks allocated, %lld slabs (%lld KB), %lld large blocks, %lld freed by other threads\n",
+        INFO_FLAGS, pool.pools, pool.allocations, pool.slabs, pool.slabs * POOL_SLAB_SIZE / 1024, pool.large, pool.remote_frees);
+}
+
+#pragma endregion
+
+#pragma region Datagram Batch
 
-    if (s == INVALID_SOCKET) {
-        printf("[%s] %s\n", ERROR_FLAGS, _CREATE_SOCKET_FAIL);
+int CreateBatch(DATAGRAM_BATCH* obatch, int capacity)
+{
+    memset(obatch, 0, sizeof(DATAGRAM_BATCH));
+    obatch->capacity = capacity;
+    obatch->datagrams = (DATAGRAM*)malloc(sizeof(DATAGRAM) * capacity);
+    int is_ok = obatch->datagrams != NULL;
+#ifdef SERVER_MMSG
+    obatch->headers = (struct mmsghdr*)calloc(capacity, sizeof(struct mmsghdr));
+    obatch->spans = (struct iovec*)calloc(capacity, sizeof(struct iovec));
+    obatch->controls = (char*)calloc(capacity, DATAGRAM_CONTROL_SIZE);
+    is_ok = is_ok && obatch->headers != NULL && obatch->spans != NULL && obatch->controls != NULL;
+#endif
+    if (!is_ok) {
+        printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+        DestroyBatch(obatch);
+        return 0;
     }
-    return s;
+    return 1;
 }
 
-int CloseSocket(SOCKET socket, int mode, int flags)
+void DestroyBatch(DATAGRAM_BATCH* batch)
 {
-    if (socket == INVALID_SOCKET)
-        return 1;
-    int is_ok = 1;
-    if (mode == CLOSE_SAFELY) {
-        if (shutdown(socket, flags) == SOCKET_ERROR) {
-            is_ok = 0;
-            printf("[%s:%d] %s\n", WARNING_FLAGS, WSAGetLastError(), _SHUTDOWN_SOCKET_FAIL);
+    free(batch->datagrams);
+#ifdef SERVER_MMSG
+    free(batch->headers);
+    free(batch->spans);
+    free(batch->controls);
+#endif
+    memset(batch, 0, sizeof(DATAGRAM_BATCH));
+}
+
+int ReceiveBatch(SOCKET receiver, DATAGRAM_BATCH* obatch, WORKER* worker)
+{
+    obatch->count = 0;
+#ifdef SERVER_MMSG
+    for (int i = 0; i < obatch->capacity; i++) {
+        struct msghdr* header = &obatch->headers[i].msg_hdr;
+        obatch->spans[i].iov_base = obatch->datagrams[i].data;
+        obatch->spans[i].iov_len = APPLICATION_BUFF_MAX_SIZE - 1; // keep a byte for '\0'
+        header->msg_name = &obatch->datagrams[i].address;
+        header->msg_namelen = sizeof(ADDRESS);
+        header->msg_iov = &obatch->spans[i];
+        header->msg_iovlen = 1;
+        header->msg_control = obatch->controls + i * DATAGRAM_CONTROL_SIZE;
+        header->msg_controllen = DATAGRAM_CONTROL_SIZE;
+        header->msg_flags = 0;
+    }
+    // block until the first datagram, then take the others already queued
+    int ret = recvmmsg(receiver, obatch->headers, obatch->capacity, MSG_WAITFORONE, NULL);
+    if (ret == SOCKET_ERROR) {
+        int err = WSAGetLastError();
+        if (err != WSAEINTR)
+            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _RECEIVE_FAIL);
+        return 0;
+    }
+    for (int i = 0; i < ret; i++) {
+        struct msghdr* header = &obatch->headers[i].msg_hdr;
+        DATAGRAM* datagram = &obatch->datagrams[i];
+        datagram->length = (int)obatch->headers[i].msg_len;
+        datagram->data[datagram->length] = '\0'; // in case buffer dont have '\0' or lost byte.
+        if (header->msg_flags & MSG_TRUNC)
+            printf("[%s] %s\n", WARNING_FLAGS, _MESSAGE_TOO_LARGE);
+#ifdef SO_RXQ_OVFL
+        if (worker != NULL) {
+            for (struct cmsghdr* control = CMSG_FIRSTHDR(header); control != NULL; control = CMSG_NXTHDR(header, control)) {
+                if (control->cmsg_level == SOL_SOCKET && control->cmsg_type == SO_RXQ_OVFL) {
+                    unsigned int dropped; // counted since the socket is created
+                    memcpy(&dropped, CMSG_DATA(control), sizeof(dropped));
+                    worker->dropped.store(dropped, std::memory_order_relaxed);
+                }
+            }
         }
+#endif
     }
-    if (closesocket(socket) == SOCKET_ERROR) {
-        is_ok = 0;
-        printf("[%s:%d] %s\n", WARNING_FLAGS, WSAGetLastError(), _CLOSE_SOCKET_FAIL);
+    obatch->count = ret;
+#else
+    // one datagram per call
+    DATAGRAM* datagram = &obatch->datagrams[0];
+    socklen_t address_len = sizeof(ADDRESS);
+    int ret = recvfrom(receiver, datagram->data, APPLICATION_BUFF_MAX_SIZE - 1, 0, (SOCKADDR*)&datagram->address, &address_len);
+    if (ret == SOCKET_ERROR) {
+        int err = WSAGetLastError();
+        if (err == WSAEMSGSIZE) {
+            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _MESSAGE_TOO_LARGE);
+            ret = APPLICATION_BUFF_MAX_SIZE - 1;
+        }
+        else {
+            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _RECEIVE_FAIL);
+            return 0;
+        }
     }
-    return is_ok;
+    datagram->length = ret;
+    datagram->data[ret] = '\0';
+    obatch->count = 1;
+#endif
+    return obatch->count;
 }
 
-int BindSocket(SOCKET socket, ADDRESS addr)
+int SendBatch(SOCKET sender, DATAGRAM_BATCH* batch)
 {
-    if (bind(socket, (SOCKADDR*)&addr, sizeof(addr)) == SOCKET_ERROR) {
-        int err = WSAGetLastError();
-        if (err == WSAEADDRINUSE) {
-            printf("[%s:%d] %s\"\n", ERROR_FLAGS, err, _ADDRESS_IN_USE);
-        }
-        else if (err == WSAEINVAL) {
-            printf("[%s:%d] %s\n", ERROR_FLAGS, err, _BOUNDED_SOCKET);
+    int sent = 0;
+#ifdef SERVER_MMSG
+    for (int i = 0; i < batch->count; i++) {
+        struct msghdr* header = &batch->headers[i].msg_hdr;
+        batch->spans[i].iov_base = batch->datagrams[i].data;
+        batch->spans[i].iov_len = batch->datagrams[i].length;
+        header->msg_name = &batch->datagrams[i].address;
+        header->msg_namelen = sizeof(ADDRESS);
+        header->msg_iov = &batch->spans[i];
+        header->msg_iovlen = 1;
+        header->msg_control = NULL;
+        header->msg_controllen = 0;
+        header->msg_flags = 0;
+    }
+    int next = 0;
+    while (next < batch->count) {
+        int ret = sendmmsg(sender, batch->headers + next, batch->count - next, 0);
+        if (ret == SOCKET_ERROR) {
+            int err = WSAGetLastError();
+            if (err == WSAEINTR)
+                continue;
+            printf("[%s:%d] %s\n", WARNING_FLAGS, err, err == WSAEHOSTUNREACH ? _HOST_UNREACHABLE : _SEND_FAIL);
+            next++; // the datagram is skipped
         }
         else {
-            printf("[%s:%d] %s\n", ERROR_FLAGS, err, _BIND_SOCKET_FAIL);
+            next += ret;
+            sent += ret;
         }
-        return 0;
     }
-    return 1;
+#else
+    for (int i = 0; i < batch->count; i++) {
+        DATAGRAM* datagram = &batch->datagrams[i];
+        int ret = sendto(sender, datagram->data, datagram->length, 0, (SOCKADDR*)&datagram->address, sizeof(ADDRESS));
+        if (ret == SOCKET_ERROR) {
+            int err = WSAGetLastError();
+            printf("[%s:%d] %s\n", WARNING_FLAGS, err, err == WSAEHOSTUNREACH ? _HOST_UNREACHABLE : _SEND_FAIL);
+        }
+        else
+            sent++;
+    }
+#endif
+    batch->count = 0;
+    batch->sent += sent;
+    return sent;
+}
+
+DATAGRAM* AppendDatagram(SOCKET sender, DATAGRAM_BATCH* batch, const MESSAGE message, ADDRESS receiver)
+{
+    DATAGRAM* datagram = NextDatagram(sender, batch, receiver);
+    int length = (int)strlen(message) + 1;
+    if (length > APPLICATION_BUFF_MAX_SIZE)
+        length = APPLICATION_BUFF_MAX_SIZE; // never happens, a response is at most MESSAGE_MAX_SIZE bytes
+    memcpy(datagram->data, message, length);
+    datagram->data[length - 1] = '\0';
+    datagram->length = length;
+    return datagram;
+}
+
+void AppendQueryID(DATAGRAM* datagram, const REQUEST_FLAGS* flags)
+{
+    // never full: the responses leave room for the ID (See: PACKED_RESPONSE_MAX_SIZE)
+    if (flags->has_id && datagram->length + QUERY_ID_SIZE <= APPLICATION_BUFF_MAX_SIZE)
+        datagram->length += EncodeQueryID(datagram->data + datagram->length, flags->id);
+}
+
+DATAGRAM* NextDatagram(SOCKET sender, DATAGRAM_BATCH* batch, ADDRESS receiver)
+{
+    if (batch->count == batch->capacity)
+        SendBatch(sender, batch);
+    DATAGRAM* datagram = &batch->datagrams[batch->count];
+    datagram->length = 0;
+    datagram->address = receiver;
+    batch->count++;
+    return datagram;
 }
 
 #pragma endregion
 
-#pragma region Send and Receive
+#pragma region Resolver Pool
 
-int Receive(SOCKET receiver, char** omessage, ADDRESS* osender_addr)
+RESOLVER_POOL* CreateResolverPool(const SERVER_CONFIG* config, CACHE* cache)
 {
-    char buffer[APPLICATION_BUFF_MAX_SIZE];
-    ADDRESS _sender_addr;
-    int _sender_addr_len = sizeof(_sender_addr);
+    if (config->resolvers == 0)
+        return NULL;
+    RESOLVER_POOL* pool = new RESOLVER_POOL;
+    pool->config = config;
+    pool->cache = cache;
+    memset(pool->table, 0, sizeof(pool->table));
+    pool->jobs_head = NULL;
+    pool->jobs_tail = NULL;
+    pool->pending = 0;
+    // the threads live as long as the server
+    pool->threads = new std::thread[config->resolvers];
+    for (int i = 0; i < config->resolvers; i++)
+        pool->threads[i] = std::thread(RunResolver, pool);
+    printf("[%s] Started %d resolvers (%s)\n", INFO_FLAGS, config->resolvers, config->resolve == ResolveWithStub ? "stub" : "system");
+    return pool;
+}
 
-    int ret = recvfrom(receiver, buffer, APPLICATION_BUFF_MAX_SIZE, 0, (SOCKADDR*)&_sender_addr, &_sender_addr_len);
+void RunResolver(RESOLVER_POOL* pool)
+{
+    DATAGRAM_BATCH replies;
+    if (!CreateBatch(&replies, pool->config->batch_size))
+        return;
+    RESOLUTION* resolution = (RESOLUTION*)malloc(sizeof(RESOLUTION));
+    RESPONSES* responses = (RESPONSES*)malloc(sizeof(RESPONSES));
+    if (resolution == NULL || responses == NULL) {
+        printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
+        free(resolution);
+        free(responses);
+        DestroyBatch(&replies);
+        return;
+    }
 
-    int is_ok = 1;
-    if (ret == SOCKET_ERROR) {
-        int err = WSAGetLastError();
-        if (err == WSAEMSGSIZE) {
-            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _MESSAGE_TOO_LARGE);
+    while (1) {
+        LOOKUP* lookup;
+        {
+            std::unique_lock<std::mutex> guard(pool->lock);
+            pool->has_jobs.wait(guard, [pool] { return pool->jobs_head != NULL; });
+            lookup = pool->jobs_head;
+            pool->jobs_head = lookup->next_job;
+            if (pool->jobs_head == NULL)
+                pool->jobs_tail = NULL;
         }
-        else {
-            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _RECEIVE_FAIL);
-            is_ok = 0;
+        // the lookup stays pending while resolving, new requests for the name join it
+        pool->config->resolve(lookup->name, pool->config->stub_delay, resolution);
+        BuildResponses(resolution, responses);
+        // cached before the lookup leaves the pending table, so the next requests for the name hit
+        if (pool->cache != NULL)
+            CachePut(pool->cache, lookup->name, responses);
+        CompleteLookup(pool, lookup, responses, &replies);
+    }
+
+    free(resolution);
+    free(responses);
+    DestroyBatch(&replies);
+}
+
+int SubmitLookup(RESOLVER_POOL* pool, const char* name, WAITER waiter)
+{
+    unsigned int hash = HashName(name);
+    std::lock_guard<std::mutex> guard(pool->lock);
+    LOOKUP** bucket = &pool->table[hash & (LOOKUP_TABLE_SIZE - 1)];
+    LOOKUP* lookup = *bucket;
+    while (lookup != NULL && (lookup->hash != hash || strcmp(lookup->name, name) != 0))
+        lookup = lookup->next;
+
+    int is_new = lookup == NULL;
+    if (is_new) {
+        if (pool->pending >= MAX_PENDING_LOOKUPS)
+            return 0;
+        int name_len = (int)strlen(name) + 1;
+        lookup = (LOOKUP*)PoolAllocate((int)sizeof(LOOKUP) + name_len);
+        if (lookup == NULL)
+            return 0;
+        memset(lookup, 0, sizeof(LOOKUP));
+        lookup->name = (char*)(lookup + 1);
+        memcpy(lookup->name, name, name_len);
+        lookup->hash = hash;
+    }
+    if (lookup->waiter_count == lookup->waiter_capacity) {
+        // pool blocks can't be resized: the waiters move to a larger block
+        int capacity = lookup->waiter_capacity == 0 ? INITIAL_WAITERS : lookup->waiter_capacity * 2;
+        WAITER* waiters = (WAITER*)PoolAllocate((int)sizeof(WAITER) * capacity);
+        if (waiters == NULL) {
+            if (is_new)
+                PoolFree(lookup);
+            return 0;
         }
+        if (lookup->waiter_count > 0)
+            memcpy(waiters, lookup->waiters, sizeof(WAITER) * lookup->waiter_count);
+        PoolFree(lookup->waiters);
+        lookup->waiters = waiters;
+        lookup->waiter_capacity = capacity;
     }
-    // Copy value to output variables
-    if (is_ok == 1) {
-        if (ret >= APPLICATION_BUFF_MAX_SIZE)
-            ret = APPLICATION_BUFF_MAX_SIZE - 1;
-        buffer[ret] = '\0'; // in case buffer dont have '\0' or lost byte.
+    lookup->waiters[lookup->waiter_count++] = waiter;
+    if (!is_new)
+        return 2;
+
+    lookup->next = *bucket;
+    *bucket = lookup;
+    if (pool->jobs_tail != NULL)
+        pool->jobs_tail->next_job = lookup;
+    else
+        pool->jobs_head = lookup;
+    pool->jobs_tail = lookup;
+    pool->pending++;
+    pool->has_jobs.notify_one();
+    return 1;
+}
 
-        *osender_addr = _sender_addr;
-        *omessage = (char*)malloc(strlen(buffer) + 1);
+void CompleteLookup(RESOLVER_POOL* pool, LOOKUP* lookup, const RESPONSES* responses, DATAGRAM_BATCH* replies)
+{
+    {
+        // the next requests for the name start a new lookup
+        std::lock_guard<std::mutex> guard(pool->lock);
+        LOOKUP** link = &pool->table[lookup->hash & (LOOKUP_TABLE_SIZE - 1)];
+        while (*link != lookup)
+            link = &(*link)->next;
+        *link = lookup->next;
+        pool->pending--;
+    }
 
-        if (*omessage == NULL)
-        {
-            printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
-            is_ok = 0;
+    SOCKET sender = INVALID_SOCKET;
+    for (int i = 0; i < lookup->waiter_count; i++) {
+        WAITER* waiter = &lookup->waiters[i];
+        if (waiter->socket != sender) {
+            // the batch is sent by one socket, the responses for other workers go in the next batch
+            if (sender != INVALID_SOCKET)
+                SendBatch(sender, replies);
+            sender = waiter->socket;
         }
-        else
-            strcpy_s(*omessage, strlen(buffer) + 1, buffer);
+        int queued = AppendResponses(sender, replies, responses, waiter->client, &waiter->flags);
+        if (waiter->worker != NULL)
+            waiter->worker->replies.fetch_add(queued, std::memory_order_relaxed);
     }
+    if (sender != INVALID_SOCKET)
+        SendBatch(sender, replies);
 
-    return is_ok;
+    PoolFree(lookup->waiters);
+    PoolFree(lookup);
 }
 
-int Send(SOCKET sender, const char* message, ADDRESS receiver, int* obyte_sent)
+unsigned int HashName(const char* name)
 {
-    int expect_send = (int)strlen(message) + 1;
+    unsigned int hash = 2166136261u;
+    for (; *name != '\0'; name++)
+        hash = (hash ^ (unsigned char)*name) * 16777619u;
+    return hash;
+}
 
-    int ret = sendto(sender, message, expect_send, 0, (SOCKADDR*)&receiver, sizeof(receiver));
+void ResolveWithSystem(const char* name, int delay, RESOLUTION* oresolution)
+{
+    (void)delay; // the system resolver has its own latency, no delay is injected
+    oresolution->is_found = 0;
+    oresolution->count = 0;
+    ADDRINFO* results;
+    if (!TranslateDomainName(name, &results))
+        return;
+    for (ADDRINFO* node = results; node != NULL && oresolution->count < RESOLUTION_MAX_ADDRESSES; node = node->ai_next)
+        oresolution->addresses[oresolution->count++] = ((ADDRESS*)node->ai_addr)->sin_addr;
+    oresolution->is_found = oresolution->count > 0;
+    freeaddrinfo(results);
+}
 
-    int is_ok = 1;
-    if (ret == SOCKET_ERROR) {
-        int err = WSAGetLastError();
-        if (err == WSAEMSGSIZE) {
-            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _MESSAGE_EXTREME_LARGE);
-            is_ok = 0;
+void ResolveWithStub(const char* name, int delay, RESOLUTION* oresolution)
+{
+    if (delay > 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+    oresolution->is_found = 0;
+    oresolution->count = 0;
+    IP ip;
+    if (TryParseIPString(name, &ip)) {
+        oresolution->addresses[oresolution->count++] = ip;
+    }
+    else if (name[0] != '\0' && strncmp(name, STUB_NOT_FOUND_PREFIX, strlen(STUB_NOT_FOUND_PREFIX)) != 0) {
+        unsigned int hash = HashName(name);
+        int count = 1 + hash % 3;
+        for (int i = 0; i < count; i++) {
+            unsigned char bytes[4] = { 10, (unsigned char)(hash >> 8), (unsigned char)(hash >> 16), (unsigned char)(i + 1) };
+            memcpy(&oresolution->addresses[oresolution->count++], bytes, sizeof(bytes));
         }
-        else if (err == WSAEHOSTUNREACH) {
-            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _HOST_UNREACHABLE);
-            is_ok = 0;
+    }
+    oresolution->is_found = oresolution->count > 0;
+}
+
+#pragma endregion
+
+#pragma region Response Cache
+
+CACHE* CreateCache(const SERVER_CONFIG* config)
+{
+    if (!config->is_cached)
+        return NULL;
+    CACHE* cache = new CACHE;
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        memset(cache->shards[i].table, 0, sizeof(cache->shards[i].table));
+        cache->shards[i].hand = NULL;
+        cache->shards[i].memory = 0;
+    }
+    cache->shard_memory = config->cache_memory / CACHE_SHARDS;
+    cache->config = config;
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->evicted = 0;
+    cache->entries = 0;
+    cache->memory = 0;
+    return cache;
+}
+
+int CacheGet(CACHE* cache, const char* name, RESPONSES* oresponses)
+{
+    unsigned int hash = HashName(name);
+    CACHE_SHARD* shard = &cache->shards[hash % CACHE_SHARDS];
+    std::lock_guard<std::mutex> guard(shard->lock);
+    CACHE_ENTRY* entry = shard->table[(hash / CACHE_SHARDS) & (CACHE_TABLE_SIZE - 1)];
+    while (entry != NULL && (entry->hash != hash || strcmp(entry->name, name) != 0))
+        entry = entry->next;
+
+    if (entry != NULL && entry->expires <= GetTimestamp()) {
+        RemoveCacheEntry(cache, shard, entry);
+        entry = NULL;
+    }
+    if (entry == NULL) {
+        cache->misses.fetch_add(1, std::memory_order_relaxed);
+        return 0;
+    }
+    entry->is_referenced = 1;
+    oresponses->is_found = entry->is_found;
+    oresponses->count = entry->count;
+    oresponses->length = entry->length;
+    memcpy(oresponses->data, entry->data, entry->length);
+    cache->hits.fetch_add(1, std::memory_order_relaxed);
+    return 1;
+}
+
+void CachePut(CACHE* cache, const char* name, const RESPONSES* responses)
+{
+    unsigned int hash = HashName(name);
+    CACHE_SHARD* shard = &cache->shards[hash % CACHE_SHARDS];
+    int name_len = (int)strlen(name) + 1;
+    int size = (int)sizeof(CACHE_ENTRY) + name_len + responses->length;
+    if (size > cache->shard_memory)
+        return;
+    CACHE_ENTRY* entry = (CACHE_ENTRY*)PoolAllocate(size);
+    if (entry == NULL)
+        return;
+    entry->name = (char*)(entry + 1);
+    memcpy(entry->name, name, name_len);
+    entry->data = entry->name + name_len;
+    memcpy(entry->data, responses->data, responses->length);
+    entry->hash = hash;
+    int ttl = responses->is_found ? cache->config->cache_ttl : cache->config->negative_ttl;
+    entry->expires = GetTimestamp() + ttl * 1000000000LL;
+    entry->is_referenced = 0;
+    entry->size = size;
+    entry->is_found = responses->is_found;
+    entry->count = responses->count;
+    entry->length = responses->length;
+
+    std::lock_guard<std::mutex> guard(shard->lock);
+    CACHE_ENTRY** bucket = &shard->table[(hash / CACHE_SHARDS) & (CACHE_TABLE_SIZE - 1)];
+    for (CACHE_ENTRY* old = *bucket; old != NULL; old = old->next) {
+        if (old->hash == hash && strcmp(old->name, name) == 0) {
+            RemoveCacheEntry(cache, shard, old); // replaced by the newer responses
+            break;
+        }
+    }
+
+    // CLOCK: the hand clears the referenced entries, and evicts the first one not referenced since its last pass
+    while (shard->hand != NULL && shard->memory + size > cache->shard_memory) {
+        CACHE_ENTRY* candidate = shard->hand;
+        if (candidate->is_referenced) {
+            candidate->is_referenced = 0;
+            shard->hand = candidate->clock_next;
         }
         else {
-            printf("[%s:%d] %s\n", WARNING_FLAGS, err, _SEND_FAIL);
-            is_ok = 0;
+            RemoveCacheEntry(cache, shard, candidate);
+            cache->evicted.fetch_add(1, std::memory_order_relaxed);
         }
-        if (obyte_sent != NULL)
-            *obyte_sent = 0;
     }
-    else
-    {
-        if (obyte_sent != NULL)
-            *obyte_sent = ret;
-        if (ret < expect_send)
-        {
-            printf("[%s] %s\n", WARNING_FLAGS, _SEND_NOT_ALL);
-        }
+
+    entry->next = *bucket;
+    *bucket = entry;
+    // a new entry is placed right behind the hand, it is inspected last
+    if (shard->hand == NULL) {
+        entry->clock_previous = entry;
+        entry->clock_next = entry;
+        shard->hand = entry;
     }
-    return is_ok;
+    else {
+        entry->clock_next = shard->hand;
+        entry->clock_previous = shard->hand->clock_previous;
+        entry->clock_previous->clock_next = entry;
+        shard->hand->clock_previous = entry;
+    }
+    shard->memory += size;
+    cache->memory.fetch_add(size, std::memory_order_relaxed);
+    cache->entries.fetch_add(1, std::memory_order_relaxed);
+}
+
+void RemoveCacheEntry(CACHE* cache, CACHE_SHARD* shard, CACHE_ENTRY* entry)
+{
+    CACHE_ENTRY** link = &shard->table[(entry->hash / CACHE_SHARDS) & (CACHE_TABLE_SIZE - 1)];
+    while (*link != entry)
+        link = &(*link)->next;
+    *link = entry->next;
+
+    if (entry->clock_next == entry) {
+        shard->hand = NULL;
+    }
+    else {
+        entry->clock_previous->clock_next = entry->clock_next;
+        entry->clock_next->clock_previous = entry->clock_previous;
+        if (shard->hand == entry)
+            shard->hand = entry->clock_next;
+    }
+    shard->memory -= entry->size;
+    cache->memory.fetch_sub(entry->size, std::memory_order_relaxed);
+    cache->entries.fetch_sub(1, std::memory_order_relaxed);
+    PoolFree(entry); // to the pool of the thread stored it
+}
+
+void NormalizeName(char* name)
+{
+    int length = 0;
+    for (; name[length] != '\0'; length++) {
+        if (name[length] >= 'A' && name[length] <= 'Z')
+            name[length] += 'a' - 'A';
+    }
+    if (length > 1 && name[length - 1] == '.')
+        name[length - 1] = '\0';
 }
 
 #pragma endregion
@@ -206,32 +700,112 @@ int TranslateDomainName(const char* name, ADDRINFO** oinfos)
     return ret == 0;
 }
 
-void HandleDomainNameRequest(const char* name, SOCKET sender, ADDRESS receiver)
+int HandleDomainNameRequest(const char* name, SOCKET sender, ADDRESS receiver, const REQUEST_FLAGS* flags, DATAGRAM_BATCH* replies, const SERVER_CONFIG* config, CACHE* cache)
 {
-    ADDRINFO* results;
-    int is_ok = TranslateDomainName(name, &results);
+    RESOLUTION resolution;
+    RESPONSES responses;
+    config->resolve(name, config->stub_delay, &resolution);
+    BuildResponses(&resolution, &responses);
+    if (cache != NULL)
+        CachePut(cache, name, &responses);
+    return AppendResponses(sender, replies, &responses, receiver, flags);
+}
+
+void ExtractRequestFlags(const DATAGRAM* request, REQUEST_FLAGS* oflags)
+{
+    oflags->is_packed = 0;
+    oflags->has_id = 0;
+    oflags->id = 0;
+    // the flags are after the '\0' of the name, the old servers never read them
+    int position = (int)strlen(request->data) + 1;
+    while (position < request->length) {
+        const char* flag = request->data + position;
+        if (*flag == REQUEST_PACKED_FLAG) {
+            oflags->is_packed = 1;
+            position++;
+        }
+        else if (DecodeQueryID(flag, request->length - position, &oflags->id)) {
+            oflags->has_id = 1;
+            position += QUERY_ID_SIZE;
+        }
+        else
+            break; // unknown flag, from a newer client
+    }
+}
 
-    if (!is_ok || results == NULL) {
-        MESSAGE response = CreateMessage(STATUS_ERROR, ERROR_MESSAGE);
-        Send(sender, response, receiver);
-        DestroyMessage(response);
+void BuildResponses(const RESOLUTION* resolution, RESPONSES* oresponses)
+{
+    oresponses->is_found = resolution->is_found;
+    oresponses->count = 0;
+    oresponses->length = 0;
+    if (!resolution->is_found) {
+        MESSAGE_HANDLE response = CreateMessage(STATUS_ERROR, ERROR_MESSAGE);
+        if (response.message != NULL) {
+            int length = (int)strlen(response.message) + 1;
+            memcpy(oresponses->data, response.message, length);
+            oresponses->length = length;
+            oresponses->count = 1;
+        }
+        return;
     }
-    else {
-        ADDRINFO* node = results;
-        while (node != NULL) {
-            char* address = GetIPString(*(ADDRESS*)(node->ai_addr));
-            if (address != NULL) {
-                int status = (node->ai_next == NULL ? STATUS_OK_END : STATUS_OK);
-                MESSAGE response = CreateMessage(status, address);
-                Send(sender, response, receiver);
-
-                free(address);
-                DestroyMessage(response);
+
+    for (int i = 0; i < resolution->count; i++) {
+        ADDRESS address = CreateSocketAddress(resolution->addresses[i], 0);
+        MESSAGE_HANDLE ip_string = GetIPString(address);
+        if (ip_string.message != NULL) {
+            int status = (i == resolution->count - 1 ? STATUS_OK_END : STATUS_OK);
+            MESSAGE_HANDLE response = CreateMessage(status, ip_string.message);
+            if (response.message != NULL) {
+                int length = (int)strlen(response.message) + 1;
+                memcpy(oresponses->data + oresponses->length, response.message, length);
+                oresponses->length += length;
+                oresponses->count++;
             }
-            node = node->ai_next;
         }
     }
-    freeaddrinfo(results);
+}
+
+int AppendResponses(SOCKET sender, DATAGRAM_BATCH* replies, const RESPONSES* responses, ADDRESS receiver, const REQUEST_FLAGS* flags)
+{
+    const char* response = responses->data;
+    if (!flags->is_packed || !responses->is_found) {
+        // one datagram per address, or the STATUS_ERROR datagram that both formats share
+        for (int i = 0; i < responses->count; i++) {
+            AppendQueryID(AppendDatagram(sender, replies, response, receiver), flags);
+            response += strlen(response) + 1;
+        }
+        return responses->count;
+    }
+
+    // the cached responses are STATUS_OK datagrams: drop their status and join the addresses
+    DATAGRAM* datagram = NULL;
+    int appended = 0;
+    for (int i = 0; i < responses->count; i++) {
+        const char* address = response + 1;
+        int length = (int)strlen(address);
+        response += length + 2;
+        if (datagram != NULL && datagram->length + 1 + length + 1 <= PACKED_RESPONSE_MAX_SIZE) {
+            datagram->data[datagram->length++] = ADDRESS_DELIMITER;
+        }
+        else {
+            // complete the list before taking the next datagram, the batch may be sent
+            if (datagram != NULL) {
+                datagram->data[datagram->length++] = '\0';
+                AppendQueryID(datagram, flags);
+            }
+            datagram = NextDatagram(sender, replies, receiver);
+            datagram->data[datagram->length++] = STATUS_LIST_CHAR;
+            appended++;
+        }
+        memcpy(datagram->data + datagram->length, address, length);
+        datagram->length += length;
+    }
+    if (datagram != NULL) {
+        datagram->data[0] = STATUS_LIST_END_CHAR;
+        datagram->data[datagram->length++] = '\0';
+        AppendQueryID(datagram, flags);
+    }
+    return appended;
 }
 
 #pragma endregion
@@ -259,40 +833,62 @@ int ExtractCommand(int argc, char* argv[], int* oport)
     return is_ok;
 }
 
-int TryParseIPString(const char* str, IP* oip)
+int ExtractOptions(int argc, char* argv[], SERVER_CONFIG* oconfig)
 {
-    return inet_pton(AF_INET, str, oip) == 1;
-}
-
-char* GetIPString(ADDRESS addr)
-{
-    char ip_str[INET_ADDRSTRLEN];
-    if (inet_ntop(addr.sin_family, &addr.sin_addr, ip_str, sizeof(ip_str)) != NULL) {
-        char* result = (char*)malloc(sizeof(ip_str));
-        if (result == NULL) {
-            printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
-            return NULL;
-        }
-        strcpy_s(result, sizeof(ip_str), ip_str);
-        return result;
+    int is_ok = 1;
+    oconfig->workers = GetIntOption(argc, argv, WORKERS_OPTION, 1);
+    if (oconfig->workers < 1 || oconfig->workers > MAX_WORKERS) {
+        printf("[%s] %s\n", WARNING_FLAGS, _CONVERT_WORKERS_FAIL);
+        oconfig->workers = 1;
+        is_ok = 0;
     }
-    return NULL;
+    oconfig->batch_size = GetIntOption(argc, argv, BATCH_OPTION, DEFAULT_BATCH);
+    if (oconfig->batch_size < 1 || oconfig->batch_size > MAX_BATCH) {
+        printf("[%s] %s\n", WARNING_FLAGS, _CONVERT_BATCH_FAIL);
+        oconfig->batch_size = DEFAULT_BATCH;
+        is_ok = 0;
+    }
+    oconfig->resolvers = GetIntOption(argc, argv, RESOLVERS_OPTION, -1);
+    if (oconfig->resolvers == -1) // GetIntOption does not tell 0 from a missing option
+        oconfig->resolvers = HasOption(argc, argv, RESOLVERS_OPTION) ? 0 : DEFAULT_RESOLVERS;
+    if (oconfig->resolvers < 0 || oconfig->resolvers > MAX_RESOLVERS) {
+        printf("[%s] %s\n", WARNING_FLAGS, _CONVERT_RESOLVERS_FAIL);
+        oconfig->resolvers = DEFAULT_RESOLVERS;
+        is_ok = 0;
+    }
+    oconfig->resolve = HasOption(argc, argv, STUB_RESOLVER_OPTION) ? ResolveWithStub : ResolveWithSystem;
+    oconfig->is_cached = !HasOption(argc, argv, NO_CACHE_OPTION);
+    oconfig->cache_memory = (long long)GetIntOption(argc, argv, CACHE_MEMORY_OPTION, DEFAULT_CACHE_MEMORY) * 1024;
+    oconfig->cache_ttl = GetIntOption(argc, argv, CACHE_TTL_OPTION, DEFAULT_CACHE_TTL);
+    oconfig->negative_ttl = GetIntOption(argc, argv, NEGATIVE_TTL_OPTION, DEFAULT_NEGATIVE_TTL);
+    if (oconfig->cache_memory <= 0 || oconfig->cache_ttl < 0 || oconfig->negative_ttl < 0) {
+        printf("[%s] %s\n", WARNING_FLAGS, _CONVERT_CACHE_FAIL);
+        oconfig->cache_memory = DEFAULT_CACHE_MEMORY * 1024LL;
+        oconfig->cache_ttl = DEFAULT_CACHE_TTL;
+        oconfig->negative_ttl = DEFAULT_NEGATIVE_TTL;
+        is_ok = 0;
+    }
+    oconfig->stub_delay = GetIntOption(argc, argv, STUB_RESOLVER_OPTION, 0);
+    if (oconfig->stub_delay < 0)
+        oconfig->stub_delay = 0;
+    return is_ok;
 }
 
-IP CreateDefaultIP()
+MESSAGE_HANDLE GetIPString(ADDRESS addr)
 {
-    IP addr;
-    addr.s_addr = htonl(INADDR_ANY);
-    return addr;
+    MESSAGE_HANDLE result((MESSAGE)PoolAllocate(INET_ADDRSTRLEN));
+    if (result.message != NULL && inet_ntop(addr.sin_family, &addr.sin_addr, result.message, INET_ADDRSTRLEN) == NULL)
+        return MESSAGE_HANDLE();
+    return result;
 }
 
-MESSAGE CreateMessage(int status, const char* message)
+MESSAGE_HANDLE CreateMessage(int status, const char* message)
 {
-    MESSAGE m = (MESSAGE)malloc(MESSAGE_MAX_SIZE);
-    if (m == NULL) {
-        printf("[%s] %s\n", WARNING_FLAGS, _ALLOCATE_MEMORY_FAIL);
-        return NULL;
-    }
+    int message_len = (int)strlen(message) + 1;
+    MESSAGE_HANDLE handle((MESSAGE)PoolAllocate(message_len + 1)); // the status, then the message with its '\0'
+    MESSAGE m = handle.message;
+    if (m == NULL)
+        return handle;
     if (status == STATUS_OK) {
         m[0] = STATUS_OK_CHAR;
     }
@@ -305,13 +901,8 @@ MESSAGE CreateMessage(int status, const char* message)
     else {
         m[0] = '\0';
     }
-    strcpy_s(m + 1, strlen(message) + 1, message);
-    return m;
+    memcpy(m + 1, message, message_len);
+    return handle;
 }
 
-void DestroyMessage(MESSAGE m)
-{
-    free(m);
-    m = NULL;
-}
 #pragma endregion
\ No newline at end of file
@@ -1,90 +1,433 @@
 #pragma once
-#pragma comment(lib, "Ws2_32.lib")
 
 #pragma region Header Declarations
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
 
-#include <WinSock2.h>
-#include <WS2tcpip.h>
+#include "Network.h"
 
-#include "CommonDefinitions.h"
+#ifdef __linux__
+#define SERVER_MMSG // batches of datagrams are received and sent with one call (recvmmsg, sendmmsg)
+#endif
 #pragma endregion
 
 #pragma region Constants Definitions
 
 #define ERROR_MESSAGE "Not found infomation"
 
+#define WORKERS_OPTION "--workers"
+#define BATCH_OPTION "--batch" // number of datagrams received with one call
+#define RESOLVERS_OPTION "--resolvers" // number of resolver threads. 0 for resolving in the datagram loops
+#define STUB_RESOLVER_OPTION "--stub-resolver" // resolve with a local stub that answers after <delay> milliseconds (See: ResolveWithStub)
+#define NO_CACHE_OPTION "--no-cache" // resolve every request, the responses are not cached
+#define CACHE_MEMORY_OPTION "--cache-memory" // memory budget of the cache, in KB
+#define CACHE_TTL_OPTION "--cache-ttl" // in seconds, lifetime of the cached addresses
+#define NEGATIVE_TTL_OPTION "--negative-ttl" // in seconds, lifetime of the cached ERROR_MESSAGE responses
+
+#define MAX_WORKERS 64
+#define DEFAULT_BATCH 32
+#define MAX_BATCH 1024
+#define WORKER_STATS_INTERVAL 1000 // in milliseconds, period of the worker counters report
+#define DATAGRAM_CONTROL_SIZE 64 // ancillary data received with a datagram: the drop counter (SO_RXQ_OVFL)
+
+#define DEFAULT_RESOLVERS 4
+#define MAX_RESOLVERS 256
+#define MAX_PENDING_LOOKUPS 65536 // queries for new names are dropped while this many lookups are pending
+#define LOOKUP_TABLE_SIZE 4096 // buckets of the pending lookups, power of 2
+#define INITIAL_WAITERS 4 // waiters a new lookup has room for, doubled when full
+#define RESOLUTION_MAX_ADDRESSES 64
+#define STUB_NOT_FOUND_PREFIX "nx" // the stub resolver finds no address for names with this prefix
+#define RESPONSES_MAX_SIZE (RESOLUTION_MAX_ADDRESSES * 20) // the responses of a resolution, each is status + IPv4 string + '\0'
+#define PACKED_RESPONSE_MAX_SIZE (APPLICATION_BUFF_MAX_SIZE - QUERY_ID_SIZE) // a list of addresses is split above this: under the Ethernet MTU, and fits the receive buffer of clients
+
+#define DEFAULT_CACHE_MEMORY 16384 // in KB
+#define DEFAULT_CACHE_TTL 60 // the system resolver does not tell the TTL of records, so a fixed one is used
+#define DEFAULT_NEGATIVE_TTL 5
+#define CACHE_SHARDS 16 // each shard has its own lock, table and clock
+#define CACHE_TABLE_SIZE 1024 // buckets of a shard, power of 2
+
+#pragma endregion
+
+#pragma region Type Definitions
+
+/// <summary>
+/// The IPv4 addresses of a domain name
+/// </summary>
+typedef struct {
+    int is_found; // 0 if the name has no address, or the lookup failed
+    int count; // number of addresses
+    IP addresses[RESOLUTION_MAX_ADDRESSES];
+} RESOLUTION;
+
+/// <summary>
+/// A function that translates a domain name to IPv4 addresses (See: ResolveWithSystem, ResolveWithStub).
+/// It may block, and is called by many threads at the same time.
+/// </summary>
+typedef void (*RESOLVE_FUNCTION)(const char* name, int delay, RESOLUTION* oresolution);
+
+/// <summary>
+/// The response datagrams of a resolution, formatted once and sent to every client asks for the name
+/// </summary>
+typedef struct {
+    int is_found; // 0 if the only response is ERROR_MESSAGE
+    int count; // number of datagrams
+    int length; // number of bytes in data
+    char data[RESPONSES_MAX_SIZE]; // the datagrams, each ends with '\0' (See: Send)
+} RESPONSES;
+
+/// <summary>
+/// The server options, from command-line arguments
+/// </summary>
+typedef struct {
+    int workers; // number of threads, each receives with its own socket if the system supports SO_REUSEPORT
+    int batch_size; // number of datagrams received with one call
+    int resolvers; // number of resolver threads. 0 for resolving in the datagram loops
+    RESOLVE_FUNCTION resolve;
+    int stub_delay; // in milliseconds, delay of the stub resolver
+    int is_cached; // 1 if the responses are cached
+    long long cache_memory; // in bytes, memory budget of the cache
+    int cache_ttl; // in seconds
+    int negative_ttl; // in seconds
+} SERVER_CONFIG;
+
+/// <summary>
+/// A worker thread that runs its own datagram loop.
+/// The counters are read by the main thread. Replies are also counted by the resolver threads.
+/// </summary>
+typedef struct alignas(64) {
+    int id;
+    SOCKET socket;
+    std::atomic<long long> queries; // number of requests received
+    std::atomic<long long> replies; // number of response datagrams queued to send
+    std::atomic<long long> coalesced; // number of requests joined a pending lookup of the same name
+    std::atomic<long long> overloaded; // number of requests dropped because too many lookups are pending
+    std::atomic<long long> dropped; // number of datagrams dropped by the system because the socket buffer is full
+} WORKER;
+
+/// <summary>
+/// The cached responses of a domain name. The name and the datagrams are stored right after the entry,
+/// in a block of the message pool (See: PoolAllocate).
+/// </summary>
+typedef struct CACHE_ENTRY {
+    char* name; // the normalized name (See: NormalizeName)
+    unsigned int hash;
+    long long expires; // timestamp when the entry expires, in nanoseconds
+    int is_referenced; // 1 if the entry is hit since the clock hand passed it
+    int size; // in bytes, memory used by the entry
+    int is_found;
+    int count; // number of datagrams
+    int length;
+    char* data;
+    struct CACHE_ENTRY* next; // next entry in the same bucket
+    struct CACHE_ENTRY* clock_previous; // the entries of a shard form a circle, scanned by the clock hand to evict
+    struct CACHE_ENTRY* clock_next;
+} CACHE_ENTRY;
+
+/// <summary>
+/// A part of the cache, for the names whose hash selects it
+/// </summary>
+typedef struct {
+    std::mutex lock;
+    CACHE_ENTRY* table[CACHE_TABLE_SIZE];
+    CACHE_ENTRY* hand; // the next entry the clock inspects. NULL if the shard is empty
+    long long memory; // in bytes, memory used by the entries
+} CACHE_SHARD;
+
+/// <summary>
+/// A cache of response datagrams by domain name, with TTL expiry and a bounded memory.
+/// The least recently used entries are evicted by the CLOCK algorithm.
+/// </summary>
+typedef struct {
+    CACHE_SHARD shards[CACHE_SHARDS];
+    long long shard_memory; // in bytes, memory budget of a shard
+    const SERVER_CONFIG* config;
+    std::atomic<long long> hits;
+    std::atomic<long long> misses; // include the expired entries
+    std::atomic<long long> evicted; // number of entries evicted to keep the memory budget
+    std::atomic<long long> entries;
+    std::atomic<long long> memory; // in bytes
+} CACHE;
+
+/// <summary>
+/// The options a client sends after the '\0' of the domain name (See: ExtractRequestFlags). The old clients send none.
+/// </summary>
+typedef struct {
+    int is_packed; // 1 if the client reads lists of addresses
+    int has_id; // 1 if the request has a query ID, echoed in every response
+    unsigned int id;
+} REQUEST_FLAGS;
+
+/// <summary>
+/// A client waits for the result of a lookup
+/// </summary>
+typedef struct {
+    ADDRESS client;
+    SOCKET socket; // the socket received the request, it sends the responses
+    WORKER* worker; // the worker received the request. NULL if not counted
+    REQUEST_FLAGS flags;
+} WAITER;
+
+/// <summary>
+/// A pending lookup of a domain name. The requests for the same name are coalesced: they wait for one lookup.
+/// The lookup and its waiters are allocated from the message pool of the worker, the name is stored right after the lookup.
+/// </summary>
+typedef struct LOOKUP {
+    char* name;
+    unsigned int hash;
+    WAITER* waiters;
+    int waiter_count;
+    int waiter_capacity;
+    struct LOOKUP* next; // next lookup in the same bucket of the pending table
+    struct LOOKUP* next_job; // next lookup in the queue of the resolver threads
+} LOOKUP;
+
+/// <summary>
+/// Threads resolve the domain names while the datagram loops receive new requests.
+/// A lookup is pending from its first request until its responses are queued to send.
+/// </summary>
+typedef struct {
+    const SERVER_CONFIG* config;
+    CACHE* cache; // the responses are cached when lookups complete. NULL if not cached
+    std::mutex lock; // protects the pending table and the queue
+    std::condition_variable has_jobs;
+    LOOKUP* table[LOOKUP_TABLE_SIZE]; // the pending lookups, by hash of name
+    LOOKUP* jobs_head; // the lookups not started, in order
+    LOOKUP* jobs_tail;
+    int pending; // number of pending lookups
+    std::thread* threads;
+} RESOLVER_POOL;
+
+/// <summary>
+/// A datagram, received or to send
+/// </summary>
+typedef struct {
+    ADDRESS address; // the sender of a datagram received, the receiver of a datagram to send
+    int length; // number of bytes in data. A datagram received is followed by '\0'
+    char data[APPLICATION_BUFF_MAX_SIZE];
+} DATAGRAM;
+
+/// <summary>
+/// A batch of datagrams, received or sent with one call
+/// </summary>
+typedef struct {
+    DATAGRAM* datagrams;
+    int count; // number of datagrams in the batch
+    int capacity;
+    long long sent; // number of datagrams sent since the batch is created
+#ifdef SERVER_MMSG
+    struct mmsghdr* headers; // headers[i] refers to datagrams[i]
+    struct iovec* spans;
+    char* controls; // DATAGRAM_CONTROL_SIZE bytes for each header
+#endif
+} DATAGRAM_BATCH;
+
 #pragma endregion
 
 #pragma region Function Declarations
 
 /// <summary>
-/// Initialize Winsock 2.2
+/// Create an UDP socket bound to INADDR_ANY:port
 /// </summary>
-/// <returns>1 if initialize successfully, 0 otherwise</returns>
-int WSInitialize();
+/// <param name="port">The port number</param>
+/// <param name="reuse_port">1 if the address can be shared with other sockets (See: SetReusePort)</param>
+/// <returns>The bound socket. INVALID_SOCKET if has errors</returns>
+SOCKET CreateDatagramSocket(int port, int reuse_port);
 
 /// <summary>
-/// Clean up Winsock 2.2
+/// Receive the requests of a socket in batches, and send all responses of a batch with one call.
+/// This function only returns if the batches can't be allocated.
 /// </summary>
-/// <returns>1 if close successfully, 0 otherwise</returns>
-int WSCleanup();
+/// <param name="socket">The bound socket</param>
+/// <param name="config">The server options</param>
+/// <param name="worker">The worker runs the loop, its counters are updated. NULL if not counted</param>
+/// <param name="pool">The resolver threads. NULL for resolving in the loop</param>
+/// <param name="cache">The cache of responses. NULL if not cached</param>
+/// <returns>0 if the loop stops because of errors</returns>
+int RunDatagramLoop(SOCKET socket, const SERVER_CONFIG* config, RESOLVER_POOL* pool, CACHE* cache, WORKER* worker = NULL);
 
 /// <summary>
-/// Create a TCP/UDP Socket.
+/// Start worker threads, each runs its own datagram loop. If the system supports SO_REUSEPORT, each worker
+/// has its own socket bound to the same port, otherwise all workers share the socket.
+/// The main thread reports the worker and cache counters while they change.
 /// </summary>
-/// <param name="protocol">TCP or UDP</param>
-/// <returns>
-/// Created TCP/UDP Socket.
-/// INVALID_SOCKET if protocol is unexpected or have error on Winsock
-/// </returns>
-SOCKET CreateSocket(int protocol);
+/// <param name="socket">The first socket, bound with reuse port if supported</param>
+/// <param name="port">The port number</param>
+/// <param name="config">The server options</param>
+/// <param name="pool">The resolver threads, shared by the workers. NULL for resolving in the loops</param>
+/// <param name="cache">The cache of responses, shared by the workers. NULL if not cached</param>
+/// <returns>0 when all workers stop</returns>
+int RunWorkers(SOCKET socket, int port, const SERVER_CONFIG* config, RESOLVER_POOL* pool, CACHE* cache);
 
 /// <summary>
-/// Close a created Socket
+/// Print the counters of workers, of the cache, and of the message pools
 /// </summary>
-/// <param name="socket">The socket want to close</param>
-/// <param name="mode">CLOSE_NORMAL or CLOSE_SAFELY (Shutdown before close)</param>
-/// <param name="flags">Specify how to close socket safely. Some flags: SD_RECEIVE, SD_SEND, SD_BOTH (Manifest constants for shutdown()). This param is not used with CLOSE_NORMAL </param>
-/// <returns>1 if close successfully, 0 otherwise</returns>
-int CloseSocket(SOCKET socket, int mode, int flags = 0);
+/// <param name="workers">The workers</param>
+/// <param name="worker_numbers">Number of workers</param>
+/// <param name="cache">The cache of responses. NULL if not cached</param>
+void PrintWorkerCounters(WORKER* workers, int worker_numbers, CACHE* cache);
 
 /// <summary>
-/// Bind a socket to an address [IPv4, Port]
+/// Allocate a batch of datagrams
 /// </summary>
-/// <param name="socket">The socket want to bind</param>
-/// <param name="addr">A socket address [IPv4, Port]</param>
-/// <returns>1 is bind successfully. 0 otherwise</returns>
-int BindSocket(SOCKET socket, ADDRESS addr);
+/// <param name="obatch">[Output] The batch, empty</param>
+/// <param name="capacity">Number of datagrams the batch can hold</param>
+/// <returns>1 if allocate successfully. 0 otherwise</returns>
+int CreateBatch(DATAGRAM_BATCH* obatch, int capacity);
 
 /// <summary>
-/// Create a socket address that used IPv4 and Port Number
+/// Free memory for a batch of datagrams
 /// </summary>
-/// <param name="ip">The IPv4 Address</param>
-/// <param name="port">The Port number</param>
-/// <returns>Created socket address</returns>
-ADDRESS CreateSocketAddress(IP ip, int port);
+/// <param name="batch">The batch</param>
+void DestroyBatch(DATAGRAM_BATCH* batch);
 
 /// <summary>
-/// Receive a message from an UDP socket buffer.
+/// Wait for datagrams, then receive all datagrams available with one call, up to the capacity of the batch.
+/// Each datagram is followed by '\0', the larger ones are truncated.
 /// </summary>
 /// <param name="receiver">The receiver socket</param>
-/// <param name="omessage">[Output] The message extracted from datagram</param>
-/// <param name="osender_addr">[Output] The sender's address in the datagram</param>
-/// <returns>1 if have no errors. 0 otherwise</returns>
-int Receive(SOCKET receiver, char** omessage, ADDRESS* osender_addr);
+/// <param name="obatch">[Output] The batch, its previous datagrams are dropped</param>
+/// <param name="worker">The worker receives, its drop counter is updated. NULL if not counted</param>
+/// <returns>Number of datagrams received. 0 if has errors</returns>
+int ReceiveBatch(SOCKET receiver, DATAGRAM_BATCH* obatch, WORKER* worker = NULL);
 
 /// <summary>
-/// Send a message to an address
+/// Send all datagrams of a batch, with as few calls as possible, then empty it.
+/// A datagram that can't be sent is skipped.
 /// </summary>
 /// <param name="sender">The sender socket</param>
-/// <param name="message">The message want to send</param>
-/// <param name="receiver">The receiver's address</param>
-/// <param name="byte_sent">[Output] Number of bytes are sent successfully.</param>
-/// <returns>1 if have no errors. 0 otherwise</returns>
-int Send(SOCKET sender, const char* message, ADDRESS receiver, int* obyte_sent = NULL);
+/// <param name="batch">The batch</param>
+/// <returns>Number of datagrams sent</returns>
+int SendBatch(SOCKET sender, DATAGRAM_BATCH* batch);
+
+/// <summary>
+/// Append a response to a batch, in the format of Send: the message with its '\0'.
+/// The batch is sent first if it is full.
+/// </summary>
+/// <param name="sender">The socket used to send the batch</param>
+/// <param name="batch">The batch</param>
+/// <param name="message">The response message (See: CreateMessage)</param>
+/// <param name="receiver">The client's address</param>
+/// <returns>The datagram appended</returns>
+DATAGRAM* AppendDatagram(SOCKET sender, DATAGRAM_BATCH* batch, const MESSAGE message, ADDRESS receiver);
+
+/// <summary>
+/// Echo the query ID of a request after the '\0' of a response datagram, if the request has one
+/// </summary>
+/// <param name="datagram">The response datagram, complete</param>
+/// <param name="flags">The options of the request</param>
+void AppendQueryID(DATAGRAM* datagram, const REQUEST_FLAGS* flags);
+
+/// <summary>
+/// Take the next datagram of a batch, empty, to fill in place and count in its length.
+/// The batch is sent first if it is full, so the datagrams taken before must be complete.
+/// </summary>
+/// <param name="sender">The socket used to send the batch</param>
+/// <param name="batch">The batch</param>
+/// <param name="receiver">The client's address</param>
+/// <returns>The datagram, already counted in the batch</returns>
+DATAGRAM* NextDatagram(SOCKET sender, DATAGRAM_BATCH* batch, ADDRESS receiver);
+
+/// <summary>
+/// Start the resolver threads
+/// </summary>
+/// <param name="config">The server options, config->resolvers threads are started</param>
+/// <param name="cache">The cache filled when lookups complete. NULL if not cached</param>
+/// <returns>The resolver threads. NULL if no thread is wanted or has errors</returns>
+RESOLVER_POOL* CreateResolverPool(const SERVER_CONFIG* config, CACHE* cache);
+
+/// <summary>
+/// Run a resolver thread: take the lookups in order, resolve them, and send the responses to every waiter
+/// </summary>
+/// <param name="pool">The resolver threads</param>
+void RunResolver(RESOLVER_POOL* pool);
+
+/// <summary>
+/// Add a request to the pending lookup of its name, or queue a new lookup. It never blocks on a lookup.
+/// </summary>
+/// <param name="pool">The resolver threads</param>
+/// <param name="name">The domain name</param>
+/// <param name="waiter">The client waits for the responses</param>
+/// <returns>1 if a new lookup is queued. 2 if the request joins a pending lookup. 0 if the request is dropped</returns>
+int SubmitLookup(RESOLVER_POOL* pool, const char* name, WAITER waiter);
+
+/// <summary>
+/// Remove a resolved lookup from the pending table, and queue its responses for every waiter
+/// </summary>
+/// <param name="pool">The resolver threads</param>
+/// <param name="lookup">The lookup, freed</param>
+/// <param name="responses">The responses for the result of the lookup</param>
+/// <param name="replies">The batch of responses of the resolver thread</param>
+void CompleteLookup(RESOLVER_POOL* pool, LOOKUP* lookup, const RESPONSES* responses, DATAGRAM_BATCH* replies);
+
+/// <summary>
+/// Hash a domain name (FNV-1a)
+/// </summary>
+/// <param name="name">The domain name</param>
+/// <returns>The hash</returns>
+unsigned int HashName(const char* name);
+
+/// <summary>
+/// Create an empty cache
+/// </summary>
+/// <param name="config">The server options: memory budget and TTLs</param>
+/// <returns>The cache. NULL if caching is disabled or has errors</returns>
+CACHE* CreateCache(const SERVER_CONFIG* config);
+
+/// <summary>
+/// Find the responses of a name that are not expired, and mark them as recently used
+/// </summary>
+/// <param name="cache">The cache</param>
+/// <param name="name">The normalized name</param>
+/// <param name="oresponses">[Output] A copy of the responses</param>
+/// <returns>1 if found. 0 otherwise, an expired entry is removed</returns>
+int CacheGet(CACHE* cache, const char* name, RESPONSES* oresponses);
+
+/// <summary>
+/// Store the responses of a name, with the TTL of their kind (found or ERROR_MESSAGE).
+/// Entries are evicted until the shard fits its memory budget.
+/// </summary>
+/// <param name="cache">The cache</param>
+/// <param name="name">The normalized name</param>
+/// <param name="responses">The responses</param>
+void CachePut(CACHE* cache, const char* name, const RESPONSES* responses);
+
+/// <summary>
+/// Unlink an entry from its shard and free it. The shard lock is held by the caller.
+/// </summary>
+/// <param name="cache">The cache</param>
+/// <param name="shard">The shard holds the entry</param>
+/// <param name="entry">The entry</param>
+void RemoveCacheEntry(CACHE* cache, CACHE_SHARD* shard, CACHE_ENTRY* entry);
+
+/// <summary>
+/// Convert a domain name to the key of the cache and of the pending lookups, in place:
+/// lower case, without the trailing '.' of a fully qualified name
+/// </summary>
+/// <param name="name">The domain name</param>
+void NormalizeName(char* name);
+
+/// <summary>
+/// Translate a domain name with the system resolver (See: TranslateDomainName)
+/// </summary>
+/// <param name="name">The domain name</param>
+/// <param name="delay">Not used, the system resolution has no injected delay (See: ResolveWithStub)</param>
+/// <param name="oresolution">[Output] The addresses</param>
+void ResolveWithSystem(const char* name, int delay, RESOLUTION* oresolution);
+
+/// <summary>
+/// Translate a domain name with a local stub, for tests: an IPv4 string is its own address,
+/// a name with STUB_NOT_FOUND_PREFIX has no address, other names have 1 to 3 addresses 10.x.y.z derived from their hash.
+/// </summary>
+/// <param name="name">The domain name</param>
+/// <param name="delay">Time to wait before answering, in milliseconds</param>
+/// <param name="oresolution">[Output] The addresses</param>
+void ResolveWithStub(const char* name, int delay, RESOLUTION* oresolution);
 
 /// <summary>
 /// Translate a Domain Name to IPv4 Addresses.
@@ -97,11 +440,45 @@ int TranslateDomainName(const char* name, ADDRINFO** oinfos);
 /// <summary>
 /// Handle request from Client that is a Domain Name String.
 /// [Translate the domain name to IPv4 Addresses]
+/// The responses are appended to a batch, which is sent first if it is full.
 /// </summary>
 /// <param name="name">The domain name want to translate</param>
 /// <param name="sender">The socket used to send result to client</param>
 /// <param name="receiver">The client's address</param>
-void HandleDomainNameRequest(const char* name, SOCKET sender, ADDRESS receiver);
+/// <param name="flags">The options of the request</param>
+/// <param name="replies">The batch of responses</param>
+/// <param name="config">The server options, with the resolve function</param>
+/// <param name="cache">The cache filled with the responses. NULL if not cached</param>
+/// <returns>Number of responses appended</returns>
+int HandleDomainNameRequest(const char* name, SOCKET sender, ADDRESS receiver, const REQUEST_FLAGS* flags, DATAGRAM_BATCH* replies, const SERVER_CONFIG* config, CACHE* cache);
+
+/// <summary>
+/// Read the options after the '\0' of the domain name, in any order: REQUEST_PACKED_FLAG asks for lists of addresses,
+/// QUERY_ID_FLAG and 4 bytes give the query ID. The old clients send the name only, and read one datagram per address.
+/// </summary>
+/// <param name="request">The request received, followed by '\0'</param>
+/// <param name="oflags">[Output] The options</param>
+void ExtractRequestFlags(const DATAGRAM* request, REQUEST_FLAGS* oflags);
+
+/// <summary>
+/// Format the responses for a resolution: one STATUS_OK datagram per address and STATUS_OK_END for the last,
+/// or one STATUS_ERROR datagram if no address is found
+/// </summary>
+/// <param name="resolution">The addresses</param>
+/// <param name="oresponses">[Output] The responses</param>
+void BuildResponses(const RESOLUTION* resolution, RESPONSES* oresponses);
+
+/// <summary>
+/// Append the responses to a batch. For a packed request, the addresses are joined by ADDRESS_DELIMITER
+/// in as few datagrams as PACKED_RESPONSE_MAX_SIZE allows: STATUS_LIST for each, STATUS_LIST_END for the last.
+/// </summary>
+/// <param name="sender">The socket used to send the batch</param>
+/// <param name="replies">The batch of responses</param>
+/// <param name="responses">The responses</param>
+/// <param name="receiver">The client's address</param>
+/// <param name="flags">The options of the request: the format, and the query ID echoed in each datagram</param>
+/// <returns>Number of datagrams appended</returns>
+int AppendResponses(SOCKET sender, DATAGRAM_BATCH* replies, const RESPONSES* responses, ADDRESS receiver, const REQUEST_FLAGS* flags);
 
 /// <summary>
 /// Extract port number from command-line arguments.
@@ -114,25 +491,20 @@ void HandleDomainNameRequest(const char* name, SOCKET sender, ADDRESS receiver);
 int ExtractCommand(int argc, char* argv[], int* oport);
 
 /// <summary>
-/// Create a INADDR_ANY IP Address
+/// Extract the server options from command-line arguments. Invalid values are replaced by defaults.
 /// </summary>
-/// <returns>The INADDR_ANY IP</returns>
-IP CreateDefaultIP();
-
-/// <summary>
-/// Try parse a string to a IPv4 Address
-/// </summary>
-/// <param name="str">The string want to parse</param>
-/// <param name="oip">[Output] The result IPv4 Address</param>
-/// <returns>1 if parse successfully. 0 otherwise</returns>
-int TryParseIPString(const char* str, IP* oip);
+/// <param name="argc">Number of Arguments [From main()]</param>
+/// <param name="argv">Arguments value [From main()]</param>
+/// <param name="oconfig">[Output] The server options</param>
+/// <returns>1 if extract successfully. 0 if some defaults are used</returns>
+int ExtractOptions(int argc, char* argv[], SERVER_CONFIG* oconfig);
 
 /// <summary>
 /// Extract IPv4 Address from Socket Address and convert to a string
 /// </summary>
 /// <param name="addr">The Socket Address</param>
-/// <returns>IPv4 in string</returns>
-char* GetIPString(ADDRESS addr);
+/// <returns>IPv4 in string, allocated from the message pool. Empty if has errors</returns>
+MESSAGE_HANDLE GetIPString(ADDRESS addr);
 
 /// <summary>
 /// Create a Message object that used to send back to client.
@@ -140,13 +512,7 @@ char* GetIPString(ADDRESS addr);
 /// </summary>
 /// <param name="status">The status (flag) for the message</param>
 /// <param name="message">The response message want to send</param>
-/// <returns>A message with status</returns>
-MESSAGE CreateMessage(int status, const char* message);
+/// <returns>A message with status, allocated from the message pool with its exact size. Empty if fail to allocate memory</returns>
+MESSAGE_HANDLE CreateMessage(int status, const char* message);
 
-/// <summary>
-/// Free memory for Message object
-/// </summary>
-/// <param name="m">The message want to free</param>
-void DestroyMessage(MESSAGE m);
-
-#pragma endregion
\ No newline at end of file
+#pragma endregion
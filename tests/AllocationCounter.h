@@ -0,0 +1,58 @@
+#pragma once
+
+#pragma region Header Declarations
+
+#include <stdlib.h>
+#include <new>
+
+#pragma endregion
+
+#pragma region Allocation Counter
+// Counts the heap allocations of the program: malloc, calloc and realloc are wrapped at link time
+// (-Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc), operator new is replaced.
+// Included by one file of a test, which defines the wrappers.
+
+static thread_local long long allocations = 0; // in the thread, the peer of a socket can write from another
+
+extern "C" void* __real_malloc(size_t size);
+extern "C" void* __real_calloc(size_t count, size_t size);
+extern "C" void* __real_realloc(void* block, size_t size);
+
+extern "C" void* __wrap_malloc(size_t size)
+{
+    allocations++;
+    return __real_malloc(size);
+}
+
+extern "C" void* __wrap_calloc(size_t count, size_t size)
+{
+    allocations++;
+    return __real_calloc(count, size);
+}
+
+extern "C" void* __wrap_realloc(void* block, size_t size)
+{
+    allocations++;
+    return __real_realloc(block, size);
+}
+
+void* operator new(size_t size)
+{
+    allocations++;
+    void* block = __real_malloc(size > 0 ? size : 1);
+    if (block == NULL)
+        throw std::bad_alloc();
+    return block;
+}
+
+void operator delete(void* block) noexcept
+{
+    free(block);
+}
+
+void operator delete(void* block, size_t) noexcept
+{
+    free(block);
+}
+
+#pragma endregion
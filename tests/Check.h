@@ -0,0 +1,33 @@
+#pragma once
+
+#pragma region Header Declarations
+
+#include <stdio.h>
+
+#pragma endregion
+
+#pragma region Checks
+// A failed check is printed and counted, the test goes on. main returns CHECK_RESULT().
+
+static int check_failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            printf("%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            check_failures++; \
+        } \
+    } while (0)
+
+#define CHECK_EQUAL(expected, actual) \
+    do { \
+        long long _expected = (long long)(expected), _actual = (long long)(actual); \
+        if (_expected != _actual) { \
+            printf("%s:%d: CHECK_EQUAL(%s, %s) failed: %lld != %lld\n", __FILE__, __LINE__, #expected, #actual, _expected, _actual); \
+            check_failures++; \
+        } \
+    } while (0)
+
+#define CHECK_RESULT() (printf("%s: %d checks failed\n", check_failures ? "FAIL" : "OK", check_failures), check_failures ? 1 : 0)
+
+#pragma endregion
@@ -0,0 +1,73 @@
+#include "TCP_Client.h"
+#include "AllocationCounter.h"
+#include "Check.h"
+
+#pragma region Test Support
+
+#define MESSAGES 200
+#define WARMUP_MESSAGES 5 // the buffer grows to the largest message, which is the first
+
+#define MESSAGE_LENGTHS 6
+
+// a legacy header tells at most SEGMENTATION_LEGACY_REMAIN_MAX bytes remain
+static const int legacy_lengths[MESSAGE_LENGTHS] = { 60000, 1, 10, APPLICATION_BUFF_MAX_SIZE, 3000, 20000 };
+static const int extended_lengths[MESSAGE_LENGTHS] = { 100000, 1, 10, APPLICATION_BUFF_MAX_SIZE, SEGMENTATION_MAX_SIZE, 70000 };
+
+static char message[100000];
+
+/// <summary>
+/// Write the responses of the server from another thread: the socket buffers do not hold them all
+/// </summary>
+static void WriteMessages(SOCKET socket, const int* lengths, const FRAMING* framing)
+{
+    for (int i = 0; i < MESSAGES; i++) {
+        message[0] = (char)('a' + i % 26); // each message is told from the previous one
+        CHECK_EQUAL(1, SegmentationSend(socket, message, lengths[i % MESSAGE_LENGTHS], NULL, framing));
+    }
+}
+
+#pragma endregion
+
+void TestMergeSegmentationMessage(const int* lengths, const FRAMING* framing)
+{
+    for (int i = 0; i < (int)sizeof(message); i++)
+        message[i] = (char)('0' + i % 10);
+    int sockets[2];
+    CHECK_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sockets));
+    // the writer thread is started before counting, so it is not counted
+    std::thread writer(WriteMessages, sockets[1], lengths, framing);
+
+    BUFFER buffer = { NULL, 0 };
+    long long steady_allocations = 0;
+    for (int i = 0; i < MESSAGES; i++) {
+        MESSAGE merged;
+        long long before = allocations;
+        CHECK_EQUAL(1, MergeSegmentationMessage(sockets[0], &buffer, &merged, framing));
+        if (i >= WARMUP_MESSAGES)
+            steady_allocations += allocations - before;
+        int length = lengths[i % MESSAGE_LENGTHS];
+        CHECK(merged != NULL && merged[0] == (char)('a' + i % 26));
+        if (length > 1) // the writer changes only the first byte
+            CHECK(merged != NULL && merged[length - 1] == (char)('0' + (length - 1) % 10));
+    }
+    writer.join();
+    printf("MergeSegmentationMessage (%d-byte segmentations): %lld allocations for %d messages\n",
+        framing != NULL ? framing->segment_size : APPLICATION_BUFF_MAX_SIZE, steady_allocations, MESSAGES - WARMUP_MESSAGES);
+    CHECK_EQUAL(0, steady_allocations);
+    DestroyBuffer(&buffer);
+    CloseSocket(sockets[0], CLOSE_NORMAL);
+    CloseSocket(sockets[1], CLOSE_NORMAL);
+}
+
+int main()
+{
+    // the counter sees the allocations of the libraries
+    long long before = allocations;
+    free(Clone("123", 3));
+    CHECK_EQUAL(before + 1, allocations);
+
+    TestMergeSegmentationMessage(legacy_lengths, NULL);
+    FRAMING extended = { SEGMENTATION_MAX_SIZE, 1 };
+    TestMergeSegmentationMessage(extended_lengths, &extended);
+    return CHECK_RESULT();
+}
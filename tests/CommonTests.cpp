@@ -0,0 +1,352 @@
+#include <limits.h>
+#include <thread>
+#include <mutex>
+
+#include "Network.h"
+#include "Check.h"
+
+#pragma region Test Support
+
+static int logged = 0; // messages logged by the library, they are expected by some checks
+
+static void CountLogMessage(const char* flags, int error, const char* message)
+{
+    (void)flags;
+    (void)error;
+    (void)message;
+    logged++;
+}
+
+static int sendmsg_limit = 0; // largest number of bytes a sendmsg call accepts. 0 for no limit
+static int sendmsg_calls = 0;
+
+extern "C" ssize_t __real_sendmsg(int socket, const struct msghdr* header, int flags);
+
+/// <summary>
+/// sendmsg, wrapped at link time (-Wl,--wrap=sendmsg): it accepts at most sendmsg_limit bytes,
+/// as a socket with a full buffer, so the callers have to resume the short writes
+/// </summary>
+extern "C" ssize_t __wrap_sendmsg(int socket, const struct msghdr* header, int flags)
+{
+    sendmsg_calls++;
+    if (sendmsg_limit == 0)
+        return __real_sendmsg(socket, header, flags);
+    struct iovec pieces[SEGMENTATION_BATCH_SIZE * 2];
+    struct msghdr limited = *header;
+    size_t left = sendmsg_limit;
+    int count = 0;
+    for (size_t i = 0; i < header->msg_iovlen && left > 0 && count < SEGMENTATION_BATCH_SIZE * 2; i++) {
+        pieces[count] = header->msg_iov[i];
+        if (pieces[count].iov_len > left)
+            pieces[count].iov_len = left;
+        left -= pieces[count].iov_len;
+        count++;
+    }
+    limited.msg_iov = pieces;
+    limited.msg_iovlen = count;
+    return __real_sendmsg(socket, &limited, flags);
+}
+
+#pragma endregion
+
+#pragma region Segmentation Header
+
+void TestLegacyHeader()
+{
+    int currents[] = { 0, 1, APPLICATION_BUFF_MAX_SIZE - SEGMENTATION_HEADER_SIZE, SEGMENTATION_MAX_SIZE - SEGMENTATION_HEADER_SIZE };
+    long long remains[] = { 0, 1, 1000, SEGMENTATION_LEGACY_REMAIN_MAX };
+    for (int current : currents) {
+        for (long long remain : remains) {
+            char header[SEGMENTATION_EXTENDED_HEADER_SIZE];
+            CHECK_EQUAL(SEGMENTATION_HEADER_SIZE, EncodeSegmentationHeader(header, current, remain));
+            int header_size = 0, decoded_current = -1;
+            long long decoded_remain = -1;
+            CHECK_EQUAL(1, DecodeSegmentationHeader(header, SEGMENTATION_HEADER_SIZE, &header_size, &decoded_current, &decoded_remain));
+            CHECK_EQUAL(SEGMENTATION_HEADER_SIZE, header_size);
+            CHECK_EQUAL(current, decoded_current);
+            CHECK_EQUAL(remain, decoded_remain);
+            // big-endian on the wire
+            CHECK_EQUAL(current >> 8, (unsigned char)header[0]);
+            CHECK_EQUAL(remain & 0xFF, (unsigned char)header[3]);
+            // incomplete
+            for (int length = 0; length < SEGMENTATION_HEADER_SIZE; length++)
+                CHECK_EQUAL(0, DecodeSegmentationHeader(header, length, &header_size, &decoded_current, &decoded_remain));
+        }
+    }
+}
+
+void TestExtendedHeader()
+{
+    int currents[] = { 0, 1, SEGMENTATION_MAX_SIZE - SEGMENTATION_EXTENDED_HEADER_SIZE, INT_MAX };
+    long long remains[] = { SEGMENTATION_LEGACY_REMAIN_MAX + 1LL, 1LL << 32, 1LL << 40, LLONG_MAX };
+    for (int current : currents) {
+        for (long long remain : remains) {
+            char header[SEGMENTATION_EXTENDED_HEADER_SIZE];
+            CHECK_EQUAL(SEGMENTATION_EXTENDED_HEADER_SIZE, EncodeSegmentationHeader(header, current, remain));
+            CHECK_EQUAL(0xFF, (unsigned char)header[0]); // the marker, never a valid legacy "current"
+            CHECK_EQUAL(0xFF, (unsigned char)header[1]);
+            CHECK_EQUAL(SEGMENTATION_EXTENDED_VERSION, ((unsigned char)header[2] << 8) | (unsigned char)header[3]);
+            int header_size = 0, decoded_current = -1;
+            long long decoded_remain = -1;
+            // the marker is enough to know the header size
+            for (int length = SEGMENTATION_HEADER_SIZE; length < SEGMENTATION_EXTENDED_HEADER_SIZE; length++) {
+                CHECK_EQUAL(0, DecodeSegmentationHeader(header, length, &header_size, &decoded_current, &decoded_remain));
+                CHECK_EQUAL(SEGMENTATION_EXTENDED_HEADER_SIZE, header_size);
+            }
+            CHECK_EQUAL(1, DecodeSegmentationHeader(header, SEGMENTATION_EXTENDED_HEADER_SIZE, &header_size, &decoded_current, &decoded_remain));
+            CHECK_EQUAL(SEGMENTATION_EXTENDED_HEADER_SIZE, header_size);
+            CHECK_EQUAL(current, decoded_current);
+            CHECK_EQUAL(remain, decoded_remain);
+        }
+    }
+}
+
+void TestInvalidHeader()
+{
+    int header_size, current;
+    long long remain;
+    char header[SEGMENTATION_EXTENDED_HEADER_SIZE];
+    logged = 0;
+
+    // the marker with an unknown version, even with a legacy-sized buffer
+    EncodeSegmentationHeader(header, 10, 1LL << 20);
+    header[3] = SEGMENTATION_EXTENDED_VERSION + 1;
+    CHECK_EQUAL(-1, DecodeSegmentationHeader(header, SEGMENTATION_HEADER_SIZE, &header_size, &current, &remain));
+    CHECK_EQUAL(-1, DecodeSegmentationHeader(header, SEGMENTATION_EXTENDED_HEADER_SIZE, &header_size, &current, &remain));
+
+    // a legacy header can't start with 0xFFFF: it is read as the marker with version 0
+    const char marker_only[SEGMENTATION_HEADER_SIZE] = { (char)0xFF, (char)0xFF, 0, 0 };
+    CHECK_EQUAL(-1, DecodeSegmentationHeader(marker_only, SEGMENTATION_HEADER_SIZE, &header_size, &current, &remain));
+
+    // lengths that do not fit the signed fields
+    EncodeSegmentationHeader(header, 10, 1LL << 20);
+    header[4] = (char)0x80;
+    CHECK_EQUAL(-1, DecodeSegmentationHeader(header, SEGMENTATION_EXTENDED_HEADER_SIZE, &header_size, &current, &remain));
+    EncodeSegmentationHeader(header, 10, 1LL << 20);
+    header[8] = (char)0x80;
+    CHECK_EQUAL(-1, DecodeSegmentationHeader(header, SEGMENTATION_EXTENDED_HEADER_SIZE, &header_size, &current, &remain));
+    CHECK_EQUAL(5, logged);
+}
+
+#pragma endregion
+
+#pragma region Socket Writes
+
+void TestPartialWrites()
+{
+    // the pieces of a message, with empty ones in the middle and at the end
+    char data[1024];
+    for (int i = 0; i < (int)sizeof(data); i++)
+        data[i] = (char)(i * 7 + i / 256);
+    int lengths[] = { 1, 7, 0, 100, 3, 500, 0 };
+    const int count = (int)(sizeof(lengths) / sizeof(lengths[0]));
+    int total = 0;
+    for (int length : lengths)
+        total += length;
+
+    int limits[] = { 1, 2, 3, 5, 7, 8, 64, 101, 107, 110, 611, 0 };
+    for (int limit : limits) {
+        int sockets[2];
+        CHECK_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sockets));
+        WSABUF buffers[count];
+        int offset = 0;
+        for (int i = 0; i < count; i++) {
+            buffers[i].buf = data + offset;
+            buffers[i].len = lengths[i];
+            offset += lengths[i];
+        }
+        // each small write takes much more of the socket buffer than its bytes, the reader drains it meanwhile
+        char received[1024];
+        int is_read = 0;
+        std::thread reader([&]() { is_read = ReadSocketBuffer(sockets[1], total, received); });
+        sendmsg_limit = limit;
+        sendmsg_calls = 0;
+        CHECK_EQUAL(1, WriteSocketBuffers(sockets[0], buffers, count));
+        sendmsg_limit = 0;
+        reader.join();
+        CHECK_EQUAL(limit == 0 ? 1 : (total + limit - 1) / limit, sendmsg_calls);
+        CHECK_EQUAL(1, is_read);
+        CHECK(memcmp(received, data, total) == 0);
+        CloseSocket(sockets[0], CLOSE_NORMAL);
+        CloseSocket(sockets[1], CLOSE_NORMAL);
+    }
+
+    // the peer is gone: the socket should be closed
+    int sockets[2];
+    CHECK_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sockets));
+    CloseSocket(sockets[1], CLOSE_NORMAL);
+    WSABUF buffer = { data, 100 };
+    logged = 0;
+    CHECK_EQUAL(-1, WriteSocketBuffers(sockets[0], &buffer, 1));
+    CHECK_EQUAL(1, logged);
+    CloseSocket(sockets[0], CLOSE_NORMAL);
+}
+
+#pragma endregion
+
+#pragma region Query ID
+
+void TestQueryID()
+{
+    unsigned int ids[] = { 0, 1, 0x7F, 0x80, 0xFF00FF00u, 0x7FFFFFFFu, 0xDEADBEEFu, 0xFFFFFFFFu };
+    for (unsigned int id : ids) {
+        char bytes[QUERY_ID_SIZE + 1];
+        CHECK_EQUAL(QUERY_ID_SIZE, EncodeQueryID(bytes, id));
+        CHECK_EQUAL(QUERY_ID_FLAG, bytes[0]);
+        unsigned int decoded = ~id;
+        CHECK_EQUAL(1, DecodeQueryID(bytes, QUERY_ID_SIZE, &decoded));
+        CHECK_EQUAL(id, decoded);
+        CHECK_EQUAL(0, DecodeQueryID(bytes, QUERY_ID_SIZE - 1, &decoded)); // truncated
+        bytes[0] = '\0';
+        CHECK_EQUAL(0, DecodeQueryID(bytes, QUERY_ID_SIZE, &decoded)); // no flag
+    }
+}
+
+#pragma endregion
+
+#pragma region Options
+
+void TestOptions()
+{
+    char* argv[] = { (char*)"program", (char*)"--a", (char*)"12", (char*)"--b", (char*)"0", (char*)"--c", (char*)"abc",
+        (char*)"--n", (char*)"-3", (char*)"--last" };
+    int argc = (int)(sizeof(argv) / sizeof(argv[0]));
+    CHECK_EQUAL(12, GetIntOption(argc, argv, "--a", 5));
+    CHECK_EQUAL(-3, GetIntOption(argc, argv, "--n", 5));
+    CHECK_EQUAL(5, GetIntOption(argc, argv, "--b", 5)); // 0 is not told from an invalid value
+    CHECK_EQUAL(5, GetIntOption(argc, argv, "--c", 5)); // not a number
+    CHECK_EQUAL(5, GetIntOption(argc, argv, "--last", 5)); // no value follows
+    CHECK_EQUAL(5, GetIntOption(argc, argv, "--missing", 5));
+    CHECK_EQUAL(5, GetIntOption(argc, argv, "program", 5)); // the program name is not an option
+    CHECK_EQUAL(1, HasOption(argc, argv, "--last"));
+    CHECK_EQUAL(0, HasOption(argc, argv, "--missing"));
+    CHECK(GetStringOption(argc, argv, "--c") != NULL && strcmp(GetStringOption(argc, argv, "--c"), "abc") == 0);
+    CHECK(GetStringOption(argc, argv, "--last") == NULL);
+}
+
+#pragma endregion
+
+#pragma region Message Pool
+
+#define POOL_TEST_BLOCKS 2000
+
+static void* pool_blocks[POOL_TEST_BLOCKS];
+
+static int GetBlockSize(int i)
+{
+    return 1 + (i * 37) % POOL_MAX_BLOCK_SIZE;
+}
+
+static void FillBlocks()
+{
+    for (int i = 0; i < POOL_TEST_BLOCKS; i++) {
+        pool_blocks[i] = PoolAllocate(GetBlockSize(i));
+        if (pool_blocks[i] != NULL)
+            memset(pool_blocks[i], (char)i, GetBlockSize(i));
+    }
+}
+
+void TestPoolSameThread()
+{
+    void* block = PoolAllocate(100);
+    CHECK(block != NULL);
+    CHECK_EQUAL(0, (size_t)block % 16);
+    PoolFree(block);
+    CHECK(PoolAllocate(100) == block); // the last block freed is reused first
+    CHECK(PoolAllocate(100) != block);
+    PoolFree(NULL);
+
+    POOL_COUNTERS before, after;
+    GetPoolCounters(&before);
+    void* large = PoolAllocate(POOL_MAX_BLOCK_SIZE + 1);
+    CHECK(large != NULL);
+    CHECK_EQUAL(0, (size_t)large % 16);
+    memset(large, 1, POOL_MAX_BLOCK_SIZE + 1);
+    PoolFree(large);
+    GetPoolCounters(&after);
+    CHECK_EQUAL(before.large + 1, after.large);
+
+    MESSAGE_HANDLE handle((MESSAGE)PoolAllocate(10));
+    MESSAGE_HANDLE moved(std::move(handle));
+    CHECK(handle.message == NULL);
+    CHECK(moved.message != NULL);
+}
+
+void TestPoolAcrossThreads()
+{
+    // blocks are allocated by a thread and freed by another, the thread that adopts the pool reuses them
+    std::thread(FillBlocks).join();
+    for (int i = 0; i < POOL_TEST_BLOCKS; i++) {
+        CHECK(pool_blocks[i] != NULL);
+        const char* bytes = (const char*)pool_blocks[i];
+        CHECK(bytes[0] == (char)i && bytes[GetBlockSize(i) - 1] == (char)i);
+    }
+    POOL_COUNTERS before, after;
+    GetPoolCounters(&before);
+    for (int i = 0; i < POOL_TEST_BLOCKS; i++)
+        PoolFree(pool_blocks[i]);
+    std::thread(FillBlocks).join();
+    GetPoolCounters(&after);
+    CHECK_EQUAL(before.pools, after.pools); // the pool of the exited thread is adopted
+    CHECK_EQUAL(before.slabs, after.slabs); // and its blocks freed remotely are reused
+    CHECK_EQUAL(before.remote_frees + POOL_TEST_BLOCKS, after.remote_frees);
+    for (int i = 0; i < POOL_TEST_BLOCKS; i++)
+        PoolFree(pool_blocks[i]);
+}
+
+void TestPoolConcurrentFrees()
+{
+    // two threads free the blocks of each other while they allocate
+    const int rounds = 20000;
+    std::mutex lock;
+    void* exchanged[2] = { NULL, NULL };
+    int corrupted = 0;
+    auto run = [&](int id) {
+        for (int i = 0; i < rounds; i++) {
+            int size = 1 + (i * 13 + id) % POOL_MAX_BLOCK_SIZE;
+            char* block = (char*)PoolAllocate(size);
+            if (block == NULL)
+                continue;
+            memset(block, id + 1, size);
+            block[0] = (char)(size & 0x7F);
+            void* other;
+            {
+                std::lock_guard<std::mutex> guard(lock);
+                other = exchanged[1 - id];
+                exchanged[1 - id] = NULL;
+                if (exchanged[id] != NULL)
+                    PoolFree(exchanged[id]); // not taken yet, freed by its owner
+                exchanged[id] = block;
+            }
+            if (other != NULL) {
+                char* bytes = (char*)other;
+                if (bytes[1] != (char)(2 - id) && (bytes[0] & 0x7F) > 1)
+                    corrupted++;
+                PoolFree(other);
+            }
+        }
+    };
+    std::thread first(run, 0), second(run, 1);
+    first.join();
+    second.join();
+    PoolFree(exchanged[0]);
+    PoolFree(exchanged[1]);
+    CHECK_EQUAL(0, corrupted);
+}
+
+#pragma endregion
+
+int main()
+{
+    SetLogHandler(CountLogMessage);
+    TestLegacyHeader();
+    TestExtendedHeader();
+    TestInvalidHeader();
+    TestPartialWrites();
+    TestQueryID();
+    TestOptions();
+    TestPoolSameThread();
+    TestPoolAcrossThreads();
+    TestPoolConcurrentFrees();
+    return CHECK_RESULT();
+}
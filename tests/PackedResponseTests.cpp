@@ -0,0 +1,200 @@
+#include "UDP_Server.h"
+#include "Check.h"
+
+#pragma region Test Support
+
+#define QUERY_ID 0xC0FFEE01u
+#define RECEIVE_TIMEOUT 2000 // in milliseconds
+
+/// <summary>
+/// A resolution with count addresses 255.255.255.100 and up: 15 characters each
+/// </summary>
+static void CreateResolution(int count, RESOLUTION* oresolution)
+{
+    oresolution->is_found = count > 0;
+    oresolution->count = count;
+    for (int i = 0; i < count; i++) {
+        unsigned char bytes[4] = { 255, 255, 255, (unsigned char)(100 + i) };
+        memcpy(&oresolution->addresses[i], bytes, sizeof(bytes));
+    }
+}
+
+/// <summary>
+/// Check that a datagram is a response with the query ID of the request, if it has one
+/// </summary>
+static void CheckQueryID(const char* data, int length, const REQUEST_FLAGS* flags)
+{
+    int message_length = (int)strnlen(data, length) + 1;
+    if (!flags->has_id) {
+        CHECK_EQUAL(message_length, length);
+        return;
+    }
+    unsigned int id = 0;
+    CHECK_EQUAL(message_length + QUERY_ID_SIZE, length);
+    CHECK(DecodeQueryID(data + message_length, length - message_length, &id));
+    CHECK_EQUAL(flags->id, id);
+}
+
+/// <summary>
+/// Check the lists of addresses of packed responses: STATUS_LIST_CHAR for each but the last, STATUS_LIST_END_CHAR for the last,
+/// and all addresses of the resolution in order
+/// </summary>
+static void CheckLists(DATAGRAM* const* datagrams, int count, const RESOLUTION* resolution, const REQUEST_FLAGS* flags)
+{
+    char expected[RESPONSES_MAX_SIZE] = { 0 };
+    char joined[RESPONSES_MAX_SIZE] = { 0 };
+    for (int i = 0; i < resolution->count; i++) {
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &resolution->addresses[i], ip, sizeof(ip));
+        if (i > 0)
+            strcat(expected, " ");
+        strcat(expected, ip);
+    }
+    for (int i = 0; i < count; i++) {
+        const DATAGRAM* datagram = datagrams[i];
+        CHECK(datagram->length <= APPLICATION_BUFF_MAX_SIZE);
+        CHECK_EQUAL(i == count - 1 ? STATUS_LIST_END_CHAR : STATUS_LIST_CHAR, datagram->data[0]);
+        CheckQueryID(datagram->data, datagram->length, flags);
+        if (i > 0)
+            strcat(joined, " ");
+        strcat(joined, datagram->data + 1);
+    }
+    CHECK(strcmp(expected, joined) == 0);
+}
+
+#pragma endregion
+
+void TestBuildResponses()
+{
+    RESOLUTION resolution;
+    RESPONSES responses;
+    CreateResolution(3, &resolution);
+    BuildResponses(&resolution, &responses);
+    CHECK_EQUAL(1, responses.is_found);
+    CHECK_EQUAL(3, responses.count);
+    const char expected[] = "+255.255.255.100\0+255.255.255.101\0" "0255.255.255.102";
+    CHECK_EQUAL(sizeof(expected), responses.length);
+    CHECK(memcmp(expected, responses.data, sizeof(expected)) == 0);
+
+    CreateResolution(0, &resolution);
+    BuildResponses(&resolution, &responses);
+    CHECK_EQUAL(0, responses.is_found);
+    CHECK_EQUAL(1, responses.count);
+    CHECK_EQUAL(STATUS_ERROR_CHAR, responses.data[0]);
+    CHECK(strcmp(ERROR_MESSAGE, responses.data + 1) == 0);
+}
+
+void TestExtractRequestFlags()
+{
+    DATAGRAM request;
+    REQUEST_FLAGS flags;
+    memcpy(request.data, "example.com\0P", 13);
+    request.length = 13 + EncodeQueryID(request.data + 13, QUERY_ID);
+    ExtractRequestFlags(&request, &flags);
+    CHECK_EQUAL(1, flags.is_packed);
+    CHECK_EQUAL(1, flags.has_id);
+    CHECK_EQUAL(QUERY_ID, flags.id);
+
+    // an old client sends the name only
+    request.length = 12;
+    ExtractRequestFlags(&request, &flags);
+    CHECK_EQUAL(0, flags.is_packed);
+    CHECK_EQUAL(0, flags.has_id);
+}
+
+void TestAppendResponses()
+{
+    ADDRESS client = CreateSocketAddress(CreateDefaultIP(), 0); // never sent: the batch does not fill
+    DATAGRAM_BATCH replies;
+    CHECK(CreateBatch(&replies, DEFAULT_BATCH));
+    RESOLUTION resolution;
+    RESPONSES responses;
+    DATAGRAM* datagrams[RESOLUTION_MAX_ADDRESSES];
+
+    // one datagram per address for the old clients, each with the query ID
+    for (int has_id = 0; has_id <= 1; has_id++) {
+        REQUEST_FLAGS flags = { 0, has_id, QUERY_ID };
+        CreateResolution(3, &resolution);
+        BuildResponses(&resolution, &responses);
+        replies.count = 0;
+        CHECK_EQUAL(3, AppendResponses(INVALID_SOCKET, &replies, &responses, client, &flags));
+        CHECK_EQUAL(3, replies.count);
+        for (int i = 0; i < replies.count; i++) {
+            CHECK_EQUAL(i == 2 ? STATUS_OK_END_CHAR : STATUS_OK_CHAR, replies.datagrams[i].data[0]);
+            CheckQueryID(replies.datagrams[i].data, replies.datagrams[i].length, &flags);
+        }
+    }
+
+    // the addresses fit in one list
+    REQUEST_FLAGS packed = { 1, 1, QUERY_ID };
+    replies.count = 0;
+    CHECK_EQUAL(1, AppendResponses(INVALID_SOCKET, &replies, &responses, client, &packed));
+    datagrams[0] = &replies.datagrams[0];
+    CheckLists(datagrams, 1, &resolution, &packed);
+
+    // 64 addresses of 15 characters are more than PACKED_RESPONSE_MAX_SIZE: split in 2 lists
+    CreateResolution(RESOLUTION_MAX_ADDRESSES, &resolution);
+    BuildResponses(&resolution, &responses);
+    replies.count = 0;
+    CHECK_EQUAL(2, AppendResponses(INVALID_SOCKET, &replies, &responses, client, &packed));
+    CHECK_EQUAL(2, replies.count);
+    datagrams[0] = &replies.datagrams[0];
+    datagrams[1] = &replies.datagrams[1];
+    CheckLists(datagrams, 2, &resolution, &packed);
+
+    // no address: the STATUS_ERROR datagram of both formats
+    CreateResolution(0, &resolution);
+    BuildResponses(&resolution, &responses);
+    replies.count = 0;
+    CHECK_EQUAL(1, AppendResponses(INVALID_SOCKET, &replies, &responses, client, &packed));
+    CHECK_EQUAL(STATUS_ERROR_CHAR, replies.datagrams[0].data[0]);
+    CheckQueryID(replies.datagrams[0].data, replies.datagrams[0].length, &packed);
+    DestroyBatch(&replies);
+}
+
+void TestSplitAcrossBatches()
+{
+    // a batch of one datagram: the first list is sent while the second is formatted
+    SOCKET client_socket = CreateDatagramSocket(0, 0);
+    SOCKET server = CreateDatagramSocket(0, 0);
+    CHECK(client_socket != INVALID_SOCKET && server != INVALID_SOCKET);
+    ADDRESS client;
+    socklen_t address_length = sizeof(client);
+    getsockname(client_socket, (SOCKADDR*)&client, &address_length);
+    TryParseIPString("127.0.0.1", &client.sin_addr);
+    SetReceiveTimeout(client_socket, RECEIVE_TIMEOUT);
+
+    DATAGRAM_BATCH replies;
+    CHECK(CreateBatch(&replies, 1));
+    RESOLUTION resolution;
+    RESPONSES responses;
+    CreateResolution(RESOLUTION_MAX_ADDRESSES, &resolution);
+    BuildResponses(&resolution, &responses);
+    REQUEST_FLAGS packed = { 1, 1, QUERY_ID };
+    CHECK_EQUAL(2, AppendResponses(server, &replies, &responses, client, &packed));
+    CHECK_EQUAL(1, SendBatch(server, &replies));
+
+    static DATAGRAM received[2];
+    DATAGRAM* datagrams[2] = { &received[0], &received[1] };
+    for (int i = 0; i < 2; i++) {
+        received[i].length = (int)recv(client_socket, received[i].data, APPLICATION_BUFF_MAX_SIZE, 0);
+        CHECK(received[i].length > 0);
+    }
+    if (received[0].length > 0 && received[1].length > 0)
+        CheckLists(datagrams, 2, &resolution, &packed);
+    DestroyBatch(&replies);
+    CloseSocket(client_socket, CLOSE_NORMAL);
+    CloseSocket(server, CLOSE_NORMAL);
+}
+
+int main()
+{
+    if (!WSInitialize())
+        return 1;
+    TestBuildResponses();
+    TestExtractRequestFlags();
+    TestAppendResponses();
+    TestSplitAcrossBatches();
+    WSCleanup();
+    return CHECK_RESULT();
+}
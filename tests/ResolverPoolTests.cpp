@@ -0,0 +1,241 @@
+#include "UDP_Server.h"
+#include "Check.h"
+
+#pragma region Test Support
+
+#define STUB_DELAY 200 // in milliseconds, long enough for every request to arrive while the lookup is pending
+#define RECEIVE_TIMEOUT 2000 // in milliseconds
+
+static std::atomic<int> resolutions(0);
+
+/// <summary>
+/// ResolveWithStub, counting the resolutions
+/// </summary>
+static void ResolveCounted(const char* name, int delay, RESOLUTION* oresolution)
+{
+    resolutions++;
+    ResolveWithStub(name, delay, oresolution);
+}
+
+/// <summary>
+/// A resolver pool without threads: the lookups stay queued until the test completes them
+/// </summary>
+static RESOLVER_POOL* CreateIdlePool(const SERVER_CONFIG* config)
+{
+    RESOLVER_POOL* pool = new RESOLVER_POOL;
+    pool->config = config;
+    pool->cache = NULL;
+    memset(pool->table, 0, sizeof(pool->table));
+    pool->jobs_head = NULL;
+    pool->jobs_tail = NULL;
+    pool->pending = 0;
+    pool->threads = NULL;
+    return pool;
+}
+
+/// <summary>
+/// Take the first lookup of the queue, as a resolver thread does
+/// </summary>
+static LOOKUP* TakeLookup(RESOLVER_POOL* pool)
+{
+    LOOKUP* lookup = pool->jobs_head;
+    if (lookup != NULL) {
+        pool->jobs_head = lookup->next_job;
+        if (pool->jobs_head == NULL)
+            pool->jobs_tail = NULL;
+    }
+    return lookup;
+}
+
+/// <summary>
+/// A client of the tests: a socket bound to a loopback port
+/// </summary>
+/// <param name="oaddress">[Output] The address of the client</param>
+static SOCKET CreateClient(ADDRESS* oaddress)
+{
+    SOCKET client = CreateDatagramSocket(0, 0);
+    if (client == INVALID_SOCKET)
+        return INVALID_SOCKET;
+    socklen_t length = sizeof(ADDRESS);
+    getsockname(client, (SOCKADDR*)oaddress, &length);
+    TryParseIPString("127.0.0.1", &oaddress->sin_addr);
+    SetReceiveTimeout(client, RECEIVE_TIMEOUT);
+    return client;
+}
+
+/// <summary>
+/// Receive datagrams until the receive timeout
+/// </summary>
+/// <param name="count">Number of datagrams expected, no more is waited for</param>
+/// <param name="oids">[Output] The query ID of each datagram, 0 if it has none. NULL if not wanted</param>
+/// <returns>Number of datagrams received</returns>
+static int ReceiveDatagrams(SOCKET client, int count, unsigned int* oids = NULL)
+{
+    char buffer[APPLICATION_BUFF_MAX_SIZE];
+    int received = 0;
+    while (received < count) {
+        int length = (int)recv(client, buffer, sizeof(buffer), 0);
+        if (length <= 0)
+            break;
+        if (oids != NULL) {
+            int position = (int)strnlen(buffer, length) + 1;
+            oids[received] = 0;
+            if (position < length)
+                DecodeQueryID(buffer + position, length - position, &oids[received]);
+        }
+        received++;
+    }
+    return received;
+}
+
+#pragma endregion
+
+void TestCoalescing(const SERVER_CONFIG* config)
+{
+    RESOLVER_POOL* pool = CreateIdlePool(config);
+    ADDRESS client;
+    SOCKET client_socket = CreateClient(&client);
+    SOCKET server = CreateDatagramSocket(0, 0);
+    CHECK(client_socket != INVALID_SOCKET && server != INVALID_SOCKET);
+    static WORKER worker;
+
+    // more waiters than a lookup has room for at first: the waiters move to a larger block
+    const int waiters = INITIAL_WAITERS * 2 + 1;
+    for (int i = 0; i < waiters; i++) {
+        WAITER waiter = { client, server, &worker, { 0, 1, (unsigned int)(100 + i) } };
+        CHECK_EQUAL(i == 0 ? 1 : 2, SubmitLookup(pool, "example.com", waiter));
+    }
+    WAITER other = { client, server, &worker, { 0, 0, 0 } };
+    CHECK_EQUAL(1, SubmitLookup(pool, "example.org", other));
+    CHECK_EQUAL(2, pool->pending);
+
+    // the lookups are queued in order, once for each name
+    LOOKUP* lookup = TakeLookup(pool);
+    CHECK(lookup != NULL && strcmp(lookup->name, "example.com") == 0);
+    if (lookup == NULL)
+        return;
+    CHECK_EQUAL(waiters, lookup->waiter_count);
+    CHECK(pool->jobs_head != NULL && pool->jobs_head->next_job == NULL);
+
+    // a request while resolving still joins the lookup
+    WAITER late = { client, server, &worker, { 0, 1, 999 } };
+    CHECK_EQUAL(2, SubmitLookup(pool, "example.com", late));
+
+    RESOLUTION resolution;
+    RESPONSES responses;
+    ResolveWithStub("example.com", 0, &resolution);
+    BuildResponses(&resolution, &responses);
+    DATAGRAM_BATCH replies;
+    CHECK(CreateBatch(&replies, DEFAULT_BATCH));
+    CompleteLookup(pool, lookup, &responses, &replies);
+    CHECK_EQUAL(1, pool->pending);
+    CHECK_EQUAL((waiters + 1) * responses.count, worker.replies.load());
+
+    // every waiter gets the responses, with its own query ID
+    unsigned int ids[(INITIAL_WAITERS * 2 + 2) * 3];
+    int expected = (waiters + 1) * responses.count;
+    CHECK_EQUAL(expected, ReceiveDatagrams(client_socket, expected, ids));
+    for (int i = 0; i < waiters; i++)
+        CHECK_EQUAL(100 + i, ids[i * responses.count]);
+    CHECK_EQUAL(999, ids[waiters * responses.count]);
+
+    // the name is not pending anymore: the next request starts a new lookup
+    CHECK_EQUAL(1, SubmitLookup(pool, "example.com", other));
+    CHECK_EQUAL(2, pool->pending);
+
+    DestroyBatch(&replies);
+    CloseSocket(client_socket, CLOSE_NORMAL);
+    CloseSocket(server, CLOSE_NORMAL);
+}
+
+void TestDropWhenFull(const SERVER_CONFIG* config)
+{
+    RESOLVER_POOL* pool = CreateIdlePool(config);
+    WAITER waiter;
+    memset(&waiter, 0, sizeof(waiter));
+    waiter.socket = INVALID_SOCKET;
+    char name[32];
+    int queued = 0;
+    for (int i = 0; i < MAX_PENDING_LOOKUPS; i++) {
+        snprintf(name, sizeof(name), "name%d.test", i);
+        queued += SubmitLookup(pool, name, waiter) == 1;
+    }
+    CHECK_EQUAL(MAX_PENDING_LOOKUPS, queued);
+    CHECK_EQUAL(MAX_PENDING_LOOKUPS, pool->pending);
+
+    // a new name is dropped, a pending one is still joined
+    CHECK_EQUAL(0, SubmitLookup(pool, "new.test", waiter));
+    CHECK_EQUAL(2, SubmitLookup(pool, "name0.test", waiter));
+    CHECK_EQUAL(MAX_PENDING_LOOKUPS, pool->pending);
+
+    // completing a lookup makes room for a new name
+    RESPONSES none;
+    memset(&none, 0, sizeof(none)); // no datagram is queued for the waiters
+    DATAGRAM_BATCH replies;
+    CHECK(CreateBatch(&replies, DEFAULT_BATCH));
+    CompleteLookup(pool, TakeLookup(pool), &none, &replies);
+    CHECK_EQUAL(1, SubmitLookup(pool, "new.test", waiter));
+    CHECK_EQUAL(0, SubmitLookup(pool, "other.test", waiter));
+
+    LOOKUP* lookup;
+    while ((lookup = TakeLookup(pool)) != NULL)
+        CompleteLookup(pool, lookup, &none, &replies);
+    CHECK_EQUAL(0, pool->pending);
+    for (int i = 0; i < LOOKUP_TABLE_SIZE; i++)
+        CHECK(pool->table[i] == NULL);
+    DestroyBatch(&replies);
+}
+
+void TestResolverThreads(SERVER_CONFIG* config)
+{
+    config->resolve = ResolveCounted;
+    config->stub_delay = STUB_DELAY;
+    config->resolvers = 2;
+    RESOLVER_POOL* pool = CreateResolverPool(config, NULL); // the threads live until the test exits
+    CHECK(pool != NULL);
+    if (pool == NULL)
+        return;
+    ADDRESS client;
+    SOCKET client_socket = CreateClient(&client);
+    SOCKET server = CreateDatagramSocket(0, 0);
+    static WORKER worker;
+
+    // the requests arrive while the first lookup is resolving: one resolution for all of them
+    const int requests = 20;
+    WAITER waiter = { client, server, &worker, { 0, 0, 0 } };
+    for (int i = 0; i < requests; i++)
+        SubmitLookup(pool, "slow.test", waiter);
+    RESOLUTION resolution;
+    ResolveWithStub("slow.test", 0, &resolution);
+    int expected = requests * resolution.count;
+    CHECK_EQUAL(expected, ReceiveDatagrams(client_socket, expected));
+    CHECK_EQUAL(1, resolutions.load());
+    CHECK_EQUAL(expected, worker.replies.load());
+    {
+        std::lock_guard<std::mutex> guard(pool->lock);
+        CHECK_EQUAL(0, pool->pending);
+    }
+
+    // a name that has no address: every waiter gets the STATUS_ERROR datagram
+    for (int i = 0; i < requests; i++)
+        SubmitLookup(pool, STUB_NOT_FOUND_PREFIX "domain.test", waiter);
+    CHECK_EQUAL(requests, ReceiveDatagrams(client_socket, requests));
+    CHECK_EQUAL(2, resolutions.load());
+
+    CloseSocket(client_socket, CLOSE_NORMAL);
+    CloseSocket(server, CLOSE_NORMAL);
+}
+
+int main()
+{
+    char* argv[] = { (char*)"UDP_Server", (char*)"5000" };
+    SERVER_CONFIG config;
+    ExtractOptions(2, argv, &config);
+    if (!WSInitialize())
+        return 1;
+    TestCoalescing(&config);
+    TestDropWhenFull(&config);
+    TestResolverThreads(&config);
+    WSCleanup();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,155 @@
+#include "UDP_Server.h"
+#include "Check.h"
+
+#pragma region Test Support
+
+#define BUDGET_ENTRIES 4 // entries a shard of the tested cache holds
+
+/// <summary>
+/// The responses of the stub resolver for a name
+/// </summary>
+static void Resolve(const char* name, RESPONSES* oresponses)
+{
+    RESOLUTION resolution;
+    ResolveWithStub(name, 0, &resolution);
+    BuildResponses(&resolution, oresponses);
+}
+
+/// <summary>
+/// The size of the cache entry for a name
+/// </summary>
+static int EntrySize(const char* name)
+{
+    RESPONSES responses;
+    Resolve(name, &responses);
+    return (int)sizeof(CACHE_ENTRY) + (int)strlen(name) + 1 + responses.length;
+}
+
+/// <summary>
+/// Find names stored in the first shard whose entries have the same size
+/// </summary>
+/// <param name="onames">[Output] The names, 32 bytes each</param>
+/// <param name="count">Number of names</param>
+/// <returns>The size of an entry</returns>
+static int FindShardNames(char (*onames)[32], int count)
+{
+    int size = 0;
+    int found = 0;
+    for (int i = 0; found < count; i++) {
+        snprintf(onames[found], 32, "host%05d.test", i);
+        if (HashName(onames[found]) % CACHE_SHARDS != 0)
+            continue;
+        if (size == 0)
+            size = EntrySize(onames[found]);
+        if (EntrySize(onames[found]) == size)
+            found++;
+    }
+    return size;
+}
+
+#pragma endregion
+
+void TestGet(SERVER_CONFIG* config)
+{
+    CACHE* cache = CreateCache(config);
+    RESPONSES put, got;
+    Resolve("example.com", &put);
+    CHECK_EQUAL(0, CacheGet(cache, "example.com", &got));
+    CachePut(cache, "example.com", &put);
+    CHECK_EQUAL(1, CacheGet(cache, "example.com", &got));
+    CHECK_EQUAL(put.is_found, got.is_found);
+    CHECK_EQUAL(put.count, got.count);
+    CHECK_EQUAL(put.length, got.length);
+    CHECK(memcmp(put.data, got.data, put.length) == 0);
+    CHECK_EQUAL(1, cache->hits.load());
+    CHECK_EQUAL(1, cache->misses.load());
+
+    // newer responses replace the entry
+    Resolve(STUB_NOT_FOUND_PREFIX "domain", &put);
+    CachePut(cache, "example.com", &put);
+    CHECK_EQUAL(1, cache->entries.load());
+    CHECK_EQUAL(1, CacheGet(cache, "example.com", &got));
+    CHECK_EQUAL(0, got.is_found);
+    CHECK(memcmp(put.data, got.data, put.length) == 0);
+}
+
+void TestClockEviction(SERVER_CONFIG* config)
+{
+    const int names_count = BUDGET_ENTRIES + 64;
+    static char names[BUDGET_ENTRIES + 64][32];
+    int size = FindShardNames(names, names_count);
+    config->cache_memory = (long long)size * BUDGET_ENTRIES * CACHE_SHARDS;
+    CACHE* cache = CreateCache(config);
+    RESPONSES responses, got;
+    for (int i = 0; i < BUDGET_ENTRIES; i++) {
+        Resolve(names[i], &responses);
+        CachePut(cache, names[i], &responses);
+    }
+    CHECK_EQUAL(BUDGET_ENTRIES, cache->entries.load());
+    CHECK_EQUAL(0, cache->evicted.load());
+
+    // the hand is on the first entry: it is hit, so the clock skips it and evicts the next one
+    CHECK_EQUAL(1, CacheGet(cache, names[0], &got));
+    Resolve(names[BUDGET_ENTRIES], &responses);
+    CachePut(cache, names[BUDGET_ENTRIES], &responses);
+    CHECK_EQUAL(1, cache->evicted.load());
+    CHECK_EQUAL(BUDGET_ENTRIES, cache->entries.load());
+    CHECK_EQUAL(0, CacheGet(cache, names[1], &got));
+    for (int i = 0; i <= BUDGET_ENTRIES; i++) {
+        if (i != 1)
+            CHECK_EQUAL(1, CacheGet(cache, names[i], &got));
+    }
+
+    // an entry hit between the passes of the hand stays, the others are evicted in turn
+    for (int i = BUDGET_ENTRIES + 1; i < names_count; i++) {
+        CHECK_EQUAL(1, CacheGet(cache, names[0], &got));
+        Resolve(names[i], &responses);
+        CachePut(cache, names[i], &responses);
+        CHECK(cache->shards[0].memory <= cache->shard_memory);
+    }
+    CHECK_EQUAL(1, CacheGet(cache, names[0], &got));
+    CHECK_EQUAL(1, CacheGet(cache, names[names_count - 1], &got));
+    CHECK_EQUAL(0, CacheGet(cache, names[BUDGET_ENTRIES], &got));
+    CHECK_EQUAL(BUDGET_ENTRIES, cache->entries.load());
+    CHECK_EQUAL(names_count - BUDGET_ENTRIES, cache->evicted.load());
+    CHECK_EQUAL((long long)size * BUDGET_ENTRIES, cache->memory.load());
+}
+
+void TestExpiry(SERVER_CONFIG* config)
+{
+    config->cache_ttl = 60;
+    config->negative_ttl = 1;
+    CACHE* cache = CreateCache(config);
+    RESPONSES found, not_found, got;
+    Resolve("example.com", &found);
+    Resolve(STUB_NOT_FOUND_PREFIX "domain", &not_found);
+    CachePut(cache, "example.com", &found);
+    CachePut(cache, STUB_NOT_FOUND_PREFIX "domain", &not_found);
+    CHECK_EQUAL(1, CacheGet(cache, "example.com", &got));
+    CHECK_EQUAL(1, CacheGet(cache, STUB_NOT_FOUND_PREFIX "domain", &got));
+
+    // the ERROR_MESSAGE responses expire first, and are removed when read
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    CHECK_EQUAL(1, CacheGet(cache, "example.com", &got));
+    CHECK_EQUAL(0, CacheGet(cache, STUB_NOT_FOUND_PREFIX "domain", &got));
+    CHECK_EQUAL(1, cache->entries.load());
+
+    // a TTL of 0 caches nothing for long
+    config->cache_ttl = 0;
+    CachePut(cache, "example.com", &found);
+    CHECK_EQUAL(0, CacheGet(cache, "example.com", &got));
+    CHECK_EQUAL(0, cache->entries.load());
+    CHECK_EQUAL(0, cache->memory.load());
+}
+
+int main()
+{
+    char* argv[] = { (char*)"UDP_Server", (char*)"5000" };
+    SERVER_CONFIG config;
+    ExtractOptions(2, argv, &config);
+    TestGet(&config);
+    TestClockEviction(&config);
+    ExtractOptions(2, argv, &config);
+    TestExpiry(&config);
+    return CHECK_RESULT();
+}
@@ -0,0 +1,214 @@
+#include "UDP_Client.h"
+#include "Check.h"
+
+#pragma region Test Support
+
+#define MS 1000000LL // nanoseconds in a millisecond
+#define TEST_RTO 200 // in milliseconds, the retransmission timeout of the queries tested
+#define SERVER_QUIET_INTERVAL 1000 // in milliseconds, the fake server stops when no request comes in this interval
+#define ANSWER "0" "1.2.3.4" // STATUS_OK_END_CHAR and an address
+
+/// <summary>
+/// A server that answers one transmission of a query, and counts the transmissions received
+/// </summary>
+typedef struct {
+    SOCKET socket;
+    ADDRESS address;
+    int answered_attempt; // the transmission answered. -1 for none
+    int is_echoing; // 1 if the answer has the query ID of the transmission
+    int has_late_answers; // 1 if answers with other IDs come first: of a previous query, and of a transmission not sent yet
+    int received; // number of transmissions received
+    long long received_at[MAX_RETRIES + 1];
+} FAKE_SERVER;
+
+/// <summary>
+/// Send an answer, with a query ID if it is not NULL
+/// </summary>
+static void SendAnswer(FAKE_SERVER* server, ADDRESS client, const unsigned int* id)
+{
+    char answer[APPLICATION_BUFF_MAX_SIZE];
+    int length = (int)sizeof(ANSWER);
+    memcpy(answer, ANSWER, length);
+    if (id != NULL)
+        length += EncodeQueryID(answer + length, *id);
+    SendBytes(server->socket, answer, length, client);
+}
+
+/// <summary>
+/// Receive the transmissions of a query until the answered one, or until the client stops
+/// </summary>
+static void RunFakeServer(FAKE_SERVER* server)
+{
+    char request[APPLICATION_BUFF_MAX_SIZE];
+    while (server->received <= MAX_RETRIES) {
+        ADDRESS client;
+        socklen_t client_len = sizeof(client);
+        int length = recvfrom(server->socket, request, sizeof(request) - 1, 0, (SOCKADDR*)&client, &client_len);
+        if (length == SOCKET_ERROR)
+            return;
+        request[length] = '\0';
+        int attempt = server->received++;
+        server->received_at[attempt] = GetTimestamp();
+        if (attempt != server->answered_attempt)
+            continue;
+
+        int position = (int)strlen(request) + 1;
+        if (position < length && request[position] == REQUEST_PACKED_FLAG)
+            position++;
+        unsigned int id = 0;
+        CHECK(DecodeQueryID(request + position, length - position, &id));
+        if (server->has_late_answers) {
+            unsigned int previous = id ^ (1u << QUERY_ATTEMPT_BITS);
+            unsigned int unsent = id + 1;
+            SendAnswer(server, client, &previous);
+            SendAnswer(server, client, &unsent);
+        }
+        SendAnswer(server, client, server->is_echoing ? &id : NULL);
+        return;
+    }
+}
+
+/// <summary>
+/// Query a fake server with HandleResponse
+/// </summary>
+/// <param name="server">The fake server, its options are set</param>
+/// <param name="rtt">The estimator of the client</param>
+/// <param name="retries">Number of retransmissions</param>
+/// <param name="ounread">[Output] Number of datagrams left unread by HandleResponse</param>
+/// <returns>The result of HandleResponse</returns>
+static int Query(FAKE_SERVER* server, RTT_ESTIMATOR* rtt, int retries, int* ounread)
+{
+    static unsigned int seed = 1;
+    server->received = 0;
+    SOCKET client = CreateSocket(UDP);
+    std::thread thread(RunFakeServer, server);
+    int result = HandleResponse(client, server->address, "example.com", 1, retries, rtt, &seed);
+    thread.join();
+    char buffer[APPLICATION_BUFF_MAX_SIZE];
+    *ounread = 0;
+    while (recv(client, buffer, sizeof(buffer), MSG_DONTWAIT) > 0)
+        (*ounread)++;
+    CloseSocket(client, CLOSE_NORMAL);
+    return result;
+}
+
+#pragma endregion
+
+void TestTimeouts()
+{
+    RTT_ESTIMATOR rtt;
+    InitializeRTT(&rtt);
+    CHECK_EQUAL(INITIAL_RTO * MS, GetRetransmissionTimeout(&rtt, 0));
+    CHECK_EQUAL(2 * INITIAL_RTO * MS, GetRetransmissionTimeout(&rtt, 1));
+    CHECK_EQUAL(8 * INITIAL_RTO * MS, GetRetransmissionTimeout(&rtt, 3));
+    // the backoff is capped, and does not overflow
+    CHECK_EQUAL(MAX_RTO * MS, GetRetransmissionTimeout(&rtt, 4));
+    CHECK_EQUAL(MAX_RTO * MS, GetRetransmissionTimeout(&rtt, 62));
+
+    // RFC 6298: the first sample R gives SRTT = R, RTTVAR = R/2, RTO = SRTT + 4 RTTVAR
+    UpdateRTT(&rtt, 100 * MS);
+    CHECK_EQUAL(100 * MS, rtt.srtt);
+    CHECK_EQUAL(50 * MS, rtt.rttvar);
+    CHECK_EQUAL(300 * MS, rtt.rto);
+    UpdateRTT(&rtt, 100 * MS);
+    CHECK_EQUAL(100 * MS, rtt.srtt);
+    CHECK_EQUAL(37500000LL, rtt.rttvar);
+    CHECK_EQUAL(250 * MS, rtt.rto);
+    CHECK_EQUAL(4 * 250 * MS, GetRetransmissionTimeout(&rtt, 2));
+    CHECK_EQUAL(MAX_RTO * MS, GetRetransmissionTimeout(&rtt, 6));
+
+    // the RTO stays between MIN_RTO and MAX_RTO
+    UpdateRTT(&rtt, 60000 * MS);
+    CHECK_EQUAL(MAX_RTO * MS, rtt.rto);
+    InitializeRTT(&rtt);
+    UpdateRTT(&rtt, 1000);
+    CHECK_EQUAL(MIN_RTO * MS, rtt.rto);
+}
+
+void TestBackoff(FAKE_SERVER* server)
+{
+    // no answer: the query is sent retries + 1 times, each timeout doubles the previous one
+    RTT_ESTIMATOR rtt;
+    InitializeRTT(&rtt);
+    rtt.rto = TEST_RTO / 4 * MS;
+    server->answered_attempt = -1;
+    int unread;
+    CHECK_EQUAL(0, Query(server, &rtt, 2, &unread));
+    CHECK_EQUAL(3, server->received);
+    if (server->received == 3) {
+        CHECK(server->received_at[1] - server->received_at[0] >= TEST_RTO / 4 * MS);
+        CHECK(server->received_at[2] - server->received_at[1] >= TEST_RTO / 2 * MS);
+    }
+    CHECK_EQUAL(0, rtt.srtt); // no sample
+}
+
+void TestKarnWithoutID(FAKE_SERVER* server)
+{
+    // an old server answers the retransmission: the answer can be for either transmission, no sample is taken
+    RTT_ESTIMATOR rtt;
+    InitializeRTT(&rtt);
+    rtt.rto = TEST_RTO * MS;
+    server->answered_attempt = 1;
+    server->is_echoing = 0;
+    server->has_late_answers = 0;
+    int unread;
+    CHECK_EQUAL(1, Query(server, &rtt, 2, &unread));
+    CHECK_EQUAL(2, server->received);
+    CHECK_EQUAL(0, rtt.srtt);
+    CHECK_EQUAL(TEST_RTO * MS, rtt.rto);
+}
+
+void TestSampleOfRetransmission(FAKE_SERVER* server)
+{
+    // the ID tells the answer is for the retransmission: the sample starts when it is sent, not at the first transmission
+    RTT_ESTIMATOR rtt;
+    InitializeRTT(&rtt);
+    rtt.rto = TEST_RTO * MS;
+    server->answered_attempt = 1;
+    server->is_echoing = 1;
+    server->has_late_answers = 0;
+    int unread;
+    CHECK_EQUAL(1, Query(server, &rtt, 2, &unread));
+    CHECK_EQUAL(2, server->received);
+    CHECK(rtt.srtt > 0 && rtt.srtt < TEST_RTO * MS);
+}
+
+void TestLateAnswers(FAKE_SERVER* server)
+{
+    // the answers of a previous query, and for a transmission not sent, are skipped: the query waits for its own
+    RTT_ESTIMATOR rtt;
+    InitializeRTT(&rtt);
+    rtt.rto = TEST_RTO * MS;
+    server->answered_attempt = 0;
+    server->is_echoing = 1;
+    server->has_late_answers = 1;
+    int unread = -1;
+    CHECK_EQUAL(1, Query(server, &rtt, 2, &unread));
+    CHECK_EQUAL(1, server->received);
+    CHECK_EQUAL(0, unread); // the own answer is read after the late ones
+    CHECK(rtt.srtt > 0 && rtt.srtt < TEST_RTO * MS);
+}
+
+int main()
+{
+    if (!WSInitialize())
+        return 1;
+    FAKE_SERVER server;
+    memset(&server, 0, sizeof(server));
+    server.socket = CreateSocket(UDP);
+    IP loopback;
+    TryParseIPString("127.0.0.1", &loopback);
+    CHECK(BindSocket(server.socket, CreateSocketAddress(loopback, 0)));
+    socklen_t address_len = sizeof(server.address);
+    getsockname(server.socket, (SOCKADDR*)&server.address, &address_len);
+    SetReceiveTimeout(server.socket, SERVER_QUIET_INTERVAL);
+
+    TestTimeouts();
+    TestBackoff(&server);
+    TestKarnWithoutID(&server);
+    TestSampleOfRetransmission(&server);
+    TestLateAnswers(&server);
+    CloseSocket(server.socket, CLOSE_NORMAL);
+    WSCleanup();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,199 @@
+#include "TCP_Server.h"
+#include "Check.h"
+
+#pragma region Test Support
+
+#define STREAMS 300
+#define MAX_STREAM_REQUESTS 24
+#define MAX_REQUEST_SIZE 3000
+#define LARGE_REQUEST_SIZE 70000 // its first segmentations have extended headers
+#define MAX_STREAM_SIZE (1 << 20)
+#define MAX_RESPONSES_SIZE (MAX_STREAM_REQUESTS * RESPONSE_MAX_SIZE + RESPONSE_MAX_SIZE)
+#define HELLO_SIZE 8192 // segmentation size asked by the streams start with a hello
+
+/// <summary>
+/// The bytes a client sends on a connection, and the responses the server should send back
+/// </summary>
+typedef struct {
+    char* bytes;
+    int length;
+    char expected[MAX_RESPONSES_SIZE];
+    int expected_length;
+} STREAM;
+
+/// <summary>
+/// Build a stream of pipelined requests: digits with a '\0' at the end, as TCP_Client sends them.
+/// Some requests have a not-digit character, some streams start with a hello.
+/// </summary>
+static void BuildStream(STREAM* stream, unsigned int* seed, const SERVER_CONFIG* config)
+{
+    static char request[LARGE_REQUEST_SIZE + 1];
+    static const RESPONSE_FRAME error_frame = EncodeConstantFrame(STATUS_ERROR, ERROR_MESSAGE);
+    stream->length = 0;
+    stream->expected_length = 0;
+    int segment_size = APPLICATION_BUFF_MAX_SIZE;
+    if (NextRandom(seed) % 3 == 0) {
+        char hello[32];
+        int hello_len = sprintf_s(hello, sizeof(hello), "%s%d", HELLO_MESSAGE, HELLO_SIZE) + 1;
+        stream->length += EncodeSegmentation(stream->bytes, MAX_STREAM_SIZE, hello, hello_len);
+        segment_size = HELLO_SIZE < config->max_segment_size ? HELLO_SIZE : config->max_segment_size;
+        stream->expected_length += EncodeNumberFrame(stream->expected, MAX_RESPONSES_SIZE, segment_size);
+    }
+    int requests = 1 + NextRandom(seed) % MAX_STREAM_REQUESTS;
+    for (int r = 0; r < requests; r++) {
+        int length = NextRandom(seed) % 40 == 0 ? LARGE_REQUEST_SIZE : 1 + NextRandom(seed) % MAX_REQUEST_SIZE;
+        long long sum = 0;
+        for (int i = 0; i < length - 1; i++) {
+            request[i] = (char)('0' + NextRandom(seed) % 10);
+            sum += request[i] - '0';
+        }
+        request[length - 1] = '\0';
+        int is_error = length > 1 && NextRandom(seed) % 5 == 0;
+        if (is_error)
+            request[NextRandom(seed) % (length - 1)] = 'x';
+        stream->length += EncodeSegmentation(stream->bytes + stream->length, MAX_STREAM_SIZE - stream->length, request, length, segment_size);
+        if (is_error) {
+            memcpy(stream->expected + stream->expected_length, error_frame.data, error_frame.length);
+            stream->expected_length += error_frame.length;
+        }
+        else {
+            stream->expected_length += EncodeNumberFrame(stream->expected + stream->expected_length,
+                MAX_RESPONSES_SIZE - stream->expected_length, sum);
+        }
+    }
+}
+
+/// <summary>
+/// Take the queued responses of a connection, as the socket would send them
+/// </summary>
+static void DrainOutput(CONNECTION* connection, char* responses, int* olength)
+{
+    while (RingLength(&connection->output) > 0) {
+        int span;
+        const char* data = RingReadSpan(&connection->output, &span);
+        if (*olength + span <= MAX_RESPONSES_SIZE)
+            memcpy(responses + *olength, data, span);
+        *olength += span;
+        RingConsume(&connection->output, span);
+    }
+}
+
+/// <summary>
+/// Get the size of the next piece of a stream: TCP splits and coalesces segments anywhere
+/// </summary>
+static int NextPieceSize(unsigned int* seed, int max_piece, int left)
+{
+    int size = 1 + NextRandom(seed) % max_piece;
+    return size < left ? size : left;
+}
+
+/// <summary>
+/// Feed a stream to a connection of the poll event loop: the pieces are written to its input buffer
+/// as its space allows (See: OnConnectionReadable). The responses are taken at random times.
+/// </summary>
+static int FeedReadable(CONNECTION* connection, const STREAM* stream, unsigned int* seed, int max_piece, char* responses)
+{
+    int responses_length = 0;
+    int position = 0;
+    while (position < stream->length) {
+        int piece = NextPieceSize(seed, max_piece, stream->length - position);
+        while (piece > 0) {
+            int free = RingFree(&connection->input);
+            if (free == 0) {
+                // the input buffer is full of requests waiting for output space
+                DrainOutput(connection, responses, &responses_length);
+                if (ProcessInput(connection) == -1)
+                    return -1;
+                if (RingFree(&connection->input) == 0) {
+                    printf("The input buffer is full but its requests are not processed\n");
+                    return -1;
+                }
+                continue;
+            }
+            int length = piece < free ? piece : free;
+            RingWrite(&connection->input, stream->bytes + position, length);
+            position += length;
+            piece -= length;
+            if (ProcessInput(connection) == -1)
+                return -1;
+        }
+        if (NextRandom(seed) % 4 == 0)
+            DrainOutput(connection, responses, &responses_length);
+    }
+    // the last requests wait for output space
+    do {
+        DrainOutput(connection, responses, &responses_length);
+        if (ProcessInput(connection) == -1)
+            return -1;
+    } while (RingLength(&connection->output) > 0);
+    return responses_length;
+}
+
+/// <summary>
+/// Feed a stream to a connection of the io_uring event loop: the pieces are appended as received (See: AppendInput).
+/// The responses are taken at random times, the input buffer grows while they wait.
+/// </summary>
+static int FeedAppend(CONNECTION* connection, const STREAM* stream, unsigned int* seed, int max_piece, char* responses)
+{
+    int responses_length = 0;
+    int position = 0;
+    while (position < stream->length) {
+        int piece = NextPieceSize(seed, max_piece, stream->length - position);
+        if (AppendInput(connection, stream->bytes + position, piece) == -1)
+            return -1;
+        position += piece;
+        if (NextRandom(seed) % 4 == 0)
+            DrainOutput(connection, responses, &responses_length);
+    }
+    do {
+        DrainOutput(connection, responses, &responses_length);
+        if (ProcessInput(connection) == -1)
+            return -1;
+    } while (RingLength(&connection->output) > 0);
+    return responses_length;
+}
+
+#pragma endregion
+
+void TestSplitStreams(int is_append)
+{
+    char* argv[] = { (char*)"TCP_Server", (char*)"5000" };
+    SERVER_CONFIG config;
+    ExtractOptions(2, argv, &config);
+    STREAM* stream = (STREAM*)malloc(sizeof(STREAM));
+    stream->bytes = (char*)malloc(MAX_STREAM_SIZE);
+    static char responses[MAX_RESPONSES_SIZE];
+    // from byte by byte to many segmentations coalesced
+    static const int max_pieces[] = { 1, 3, 17, 100, 1500, 10000, MAX_STREAM_SIZE };
+    unsigned int seed = is_append ? 2 : 1;
+    int failed_streams = 0;
+    for (int s = 0; s < STREAMS; s++) {
+        BuildStream(stream, &seed, &config);
+        int max_piece = max_pieces[s % (sizeof(max_pieces) / sizeof(max_pieces[0]))];
+        int sockets[2];
+        CHECK_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sockets)); // not used: the bytes are given to the connection
+        CONNECTION* connection = CreateConnection(sockets[0], &config);
+        CHECK(connection != NULL);
+        if (connection == NULL)
+            break;
+        int length = is_append ? FeedAppend(connection, stream, &seed, max_piece, responses)
+            : FeedReadable(connection, stream, &seed, max_piece, responses);
+        if (length != stream->expected_length || memcmp(responses, stream->expected, length) != 0) {
+            if (failed_streams++ == 0)
+                printf("%s, stream %d of %d bytes, pieces up to %d bytes: %d bytes of responses, %d expected\n",
+                    is_append ? "AppendInput" : "ProcessInput", s, stream->length, max_piece, length, stream->expected_length);
+        }
+        DestroyConnection(connection);
+        CloseSocket(sockets[1], CLOSE_NORMAL);
+    }
+    CHECK_EQUAL(0, failed_streams);
+    free(stream->bytes);
+    free(stream);
+}
+
+int main()
+{
+    TestSplitStreams(0);
+    TestSplitStreams(1);
+    return CHECK_RESULT();
+}
@@ -0,0 +1,129 @@
+#include <thread>
+
+#include "Network.h"
+
+#pragma region Benchmark Support
+
+#define BENCHMARK_BYTES (64LL << 20) // bytes of messages sent for each case
+#define MAX_MESSAGE_SIZE (1 << 20)
+
+static thread_local long long system_calls = 0; // the sends of the thread
+
+extern "C" ssize_t __real_send(int socket, const void* buffer, size_t length, int flags);
+extern "C" ssize_t __real_sendmsg(int socket, const struct msghdr* header, int flags);
+
+/// <summary>
+/// send and sendmsg, wrapped at link time (-Wl,--wrap=send,--wrap=sendmsg) to count them
+/// </summary>
+extern "C" ssize_t __wrap_send(int socket, const void* buffer, size_t length, int flags)
+{
+    system_calls++;
+    return __real_send(socket, buffer, length, flags);
+}
+
+extern "C" ssize_t __wrap_sendmsg(int socket, const struct msghdr* header, int flags)
+{
+    system_calls++;
+    return __real_sendmsg(socket, header, flags);
+}
+
+/// <summary>
+/// SegmentationSend before the scatter-gather path, the baseline: each segmentation is copied
+/// behind its header into a buffer and sent with its own call
+/// </summary>
+static int SegmentationSendPerCall(SOCKET sender, const char* message, int message_len, int segment_size)
+{
+    char content[SEGMENTATION_MAX_SIZE];
+    int start_byte = 0;
+    while (start_byte < message_len) {
+        int bsend = message_len - start_byte;
+        if (bsend + SEGMENTATION_HEADER_SIZE > segment_size)
+            bsend = segment_size - SEGMENTATION_HEADER_SIZE;
+        int header_size = EncodeSegmentationHeader(content, bsend, message_len - start_byte - bsend);
+        memcpy(content + header_size, message + start_byte, bsend);
+        int ret = WriteSocketBuffer(sender, header_size + bsend, content);
+        if (ret != 1)
+            return ret;
+        start_byte += bsend;
+    }
+    return 1;
+}
+
+/// <summary>
+/// Drain a socket until it is closed: the receiver is not measured
+/// </summary>
+static void DrainSocket(SOCKET receiver)
+{
+    static char buffer[1 << 16];
+    while (recv(receiver, buffer, sizeof(buffer), 0) > 0)
+        ;
+}
+
+/// <summary>
+/// Send messages of a size over a socketpair, with the scatter-gather path or the baseline
+/// </summary>
+/// <param name="osystem_calls">[Output] Number of sends per message</param>
+/// <returns>The throughput in MB/s. 0 if a send fails</returns>
+static double MeasureSend(const char* message, int message_len, const FRAMING* framing, int is_baseline, double* osystem_calls)
+{
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0)
+        return 0;
+    std::thread reader(DrainSocket, sockets[1]);
+    long long messages = BENCHMARK_BYTES / message_len;
+    int status = 1;
+    system_calls = 0;
+    long long start = GetTimestamp();
+    for (long long i = 0; i < messages && status == 1; i++) {
+        status = is_baseline ? SegmentationSendPerCall(sockets[0], message, message_len, framing->segment_size)
+            : SegmentationSend(sockets[0], message, message_len, NULL, framing);
+    }
+    long long elapsed = GetTimestamp() - start;
+    CloseSocket(sockets[0], CLOSE_NORMAL);
+    reader.join();
+    CloseSocket(sockets[1], CLOSE_NORMAL);
+    *osystem_calls = (double)system_calls / messages;
+    return status == 1 && elapsed > 0 ? (double)messages * message_len / elapsed * 1e9 / (1 << 20) : 0;
+}
+
+#pragma endregion
+
+int main()
+{
+    static char message[MAX_MESSAGE_SIZE];
+    memset(message, '5', sizeof(message));
+    FRAMING legacy = { APPLICATION_BUFF_MAX_SIZE, 0 };
+    FRAMING extended = { SEGMENTATION_MAX_SIZE, 1 };
+    typedef struct {
+        int message_len;
+        const FRAMING* framing;
+        int has_baseline; // the baseline has legacy headers only
+    } BENCHMARK_CASE;
+    BENCHMARK_CASE cases[] = {
+        { 100, &legacy, 1 },
+        { APPLICATION_BUFF_MAX_SIZE - SEGMENTATION_HEADER_SIZE, &legacy, 1 },
+        { 4096, &legacy, 1 },
+        { 60 * 1024, &legacy, 1 },
+        { 60 * 1024, &extended, 1 },
+        { MAX_MESSAGE_SIZE, &extended, 0 },
+    };
+
+    printf("%-9s %-9s %18s %18s %14s %14s\n", "Message", "Segment", "Baseline MB/s", "Batched MB/s", "Baseline calls", "Batched calls");
+    int is_ok = 1;
+    for (const BENCHMARK_CASE& c : cases) {
+        double baseline_calls = 0, batched_calls = 0, baseline = 0;
+        if (c.has_baseline)
+            baseline = MeasureSend(message, c.message_len, c.framing, 1, &baseline_calls);
+        double batched = MeasureSend(message, c.message_len, c.framing, 0, &batched_calls);
+        if (batched == 0 || (c.has_baseline && baseline == 0))
+            is_ok = 0;
+        if (c.has_baseline)
+            printf("%-9d %-9d %18.0f %18.0f %14.2f %14.2f\n", c.message_len, c.framing->segment_size, baseline, batched, baseline_calls, batched_calls);
+        else
+            printf("%-9d %-9d %18s %18.0f %14s %14.2f\n", c.message_len, c.framing->segment_size, "-", batched, "-", batched_calls);
+        fflush(stdout);
+    }
+    if (!is_ok)
+        printf("FAIL: a send failed\n");
+    return is_ok ? 0 : 1;
+}
@@ -0,0 +1,119 @@
+#include "TCP_Server.h"
+#include "AllocationCounter.h"
+#include "Check.h"
+
+#pragma region Test Support
+
+#define BATCH_REQUESTS 20 // requests written before they are handled, they fit the socket buffers
+#define BATCHES 50
+#define WARMUP_BATCHES 2
+
+static int request_lengths[] = { 1, 10, APPLICATION_BUFF_MAX_SIZE, 3000, 20000 }; // with the '\0', up to 20 segmentations
+
+/// <summary>
+/// Write a batch of requests of digits, and keep their sums
+/// </summary>
+static void WriteRequests(SOCKET socket, char* digits, int* oexpected)
+{
+    for (int i = 0; i < BATCH_REQUESTS; i++) {
+        int length = request_lengths[i % (sizeof(request_lengths) / sizeof(request_lengths[0]))];
+        digits[length - 1] = '\0';
+        oexpected[i] = GetSumDigitOnStringScalar(digits, length);
+        CHECK_EQUAL(1, SegmentationSend(socket, digits, length, NULL));
+        digits[length - 1] = (char)('0' + (length - 1) % 10);
+    }
+}
+
+/// <summary>
+/// Read a batch of responses and compare them with the sums
+/// </summary>
+static void ReadResponses(SOCKET socket, const int* expected)
+{
+    char buffer[APPLICATION_BUFF_MAX_SIZE];
+    for (int i = 0; i < BATCH_REQUESTS; i++) {
+        const char* body;
+        int body_len;
+        long long remain;
+        CHECK_EQUAL(1, SegmentationReceive(socket, buffer, &body, &body_len, &remain));
+        CHECK_EQUAL(0, remain);
+        CHECK(body_len > 1 && body[0] == STATUS_OK_END_CHAR);
+        if (body_len > 1)
+            CHECK_EQUAL(expected[i], atoll(body + 1));
+    }
+}
+
+#pragma endregion
+
+void TestHandleRequest(int is_stats)
+{
+    if (is_stats)
+        EnableStats(); // the timers and counters are recorded too
+    int sockets[2];
+    CHECK_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sockets));
+    static char digits[20000];
+    for (int i = 0; i < (int)sizeof(digits); i++)
+        digits[i] = (char)('0' + i % 10);
+    int expected[BATCH_REQUESTS];
+    int can_negotiate = 0;
+    SERVER_CONFIG config;
+    char* argv[] = { (char*)"TCP_Server", (char*)"5000" };
+    ExtractOptions(2, argv, &config);
+
+    long long steady_allocations = 0;
+    for (int batch = 0; batch < BATCHES; batch++) {
+        WriteRequests(sockets[1], digits, expected);
+        long long before = allocations;
+        for (int i = 0; i < BATCH_REQUESTS; i++)
+            CHECK_EQUAL(1, HandleRequest(sockets[0], &can_negotiate, &config));
+        if (batch >= WARMUP_BATCHES)
+            steady_allocations += allocations - before;
+        ReadResponses(sockets[1], expected);
+    }
+    printf("HandleRequest%s: %lld allocations for %d requests\n", is_stats ? " (stats)" : "",
+        steady_allocations, (BATCHES - WARMUP_BATCHES) * BATCH_REQUESTS);
+    CHECK_EQUAL(0, steady_allocations);
+    CloseSocket(sockets[0], CLOSE_NORMAL);
+    CloseSocket(sockets[1], CLOSE_NORMAL);
+}
+
+void TestSegmentationReceive()
+{
+    int sockets[2];
+    CHECK_EQUAL(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sockets));
+    static char message[20000];
+    memset(message, '7', sizeof(message));
+    char buffer[APPLICATION_BUFF_MAX_SIZE];
+    long long steady_allocations = 0;
+    for (int round = 0; round < BATCHES; round++) {
+        CHECK_EQUAL(1, SegmentationSend(sockets[1], message, sizeof(message), NULL));
+        long long before = allocations;
+        long long received = 0, remain = 1;
+        while (remain > 0) {
+            const char* body;
+            int body_len;
+            if (SegmentationReceive(sockets[0], buffer, &body, &body_len, &remain) != 1)
+                break;
+            received += body_len;
+        }
+        CHECK_EQUAL(sizeof(message), received);
+        if (round >= WARMUP_BATCHES)
+            steady_allocations += allocations - before;
+    }
+    printf("SegmentationReceive: %lld allocations for %d messages\n", steady_allocations, BATCHES - WARMUP_BATCHES);
+    CHECK_EQUAL(0, steady_allocations);
+    CloseSocket(sockets[0], CLOSE_NORMAL);
+    CloseSocket(sockets[1], CLOSE_NORMAL);
+}
+
+int main()
+{
+    // the counter sees the allocations of the libraries
+    long long before = allocations;
+    free(Clone("123", 3));
+    CHECK_EQUAL(before + 1, allocations);
+
+    TestSegmentationReceive();
+    TestHandleRequest(0);
+    TestHandleRequest(1);
+    return CHECK_RESULT();
+}
@@ -0,0 +1,130 @@
+#include <thread>
+
+#include "TCP_Server.h"
+
+#pragma region Benchmark Support
+
+#define CALLS 10000000 // calls of the instrumentation measured alone
+#define REQUESTS 200000 // requests served for each case
+#define REQUEST_LENGTH 101 // 100 digits and the '\0', as TCP_Client sends them
+#define BATCH_REQUESTS 64 // requests written by a send of the client
+#define MAX_OVERHEAD 0.02
+
+// instrumentation of a request served by HandleRequest: receive, sum_digit and send,
+// and bytes_in, segments, requests and bytes_out
+#define REQUEST_TIMERS 3
+#define REQUEST_COUNTERS 4
+
+/// <summary>
+/// Send REQUESTS requests, as a client that does not wait for the responses
+/// </summary>
+static void WriteRequests(SOCKET socket)
+{
+    static char batch[BATCH_REQUESTS * (REQUEST_LENGTH + SEGMENTATION_HEADER_SIZE)];
+    char request[REQUEST_LENGTH];
+    for (int i = 0; i < REQUEST_LENGTH - 1; i++)
+        request[i] = (char)('0' + i % 10);
+    request[REQUEST_LENGTH - 1] = '\0';
+    int length = 0;
+    for (int i = 0; i < BATCH_REQUESTS; i++)
+        length += EncodeSegmentation(batch + length, sizeof(batch) - length, request, REQUEST_LENGTH);
+    for (int sent = 0; sent < REQUESTS; sent += BATCH_REQUESTS) {
+        if (WriteSocketBuffer(socket, length, batch) != 1)
+            return;
+    }
+}
+
+/// <summary>
+/// Drain the responses until the socket is closed: the client is not measured
+/// </summary>
+static void DrainSocket(SOCKET socket)
+{
+    static char buffer[1 << 16];
+    while (recv(socket, buffer, sizeof(buffer), 0) > 0)
+        ;
+}
+
+/// <summary>
+/// Serve requests over a socketpair with HandleRequest, the loop of a blocking worker
+/// </summary>
+/// <returns>The time to serve a request, in nanoseconds. 0 if a request fails</returns>
+static double MeasureRequests()
+{
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0)
+        return 0;
+    std::thread writer(WriteRequests, sockets[1]);
+    std::thread reader(DrainSocket, sockets[1]);
+    int can_negotiate = 0;
+    int status = 1;
+    long long start = GetTimestamp();
+    int served = 0;
+    for (; served < REQUESTS && status == 1; served++)
+        status = HandleRequest(sockets[0], &can_negotiate, NULL);
+    long long elapsed = GetTimestamp() - start;
+    shutdown(sockets[0], SHUT_RDWR); // the client stops, even if a request failed
+    writer.join();
+    reader.join();
+    CloseSocket(sockets[0], CLOSE_NORMAL);
+    CloseSocket(sockets[1], CLOSE_NORMAL);
+    return status == 1 ? (double)elapsed / served : 0;
+}
+
+/// <summary>
+/// Measure a counter update, as the request paths do it
+/// </summary>
+/// <returns>The time of an update, in nanoseconds</returns>
+static double MeasureCounter()
+{
+    STATS* stats = GetThreadStats();
+    long long start = GetTimestamp();
+    for (int i = 0; i < CALLS; i++)
+        IncreaseCounter(&stats->bytes_in, i & 0xFF);
+    return (double)(GetTimestamp() - start) / CALLS;
+}
+
+/// <summary>
+/// Measure a latency measurement: StartTimer, then StopTimer records it
+/// </summary>
+/// <returns>The time of a measurement, in nanoseconds</returns>
+static double MeasureTimer()
+{
+    long long start = GetTimestamp();
+    for (int i = 0; i < CALLS; i++)
+        StopTimer(STATS_SUM_DIGIT, StartTimer());
+    return (double)(GetTimestamp() - start) / CALLS;
+}
+
+#pragma endregion
+
+int main()
+{
+    MeasureRequests(); // warm up
+    double counter = MeasureCounter();
+    double disabled_timer = MeasureTimer();
+    double disabled = MeasureRequests();
+    EnableStats();
+    double enabled_timer = MeasureTimer();
+    double enabled = MeasureRequests();
+    if (disabled == 0 || enabled == 0) {
+        printf("FAIL: a request failed\n");
+        return 1;
+    }
+
+    printf("%-34s %10.1f ns\n", "IncreaseCounter", counter);
+    printf("%-34s %10.1f ns\n", "StartTimer + StopTimer, disabled", disabled_timer);
+    printf("%-34s %10.1f ns\n", "StartTimer + StopTimer, enabled", enabled_timer);
+    printf("%-34s %10.1f ns\n", "Request, instrumentation disabled", disabled);
+    printf("%-34s %10.1f ns\n", "Request, instrumentation enabled", enabled);
+    // the counters are always updated, and the time of a request varies by more than 2% from run to run:
+    // the cost of the instrumentation is estimated from the calls measured alone
+    double instrumentation = REQUEST_TIMERS * enabled_timer + REQUEST_COUNTERS * counter;
+    double overhead = instrumentation / (disabled - REQUEST_COUNTERS * counter);
+    printf("Instrumentation of a request: %.1f ns, %.2f%% overhead (end to end: %+.2f%%)\n",
+        instrumentation, overhead * 100, (enabled - disabled) / disabled * 100);
+    if (overhead >= MAX_OVERHEAD) {
+        printf("FAIL: the overhead is %.0f%% or more\n", MAX_OVERHEAD * 100);
+        return 1;
+    }
+    return 0;
+}
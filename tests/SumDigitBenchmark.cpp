@@ -0,0 +1,71 @@
+#include "TCP_Server.h"
+
+#pragma region Benchmark
+
+#define BENCHMARK_BYTES (256LL << 20) // bytes summed by a kernel for each length
+
+typedef struct {
+    const char* name;
+    SUM_DIGIT_KERNEL kernel;
+} BENCHMARKED_KERNEL;
+
+/// <summary>
+/// Sum BENCHMARK_BYTES of digits, in strings of a length
+/// </summary>
+/// <returns>The throughput in MB/s</returns>
+static double MeasureKernel(SUM_DIGIT_KERNEL kernel, const char* str, int strlen, long long* ochecksum)
+{
+    long long rounds = BENCHMARK_BYTES / strlen;
+    long long checksum = 0;
+    long long start = GetTimestamp();
+    for (long long i = 0; i < rounds; i++)
+        checksum += kernel(str + (i & 15), strlen); // the alignment of a received segmentation varies
+    long long elapsed = GetTimestamp() - start;
+    *ochecksum = checksum;
+    return elapsed > 0 ? (double)rounds * strlen / elapsed * 1e9 / (1 << 20) : 0;
+}
+
+#pragma endregion
+
+int main()
+{
+    BENCHMARKED_KERNEL kernels[3];
+    int count = 0;
+    kernels[count++] = { "Scalar", GetSumDigitOnStringScalar };
+#ifdef SUM_DIGIT_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        kernels[count++] = { "SSE2", GetSumDigitOnStringSSE2 };
+    if (__builtin_cpu_supports("avx2"))
+        kernels[count++] = { "AVX2", GetSumDigitOnStringAVX2 };
+#endif
+    // a request body: its segmentations are at most APPLICATION_BUFF_MAX_SIZE, or SEGMENTATION_MAX_SIZE when negotiated
+    int lengths[] = { 16, 64, 256, APPLICATION_BUFF_MAX_SIZE - SEGMENTATION_HEADER_SIZE, SEGMENTATION_MAX_SIZE - SEGMENTATION_EXTENDED_HEADER_SIZE };
+    static char str[SEGMENTATION_MAX_SIZE + 16];
+    unsigned int seed = 1;
+    for (int i = 0; i < (int)sizeof(str); i++)
+        str[i] = (char)('0' + NextRandom(&seed) % 10);
+
+    printf("%-8s", "Length");
+    for (int k = 0; k < count; k++)
+        printf("%12s", kernels[k].name);
+    printf("  (MB/s)\n");
+    int is_consistent = 1;
+    for (int length : lengths) {
+        printf("%-8d", length);
+        long long expected = -1;
+        for (int k = 0; k < count; k++) {
+            long long checksum;
+            printf("%12.0f", MeasureKernel(kernels[k].kernel, str, length, &checksum));
+            fflush(stdout);
+            if (expected == -1)
+                expected = checksum;
+            else if (checksum != expected)
+                is_consistent = 0;
+        }
+        printf("\n");
+    }
+    if (!is_consistent)
+        printf("FAIL: the kernels disagree\n");
+    return is_consistent ? 0 : 1;
+}
@@ -0,0 +1,113 @@
+#include "TCP_Server.h"
+#include "Check.h"
+
+#pragma region Test Support
+
+#define MAX_TESTED_LENGTH 256
+#define RANDOM_BUFFERS 20000
+#define RANDOM_MAX_LENGTH 2048
+
+typedef struct {
+    const char* name;
+    SUM_DIGIT_KERNEL kernel;
+} TESTED_KERNEL;
+
+static TESTED_KERNEL kernels[2];
+static int kernel_count = 0;
+
+// bytes around the digits, and the ones a signed or unsigned compare gets wrong
+static const char not_digits[] = { '/', ':', ' ', 'a', (char)0x7F, (char)0x80, (char)0xB0, (char)0xFF };
+
+/// <summary>
+/// Compare the SIMD kernels the CPU supports with GetSumDigitOnStringScalar on a string.
+/// The string is at every offset of a 32-byte block, and the byte after it is not a digit.
+/// </summary>
+static void CompareKernels(const char* str, int strlen)
+{
+    static char buffer[RANDOM_MAX_LENGTH + 64];
+    for (int offset = 0; offset < 32; offset += 7) {
+        char* copy = buffer + offset;
+        memcpy(copy, str, strlen);
+        copy[strlen] = 'x';
+        int expected = GetSumDigitOnStringScalar(copy, strlen);
+        for (int k = 0; k < kernel_count; k++) {
+            int actual = kernels[k].kernel(copy, strlen);
+            if (actual != expected) {
+                printf("%s, length %d, offset %d: %d != %d\n", kernels[k].name, strlen, offset, expected, actual);
+                check_failures++;
+            }
+        }
+    }
+}
+
+#pragma endregion
+
+void TestEveryPosition()
+{
+    unsigned int seed = 1;
+    char str[MAX_TESTED_LENGTH] = { 0 }; // the empty string is compared first
+    for (int length = 0; length <= MAX_TESTED_LENGTH; length++) {
+        for (int i = 0; i < length; i++)
+            str[i] = (char)('0' + NextRandom(&seed) % 10);
+        CompareKernels(str, length);
+        for (int position = 0; position < length; position++) {
+            char digit = str[position];
+            str[position] = '\0';
+            CompareKernels(str, length);
+            for (char not_digit : not_digits) {
+                str[position] = not_digit;
+                CompareKernels(str, length);
+            }
+            str[position] = digit;
+        }
+    }
+    // the largest sums: all '9'
+    memset(str, '9', sizeof(str));
+    for (int length = 0; length <= MAX_TESTED_LENGTH; length++)
+        CompareKernels(str, length);
+    CHECK_EQUAL(9 * MAX_TESTED_LENGTH, GetSumDigitOnStringScalar(str, MAX_TESTED_LENGTH));
+}
+
+void TestRandomBuffers()
+{
+    unsigned int seed = 2;
+    static char str[RANDOM_MAX_LENGTH];
+    for (int n = 0; n < RANDOM_BUFFERS; n++) {
+        int length = NextRandom(&seed) % (RANDOM_MAX_LENGTH + 1);
+        // mostly digits, so that the blocks after the first '\0' or not-digit byte are reached
+        int rate = 1 + NextRandom(&seed) % 1000;
+        for (int i = 0; i < length; i++) {
+            unsigned int r = NextRandom(&seed);
+            if (r % rate == 0)
+                str[i] = (r >> 16) % 3 == 0 ? '\0' : (char)(r >> 8);
+            else
+                str[i] = (char)('0' + (r >> 8) % 10);
+        }
+        CompareKernels(str, length);
+    }
+}
+
+void TestScalar()
+{
+    CHECK_EQUAL(0, GetSumDigitOnStringScalar("", 0));
+    CHECK_EQUAL(45, GetSumDigitOnStringScalar("0123456789", 10));
+    CHECK_EQUAL(6, GetSumDigitOnStringScalar("123\0abc", 7)); // stops at '\0'
+    CHECK_EQUAL(-1, GetSumDigitOnStringScalar("12a3", 4));
+    CHECK_EQUAL(3, GetSumDigitOnStringScalar("12a3", 2)); // only strlen bytes are read
+}
+
+int main()
+{
+#ifdef SUM_DIGIT_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2"))
+        kernels[kernel_count++] = { "SSE2", GetSumDigitOnStringSSE2 };
+    if (__builtin_cpu_supports("avx2"))
+        kernels[kernel_count++] = { "AVX2", GetSumDigitOnStringAVX2 };
+#endif
+    printf("Kernels compared with the scalar one: %d\n", kernel_count);
+    TestScalar();
+    TestEveryPosition();
+    TestRandomBuffers();
+    return CHECK_RESULT();
+}
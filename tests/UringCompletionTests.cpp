@@ -0,0 +1,152 @@
+#include "TCP_Server.h"
+#include "Check.h"
+
+#ifdef SERVER_IO_URING
+
+#pragma region Test Support
+
+/// <summary>
+/// Complete an operation of the io_uring event loop as the kernel would
+/// </summary>
+static int Complete(URING* ring, URING_CONNECTION* connection, int operation, int res, unsigned int flags, const SERVER_CONFIG* config, WORKER* worker)
+{
+    struct io_uring_cqe cqe;
+    memset(&cqe, 0, sizeof(cqe));
+    cqe.user_data = (unsigned long long)(uintptr_t)connection | operation;
+    cqe.res = res;
+    cqe.flags = flags;
+    return OnUringCompletion(ring, &cqe, INVALID_SOCKET, config, worker);
+}
+
+/// <summary>
+/// Accept a connection of a socketpair: its multishot recv is armed, not submitted
+/// </summary>
+/// <param name="opeer">[Output] The socket of the client</param>
+static URING_CONNECTION* Accept(URING* ring, const SERVER_CONFIG* config, WORKER* worker, SOCKET* opeer)
+{
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets) != 0)
+        return NULL;
+    *opeer = sockets[1];
+    // the multishot accept stays armed: no accept is prepared again
+    Complete(ring, NULL, URING_OP_ACCEPT, sockets[0], IORING_CQE_F_MORE, config, worker);
+    return ring->connections;
+}
+
+/// <summary>
+/// The flags of a recv completion that filled a provided buffer
+/// </summary>
+static unsigned int ReceivedFlags(int id, int has_more)
+{
+    return IORING_CQE_F_BUFFER | ((unsigned int)id << IORING_CQE_BUFFER_SHIFT) | (has_more ? IORING_CQE_F_MORE : 0);
+}
+
+#pragma endregion
+
+void TestReceiveAfterClose(URING* ring, const SERVER_CONFIG* config)
+{
+    static WORKER worker;
+    SOCKET peer;
+    URING_CONNECTION* connection = Accept(ring, config, &worker, &peer);
+    CHECK(connection != NULL && connection->is_receiving);
+    if (connection == NULL)
+        return;
+    CloseUringConnection(ring, connection);
+    CHECK(ring->connections == connection); // the recv is in flight
+    // the last completion of the recv has bytes: the connection is destroyed anyway
+    CHECK_EQUAL(1, Complete(ring, connection, URING_OP_RECEIVE, 5, ReceivedFlags(0, 0), config, &worker));
+    CHECK(ring->connections == NULL);
+    CHECK_EQUAL(1, worker.closed.load());
+    CloseSocket(peer, CLOSE_NORMAL);
+}
+
+void TestNoSendAfterClose(URING* ring, const SERVER_CONFIG* config)
+{
+    static WORKER worker;
+    SOCKET peer;
+    URING_CONNECTION* connection = Accept(ring, config, &worker, &peer);
+    if (connection == NULL)
+        return;
+    RingWrite(&connection->state->output, "response", 8); // not sent yet
+    CloseUringConnection(ring, connection);
+    CHECK_EQUAL(1, Complete(ring, connection, URING_OP_RECEIVE, 5, ReceivedFlags(1, 1), config, &worker));
+    CHECK(ring->connections == connection);
+    CHECK_EQUAL(0, connection->is_sending); // the queued responses are dropped
+    CHECK_EQUAL(1, Complete(ring, connection, URING_OP_RECEIVE, -ECANCELED, 0, config, &worker));
+    CHECK(ring->connections == NULL);
+    CHECK_EQUAL(1, worker.closed.load());
+    CloseSocket(peer, CLOSE_NORMAL);
+}
+
+void TestPauseReceive(URING* ring, const SERVER_CONFIG* config)
+{
+    static WORKER worker;
+    SOCKET peer;
+    URING_CONNECTION* connection = Accept(ring, config, &worker, &peer);
+    if (connection == NULL)
+        return;
+    // the responses of earlier requests fill the output buffer, the client does not read them
+    static char pending[RING_BUFFER_SIZE];
+    int pending_length = connection->state->output.size - RESPONSE_MAX_SIZE + 1;
+    RingWrite(&connection->state->output, pending, pending_length);
+    int request_length = 0;
+    for (int id = 2; id <= 3; id++)
+        request_length = EncodeSegmentation(ring->buffer_data + (size_t)id * URING_BUFFER_SIZE, URING_BUFFER_SIZE, "12345", 6);
+
+    // the request waits for output space: the recv is cancelled
+    Complete(ring, connection, URING_OP_RECEIVE, request_length, ReceivedFlags(2, 1), config, &worker);
+    CHECK_EQUAL(1, connection->is_paused);
+    CHECK_EQUAL(request_length, RingLength(&connection->state->input));
+    // received before the cancel completes: held in its provided buffer
+    Complete(ring, connection, URING_OP_RECEIVE, request_length, ReceivedFlags(3, 1), config, &worker);
+    CHECK_EQUAL(1, connection->held_count);
+    CHECK_EQUAL(request_length, RingLength(&connection->state->input));
+    Complete(ring, connection, URING_OP_RECEIVE, -ECANCELED, 0, config, &worker);
+    CHECK(ring->connections == connection);
+    CHECK_EQUAL(0, connection->is_receiving);
+
+    // the responses are sent: both requests are answered, and the recv is armed again
+    CHECK_EQUAL(1, connection->is_sending);
+    Complete(ring, connection, URING_OP_SEND, pending_length, 0, config, &worker);
+    char frame[RESPONSE_MAX_SIZE];
+    int frame_length = EncodeNumberFrame(frame, RESPONSE_MAX_SIZE, 15);
+    CHECK_EQUAL(0, connection->held_count);
+    CHECK_EQUAL(0, RingLength(&connection->state->input));
+    CHECK_EQUAL(2 * frame_length, RingLength(&connection->state->output));
+    CHECK_EQUAL(1, connection->is_receiving);
+    CHECK_EQUAL(0, connection->is_paused);
+
+    CloseUringConnection(ring, connection);
+    Complete(ring, connection, URING_OP_RECEIVE, -ECANCELED, 0, config, &worker);
+    Complete(ring, connection, URING_OP_SEND, -ECANCELED, 0, config, &worker);
+    CHECK(ring->connections == NULL);
+    CHECK_EQUAL(1, worker.closed.load());
+    CloseSocket(peer, CLOSE_NORMAL);
+}
+
+int main()
+{
+    char* argv[] = { (char*)"TCP_Server", (char*)"5000" };
+    SERVER_CONFIG config;
+    ExtractOptions(2, argv, &config);
+    URING ring;
+    if (!SetupUring(&ring)) {
+        printf("io_uring is not supported: not tested\n");
+        return 0;
+    }
+    TestReceiveAfterClose(&ring, &config);
+    TestNoSendAfterClose(&ring, &config);
+    TestPauseReceive(&ring, &config);
+    DestroyUring(&ring);
+    return CHECK_RESULT();
+}
+
+#else
+
+int main()
+{
+    printf("The io_uring event loop is not built: not tested\n");
+    return 0;
+}
+
+#endif
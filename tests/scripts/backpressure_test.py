@@ -0,0 +1,74 @@
+"""Test of a pipelining client that does not read its responses: it sends requests as fast as the server takes them.
+The server must stop receiving from it while the responses wait, with the poll and the io_uring event loops:
+the connection is not closed, its buffers stay within --connection-memory, and every request is answered
+once the client reads.
+Usage: backpressure_test.py <TCP_Server> <TCP_Client>"""
+
+import socket
+import struct
+import sys
+import threading
+
+import load_harness
+
+CONNECTION_MEMORY = 64  # in KB
+REQUEST = b"12345\0"
+REQUESTS = 400000  # 4 MB of requests: more than the socket buffers and the connection memory hold
+UNREAD_TIME = 2.0  # in seconds, the client sends without reading
+
+
+def send_requests(connection, errors):
+    try:
+        connection.sendall((struct.pack(">HH", len(REQUEST), 0) + REQUEST) * REQUESTS)  # legacy header: current | remain
+    except OSError as error:
+        errors.append(error)
+
+
+def read_responses(connection):
+    """Read the responses of every request, and return the number of them that are correct"""
+    data = bytearray()
+    expected_length = None
+    while expected_length is None or len(data) < expected_length:
+        chunk = connection.recv(1 << 20)
+        if not chunk:
+            break
+        data += chunk
+        if expected_length is None and len(data) >= 4:
+            frame_length = 4 + struct.unpack(">H", data[:2])[0]
+            expected_length = frame_length * REQUESTS
+    if expected_length is None:
+        return 0
+    frame = bytes(data[:frame_length])
+    if frame[4:5] != b"0" or frame[5:].rstrip(b"\0") != b"15":
+        return 0
+    return data.count(frame)  # the frames are the same, a missing or a wrong byte breaks one
+
+
+def main():
+    server_path, _ = load_harness.main_arguments("<TCP_Server> <TCP_Client>")
+    problems = []
+    for name, options in (("poll", ["--poll"]), ("io_uring", [])):
+        with load_harness.Server(server_path, *options, "--connection-memory", str(CONNECTION_MEMORY), stats=True) as server:
+            with socket.create_connection((load_harness.LOOPBACK, server.port), timeout=30) as connection:
+                errors = []
+                sender = threading.Thread(target=send_requests, args=(connection, errors))
+                sender.start()
+                sender.join(UNREAD_TIME)
+                stats = server.stats()
+                answered = read_responses(connection)
+                sender.join()
+        print(f"{name}: {answered} of {REQUESTS} requests answered, {stats.get('connection_memory', 0) // 1024} KB of buffers "
+              f"while the client did not read")
+        if errors:
+            problems.append(f"{name}: the requests are not sent: {errors[0]}")
+        if stats.get("connections", 0) != 1:
+            problems.append(f"{name}: the connection is closed while the client does not read")
+        if stats.get("over_budget", 0) != 0 or stats.get("connection_memory", 0) > CONNECTION_MEMORY * 1024:
+            problems.append(f"{name}: the buffers of the connection reach its memory budget")
+        if answered != REQUESTS:
+            problems.append(f"{name}: {answered} requests answered correctly, {REQUESTS} expected")
+    return load_harness.finish(problems)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,93 @@
+"""Test of the read deadline (TCP_Server --read-timeout) against a slow client: it sends a segmentation header,
+then trickles its body one byte every 50 ms. The connection is active, but the request is not received in time,
+so the server must close it shortly after the deadline, with the poll and the io_uring event loops.
+A request received before its deadline is still answered.
+Usage: deadline_test.py <TCP_Server> <TCP_Client>"""
+
+import select
+import socket
+import struct
+import sys
+import time
+
+import load_harness
+
+READ_TIMEOUT = 500  # in milliseconds
+TRICKLE_INTERVAL = 0.05
+BODY_SIZE = 1000  # bytes announced by the header, never all sent in time
+LATEST_EVICTION = 2.0  # in seconds: the deadline, the check interval of the loops, and a margin for a busy machine
+
+
+def is_closed(connection, timeout):
+    """Wait for the server to close the connection, at most timeout seconds"""
+    readable, _, _ = select.select([connection], [], [], timeout)
+    if not readable:
+        return False
+    try:
+        return connection.recv(4096) == b""
+    except ConnectionError:
+        return True
+
+
+def trickle(port):
+    """Trickle a request, and return the seconds until the server closes the connection. None if it is not closed"""
+    with socket.create_connection((load_harness.LOOPBACK, port)) as connection:
+        connection.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        start = time.monotonic()
+        connection.sendall(struct.pack(">HH", BODY_SIZE, 0))  # legacy header: current | remain
+        for _ in range(BODY_SIZE - 1):
+            try:
+                connection.sendall(b"1")
+            except ConnectionError:
+                return time.monotonic() - start
+            if is_closed(connection, TRICKLE_INTERVAL):
+                return time.monotonic() - start
+            if time.monotonic() - start > LATEST_EVICTION + 1:
+                return None
+        return None
+
+
+def request_in_time(port):
+    """Trickle a short request within the deadline, and return the response body"""
+    with socket.create_connection((load_harness.LOOPBACK, port), timeout=5) as connection:
+        connection.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        body = b"12345\0"
+        connection.sendall(struct.pack(">HH", len(body), 0))
+        for byte in body:
+            time.sleep(TRICKLE_INTERVAL)
+            connection.sendall(bytes([byte]))
+        response = b""
+        while len(response) < 4 or len(response) < 4 + struct.unpack(">H", response[:2])[0]:
+            chunk = connection.recv(4096)
+            if not chunk:
+                break
+            response += chunk
+        return response[4:]
+
+
+def main():
+    server_path, _ = load_harness.main_arguments("<TCP_Server> <TCP_Client>")
+    problems = []
+    for name, options in (("poll", ["--poll"]), ("io_uring", [])):
+        with load_harness.Server(server_path, *options, "--read-timeout", str(READ_TIMEOUT),
+                                 "--idle-timeout", "60000", stats=True) as server:
+            evicted_after = trickle(server.port)
+            response = request_in_time(server.port)
+            read_timeouts = server.stats().get("read_timeouts", 0)
+        if evicted_after is None:
+            problems.append(f"{name}: the trickling client is not evicted")
+        else:
+            print(f"{name}: the trickling client is evicted after {evicted_after * 1000:.0f} ms")
+            if evicted_after < READ_TIMEOUT / 1000 * 0.9:
+                problems.append(f"{name}: evicted before the deadline")
+            elif evicted_after > LATEST_EVICTION:
+                problems.append(f"{name}: evicted {evicted_after * 1000:.0f} ms after the request started")
+        if read_timeouts != 1:
+            problems.append(f"{name}: {read_timeouts} read timeouts counted, 1 expected")
+        if response[:1] != b"0" or response[1:].rstrip(b"\0") != b"15":
+            problems.append(f"{name}: the request received in time is answered {response!r}")
+    return load_harness.finish(problems)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
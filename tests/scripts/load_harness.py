@@ -0,0 +1,127 @@
+"""Shared helpers of the loopback load tests: start TCP_Server, drive it with the load generator of TCP_Client
+(TCP_Client 127.0.0.1 <port> --load ...), read its statistics (--stats-port)."""
+
+import re
+import shutil
+import socket
+import subprocess
+import sys
+import time
+
+LOOPBACK = "127.0.0.1"
+
+
+def free_port():
+    with socket.socket(socket.AF_INET, socket.SOCK_STREAM) as probe:
+        probe.bind((LOOPBACK, 0))
+        return probe.getsockname()[1]
+
+
+def wait_for_port(port, timeout=10.0):
+    deadline = time.monotonic() + timeout
+    while time.monotonic() < deadline:
+        try:
+            with socket.create_connection((LOOPBACK, port), timeout=0.5):
+                return
+        except OSError:
+            time.sleep(0.05)
+    raise RuntimeError(f"nothing listens at port {port}")
+
+
+class Server:
+    """TCP_Server in a child process, stopped when the block ends. Its output is line-buffered (stdbuf) when possible,
+    so the lines printed before it is killed are kept."""
+
+    def __init__(self, path, *options, stats=False):
+        self.port = free_port()
+        self.stats_port = free_port() if stats else None
+        self.command = [path, str(self.port), *options]
+        if stats:
+            self.command += ["--stats-port", str(self.stats_port)]
+        stdbuf = shutil.which("stdbuf")
+        if stdbuf is not None:
+            self.command = [stdbuf, "-oL", *self.command]
+        self.output = ""
+
+    def __enter__(self):
+        self.process = subprocess.Popen(self.command, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True)
+        wait_for_port(self.port)
+        # the probe connection of wait_for_port is closed, it is not counted by the tests
+        if self.stats_port is not None:
+            wait_for_port(self.stats_port)
+        return self
+
+    def __exit__(self, *error):
+        self.process.terminate()
+        try:
+            self.output, _ = self.process.communicate(timeout=10)
+        except subprocess.TimeoutExpired:
+            self.process.kill()
+            self.output, _ = self.process.communicate()
+        return False
+
+    def stats(self):
+        """The counters of the statistics dump, as integers: "requests", "system_calls"..."""
+        chunks = []
+        with socket.create_connection((LOOPBACK, self.stats_port), timeout=5) as connection:
+            while True:
+                chunk = connection.recv(65536)
+                if not chunk:
+                    break
+                chunks.append(chunk)
+        counters = {}
+        for line in b"".join(chunks).decode().splitlines():
+            fields = line.split()
+            if len(fields) == 2 and fields[1].lstrip("-").isdigit():
+                counters[fields[0]] = int(fields[1])
+        return counters
+
+
+def run_load(client, port, connections, requests, *options, timeout=120):
+    """Run the load generator, and return its results: requests, seconds, requests_per_second, mb_per_second,
+    rejected, mismatched, lost. Raise if it fails or its results can't be read."""
+    command = [client, LOOPBACK, str(port), "--load", "--connections", str(connections),
+               "--requests", str(requests), *options]
+    completed = subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.STDOUT, text=True,
+                               stdin=subprocess.DEVNULL, timeout=timeout)
+    output = completed.stdout
+    throughput = re.search(r"(\d+) requests in ([\d.]+) seconds: (\d+) requests/s, ([\d.]+) MB/s", output)
+    errors = re.search(r"Rejected: (\d+), Mismatched: (\d+), Lost: (\d+)", output)
+    if completed.returncode != 0 or throughput is None or errors is None:
+        raise RuntimeError(f"the load generator failed ({completed.returncode}):\n{output}")
+    return {
+        "requests": int(throughput.group(1)),
+        "seconds": float(throughput.group(2)),
+        "requests_per_second": int(throughput.group(3)),
+        "mb_per_second": float(throughput.group(4)),
+        "rejected": int(errors.group(1)),
+        "mismatched": int(errors.group(2)),
+        "lost": int(errors.group(3)),
+    }
+
+
+def check_results(results, expected_requests):
+    """Return the problems of a load run: every request is responded, with the expected sum"""
+    problems = []
+    if results["requests"] != expected_requests:
+        problems.append(f"{results['requests']} responses, {expected_requests} expected")
+    for counter in ("rejected", "mismatched", "lost"):
+        if results[counter] != 0:
+            problems.append(f"{results[counter]} {counter}")
+    return problems
+
+
+def finish(problems):
+    """Print the problems and return the exit code of a test"""
+    for problem in problems:
+        print(f"FAIL: {problem}")
+    if not problems:
+        print("OK")
+    return 1 if problems else 0
+
+
+def main_arguments(usage):
+    if len(sys.argv) != 3:
+        print(f"Usage: {sys.argv[0]} {usage}")
+        sys.exit(2)
+    return sys.argv[1], sys.argv[2]
@@ -0,0 +1,66 @@
+"""Loopback load test of the readiness event loop (TCP_Server --poll, epoll on Linux): the throughput for 1 to 256 clients,
+then the same load while 10000 idle clients stay connected. The idle clients must not slow it down much: epoll returns
+the ready sockets only. Every request must be answered correctly.
+Usage: poll_load_test.py <TCP_Server> <TCP_Client>"""
+
+import resource
+import socket
+import sys
+import time
+
+import load_harness
+
+CONNECTIONS = [1, 8, 64, 256]
+TOTAL_REQUESTS = 4000  # for each number of connections, so the runs are comparable
+IDLE_CLIENTS = 10000  # fewer if the limit of open files is lower, the test and the server each hold one per client
+IDLE_LOAD_CONNECTIONS = 64
+IDLE_LOAD_REQUESTS = 40000  # the runs with and without the idle clients are long enough to be compared
+MIN_IDLE_RATIO = 0.5  # of the throughput without the idle clients
+
+
+def main():
+    server_path, client_path = load_harness.main_arguments("<TCP_Server> <TCP_Client>")
+    problems = []
+    soft_limit, _ = resource.getrlimit(resource.RLIMIT_NOFILE)
+    idle_clients = min(IDLE_CLIENTS, soft_limit - 256)
+    with load_harness.Server(server_path, "--poll", "--max-connections", str(idle_clients + 1000), stats=True) as server:
+        print(f"{'Connections':>12} {'Requests/s':>12} {'MB/s':>8}")
+        for connections in CONNECTIONS:
+            requests = TOTAL_REQUESTS // connections
+            results = load_harness.run_load(client_path, server.port, connections, requests)
+            print(f"{connections:>12} {results['requests_per_second']:>12} {results['mb_per_second']:>8.2f}")
+            problems += [f"{connections} connections: {p}" for p in load_harness.check_results(results, connections * requests)]
+
+        # idle clients hold connections open, the active ones must not wait for them
+        requests = IDLE_LOAD_REQUESTS // IDLE_LOAD_CONNECTIONS
+        baseline = load_harness.run_load(client_path, server.port, IDLE_LOAD_CONNECTIONS, requests)
+        print(f"{IDLE_LOAD_CONNECTIONS:>12} {baseline['requests_per_second']:>12} {baseline['mb_per_second']:>8.2f}"
+              f"  {IDLE_LOAD_REQUESTS} requests")
+        problems += [f"without idle clients: {p}" for p in
+                     load_harness.check_results(baseline, IDLE_LOAD_CONNECTIONS * requests)]
+        idle = []
+        try:
+            for _ in range(idle_clients):
+                idle.append(socket.create_connection((load_harness.LOOPBACK, server.port)))
+            deadline = time.monotonic() + 30
+            while server.stats().get("connections", 0) < idle_clients and time.monotonic() < deadline:
+                time.sleep(0.1)
+            open_connections = server.stats().get("connections", 0)
+            if open_connections < idle_clients:
+                problems.append(f"{open_connections} idle connections accepted, {idle_clients} expected")
+            results = load_harness.run_load(client_path, server.port, IDLE_LOAD_CONNECTIONS, requests)
+            print(f"{IDLE_LOAD_CONNECTIONS:>12} {results['requests_per_second']:>12} {results['mb_per_second']:>8.2f}"
+                  f"  {IDLE_LOAD_REQUESTS} requests, with {idle_clients} idle clients")
+            problems += [f"with idle clients: {p}" for p in
+                         load_harness.check_results(results, IDLE_LOAD_CONNECTIONS * requests)]
+            if results["requests_per_second"] < baseline["requests_per_second"] * MIN_IDLE_RATIO:
+                problems.append(f"the idle clients slow the load from {baseline['requests_per_second']} "
+                                f"to {results['requests_per_second']} requests/s")
+        finally:
+            for connection in idle:
+                connection.close()
+    return load_harness.finish(problems)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
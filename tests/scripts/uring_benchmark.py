@@ -0,0 +1,49 @@
+"""Loopback benchmark of the io_uring event loop against the poll one (TCP_Server --poll):
+requests/s and system calls per request, from the statistics of the server (--stats-port).
+Every request must be answered correctly. If io_uring is not available, only the poll loop is measured.
+Usage: uring_benchmark.py <TCP_Server> <TCP_Client>"""
+
+import sys
+
+import load_harness
+
+IO_URING_FAIL = "Fail to set up io_uring"  # _IO_URING_FAIL, the server falls back to the poll loop
+CONNECTIONS = [1, 16, 128]
+TOTAL_REQUESTS = 20000
+WINDOW = 8  # requests in flight on each connection: the loops batch their system calls
+
+
+def measure(server_path, client_path, options, connections):
+    with load_harness.Server(server_path, *options, stats=True) as server:
+        before = server.stats()
+        requests = TOTAL_REQUESTS // connections
+        results = load_harness.run_load(client_path, server.port, connections, requests, "--window", str(WINDOW))
+        after = server.stats()
+    problems = load_harness.check_results(results, connections * requests)
+    served = after.get("requests", 0) - before.get("requests", 0)
+    calls = after.get("system_calls", 0) - before.get("system_calls", 0)
+    if served != connections * requests:
+        problems.append(f"the server counted {served} requests")
+    results["calls_per_request"] = calls / served if served else 0
+    results["is_fallback"] = IO_URING_FAIL in server.output
+    return results, problems
+
+
+def main():
+    server_path, client_path = load_harness.main_arguments("<TCP_Server> <TCP_Client>")
+    problems = []
+    print(f"Window {WINDOW}")
+    print(f"{'Loop':>8} {'Connections':>12} {'Requests/s':>12} {'Calls/request':>14}")
+    for connections in CONNECTIONS:
+        for name, options in (("poll", ["--poll"]), ("io_uring", [])):
+            results, run_problems = measure(server_path, client_path, options, connections)
+            problems += [f"{name}, {connections} connections: {p}" for p in run_problems]
+            if results["is_fallback"]:
+                print(f"{name:>8} {connections:>12} io_uring is not available, the poll loop was measured again")
+                continue
+            print(f"{name:>8} {connections:>12} {results['requests_per_second']:>12} {results['calls_per_request']:>14.3f}")
+    return load_harness.finish(problems)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
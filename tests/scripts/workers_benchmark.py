@@ -0,0 +1,36 @@
+"""Loopback benchmark of the SO_REUSEPORT workers (TCP_Server --workers N): requests/s for N = 1, 2, 4 and 8.
+The load generator uses as many threads as the largest N. Every request must be answered correctly.
+Usage: workers_benchmark.py <TCP_Server> <TCP_Client>"""
+
+import os
+import sys
+
+import load_harness
+
+WORKERS = [1, 2, 4, 8]
+CONNECTIONS = 64
+REQUESTS = 200  # per connection
+CLIENT_THREADS = 8
+
+
+def main():
+    server_path, client_path = load_harness.main_arguments("<TCP_Server> <TCP_Client>")
+    problems = []
+    print(f"{os.cpu_count()} CPUs, {CONNECTIONS} connections, {CLIENT_THREADS} client threads")
+    print(f"{'Workers':>8} {'Requests/s':>12} {'MB/s':>8}")
+    baseline = None
+    for workers in WORKERS:
+        with load_harness.Server(server_path, "--workers", str(workers)) as server:
+            results = load_harness.run_load(client_path, server.port, CONNECTIONS, REQUESTS,
+                                            "--threads", str(CLIENT_THREADS))
+        baseline = baseline or results["requests_per_second"]
+        speedup = results["requests_per_second"] / baseline if baseline else 0
+        print(f"{workers:>8} {results['requests_per_second']:>12} {results['mb_per_second']:>8.2f}  x{speedup:.2f}")
+        problems += [f"{workers} workers: {p}" for p in load_harness.check_results(results, CONNECTIONS * REQUESTS)]
+        if workers > 1 and "SO_REUSEPORT listeners" not in server.output:
+            problems.append(f"{workers} workers: the listeners are not SO_REUSEPORT")
+    return load_harness.finish(problems)
+
+
+if __name__ == "__main__":
+    sys.exit(main())